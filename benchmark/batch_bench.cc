@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/Metrics.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcBatch.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+
+using namespace network;
+
+/**
+ * 用法: batch_bench [lookups_per_round] [payload_bytes] [seconds]
+ *
+ * 一轮发出 lookups_per_round 个 payload_bytes 字节的小请求（按 key 查询），全部返回后开始下一轮，
+ * 计时 seconds 秒，依次测两种发法：
+ *   individual - 每个请求一次 CallMethod：各自分配 ID、各自加锁登记、各自一次写，自己数回调；
+ *   batch      - 整轮放进一个 RpcBatch，一次 callBatch：一次写、一次加锁登记、一个完成回调。
+ * 每种发法输出一行 CSV：
+ *   mode,lookups_per_round,payload_bytes,rounds_per_sec,lookups_per_sec,p50_us,p99_us,cpu_ns_per_lookup
+ * p50/p99 是一整轮的延迟；cpu_ns_per_lookup 是整个进程（客户端加服务端）平均每个请求用掉的 CPU 时间
+ */
+
+namespace {
+
+const uint16_t kPort = 9978;
+
+int g_lookups = 1000;
+int g_payloadBytes = 32;
+double g_durationSec = 3.0;
+
+Counter *const g_rounds = MetricsRegistry::instance().counter("batch_bench.rounds");
+
+std::atomic<bool> g_running(false);
+std::atomic<bool> g_connected(false);
+
+bench::EchoService g_service;
+
+void startServer(EventLoop *loop) {
+    bench::startServer(loop, kPort, &g_service);
+}
+
+int64_t cpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * 到服务端的一条连接，在客户端 loop 线程里一轮接一轮地发请求。
+ * 两种发法的请求内容相同：第 i 个请求的 payload 是 key i 填充到 payload_bytes 字节
+ */
+class Client {
+public:
+    Client(EventLoop *loop, const InetAddress &serverAddr)
+        : client_(loop, serverAddr, "BatchBench"),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)),
+        method_(bench::BenchService::descriptor()->FindMethodByName("Echo")),
+        requests_(g_lookups),
+        responses_(g_lookups),
+        batchMode_(false),
+        pending_(0),
+        roundStartUs_(0),
+        latency_(NULL) {
+        client_.setConnectionCallback(std::bind(&Client::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+        for (int i = 0; i < g_lookups; ++i) {
+            std::string key = std::to_string(i);
+            key.resize(g_payloadBytes, '#');
+            requests_[i].set_payload(key);
+        }
+        batch_.reserve(g_lookups);
+        for (int i = 0; i < g_lookups; ++i) {
+            batch_.add(method_, &requests_[i], &responses_[i]);
+        }
+    }
+
+    void start() { client_.connect(); }
+
+    // 在客户端 loop 线程里调用
+    void startRounds(bool batchMode, Histogram *latency) {
+        batchMode_ = batchMode;
+        latency_ = latency;
+        startRound();
+    }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (conn->connected()) {
+            conn->setTcpNoDelay(true);
+            channel_->setConnection(conn);
+            g_connected = true;
+        }
+    }
+
+    void startRound() {
+        if (!g_running.load(std::memory_order_relaxed)) {
+            return;
+        }
+        roundStartUs_ = getNowUs();
+        if (batchMode_) {
+            channel_->callBatch(&batch_, NULL,
+                                ::google::protobuf::NewCallback(this, &Client::onRoundDone));
+            return;
+        }
+        pending_ = g_lookups;
+        for (int i = 0; i < g_lookups; ++i) {
+            stub_.Echo(NULL, &requests_[i], new bench::EchoResponse,
+                       ::google::protobuf::NewCallback(this, &Client::onIndividualDone));
+        }
+    }
+
+    void onIndividualDone() {
+        if (--pending_ == 0) {
+            onRoundDone();
+        }
+    }
+
+    void onRoundDone() {
+        latency_->record(getNowUs() - roundStartUs_);
+        g_rounds->inc();
+        startRound();
+    }
+
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+    const ::google::protobuf::MethodDescriptor *method_;
+    std::vector<bench::EchoRequest> requests_;
+    std::vector<bench::EchoResponse> responses_;
+    RpcBatch batch_;
+    bool batchMode_;
+    int pending_;
+    int64_t roundStartUs_;
+    Histogram *latency_;
+};
+
+void runMode(EventLoop *loop, Client *client, const char *mode, bool batchMode) {
+    std::string name = std::string("batch_bench.") + mode + "_us";
+    Histogram *latency = MetricsRegistry::instance().histogram(name);
+    g_running = true;
+    loop->runInLoop(std::bind(&Client::startRounds, client, batchMode, latency));
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    MetricsSnapshot before = MetricsRegistry::instance().snapshot();
+    int64_t cpuBefore = cpuNs();
+    std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(g_durationSec * 1000)));
+    int64_t cpu = cpuNs() - cpuBefore;
+    MetricsSnapshot delta = MetricsRegistry::instance().snapshot().diff(before);
+
+    const LogLinearHistogram::Snapshot &rounds = delta.histograms[name];
+    double seconds = delta.timestampUs / 1e6;
+    double lookups = static_cast<double>(rounds.count) * g_lookups;
+    printf("%s,%d,%d,%.0f,%.0f,%lld,%lld,%.0f\n", mode, g_lookups, g_payloadBytes,
+           rounds.count / seconds, lookups / seconds, static_cast<long long>(rounds.percentile(50)),
+           static_cast<long long>(rounds.percentile(99)), lookups > 0 ? cpu / lookups : 0.0);
+    fflush(stdout);
+
+    // 停止发起新的一轮，等在途的一轮返回
+    g_running = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_lookups = argc > 1 ? atoi(argv[1]) : 1000;
+    g_payloadBytes = argc > 2 ? atoi(argv[2]) : 32;
+    g_durationSec = argc > 3 ? atof(argv[3]) : 3.0;
+
+    EventLoopThread serverThread(startServer, "BatchBenchServer");
+    serverThread.startLoop();
+
+    EventLoopThread clientThread(EventLoopThread::ThreadInitCallback(), "BatchBenchClient");
+    EventLoop *loop = clientThread.startLoop();
+    Client *client = new Client(loop, InetAddress("127.0.0.1", kPort));
+    client->start();
+    while (!g_connected) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    printf("mode,lookups_per_round,payload_bytes,rounds_per_sec,lookups_per_sec,p50_us,p99_us,"
+           "cpu_ns_per_lookup\n");
+    runMode(loop, client, "individual", false);
+    runMode(loop, client, "batch", true);
+
+    // 结果已经输出，直接退出，不等各个 loop 线程
+    _exit(0);
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "network/InetAddress.h"
+#include "network/util.h"
+#include "bench_util.h"
+
+using namespace network;
+
+namespace bench {
+
+void EchoService::Echo(::google::protobuf::RpcController *controller,
+                       const EchoRequest *request,
+                       EchoResponse *response,
+                       ::google::protobuf::Closure *done) {
+    response->set_payload(request->payload());
+    done->Run();
+}
+
+void BusyEchoService::Echo(::google::protobuf::RpcController *controller,
+                           const EchoRequest *request,
+                           EchoResponse *response,
+                           ::google::protobuf::Closure *done) {
+    int64_t until = getNowUs() + workUs_;
+    while (getNowUs() < until) {
+    }
+    done->Run();
+}
+
+RpcServer *startServer(EventLoop *loop, uint16_t port, ::google::protobuf::Service *service,
+                       const std::function<void(RpcServer *)> &configure) {
+    RpcServer *server = new RpcServer(loop, InetAddress(port));
+    server->registerService(service);
+    if (configure) {
+        configure(server);
+    }
+    server->start();
+    return server;
+}
+
+int64_t percentile(std::vector<int64_t> &values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(p / 100.0 * (values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+void runInChild(const std::function<void()> &fn) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn();
+        fflush(stdout);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+}
+
+} // namespace bench
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+#include "network/EventLoop.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+
+/**
+ * 各个 benchmark 共用的夹具：回显服务、在 loop 线程里启动 RpcServer、延迟分位、按模式 fork 子进程。
+ * 每个 benchmark 只保留自己的场景
+ */
+
+namespace bench {
+
+// 原样回显 payload
+class EchoService : public BenchService {
+public:
+    void Echo(::google::protobuf::RpcController *controller,
+              const EchoRequest *request,
+              EchoResponse *response,
+              ::google::protobuf::Closure *done) override;
+};
+
+// 在调用 Echo 的线程里空转 workUs 微秒 CPU 后返回空响应，模拟计算密集的 handler
+class BusyEchoService : public BenchService {
+public:
+    explicit BusyEchoService(int workUs = 0) : workUs_(workUs) {}
+
+    // 只能在 server 启动之前调用
+    void setWorkUs(int workUs) { workUs_ = workUs; }
+
+    void Echo(::google::protobuf::RpcController *controller,
+              const EchoRequest *request,
+              EchoResponse *response,
+              ::google::protobuf::Closure *done) override;
+
+private:
+    int workUs_;
+};
+
+/**
+ * 在 loop 所在线程里（通常是 EventLoopThread 的 ThreadInitCallback）创建 RpcServer，
+ * 注册 service，执行 configure 设置选项后 start()。
+ * 返回的 server 不析构，避免进程退出时在 loop 线程之外销毁 TcpServer
+ */
+network::RpcServer *startServer(network::EventLoop *loop, uint16_t port,
+                                ::google::protobuf::Service *service,
+                                const std::function<void(network::RpcServer *)> &configure =
+                                    std::function<void(network::RpcServer *)>());
+
+// p 取 0 到 100，返回最接近的样本；会重排 values，没有样本时返回 0
+int64_t percentile(std::vector<int64_t> &values, double p);
+
+/**
+ * 在子进程里执行 fn 并等它结束，每种模式一个干净的进程：端口、全局状态和统计互不影响，
+ * 峰值 RSS 也分开。fn 返回后子进程直接 _exit，不析构还有线程在用的全局对象
+ */
+void runInChild(const std::function<void()> &fn);
+
+} // namespace bench
@@ -0,0 +1,435 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/Buffer.h"
+#include "network/Endian.h"
+#include "network/EventLoop.h"
+#include "network/InetAddress.h"
+#include "network/Metrics.h"
+#include "network/util.h"
+#include "rpc_framework/RpcCodec.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+#include "rpc.pb.h"
+
+using namespace network;
+
+/**
+ * 用法: c100k_bench [max_connections] [server_threads] [sparse_calls]
+ *
+ * 连接规模测试。fork 出一个只运行 RpcServer 的子进程，父进程用阻塞的原始 socket 经 loopback
+ * 逐级建立 1k、5k、10k、20k、50k、100k（不超过 max_connections）条连接并保持空闲。
+ * 每个源地址 127.0.0.x 最多 kConnectionsPerSourceIp 条连接（IP_BIND_ADDRESS_NO_PORT 让内核按四元组分配端口）；
+ * 同一个源地址占用的本地端口超过端口范围的一半左右时，connect 找空闲端口明显变慢，accept 速率会掉到十分之一，
+ * 所以每个源地址只用 1 万条。每一级输出：
+ *   - accept_per_sec   这一批连接从开始 connect 到服务端全部建立 TcpConnection 的速率；
+ *   - rss_per_conn     服务端进程 RSS 的增量除以连接数；
+ *   - tcp_mem_per_conn 内核 TCP 缓冲区（/proc/net/sockstat 的 mem，两端合计）除以连接数；
+ *   - idle_cpu_pct     连接全部空闲时服务端进程 1 秒内的 CPU 占用；
+ *   - epoll_wait_ns    把客户端的全部 fd 注册进一个 epoll，没有事件时 epoll_wait(timeout=0) 的耗时；
+ *   - sparse p50/p99/max  随机挑 sparse_calls 条空闲连接，每 2ms 发一次 Echo 的往返延迟。
+ * 最后关闭全部连接，输出服务端清理完的速率。
+ *
+ * 进程和服务端子进程会把 RLIMIT_NOFILE 提到硬上限；硬上限不够时 max_connections 会被截断，
+ * 需要先在 shell 里 ulimit -Hn 调高（以及按需调大 net.ipv4.ip_local_port_range、net.core.somaxconn）。
+ */
+
+namespace {
+
+const uint16_t kPort = 9996;
+const int kConnectionsPerSourceIp = 10000;
+const int kSparseIntervalUs = 2000;
+
+// 子进程每 10ms 通过 MAP_SHARED 的内存把当前连接数告诉父进程
+struct SharedCounters {
+    std::atomic<int64_t> connections;
+};
+
+SharedCounters *g_shared = NULL;
+
+void publishConnections() {
+    MetricsSnapshot snapshot = MetricsRegistry::instance().snapshot();
+    g_shared->connections.store(snapshot.gauges["net.connections"]);
+}
+
+void runServer(int threads) {
+    EventLoop loop;
+    bench::EchoService service;
+    RpcServer server(&loop, InetAddress(kPort));
+    server.setThreadNum(threads);
+    server.registerService(&service);
+    server.start();
+    loop.runEvery(0.01, publishConnections);
+    loop.loop();
+    _exit(0);
+}
+
+void raiseFdLimit() {
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+int64_t fdLimit() {
+    struct rlimit limit;
+    ::getrlimit(RLIMIT_NOFILE, &limit);
+    return static_cast<int64_t>(limit.rlim_cur);
+}
+
+// /proc/<pid>/status 里的 VmRSS，单位 KiB
+int64_t readRssKib(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/status", pid);
+    FILE *file = ::fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    char line[256];
+    long long rss = 0;
+    while (::fgets(line, sizeof line, file)) {
+        if (sscanf(line, "VmRSS: %lld", &rss) == 1) {
+            break;
+        }
+    }
+    ::fclose(file);
+    return rss;
+}
+
+// /proc/<pid>/stat 的 utime + stime，单位是时钟滴答
+int64_t readCpuTicks(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/stat", pid);
+    FILE *file = ::fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    char buf[1024];
+    size_t n = ::fread(buf, 1, sizeof buf - 1, file);
+    ::fclose(file);
+    buf[n] = '\0';
+    // 第 2 个字段是括号里的线程名，可能含空格，从最后一个 ')' 之后数字段
+    const char *p = strrchr(buf, ')');
+    if (!p) {
+        return 0;
+    }
+    long long utime = 0, stime = 0;
+    sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lld %lld", &utime, &stime);
+    return utime + stime;
+}
+
+// /proc/net/sockstat 的 "TCP: ... mem N"，单位是页
+int64_t readTcpMemPages() {
+    FILE *file = ::fopen("/proc/net/sockstat", "r");
+    if (!file) {
+        return 0;
+    }
+    char line[256];
+    long long pages = 0;
+    while (::fgets(line, sizeof line, file)) {
+        const char *mem = strstr(line, " mem ");
+        if (strncmp(line, "TCP:", 4) == 0 && mem) {
+            pages = atoll(mem + 5);
+            break;
+        }
+    }
+    ::fclose(file);
+    return pages;
+}
+
+/**
+ * 第 index 条连接从 127.0.0.(1 + index / kConnectionsPerSourceIp) 发起。
+ * 返回阻塞模式的 fd，失败返回 -1
+ */
+int connectOne(int index) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    ::setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof on);
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    struct timeval timeout = { 2, 0 };
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof local);
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + index / kConnectionsPerSourceIp);
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof server);
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(kPort);
+    if (::bind(fd, reinterpret_cast<struct sockaddr *>(&local), sizeof local) != 0 ||
+        ::connect(fd, reinterpret_cast<struct sockaddr *>(&server), sizeof server) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 等到服务端的连接数等于 target，超时返回 false
+bool waitForConnections(int64_t target, double timeoutSec) {
+    int64_t deadline = getNowUs() + static_cast<int64_t>(timeoutSec * 1000000);
+    while (g_shared->connections.load() != target) {
+        if (getNowUs() > deadline) {
+            return false;
+        }
+        ::usleep(500);
+    }
+    return true;
+}
+
+double epollWaitNs(const std::vector<int> &fds) {
+    const int kCalls = 2000;
+    int epollfd = ::epoll_create1(EPOLL_CLOEXEC);
+    for (int fd : fds) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof event);
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        ::epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    }
+    struct epoll_event events[64];
+    int64_t start = getNowUs();
+    for (int i = 0; i < kCalls; ++i) {
+        ::epoll_wait(epollfd, events, 64, 0);
+    }
+    int64_t elapsedUs = getNowUs() - start;
+    ::close(epollfd);
+    return elapsedUs * 1000.0 / kCalls;
+}
+
+bool writeAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool readAll(int fd, char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::read(fd, data, len);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * 在一条空闲连接上按 RpcChannel 的线上格式同步调用一次 Echo，返回往返微秒数，失败返回 -1
+ */
+class SparseCaller {
+public:
+    SparseCaller()
+        : codec_(ProtoRpcCodec::ProtobufMessageCallback()),
+        nextId_(1) {
+        bench::EchoRequest request;
+        request.set_payload(std::string(16, 's'));
+        requestBytes_ = request.SerializeAsString();
+    }
+
+    int64_t call(int fd) {
+        RpcMessage message;
+        message.set_type(REQUEST);
+        message.set_id(nextId_++);
+        message.set_service(bench::BenchService::descriptor()->full_name());
+        message.set_method("Echo");
+        message.set_request(requestBytes_);
+        Buffer buf;
+        codec_.fillEmptyBuffer(&buf, message);
+
+        int64_t start = getNowUs();
+        if (!writeAll(fd, buf.peek(), buf.readableBytes())) {
+            return -1;
+        }
+        int32_t be32 = 0;
+        if (!readAll(fd, reinterpret_cast<char *>(&be32), sizeof be32)) {
+            return -1;
+        }
+        int32_t len = sockets::networkToHost32(be32);
+        if (len <= 0 || len > ProtoRpcCodec::kMaxMessageLen) {
+            return -1;
+        }
+        std::string frame(len, '\0');
+        if (!readAll(fd, &frame[0], len)) {
+            return -1;
+        }
+        int64_t elapsed = getNowUs() - start;
+
+        RpcMessage response;
+        if (codec_.parse(frame.data(), len, &response) != ProtoRpcCodec::kNoError ||
+            response.type() != RESPONSE || response.id() != message.id() ||
+            response.error() != NO_ERROR) {
+            return -1;
+        }
+        return elapsed;
+    }
+
+private:
+    ProtoRpcCodec codec_;
+    int64_t nextId_;
+    std::string requestBytes_;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    int maxConnections = argc > 1 ? atoi(argv[1]) : 100000;
+    int serverThreads = argc > 2 ? atoi(argv[2]) : 4;
+    int sparseCalls = argc > 3 ? atoi(argv[3]) : 200;
+
+    raiseFdLimit();
+    int64_t usable = fdLimit() - 64;
+    if (maxConnections > usable) {
+        printf("RLIMIT_NOFILE is %lld, max_connections limited to %lld\n",
+               static_cast<long long>(fdLimit()), static_cast<long long>(usable));
+        maxConnections = static_cast<int>(usable);
+    }
+
+    void *shared = ::mmap(NULL, sizeof(SharedCounters), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    g_shared = new (shared) SharedCounters;
+    g_shared->connections.store(0);
+
+    pid_t server = fork();
+    if (server == 0) {
+        runServer(serverThreads);
+    }
+
+    // 等服务端开始监听，第一条连接也算进第一级
+    std::vector<int> fds;
+    for (int retry = 0; retry < 100 && fds.empty(); ++retry) {
+        int fd = connectOne(0);
+        if (fd >= 0) {
+            fds.push_back(fd);
+        } else {
+            ::usleep(50 * 1000);
+        }
+    }
+    if (fds.empty() || !waitForConnections(1, 5.0)) {
+        printf("server did not start\n");
+        ::kill(server, SIGKILL);
+        return 1;
+    }
+    ::usleep(200 * 1000);
+    const int64_t baseRssKib = readRssKib(server);
+    const int64_t baseTcpPages = readTcpMemPages();
+    const long ticksPerSec = ::sysconf(_SC_CLK_TCK);
+    const long pageSize = ::sysconf(_SC_PAGESIZE);
+
+    std::vector<int> steps;
+    const int candidates[] = { 1000, 5000, 10000, 20000, 50000, 100000 };
+    for (int step : candidates) {
+        if (step < maxConnections) {
+            steps.push_back(step);
+        }
+    }
+    steps.push_back(maxConnections);
+
+    printf("%11s %14s %12s %16s %12s %13s %8s %8s %8s\n", "connections", "accept_per_sec",
+           "rss_per_conn", "tcp_mem_per_conn", "idle_cpu_pct", "epoll_wait_ns", "p50_us",
+           "p99_us", "max_us");
+    fflush(stdout);
+
+    std::mt19937 rng(12345);
+    SparseCaller caller;
+    for (int step : steps) {
+        int64_t start = getNowUs();
+        int added = 0;
+        while (static_cast<int>(fds.size()) < step) {
+            int fd = connectOne(static_cast<int>(fds.size()));
+            if (fd < 0) {
+                printf("connect #%zu failed: %s\n", fds.size(), strerror(errno));
+                break;
+            }
+            fds.push_back(fd);
+            ++added;
+        }
+        if (!waitForConnections(static_cast<int64_t>(fds.size()), 30.0)) {
+            printf("server accepted %lld of %zu connections\n",
+                   static_cast<long long>(g_shared->connections.load()), fds.size());
+            break;
+        }
+        double acceptPerSec = added * 1000000.0 / std::max<int64_t>(getNowUs() - start, 1);
+
+        int64_t cpuBefore = readCpuTicks(server);
+        ::sleep(1);
+        double idleCpuPct = (readCpuTicks(server) - cpuBefore) * 100.0 / ticksPerSec;
+
+        double connections = static_cast<double>(fds.size());
+        double rssPerConn = (readRssKib(server) - baseRssKib) * 1024.0 / connections;
+        double tcpMemPerConn = (readTcpMemPages() - baseTcpPages) * pageSize / connections;
+        double epollNs = epollWaitNs(fds);
+
+        std::vector<int64_t> latencies;
+        std::uniform_int_distribution<size_t> pick(0, fds.size() - 1);
+        for (int i = 0; i < sparseCalls; ++i) {
+            int64_t latency = caller.call(fds[pick(rng)]);
+            if (latency >= 0) {
+                latencies.push_back(latency);
+            }
+            ::usleep(kSparseIntervalUs);
+        }
+
+        printf("%11zu %14.0f %12.0f %16.0f %12.1f %13.0f %8lld %8lld %8lld\n", fds.size(),
+               acceptPerSec, rssPerConn, tcpMemPerConn, idleCpuPct, epollNs,
+               static_cast<long long>(bench::percentile(latencies, 50)),
+               static_cast<long long>(bench::percentile(latencies, 99)),
+               static_cast<long long>(bench::percentile(latencies, 100)));
+        if (static_cast<int>(latencies.size()) != sparseCalls) {
+            printf("%d of %d sparse calls failed\n",
+                   sparseCalls - static_cast<int>(latencies.size()), sparseCalls);
+        }
+        fflush(stdout);
+        if (static_cast<int>(fds.size()) < step) {
+            break;
+        }
+    }
+
+    int64_t start = getNowUs();
+    size_t closed = fds.size();
+    for (int fd : fds) {
+        ::close(fd);
+    }
+    if (waitForConnections(0, 30.0)) {
+        printf("closed %zu connections, server cleaned up at %.0f/s\n", closed,
+               closed * 1000000.0 / std::max<int64_t>(getNowUs() - start, 1));
+    }
+
+    ::kill(server, SIGKILL);
+    int status = 0;
+    ::waitpid(server, &status, 0);
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/Metrics.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+
+using namespace network;
+
+/**
+ * 用法: chunk_bench [large_mib] [chunk_kib] [seconds] [large_inflight]
+ *
+ * 同一条连接上一直有 large_inflight 个大响应（每个 large_mib MiB）在传输时，小调用的延迟。
+ * 客户端每毫秒发一个 32 字节的小 Echo，大调用返回后立即再发一个，四种配置：
+ *   idle           - 没有大调用，小调用的基线延迟；
+ *   single_frame   - 不分块，大响应整帧写出，后面的小响应要等它写完、被对端收齐；
+ *   round_robin    - 两端都按 chunk_kib KiB 分块，多个大响应轮流发一块；
+ *   smallest_first - 同样分块，先发剩余字节最少的大响应。
+ * 每种配置输出一行 CSV：
+ *   mode,large_bytes,chunk_bytes,small_calls,small_p50_us,small_p99_us,small_p999_us,
+ *   large_calls,large_p50_ms,large_mib_per_sec
+ * large_p50_ms 是一个大调用从发出到响应解析完的时间
+ */
+
+namespace {
+
+const uint16_t kBasePort = 9970;
+const int kModes = 4;
+const char *const kModeNames[kModes] = { "idle", "single_frame", "round_robin", "smallest_first" };
+
+int g_largeBytes = 50 * 1024 * 1024;
+size_t g_chunkBytes = 64 * 1024;
+double g_durationSec = 3.0;
+int g_largeInflight = 2;
+
+class EchoService : public bench::BenchService {
+public:
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        if (request->response_size() > 0) {
+            if (static_cast<int>(large_.size()) != request->response_size()) {
+                large_.assign(request->response_size(), 'L');
+            }
+            response->set_payload(large_);
+        } else {
+            response->set_payload(request->payload());
+        }
+        done->Run();
+    }
+
+private:
+    std::string large_; // 只在 server 的 loop 线程里访问
+};
+
+EchoService g_service;
+
+// 每种配置一个 server，都在同一个 loop 线程里
+void startServers(EventLoop *loop) {
+    for (int i = 0; i < kModes; ++i) {
+        bench::startServer(loop, static_cast<uint16_t>(kBasePort + i), &g_service,
+                           [i](RpcServer *server) {
+            if (i == 2) {
+                server->setChunking(g_chunkBytes, ChunkWriter::kRoundRobin);
+            } else if (i == 3) {
+                server->setChunking(g_chunkBytes, ChunkWriter::kSmallestFirst);
+            }
+        });
+    }
+}
+
+std::atomic<int> g_connected(0);
+
+/**
+ * 到一个 server 的连接，只在客户端 loop 线程里使用
+ */
+class Client {
+public:
+    Client(EventLoop *loop, int mode)
+        : client_(loop, InetAddress("127.0.0.1", static_cast<uint16_t>(kBasePort + mode)),
+                  "ChunkBench"),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)),
+        running_(false),
+        largeOutstanding_(0),
+        smallOutstanding_(0) {
+        client_.setConnectionCallback(std::bind(&Client::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+        if (mode == 2) {
+            channel_->setChunking(g_chunkBytes, ChunkWriter::kRoundRobin);
+        } else if (mode == 3) {
+            channel_->setChunking(g_chunkBytes, ChunkWriter::kSmallestFirst);
+        }
+        std::string name = std::string("chunk_bench.") + kModeNames[mode];
+        smallLatency_ = MetricsRegistry::instance().histogram(name + ".small_us");
+        largeLatency_ = MetricsRegistry::instance().histogram(name + ".large_us");
+        smallRequest_.set_payload(std::string(32, 's'));
+        largeRequest_.set_response_size(g_largeBytes);
+    }
+
+    void start() { client_.connect(); }
+
+    void startLoad(bool large) {
+        running_ = true;
+        for (int i = 0; large && i < g_largeInflight; ++i) {
+            sendLarge();
+        }
+    }
+
+    void stopLoad() { running_ = false; }
+
+    bool idle() const { return largeOutstanding_ == 0 && smallOutstanding_ == 0; }
+
+    void sendSmall() {
+        if (!running_) {
+            return;
+        }
+        ++smallOutstanding_;
+        stub_.Echo(NULL, &smallRequest_, new bench::EchoResponse,
+                   ::google::protobuf::NewCallback(this, &Client::onSmallDone, getNowUs()));
+    }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (conn->connected()) {
+            conn->setTcpNoDelay(true);
+            channel_->setConnection(conn);
+            ++g_connected;
+        }
+    }
+
+    void sendLarge() {
+        ++largeOutstanding_;
+        stub_.Echo(NULL, &largeRequest_, new bench::EchoResponse,
+                   ::google::protobuf::NewCallback(this, &Client::onLargeDone, getNowUs()));
+    }
+
+    void onSmallDone(int64_t startUs) {
+        smallLatency_->record(getNowUs() - startUs);
+        --smallOutstanding_;
+    }
+
+    void onLargeDone(int64_t startUs) {
+        largeLatency_->record(getNowUs() - startUs);
+        --largeOutstanding_;
+        if (running_) {
+            sendLarge();
+        }
+    }
+
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+    bench::EchoRequest smallRequest_;
+    bench::EchoRequest largeRequest_;
+    Histogram *smallLatency_;
+    Histogram *largeLatency_;
+    bool running_;
+    int largeOutstanding_;
+    int smallOutstanding_;
+};
+
+Client *g_active = NULL; // 只在客户端 loop 线程里访问
+
+void onTick() {
+    if (g_active) {
+        g_active->sendSmall();
+    }
+}
+
+void runMode(EventLoop *loop, Client *client, int mode) {
+    loop->runInLoop([client, mode]() {
+        g_active = client;
+        client->startLoad(mode != 0);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    MetricsSnapshot before = MetricsRegistry::instance().snapshot();
+    std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(g_durationSec * 1000)));
+    MetricsSnapshot delta = MetricsRegistry::instance().snapshot().diff(before);
+
+    // 停止发送，等在途的调用都返回
+    for (;;) {
+        std::promise<bool> stopped;
+        std::future<bool> idle = stopped.get_future();
+        loop->runInLoop([client, &stopped]() {
+            g_active = NULL;
+            client->stopLoad();
+            stopped.set_value(client->idle());
+        });
+        if (idle.get()) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    std::string name = std::string("chunk_bench.") + kModeNames[mode];
+    const LogLinearHistogram::Snapshot &small = delta.histograms[name + ".small_us"];
+    const LogLinearHistogram::Snapshot &large = delta.histograms[name + ".large_us"];
+    double seconds = delta.timestampUs / 1e6;
+    printf("%s,%d,%zu,%lld,%lld,%lld,%lld,%lld,%.1f,%.0f\n", kModeNames[mode], g_largeBytes,
+           mode >= 2 ? g_chunkBytes : 0, static_cast<long long>(small.count),
+           static_cast<long long>(small.percentile(50)), static_cast<long long>(small.percentile(99)),
+           static_cast<long long>(small.percentile(99.9)), static_cast<long long>(large.count),
+           large.percentile(50) / 1000.0, large.count * (g_largeBytes / 1048576.0) / seconds);
+    fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_largeBytes = (argc > 1 ? atoi(argv[1]) : 50) * 1024 * 1024;
+    g_chunkBytes = static_cast<size_t>(argc > 2 ? atoi(argv[2]) : 64) * 1024;
+    g_durationSec = argc > 3 ? atof(argv[3]) : 3.0;
+    g_largeInflight = argc > 4 ? atoi(argv[4]) : 2;
+
+    EventLoopThread serverThread(startServers, "ChunkBenchServer");
+    serverThread.startLoop();
+
+    EventLoopThread clientThread(EventLoopThread::ThreadInitCallback(), "ChunkBenchClient");
+    EventLoop *loop = clientThread.startLoop();
+    Client *clients[kModes];
+    for (int i = 0; i < kModes; ++i) {
+        clients[i] = new Client(loop, i);
+        clients[i]->start();
+    }
+    while (g_connected < kModes) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    loop->runEvery(0.001, onTick);
+
+    printf("mode,large_bytes,chunk_bytes,small_calls,small_p50_us,small_p99_us,small_p999_us,"
+           "large_calls,large_p50_ms,large_mib_per_sec\n");
+    for (int i = 0; i < kModes; ++i) {
+        runMode(loop, clients[i], i);
+    }
+
+    // 结果已经输出，直接退出，不等各个 loop 线程
+    _exit(0);
+}
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/EventLoopThreadPool.h"
+#include "network/InetAddress.h"
+#include "network/Metrics.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcCoroutine.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+
+using namespace network;
+
+/**
+ * 用法: coroutine_bench [frontend_threads] [concurrency] [backend_delay_ms] [seconds]
+ *
+ * 三跳调用的 handler 在阻塞写法和协程写法下的吞吐和延迟。前端的 Echo 依次调用后端三次，
+ * 每次把上一次的响应作为下一次的请求；后端每次调用延迟 backend_delay_ms 毫秒后返回
+ * （用定时器，不占 IO 线程）。两种前端各有 frontend_threads 个 IO 线程：
+ *   blocking  - handler 发起调用后在 IO 线程里等 future，三跳做完才返回，IO 线程一直被占住；
+ *   coroutine - handler 是 RpcTask 协程，co_await rpcCall 时让出 IO 线程。
+ * 下游连接都在单独的 client loop 上，阻塞写法不会死锁。客户端保持 concurrency 个请求在途，
+ * 计时 seconds 秒，每种写法输出一行 CSV：
+ *   mode,frontend_threads,concurrency,backend_delay_ms,seconds,calls_per_sec,p50_us,p99_us,frame_allocations
+ * 阻塞写法的吞吐上限是 frontend_threads / (3 * backend_delay_ms)，与 concurrency 无关；
+ * frame_allocations 是计时期间协程帧向 operator new 申请的次数，帧池生效时接近 0
+ */
+
+namespace {
+
+const uint16_t kBackendPort = 9980;
+const uint16_t kBlockingPort = 9981;
+const uint16_t kCoroutinePort = 9983;
+const int kHops = 3;
+const int kDownstreamConnections = 4;
+const int kClientConnections = 8;
+
+int g_frontendThreads = 2;
+int g_concurrency = 64;
+double g_backendDelaySec = 0.001;
+double g_durationSec = 3.0;
+
+std::atomic<bool> g_running(false);
+std::atomic<int> g_connected(0);
+
+// 后端：延迟 backend_delay_ms 后原样返回 payload
+class BackendService : public bench::BenchService {
+public:
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        response->set_payload(request->payload());
+        EventLoop::getEventLoopOfCurrentThread()->runAfter(g_backendDelaySec,
+                                                           [done]() { done->Run(); });
+    }
+};
+
+BackendService g_backend;
+
+/**
+ * 前端到后端的连接，在单独的 client loop 上。两种前端共用，按轮询选择 Stub。
+ * 建立连接之后只读，IO 线程里并发使用（RpcChannel::CallMethod 是线程安全的）
+ */
+class Downstream {
+public:
+    Downstream(EventLoop *loop, const InetAddress &serverAddr)
+        : client_(loop, serverAddr, "CoroutineBenchDownstream"),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)) {
+        client_.setConnectionCallback(std::bind(&Downstream::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+    }
+
+    void start() { client_.connect(); }
+
+    bench::BenchService::Stub *stub() { return &stub_; }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (conn->connected()) {
+            conn->setTcpNoDelay(true);
+            channel_->setConnection(conn);
+            ++g_connected;
+        } else {
+            // 等待下游响应的协程以 UNAVAILABLE 恢复，不会一直挂起
+            channel_->failOutstandingCalls(UNAVAILABLE);
+        }
+    }
+
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+};
+
+std::vector<Downstream *> g_downstreams;
+std::atomic<uint32_t> g_nextDownstream(0);
+
+bench::BenchService::Stub *nextStub() {
+    return g_downstreams[g_nextDownstream.fetch_add(1) % g_downstreams.size()]->stub();
+}
+
+void onBlockingDone(bench::EchoResponse *response, std::promise<std::string> *result) {
+    result->set_value(response->payload());
+}
+
+// 阻塞写法：每一跳都在 IO 线程里等下游的响应
+class BlockingFrontend : public bench::BenchService {
+public:
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        bench::EchoRequest hop;
+        hop.set_payload(request->payload());
+        for (int i = 0; i < kHops; ++i) {
+            std::promise<std::string> result;
+            std::future<std::string> future = result.get_future();
+            bench::EchoResponse *hopResponse = new bench::EchoResponse;
+            nextStub()->Echo(NULL, &hop, hopResponse,
+                             ::google::protobuf::NewCallback(&onBlockingDone, hopResponse, &result));
+            hop.set_payload(future.get());
+        }
+        response->set_payload(hop.payload());
+        done->Run();
+    }
+};
+
+BlockingFrontend g_blockingFrontend;
+
+// 协程写法：同样的三跳，co_await 时 IO 线程去处理别的请求
+class CoroutineFrontend : public bench::BenchService {
+public:
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        serveCoroutine(echo(*request), controller, response, done);
+    }
+
+private:
+    RpcTask<bench::EchoResponse> echo(const bench::EchoRequest &request) {
+        bench::EchoRequest hop;
+        hop.set_payload(request.payload());
+        for (int i = 0; i < kHops; ++i) {
+            RpcResult<bench::EchoResponse> result =
+                co_await rpcCall(nextStub(), &bench::BenchService::Stub::Echo, hop);
+            hop.set_payload(result.response.payload());
+        }
+        bench::EchoResponse response;
+        response.set_payload(hop.payload());
+        co_return response;
+    }
+};
+
+CoroutineFrontend g_coroutineFrontend;
+
+// 所有 server 都在同一个 loop 线程里创建，进程退出时不析构
+void startServers(EventLoop *loop) {
+    RpcServer *backend = new RpcServer(loop, InetAddress(kBackendPort));
+    backend->setThreadNum(2);
+    backend->registerService(&g_backend);
+    backend->start();
+
+    RpcServer *blocking = new RpcServer(loop, InetAddress(kBlockingPort));
+    blocking->setThreadNum(g_frontendThreads);
+    blocking->registerService(&g_blockingFrontend);
+    blocking->start();
+
+    RpcServer *coroutine = new RpcServer(loop, InetAddress(kCoroutinePort));
+    coroutine->setThreadNum(g_frontendThreads);
+    coroutine->registerService(&g_coroutineFrontend);
+    coroutine->start();
+}
+
+// 到前端的一条连接，保持 pipeline 个请求在途，延迟记到 histogram
+class Connection {
+public:
+    Connection(EventLoop *loop, const InetAddress &serverAddr, int pipeline, Histogram *latency)
+        : client_(loop, serverAddr, "CoroutineBenchClient"),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)),
+        pipeline_(pipeline),
+        latency_(latency) {
+        client_.setConnectionCallback(std::bind(&Connection::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+    }
+
+    void start() { client_.connect(); }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        conn->setTcpNoDelay(true);
+        channel_->setConnection(conn);
+        ++g_connected;
+        for (int i = 0; i < pipeline_; ++i) {
+            sendEcho();
+        }
+    }
+
+    void sendEcho() {
+        if (!g_running.load(std::memory_order_relaxed)) {
+            return;
+        }
+        bench::EchoRequest request;
+        request.set_payload(std::string(64, 'x'));
+        stub_.Echo(NULL, &request, new bench::EchoResponse,
+                   ::google::protobuf::NewCallback(this, &Connection::onResponse, getNowUs()));
+    }
+
+    void onResponse(int64_t startUs) {
+        latency_->record(getNowUs() - startUs);
+        sendEcho();
+    }
+
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+    const int pipeline_;
+    Histogram *latency_;
+};
+
+void waitConnected(int expected) {
+    while (g_connected < expected) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+void runMode(EventLoopThreadPool *pool, const char *mode, uint16_t port) {
+    std::string name = std::string("coroutine_bench.") + mode + "_us";
+    Histogram *latency = MetricsRegistry::instance().histogram(name);
+    g_connected = 0;
+    g_running = true;
+    int pipeline = std::max(1, g_concurrency / kClientConnections);
+    for (int i = 0; i < kClientConnections; ++i) {
+        Connection *conn = new Connection(pool->getNextLoop(), InetAddress("127.0.0.1", port),
+                                          pipeline, latency);
+        conn->start();
+    }
+    waitConnected(kClientConnections);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    MetricsSnapshot before = MetricsRegistry::instance().snapshot();
+    std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(g_durationSec * 1000)));
+    MetricsSnapshot delta = MetricsRegistry::instance().snapshot().diff(before);
+    const LogLinearHistogram::Snapshot &calls = delta.histograms[name];
+    printf("%s,%d,%d,%.1f,%.1f,%.0f,%lld,%lld,%lld\n", mode, g_frontendThreads,
+           pipeline * kClientConnections, g_backendDelaySec * 1000, delta.timestampUs / 1e6,
+           calls.count / (delta.timestampUs / 1e6), static_cast<long long>(calls.percentile(50)),
+           static_cast<long long>(calls.percentile(99)),
+           static_cast<long long>(delta.counters["rpc.coroutine_frame_allocations"]));
+    fflush(stdout);
+
+    g_running = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_frontendThreads = argc > 1 ? atoi(argv[1]) : 2;
+    g_concurrency = argc > 2 ? atoi(argv[2]) : 64;
+    g_backendDelaySec = (argc > 3 ? atof(argv[3]) : 1.0) / 1000.0;
+    g_durationSec = argc > 4 ? atof(argv[4]) : 3.0;
+
+    EventLoopThread serverThread(startServers, "CoroutineBenchServer");
+    serverThread.startLoop();
+
+    // 只作为线程池的 base loop，不运行
+    EventLoop loop;
+    EventLoopThread downstreamThread(EventLoopThread::ThreadInitCallback(),
+                                     "CoroutineBenchDownstream");
+    EventLoop *downstreamLoop = downstreamThread.startLoop();
+    for (int i = 0; i < kDownstreamConnections; ++i) {
+        g_downstreams.push_back(new Downstream(downstreamLoop, InetAddress("127.0.0.1", kBackendPort)));
+        g_downstreams.back()->start();
+    }
+    waitConnected(kDownstreamConnections);
+
+    EventLoopThreadPool pool(&loop, "CoroutineBenchClient");
+    pool.setThreadNum(1);
+    pool.start();
+
+    printf("mode,frontend_threads,concurrency,backend_delay_ms,seconds,calls_per_sec,p50_us,p99_us,"
+           "frame_allocations\n");
+    runMode(&pool, "blocking", kBlockingPort);
+    runMode(&pool, "coroutine", kCoroutinePort);
+
+    // 结果已经输出，直接退出，不等各个 loop 线程
+    _exit(0);
+}
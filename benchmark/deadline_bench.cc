@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcController.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+
+using namespace network;
+
+/**
+ * 用法: deadline_bench [work_us] [load_percent] [duration_sec] [min_timeout_ms] [max_timeout_ms]
+ *
+ * 服务端只有一个 IO 线程，Echo 在 IO 线程里占用 work_us 微秒 CPU，容量约为 1000000 / work_us QPS。
+ * 客户端按容量的 load_percent（默认 120%）开环发送 duration_sec 秒，
+ * 每个请求的时间预算在 [min_timeout_ms, max_timeout_ms] 里均匀随机。分三种模式各跑一遍（各自一个子进程）：
+ *   fifo      - 不开启调度，请求按到达顺序执行，不管 deadline
+ *   fifo+drop - 开启调度（单连接时就是 FIFO），丢弃来不及执行的请求
+ *   edf       - 开启调度并按 deadline 最早优先执行，丢弃来不及执行的请求
+ * 输出在 deadline 以内完成的请求比例、超时返回的请求数、执行了但完成时已经超时的请求数。
+ */
+
+namespace {
+
+const uint16_t kPort = 9988;
+
+enum Mode { kFifo, kFifoDrop, kEdf };
+const char *kModeNames[] = { "fifo", "fifo+drop", "edf" };
+
+int g_workUs = 1000;
+int g_loadPercent = 120;
+double g_durationSec = 5.0;
+int g_minTimeoutMs = 20;
+int g_maxTimeoutMs = 200;
+Mode g_mode = kFifo;
+
+bench::BusyEchoService g_service;
+RpcServer *g_server = NULL;
+
+void configureServer(RpcServer *server) {
+    if (g_mode != kFifo) {
+        RequestSchedulerOptions options;
+        options.earliestDeadlineFirst = g_mode == kEdf;
+        server->enableScheduling(options);
+    }
+}
+
+void startServer(EventLoop *loop) {
+    g_service.setWorkUs(g_workUs);
+    g_server = bench::startServer(loop, kPort, &g_service, configureServer);
+}
+
+class DeadlineBench {
+public:
+    DeadlineBench(EventLoop *loop, const InetAddress &serverAddr, double offeredQps)
+        : loop_(loop),
+        client_(loop, serverAddr, "DeadlineBench"),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)),
+        offeredQps_(offeredQps),
+        random_(20260417),
+        timeoutDist_(g_minTimeoutMs, g_maxTimeoutMs),
+        startUs_(0),
+        lastTickUs_(0),
+        credit_(0),
+        sending_(false),
+        outstanding_(0),
+        sent_(0),
+        withinDeadline_(0),
+        timedOut_(0),
+        late_(0),
+        tickTimer_(0) {
+        client_.setConnectionCallback(std::bind(&DeadlineBench::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+    }
+
+    void connect() { client_.connect(); }
+
+private:
+    struct Call {
+        int64_t startUs;
+        int64_t timeoutMs;
+        RpcController controller;
+        bench::EchoResponse *response;
+    };
+
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        channel_->setConnection(conn);
+        startUs_ = getNowUs();
+        lastTickUs_ = startUs_;
+        sending_ = true;
+        tickTimer_ = loop_->runEvery(0.001, std::bind(&DeadlineBench::tick, this));
+    }
+
+    void tick() {
+        int64_t now = getNowUs();
+        if (now - startUs_ >= static_cast<int64_t>(g_durationSec * 1000000)) {
+            sending_ = false;
+            loop_->cancel(tickTimer_);
+            // FIFO 模式下堆积的请求全部执行完需要一段时间，最多再等 30 秒
+            loop_->runAfter(30.0, std::bind(&DeadlineBench::report, this));
+            return;
+        }
+
+        // 按实际经过的时间累积额度，定时器晚到也不会降低发送速率
+        credit_ += offeredQps_ * (now - lastTickUs_) / 1000000.0;
+        lastTickUs_ = now;
+        bench::EchoRequest request;
+        request.set_payload("x");
+        while (credit_ >= 1.0) {
+            credit_ -= 1.0;
+            Call *call = new Call;
+            call->startUs = now;
+            call->timeoutMs = timeoutDist_(random_);
+            call->controller.setTimeoutMs(call->timeoutMs);
+            call->response = new bench::EchoResponse;
+            ++sent_;
+            ++outstanding_;
+            stub_.Echo(&call->controller, &request, call->response,
+                       ::google::protobuf::NewCallback(this, &DeadlineBench::onDone, call));
+        }
+    }
+
+    void onDone(Call *call) {
+        std::unique_ptr<Call> d(call);
+        if (call->controller.errorCode() == TIMEOUT) {
+            ++timedOut_;
+        } else if (!call->controller.Failed()) {
+            if (getNowUs() - call->startUs <= call->timeoutMs * 1000) {
+                ++withinDeadline_;
+            } else {
+                ++late_;
+            }
+        }
+        if (--outstanding_ == 0 && !sending_) {
+            report();
+        }
+    }
+
+    void report() {
+        printf("[%s] offered=%.0f qps, timeout=%d..%dms\n", kModeNames[g_mode], offeredQps_,
+               g_minTimeoutMs, g_maxTimeoutMs);
+        printf("  sent=%ld within_deadline=%ld (%.1f%%) late=%ld timeout_replies=%ld\n",
+               sent_, withinDeadline_, 100.0 * withinDeadline_ / std::max<int64_t>(sent_, 1),
+               late_, timedOut_);
+        std::vector<RequestScheduler::BandStats> bands = g_server->schedulerStats();
+        for (size_t i = 0; i < bands.size(); ++i) {
+            if (bands[i].enqueued > 0) {
+                printf("  band %zu executed=%ld expired=%ld mean_wait=%.2fms\n", i,
+                       bands[i].executed, bands[i].expired,
+                       bands[i].waitUsTotal / 1000.0 / std::max<int64_t>(bands[i].executed, 1));
+            }
+        }
+        fflush(stdout);
+        loop_->quit();
+    }
+
+    EventLoop *loop_;
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+    const double offeredQps_;
+    std::mt19937 random_;
+    std::uniform_int_distribution<int> timeoutDist_;
+    int64_t startUs_;
+    int64_t lastTickUs_;
+    double credit_;
+    bool sending_;
+    int64_t outstanding_;
+    int64_t sent_;
+    int64_t withinDeadline_;
+    int64_t timedOut_;
+    int64_t late_;
+    TimerId tickTimer_;
+};
+
+void runBench() {
+    EventLoopThread serverThread(startServer, "DeadlineBenchServer");
+    serverThread.startLoop();
+
+    EventLoop loop;
+    DeadlineBench bench(&loop, InetAddress("127.0.0.1", kPort),
+                        1000000.0 / g_workUs * g_loadPercent / 100.0);
+    bench.connect();
+    loop.loop();
+
+    // 结果已经输出，子进程直接退出
+    _exit(0);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_workUs = argc > 1 ? atoi(argv[1]) : 1000;
+    g_loadPercent = argc > 2 ? atoi(argv[2]) : 120;
+    g_durationSec = argc > 3 ? atof(argv[3]) : 5.0;
+    g_minTimeoutMs = argc > 4 ? atoi(argv[4]) : 20;
+    g_maxTimeoutMs = argc > 5 ? atoi(argv[5]) : 200;
+
+    const Mode modes[] = { kFifo, kFifoDrop, kEdf };
+    for (Mode mode : modes) {
+        bench::runInChild([mode]() {
+            g_mode = mode;
+            runBench();
+        });
+    }
+
+    google::protobuf::ShutdownProtobufLibrary();
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/Metrics.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/FanOut.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+
+using namespace network;
+
+/**
+ * 用法: fanout_bench [backends] [fast_ms] [slow_ms] [deadline_ms] [concurrency] [seconds]
+ *
+ * 聚合服务把一个请求扇出到 backends 个后端，其中一个后端很慢时的延迟。后端 0 每次调用延迟 slow_ms
+ * 毫秒，其余后端延迟 fast_ms 的 0.5 到 1.5 倍（都用定时器，不占 IO 线程）。客户端保持 concurrency
+ * 个扇出调用在途，计时 seconds 秒，依次测三种完成条件：
+ *   all      - 等所有后端返回，相当于手写计数器等全部回调；
+ *   quorum   - 前 backends-1 个成功就完成，慢后端成为 straggler；
+ *   deadline - 等所有后端，但最多等 deadline_ms，超时后带着部分结果完成。
+ * 每种条件输出一行 CSV：
+ *   mode,backends,quorum,timeout_ms,calls_per_sec,p50_us,p99_us,avg_succeeded,stragglers_per_call
+ * avg_succeeded 是每次扇出平均拿到的成功响应数，stragglers_per_call 是完成时平均被放弃的下游调用数
+ */
+
+namespace {
+
+const uint16_t kBasePort = 9900;
+
+int g_backends = 32;
+double g_fastMs = 1.0;
+double g_slowMs = 50.0;
+int64_t g_deadlineMs = 10;
+int g_concurrency = 4;
+double g_durationSec = 3.0;
+
+Counter *const g_succeeded = MetricsRegistry::instance().counter("fanout_bench.succeeded");
+
+std::atomic<bool> g_running(false);
+std::atomic<int> g_connected(0);
+
+// 后端：延迟 delayMs（fast 的后端带 ±50% 抖动）后原样返回 payload
+class DelayService : public bench::BenchService {
+public:
+    DelayService(double delayMs, bool jitter) : delayMs_(delayMs), jitter_(jitter) {}
+
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        static thread_local std::mt19937 rng(12345);
+        double delayMs = delayMs_;
+        if (jitter_) {
+            delayMs *= std::uniform_real_distribution<double>(0.5, 1.5)(rng);
+        }
+        response->set_payload(request->payload());
+        EventLoop::getEventLoopOfCurrentThread()->runAfter(delayMs / 1000.0,
+                                                           [done]() { done->Run(); });
+    }
+
+private:
+    const double delayMs_;
+    const bool jitter_;
+};
+
+// 所有后端都在同一个 loop 线程里，进程退出时不析构
+void startBackends(EventLoop *loop) {
+    for (int i = 0; i < g_backends; ++i) {
+        DelayService *service = i == 0 ? new DelayService(g_slowMs, false)
+                                       : new DelayService(g_fastMs, true);
+        RpcServer *server = new RpcServer(loop, InetAddress(static_cast<uint16_t>(kBasePort + i)));
+        server->registerService(service);
+        server->start();
+    }
+}
+
+// 到一个后端的连接
+class Backend {
+public:
+    Backend(EventLoop *loop, const InetAddress &serverAddr)
+        : client_(loop, serverAddr, "FanOutBench"),
+        channel_(new RpcChannel) {
+        client_.setConnectionCallback(std::bind(&Backend::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+    }
+
+    void start() { client_.connect(); }
+
+    RpcChannel *channel() { return get_pointer(channel_); }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (conn->connected()) {
+            conn->setTcpNoDelay(true);
+            channel_->setConnection(conn);
+            ++g_connected;
+        } else {
+            // 这个后端的回复不会再来，以 UNAVAILABLE 结束，扇出调用不会一直等它
+            channel_->failOutstandingCalls(UNAVAILABLE);
+        }
+    }
+
+    TcpClient client_;
+    RpcChannelPtr channel_;
+};
+
+FanOut *g_fanOut = NULL;
+FanOutOptions g_options;
+Histogram *g_latency = NULL;
+
+void startFanOut();
+
+void onFanOutDone(int64_t startUs, FanOutResult &result) {
+    g_latency->record(getNowUs() - startUs);
+    g_succeeded->inc(static_cast<int64_t>(result.succeeded));
+    startFanOut();
+}
+
+// 只在客户端 loop 线程里调用
+void startFanOut() {
+    if (!g_running.load(std::memory_order_relaxed)) {
+        return;
+    }
+    bench::EchoRequest request;
+    request.set_payload(std::string(64, 'x'));
+    g_fanOut->call(bench::BenchService::descriptor()->FindMethodByName("Echo"), request, g_options,
+                   std::bind(&onFanOutDone, getNowUs(), std::placeholders::_1));
+}
+
+void runMode(EventLoop *loop, const char *mode, size_t quorum, int64_t timeoutMs) {
+    std::string name = std::string("fanout_bench.") + mode + "_us";
+    g_latency = MetricsRegistry::instance().histogram(name);
+    g_options.quorum = quorum;
+    g_options.timeoutMs = timeoutMs;
+    g_running = true;
+    loop->runInLoop([]() {
+        for (int i = 0; i < g_concurrency; ++i) {
+            startFanOut();
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    MetricsSnapshot before = MetricsRegistry::instance().snapshot();
+    FanOut::Stats statsBefore = g_fanOut->stats();
+    std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(g_durationSec * 1000)));
+    MetricsSnapshot delta = MetricsRegistry::instance().snapshot().diff(before);
+    FanOut::Stats statsAfter = g_fanOut->stats();
+
+    const LogLinearHistogram::Snapshot &calls = delta.histograms[name];
+    double count = calls.count > 0 ? static_cast<double>(calls.count) : 1.0;
+    printf("%s,%d,%zu,%lld,%.0f,%lld,%lld,%.2f,%.2f\n", mode, g_backends,
+           quorum == 0 ? static_cast<size_t>(g_backends) : quorum, static_cast<long long>(timeoutMs),
+           calls.count / (delta.timestampUs / 1e6), static_cast<long long>(calls.percentile(50)),
+           static_cast<long long>(calls.percentile(99)),
+           delta.counters["fanout_bench.succeeded"] / count,
+           (statsAfter.stragglersCancelled - statsBefore.stragglersCancelled) / count);
+    fflush(stdout);
+
+    // 停止补发，等在途的扇出和慢后端的 straggler 都返回
+    g_running = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(g_slowMs) + 500));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_backends = argc > 1 ? atoi(argv[1]) : 32;
+    g_fastMs = argc > 2 ? atof(argv[2]) : 1.0;
+    g_slowMs = argc > 3 ? atof(argv[3]) : 50.0;
+    g_deadlineMs = argc > 4 ? atoll(argv[4]) : 10;
+    g_concurrency = argc > 5 ? atoi(argv[5]) : 4;
+    g_durationSec = argc > 6 ? atof(argv[6]) : 3.0;
+
+    EventLoopThread serverThread(startBackends, "FanOutBenchServer");
+    serverThread.startLoop();
+
+    EventLoopThread clientThread(EventLoopThread::ThreadInitCallback(), "FanOutBenchClient");
+    EventLoop *loop = clientThread.startLoop();
+    std::vector<::google::protobuf::RpcChannel *> channels;
+    for (int i = 0; i < g_backends; ++i) {
+        Backend *backend = new Backend(loop, InetAddress("127.0.0.1",
+                                                         static_cast<uint16_t>(kBasePort + i)));
+        backend->start();
+        channels.push_back(backend->channel());
+    }
+    while (g_connected < g_backends) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    g_fanOut = new FanOut(loop, channels);
+
+    printf("mode,backends,quorum,timeout_ms,calls_per_sec,p50_us,p99_us,avg_succeeded,"
+           "stragglers_per_call\n");
+    runMode(loop, "all", 0, 0);
+    runMode(loop, "quorum", static_cast<size_t>(g_backends - 1), 0);
+    runMode(loop, "deadline", 0, g_deadlineMs);
+
+    // 结果已经输出，直接退出，不等各个 loop 线程
+    _exit(0);
+}
@@ -0,0 +1,270 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcController.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+
+using namespace network;
+
+/**
+ * 用法: heartbeat_bench [interval_ms] [miss_threshold] [max_wait_sec]
+ *
+ * 对端“半死”时多久能发现：客户端经过本地代理连到 server，代理可以切到黑洞模式，
+ * 两个方向的数据都照常读走但不再转发，也不关闭连接（像对端掉电或网络分区，只是 TCP 层仍然有 ACK）。
+ * 每种配置的步骤：
+ *   1. 建立连接，发 10 个调用确认链路正常；
+ *   2. 空闲 3 个心跳间隔，确认心跳正常应答时连接不会被误判失效（idle_ok）；
+ *   3. 代理切到黑洞，立即发出一个调用，记录它多久以后结束、错误码，以及连接多久以后断开。
+ *      心跳从最后一次收到数据（空闲时是上一个 PONG）开始计算，所以从切到黑洞算起的时间会小于
+ *      interval_ms * (miss_threshold + 1)，和黑洞开始时处在心跳周期的哪个位置有关。
+ * 两种配置：
+ *   keepalive_only - 只有 SO_KEEPALIVE（内核默认约两小时），max_wait_sec 内等不到结果，记为 -1；
+ *   heartbeat      - 客户端开启应用层心跳，间隔 interval_ms，连续 miss_threshold 个 PING 没有回应即失效。
+ * 每种配置输出一行 CSV：
+ *   mode,interval_ms,miss_threshold,idle_ok,call_done_ms,call_error,conn_down_ms
+ */
+
+namespace {
+
+const uint16_t kServerPort = 9960;
+const uint16_t kProxyPort = 9961;
+
+int64_t g_intervalMs = 200;
+int g_missThreshold = 3;
+double g_maxWaitSec = 10.0;
+
+bench::EchoService g_service;
+
+void startServer(EventLoop *loop) {
+    bench::startServer(loop, kServerPort, &g_service);
+}
+
+/**
+ * 每条连接两个方向的转发都在一个线程里用 poll 完成。黑洞模式下照常读走数据但直接丢弃，
+ * 连接不会因为窗口满而停住，两端也收不到任何数据和 FIN
+ */
+std::atomic<bool> g_blackhole(false);
+
+void pump(int clientFd, int serverFd) {
+    char buf[64 * 1024];
+    pollfd fds[2] = { { clientFd, POLLIN, 0 }, { serverFd, POLLIN, 0 } };
+    for (;;) {
+        if (::poll(fds, 2, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        bool closed = false;
+        for (int i = 0; i < 2; ++i) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            ssize_t n = ::read(fds[i].fd, buf, sizeof buf);
+            if (n <= 0) {
+                closed = true;
+                break;
+            }
+            if (!g_blackhole) {
+                int to = fds[1 - i].fd;
+                for (ssize_t sent = 0; sent < n;) {
+                    ssize_t w = ::write(to, buf + sent, n - sent);
+                    if (w <= 0) {
+                        closed = true;
+                        break;
+                    }
+                    sent += w;
+                }
+            }
+        }
+        if (closed) {
+            break;
+        }
+    }
+    ::close(clientFd);
+    ::close(serverFd);
+}
+
+void runProxy(int listenFd) {
+    for (;;) {
+        int clientFd = ::accept(listenFd, NULL, NULL);
+        if (clientFd < 0) {
+            continue;
+        }
+        int serverFd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(kServerPort);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::connect(serverFd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0) {
+            ::close(clientFd);
+            ::close(serverFd);
+            continue;
+        }
+        std::thread(pump, clientFd, serverFd).detach();
+    }
+}
+
+void startProxy() {
+    int listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kProxyPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0 ||
+        ::listen(listenFd, 16) < 0) {
+        LOG(FATAL) << "heartbeat_bench - proxy listen on " << kProxyPort << " failed";
+    }
+    std::thread(runProxy, listenFd).detach();
+}
+
+/**
+ * 一次调用的结果。没有结束的调用在进程退出前一直引用它，所以不释放
+ */
+struct CallResult {
+    RpcController controller;
+    std::atomic<int64_t> doneUs;
+    std::promise<void> done;
+
+    CallResult() : doneUs(0) {}
+
+    static void onDone(CallResult *result) {
+        result->doneUs = getNowUs();
+        result->done.set_value();
+    }
+};
+
+/**
+ * 经过代理到 server 的一条连接，连接断开时未完成的调用立即以 UNAVAILABLE 结束
+ */
+class Client {
+public:
+    Client(EventLoop *loop, bool heartbeat)
+        : client_(loop, InetAddress("127.0.0.1", kProxyPort), "HeartbeatBench"),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)),
+        heartbeat_(heartbeat),
+        upUs_(0),
+        downUs_(0) {
+        client_.setConnectionCallback(std::bind(&Client::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+        request_.set_payload(std::string(32, 'h'));
+    }
+
+    void start() { client_.connect(); }
+
+    bool up() const { return upUs_ > 0; }
+
+    int64_t downUs() const { return downUs_; }
+
+    // 可以在任意线程调用
+    CallResult *call() {
+        CallResult *result = new CallResult;
+        stub_.Echo(&result->controller, &request_, new bench::EchoResponse,
+                   ::google::protobuf::NewCallback(&CallResult::onDone, result));
+        return result;
+    }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (conn->connected()) {
+            conn->setTcpNoDelay(true);
+            channel_->setConnection(conn);
+            if (heartbeat_) {
+                HeartbeatOptions options;
+                options.intervalMs = g_intervalMs;
+                options.missThreshold = g_missThreshold;
+                channel_->enableHeartbeat(options);
+            }
+            upUs_ = getNowUs();
+        } else {
+            downUs_ = getNowUs();
+            channel_->failOutstandingCalls(UNAVAILABLE);
+        }
+    }
+
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+    bench::EchoRequest request_;
+    bool heartbeat_;
+    std::atomic<int64_t> upUs_;
+    std::atomic<int64_t> downUs_;
+};
+
+void runMode(EventLoop *loop, const char *mode, bool heartbeat) {
+    g_blackhole = false;
+    Client *client = new Client(loop, heartbeat);
+    client->start();
+    while (!client->up()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    for (int i = 0; i < 10; ++i) {
+        CallResult *result = client->call();
+        result->done.get_future().wait();
+        delete result;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(3 * g_intervalMs));
+    bool idleOk = client->downUs() == 0;
+
+    g_blackhole = true;
+    int64_t startUs = getNowUs();
+    CallResult *result = client->call();
+    std::future<void> done = result->done.get_future();
+    bool finished = done.wait_for(std::chrono::milliseconds(static_cast<int64_t>(g_maxWaitSec * 1000))) ==
+        std::future_status::ready;
+    int64_t downUs = client->downUs();
+    printf("%s,%lld,%d,%d,%lld,%s,%lld\n", mode, static_cast<long long>(heartbeat ? g_intervalMs : 0),
+           heartbeat ? g_missThreshold : 0, idleOk ? 1 : 0,
+           static_cast<long long>(finished ? (result->doneUs - startUs) / 1000 : -1),
+           finished ? ErrorCode_Name(result->controller.errorCode()).c_str() : "-",
+           static_cast<long long>(downUs > startUs ? (downUs - startUs) / 1000 : -1));
+    fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_intervalMs = argc > 1 ? atoll(argv[1]) : 200;
+    g_missThreshold = argc > 2 ? atoi(argv[2]) : 3;
+    g_maxWaitSec = argc > 3 ? atof(argv[3]) : 10.0;
+
+    EventLoopThread serverThread(startServer, "HeartbeatBenchServer");
+    serverThread.startLoop();
+    startProxy();
+
+    EventLoopThread clientThread(EventLoopThread::ThreadInitCallback(), "HeartbeatBenchClient");
+    EventLoop *loop = clientThread.startLoop();
+
+    printf("mode,interval_ms,miss_threshold,idle_ok,call_done_ms,call_error,conn_down_ms\n");
+    runMode(loop, "keepalive_only", false);
+    runMode(loop, "heartbeat", true);
+
+    // 结果已经输出，直接退出，不等各个 loop 线程和代理线程
+    _exit(0);
+}
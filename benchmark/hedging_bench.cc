@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "rpc_framework/HedgingChannel.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+
+using namespace network;
+
+/**
+ * 用法: hedging_bench [calls] [concurrency] [slow_percent] [slow_ms]
+ *
+ * 同一个进程里启动一个本地 RpcServer，它的 Echo 以 slow_percent% 的概率延迟 slow_ms 毫秒返回，
+ * 其余请求延迟 200~1000 微秒。客户端建立两条连接，先不开启对冲跑一轮，再开启对冲跑一轮，
+ * 对比两轮的延迟分位和对冲统计。
+ */
+
+namespace {
+
+const uint16_t kPort = 9982;
+
+int g_slowPercent = 5;
+int g_slowMs = 20;
+
+/**
+ * 随机注入延迟的 Echo 服务。延迟通过 loop 的定时器实现，不会阻塞 IO 线程
+ */
+class DelayedEchoService : public bench::BenchService {
+public:
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        response->set_payload(request->payload());
+
+        thread_local std::mt19937 rng(std::random_device{}());
+        std::uniform_int_distribution<int> percent(0, 99);
+        std::uniform_int_distribution<int> fastUs(200, 1000);
+        double delay = percent(rng) < g_slowPercent ? g_slowMs / 1000.0 : fastUs(rng) / 1000000.0;
+        EventLoop::getEventLoopOfCurrentThread()->runAfter(delay, [done]() { done->Run(); });
+    }
+};
+
+DelayedEchoService g_service;
+
+void startServer(EventLoop *loop) {
+    bench::startServer(loop, kPort, &g_service, [](RpcServer *server) { server->setThreadNum(2); });
+}
+
+/**
+ * 两条连接、两个 RpcChannel，以及在它们之上的 HedgingChannel。
+ * 每一轮保持 concurrency 个请求在途，一个返回就立即补发下一个，直到发完 calls 个
+ */
+class HedgingBench {
+public:
+    HedgingBench(EventLoop *loop, const InetAddress &serverAddr, int calls, int concurrency)
+        : loop_(loop),
+        primaryClient_(loop, serverAddr, "HedgingBenchPrimary"),
+        secondaryClient_(loop, serverAddr, "HedgingBenchSecondary"),
+        primary_(new RpcChannel),
+        secondary_(new RpcChannel),
+        hedging_(loop, get_pointer(primary_), get_pointer(secondary_)),
+        calls_(calls),
+        concurrency_(concurrency),
+        connected_(0),
+        hedgingRound_(false),
+        sent_(0),
+        finished_(0) {
+        primaryClient_.setConnectionCallback(
+            std::bind(&HedgingBench::onConnection, this, primary_, _1));
+        primaryClient_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(primary_), _1, _2));
+        secondaryClient_.setConnectionCallback(
+            std::bind(&HedgingBench::onConnection, this, secondary_, _1));
+        secondaryClient_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(secondary_), _1, _2));
+
+        HedgingOptions options;
+        options.percentile = 90.0;
+        options.initialDelayUs = 2000;
+        hedging_.enableHedging("bench.BenchService.Echo", options);
+        hedging_.setHedgeBudgetPercent(10.0);
+    }
+
+    void connect() {
+        primaryClient_.connect();
+        secondaryClient_.connect();
+    }
+
+private:
+    void onConnection(const RpcChannelPtr &channel, const TcpConnectionPtr &conn) {
+        if (conn->connected()) {
+            channel->setConnection(conn);
+            if (++connected_ == 2) {
+                startRound(false);
+            }
+        }
+    }
+
+    void startRound(bool hedging) {
+        hedgingRound_ = hedging;
+        sent_ = 0;
+        finished_ = 0;
+        latencies_.clear();
+        latencies_.reserve(calls_);
+        for (int i = 0; i < concurrency_ && sent_ < calls_; ++i) {
+            sendOne();
+        }
+    }
+
+    void sendOne() {
+        ++sent_;
+        bench::EchoRequest request;
+        request.set_payload(std::string(64, 'x'));
+        bench::EchoResponse *response = new bench::EchoResponse;
+        ::google::protobuf::RpcChannel *channel =
+            hedgingRound_ ? static_cast<::google::protobuf::RpcChannel *>(&hedging_)
+                          : static_cast<::google::protobuf::RpcChannel *>(get_pointer(primary_));
+        bench::BenchService::Stub stub(channel);
+        stub.Echo(NULL, &request, response,
+                  ::google::protobuf::NewCallback(this, &HedgingBench::onResponse, getNowUs()));
+    }
+
+    void onResponse(int64_t startUs) {
+        latencies_.push_back(getNowUs() - startUs);
+        ++finished_;
+        if (sent_ < calls_) {
+            sendOne();
+        } else if (finished_ == calls_) {
+            report();
+            if (!hedgingRound_) {
+                startRound(true);
+            } else {
+                loop_->quit();
+            }
+        }
+    }
+
+    void report() {
+        printf("%-10s calls=%d p50=%ldus p90=%ldus p99=%ldus p999=%ldus\n",
+               hedgingRound_ ? "hedging" : "baseline", calls_,
+               bench::percentile(latencies_, 50), bench::percentile(latencies_, 90),
+               bench::percentile(latencies_, 99), bench::percentile(latencies_, 99.9));
+        if (hedgingRound_) {
+            HedgingChannel::Stats s = hedging_.stats();
+            printf("%-10s hedges_sent=%ld (%.1f%%) hedges_won=%ld throttled=%ld\n", "",
+                   s.hedgesSent, 100.0 * s.hedgesSent / std::max<int64_t>(s.calls, 1),
+                   s.hedgesWon, s.hedgesThrottled);
+        }
+        fflush(stdout);
+    }
+
+    EventLoop *loop_;
+    TcpClient primaryClient_;
+    TcpClient secondaryClient_;
+    RpcChannelPtr primary_;
+    RpcChannelPtr secondary_;
+    HedgingChannel hedging_;
+    const int calls_;
+    const int concurrency_;
+    int connected_;
+    bool hedgingRound_;
+    int sent_;
+    int finished_;
+    std::vector<int64_t> latencies_;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    int calls = argc > 1 ? atoi(argv[1]) : 20000;
+    int concurrency = argc > 2 ? atoi(argv[2]) : 8;
+    g_slowPercent = argc > 3 ? atoi(argv[3]) : 5;
+    g_slowMs = argc > 4 ? atoi(argv[4]) : 20;
+
+    EventLoopThread serverThread(startServer, "HedgingBenchServer");
+    serverThread.startLoop();
+
+    EventLoop loop;
+    HedgingBench bench(&loop, InetAddress("127.0.0.1", kPort), calls, concurrency);
+    bench.connect();
+    loop.loop();
+
+    google::protobuf::ShutdownProtobufLibrary();
+    return 0;
+}
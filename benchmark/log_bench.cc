@@ -0,0 +1,196 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/AsyncLogging.h"
+#include "network/Metrics.h"
+#include "network/util.h"
+
+using namespace network;
+
+/**
+ * 用法: log_bench [threads] [rate_per_thread] [seconds] [stall_ms] [stall_period_ms]
+ *
+ * 模拟磁盘卡顿时 IO 线程里 LOG(INFO) 的调用延迟。threads 个线程各自按 rate_per_thread 条/秒
+ * 的节奏写日志，持续 seconds 秒，记录每次 LOG() 调用的耗时。日志最终写到 /dev/null，
+ * 但每隔 stall_period_ms 毫秒有一次写入要先睡 stall_ms 毫秒，模拟磁盘卡住。依次测两种后端：
+ *   sync  - 在调用线程里加锁格式化并直接写盘，相当于 glog 默认的同步写文件；
+ *   async - AsyncLogging，调用线程只把日志拷进本线程的暂存区。
+ * 每种后端输出一行 CSV：
+ *   mode,threads,rate_per_thread,calls,p50_us,p99_us,p999_us,max_us,sched_p99_us,sched_max_us,
+ *   dropped,bytes_written
+ * p50 到 max 是单次 LOG() 的耗时。卡住的那一次调用之后线程要连续补写积压的日志，这些调用本身很快，
+ * 所以另外按计划时间统计 sched：从这条日志本该写的时刻到调用返回，相当于 IO 线程上其他事件被推迟的时间。
+ * dropped 是暂存区写满时丢弃的条数，卡顿期间积压的日志超过暂存区大小时才会出现
+ */
+
+namespace {
+
+int g_threads = 4;
+int g_ratePerThread = 5000;
+double g_durationSec = 3.0;
+int g_stallMs = 200;
+int g_stallPeriodMs = 1000;
+
+int64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 写到 /dev/null 的“磁盘”，每个周期第一次写入时卡住 stall_ms
+class StalledDisk {
+public:
+    StalledDisk() : fd_(::open("/dev/null", O_WRONLY | O_CLOEXEC)), nextStallNs_(0), bytes_(0) {}
+
+    ~StalledDisk() { ::close(fd_); }
+
+    // 同一时刻只有一个线程调用：sync 模式在锁里，async 模式只在后台线程里
+    void write(const char *data, size_t len) {
+        int64_t now = nowNs();
+        if (now >= nextStallNs_) {
+            ::usleep(g_stallMs * 1000);
+            nextStallNs_ = nowNs() + g_stallPeriodMs * 1000000LL;
+        }
+        ssize_t n = ::write(fd_, data, len);
+        (void)n;
+        bytes_.fetch_add(len, std::memory_order_relaxed);
+    }
+
+    int64_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+private:
+    int fd_;
+    int64_t nextStallNs_;
+    std::atomic<int64_t> bytes_;
+};
+
+// 同步后端：所有线程排队格式化一行并写盘，和 glog 在 log_mutex 里写文件一样
+class SyncSink : public google::LogSink {
+public:
+    explicit SyncSink(StalledDisk *disk) : disk_(disk) {}
+
+    void send(google::LogSeverity severity, const char *fullFilename, const char *baseFilename,
+              int line, const struct ::tm *tmTime, const char *message,
+              size_t messageLen) override {
+        (void)fullFilename;
+        (void)tmTime;
+        std::lock_guard<std::mutex> lock(mutex_);
+        line_.assign(1, "IWEF"[severity & 3]);
+        line_ += " ";
+        line_ += baseFilename;
+        line_ += ":" + std::to_string(line) + "] ";
+        line_.append(message, messageLen);
+        line_ += "\n";
+        disk_->write(line_.data(), line_.size());
+    }
+
+private:
+    StalledDisk *disk_;
+    std::mutex mutex_;
+    std::string line_;
+};
+
+// 按固定节奏写日志的“IO 线程”，每次调用的耗时记到 calls，从计划时刻算起的延迟记到 sched
+void runWriter(int index, Histogram *calls, Histogram *sched) {
+    const int64_t intervalNs = 1000000000LL / g_ratePerThread;
+    const int64_t endNs = nowNs() + static_cast<int64_t>(g_durationSec * 1e9);
+    int64_t next = nowNs();
+    for (int64_t i = 0; next < endNs; ++i) {
+        int64_t begin = nowNs();
+        LOG(INFO) << "TcpServer::newConnection [LogBench] - new connection [LogBench-" << index
+                  << "#" << i << "] from 127.0.0.1:" << 10000 + i % 50000;
+        int64_t end = nowNs();
+        calls->record(end - begin);
+        sched->record(end - next);
+
+        next += intervalNs;
+        int64_t sleepNs = next - nowNs();
+        if (sleepNs > 0) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(sleepNs));
+        }
+    }
+}
+
+void runMode(const char *mode) {
+    MetricsRegistry &registry = MetricsRegistry::instance();
+    Histogram *calls = registry.histogram(std::string("log_bench.") + mode + "_call_ns");
+    Histogram *sched = registry.histogram(std::string("log_bench.") + mode + "_sched_ns");
+    std::vector<std::thread> writers;
+    for (int t = 0; t < g_threads; ++t) {
+        writers.emplace_back(runWriter, t, calls, sched);
+    }
+    for (std::thread &writer : writers) {
+        writer.join();
+    }
+}
+
+void report(const char *mode, const MetricsSnapshot &before, const MetricsSnapshot &after,
+            int64_t bytesWritten) {
+    MetricsSnapshot delta = after.diff(before);
+    const LogLinearHistogram::Snapshot &calls =
+        delta.histograms[std::string("log_bench.") + mode + "_call_ns"];
+    const LogLinearHistogram::Snapshot &sched =
+        delta.histograms[std::string("log_bench.") + mode + "_sched_ns"];
+    printf("%s,%d,%d,%lld,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%lld,%lld\n", mode, g_threads,
+           g_ratePerThread, static_cast<long long>(calls.count), calls.percentile(50) / 1000.0,
+           calls.percentile(99) / 1000.0, calls.percentile(99.9) / 1000.0, calls.max / 1000.0,
+           sched.percentile(99) / 1000.0, sched.max / 1000.0,
+           static_cast<long long>(delta.counters["log.dropped"]),
+           static_cast<long long>(bytesWritten));
+    fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_threads = argc > 1 ? atoi(argv[1]) : 4;
+    g_ratePerThread = argc > 2 ? atoi(argv[2]) : 5000;
+    g_durationSec = argc > 3 ? atof(argv[3]) : 3.0;
+    g_stallMs = argc > 4 ? atoi(argv[4]) : 200;
+    g_stallPeriodMs = argc > 5 ? atoi(argv[5]) : 1000;
+
+    google::InitGoogleLogging(argv[0]);
+    for (int severity = google::GLOG_INFO; severity < google::NUM_SEVERITIES; ++severity) {
+        google::SetLogDestination(severity, "");
+    }
+    MetricsRegistry &registry = MetricsRegistry::instance();
+    registry.counter("log.dropped");
+
+    printf("mode,threads,rate_per_thread,calls,p50_us,p99_us,p999_us,max_us,sched_p99_us,sched_max_us,"
+           "dropped,bytes_written\n");
+    {
+        StalledDisk disk;
+        SyncSink sink(&disk);
+        google::AddLogSink(&sink);
+        MetricsSnapshot before = registry.snapshot();
+        runMode("sync");
+        MetricsSnapshot after = registry.snapshot();
+        google::RemoveLogSink(&sink);
+        report("sync", before, after, disk.bytes());
+    }
+    {
+        StalledDisk disk;
+        AsyncLogging logging("log_bench", 1024 * 1024 * 1024);
+        logging.setOutput(std::bind(&StalledDisk::write, &disk, std::placeholders::_1,
+                                    std::placeholders::_2));
+        logging.setDisableGlogFiles(false); // main 里已经关掉了 glog 的日志文件
+        logging.start();
+        MetricsSnapshot before = registry.snapshot();
+        runMode("async");
+        MetricsSnapshot after = registry.snapshot();
+        logging.stop();
+        report("async", before, after, disk.bytes());
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "network/Buffer.h"
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/util.h"
+
+using namespace network;
+
+/**
+ * 用法: micro_bench [--benchmark_filter=正则] [其他 Google Benchmark 参数]
+ *
+ * 每个请求都会经过的 Buffer 和 EventLoop 跨线程投递路径的微基准，
+ * 以后改写 Buffer 或任务队列时拿这里的数字对比：
+ *   - BM_BufferAppend：追加小块和大块数据；
+ *   - BM_BufferPrependHeader：在已有的消息前面写 4 字节长度头；
+ *   - BM_BufferCompact / BM_BufferGrow：makeSpace 的两条路径，挪动已有数据和扩容；
+ *   - BM_BufferReadFd / BM_RawRead：从 socketpair 读数据，后者直接 read 到数组，差值是 Buffer 的开销；
+ *   - BM_QueueInLoopThroughput / BM_RunInLoopLatency：1 到 16 个生产者线程向同一个 loop 投递任务的
+ *     吞吐，以及投递之后等到任务执行完的往返时间。
+ */
+
+namespace {
+
+void BM_BufferAppend(benchmark::State &state) {
+    const size_t len = state.range(0);
+    std::vector<char> data(len, 'a');
+    Buffer buf;
+    for (auto _ : state) {
+        buf.append(data.data(), len);
+        benchmark::DoNotOptimize(buf.peek());
+        buf.retrieveAll();
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_BufferAppend)->Arg(8)->Arg(64)->Arg(512)->Arg(4096)->Arg(65536);
+
+// 先追加消息体，再在预留空间里写长度头，和编解码器的用法一样
+void BM_BufferPrependHeader(benchmark::State &state) {
+    const size_t len = state.range(0);
+    std::vector<char> body(len, 'b');
+    Buffer buf;
+    for (auto _ : state) {
+        buf.append(body.data(), len);
+        buf.prependInt32(static_cast<int32_t>(len));
+        benchmark::DoNotOptimize(buf.peek());
+        buf.retrieveAll();
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_BufferPrependHeader)->Arg(64)->Arg(4096);
+
+/**
+ * 可写空间不够但加上前面已读的空间足够：makeSpace 把剩下的 range(0) 字节挪到开头。
+ * 每轮先写满初始容量、读掉除最后 range(0) 字节以外的部分，再追加触发挪动
+ */
+void BM_BufferCompact(benchmark::State &state) {
+    const size_t remaining = state.range(0);
+    const size_t capacity = Buffer::kInitialSize;
+    std::vector<char> data(capacity, 'c');
+    Buffer buf;
+    for (auto _ : state) {
+        buf.append(data.data(), capacity);
+        buf.retrieve(capacity - remaining);
+        buf.append(data.data(), capacity - remaining);
+        benchmark::DoNotOptimize(buf.peek());
+        buf.retrieveAll();
+    }
+    state.SetBytesProcessed(state.iterations() * remaining);
+}
+BENCHMARK(BM_BufferCompact)->Arg(16)->Arg(256)->Arg(768);
+
+// 新建的 Buffer 一次追加 range(0) 字节，超过初始容量时 makeSpace 扩容
+void BM_BufferGrow(benchmark::State &state) {
+    const size_t len = state.range(0);
+    std::vector<char> data(len, 'g');
+    for (auto _ : state) {
+        Buffer buf;
+        buf.append(data.data(), len);
+        benchmark::DoNotOptimize(buf.peek());
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_BufferGrow)->Arg(512)->Arg(4096)->Arg(65536)->Arg(1024 * 1024);
+
+class SocketPair {
+public:
+    SocketPair() {
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds_) != 0) {
+            fds_[0] = fds_[1] = -1;
+        }
+    }
+
+    ~SocketPair() {
+        ::close(fds_[0]);
+        ::close(fds_[1]);
+    }
+
+    int reader() const { return fds_[0]; }
+    int writer() const { return fds_[1]; }
+
+private:
+    int fds_[2];
+};
+
+// 每轮向 socketpair 写 range(0) 字节再用 readFd 读出来；写入的开销和 BM_RawRead 相同
+void BM_BufferReadFd(benchmark::State &state) {
+    const size_t len = state.range(0);
+    std::vector<char> data(len, 'r');
+    SocketPair pair;
+    Buffer buf;
+    int savedErrno = 0;
+    for (auto _ : state) {
+        if (::write(pair.writer(), data.data(), len) != static_cast<ssize_t>(len)) {
+            state.SkipWithError("write to socketpair failed");
+            break;
+        }
+        size_t total = 0;
+        while (total < len) {
+            ssize_t n = buf.readFd(pair.reader(), &savedErrno);
+            if (n <= 0) {
+                break;
+            }
+            total += n;
+        }
+        buf.retrieveAll();
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_BufferReadFd)->Arg(64)->Arg(4096)->Arg(65536);
+
+void BM_RawRead(benchmark::State &state) {
+    const size_t len = state.range(0);
+    std::vector<char> data(len, 'r');
+    std::vector<char> out(len);
+    SocketPair pair;
+    for (auto _ : state) {
+        if (::write(pair.writer(), data.data(), len) != static_cast<ssize_t>(len)) {
+            state.SkipWithError("write to socketpair failed");
+            break;
+        }
+        size_t total = 0;
+        while (total < len) {
+            ssize_t n = ::read(pair.reader(), out.data() + total, len - total);
+            if (n <= 0) {
+                break;
+            }
+            total += n;
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_RawRead)->Arg(64)->Arg(4096)->Arg(65536);
+
+// 所有跨线程用例共用的消费者 loop，第一次使用时启动，进程退出前一直运行
+EventLoop *consumerLoop() {
+    static EventLoopThread *thread = new EventLoopThread(EventLoopThread::ThreadInitCallback(),
+                                                         "MicroBenchLoop");
+    static EventLoop *loop = thread->startLoop();
+    return loop;
+}
+
+/**
+ * 每个生产者只等自己投递的任务执行完，计数器只由 loop 线程写。
+ * 在途任务超过 kMaxInFlight 时生产者让出 CPU，避免 loop 跟不上时队列无限增长
+ */
+void BM_QueueInLoopThroughput(benchmark::State &state) {
+    const int64_t kMaxInFlight = 4096;
+    EventLoop *loop = consumerLoop();
+    std::shared_ptr<std::atomic<int64_t>> done = std::make_shared<std::atomic<int64_t>>(0);
+    int64_t sent = 0;
+    for (auto _ : state) {
+        while (sent - done->load(std::memory_order_acquire) >= kMaxInFlight) {
+            std::this_thread::yield();
+        }
+        loop->queueInLoop([done]() {
+            done->store(done->load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        });
+        ++sent;
+    }
+    while (done->load(std::memory_order_acquire) < sent) {
+        std::this_thread::yield();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_QueueInLoopThroughput)->ThreadRange(1, 16)->UseRealTime();
+
+// 一次只有一个任务在途：从投递到任务在 loop 线程里执行完，再回到生产者线程
+void BM_RunInLoopLatency(benchmark::State &state) {
+    EventLoop *loop = consumerLoop();
+    std::shared_ptr<std::atomic<bool>> ran = std::make_shared<std::atomic<bool>>(false);
+    for (auto _ : state) {
+        ran->store(false, std::memory_order_relaxed);
+        loop->runInLoop([ran]() { ran->store(true, std::memory_order_release); });
+        while (!ran->load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RunInLoopLatency)->ThreadRange(1, 16)->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/Metrics.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+
+using namespace network;
+
+/**
+ * 用法: microbatch_bench [fixed_us] [per_item_us] [seconds_per_level] [rates]
+ *
+ * 批处理友好的 handler 在逐个调用和服务端攒批两种方式下、不同负载时的吞吐和延迟。
+ * handler 每次调用先忙等 fixed_us 微秒（模拟一次写存储或一次计算接口调用的固定开销），
+ * 每个请求再忙等 per_item_us 微秒。服务端只有一个 IO 线程，三种配置：
+ *   single     - 普通 handler，每个请求一次调用，容量约 1 / (fixed_us + per_item_us)；
+ *   batch      - batchHandler，maxBatchSize 64，不额外等待，loop 一轮读到的请求攒成一批；
+ *   batch_wait - 同上，但第一个请求最多等 200 微秒攒批。
+ * 客户端按 rates（逗号分隔，请求/秒）逐级开环发送，8 条连接轮流发，在途请求超过 4000 时跳过。
+ * 每种配置每一级负载输出一行 CSV：
+ *   mode,offered_per_sec,achieved_per_sec,p50_us,p99_us,avg_batch,skipped
+ * avg_batch 是每次调用 handler 平均处理的请求数，skipped 是因为在途请求太多没有发出的请求数
+ */
+
+namespace {
+
+const uint16_t kSinglePort = 9975;
+const uint16_t kBatchPort = 9976;
+const uint16_t kBatchWaitPort = 9977;
+const int kConnections = 8;
+const int kMaxOutstanding = 4000;
+
+int64_t g_fixedUs = 50;
+int64_t g_perItemUs = 2;
+double g_levelSec = 2.0;
+
+void spinUs(int64_t us) {
+    int64_t end = getNowUs() + us;
+    while (getNowUs() < end) {
+    }
+}
+
+class SingleService : public bench::BenchService {
+public:
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        spinUs(g_fixedUs + g_perItemUs);
+        response->set_payload(request->payload());
+        done->Run();
+    }
+};
+
+SingleService g_service;
+
+// 整批只付一次固定开销
+void echoBatch(std::vector<BatchedCall> &calls) {
+    spinUs(g_fixedUs + g_perItemUs * static_cast<int64_t>(calls.size()));
+    for (BatchedCall &call : calls) {
+        const bench::EchoRequest *request = static_cast<const bench::EchoRequest *>(call.request);
+        static_cast<bench::EchoResponse *>(call.response)->set_payload(request->payload());
+        call.done->Run();
+    }
+}
+
+RpcServer *g_servers[3];
+
+RpcServer *startServer(EventLoop *loop, uint16_t port, bool batch, int64_t maxBatchDelayUs) {
+    RpcServer *server = new RpcServer(loop, InetAddress(port));
+    server->setThreadNum(1);
+    server->registerService(&g_service);
+    if (batch) {
+        RpcMethodOptions options;
+        options.batchHandler = echoBatch;
+        options.maxBatchSize = 64;
+        options.maxBatchDelayUs = maxBatchDelayUs;
+        server->setMethodOptions("bench.BenchService.Echo", options);
+    }
+    server->start();
+    return server;
+}
+
+// 三个 server 都在同一个 loop 线程里创建，进程退出时不析构
+void startServers(EventLoop *loop) {
+    g_servers[0] = startServer(loop, kSinglePort, false, 0);
+    g_servers[1] = startServer(loop, kBatchPort, true, 0);
+    g_servers[2] = startServer(loop, kBatchWaitPort, true, 200);
+}
+
+std::atomic<int> g_connected(0);
+std::atomic<int> g_outstanding(0);
+
+class Connection {
+public:
+    Connection(EventLoop *loop, const InetAddress &serverAddr)
+        : client_(loop, serverAddr, "MicrobatchBench"),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)) {
+        client_.setConnectionCallback(std::bind(&Connection::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+        request_.set_payload(std::string(32, 'k'));
+    }
+
+    void start() { client_.connect(); }
+
+    void send(Histogram *latency) {
+        ++g_outstanding;
+        stub_.Echo(NULL, &request_, new bench::EchoResponse,
+                   ::google::protobuf::NewCallback(&Connection::onResponse, latency, getNowUs()));
+    }
+
+private:
+    static void onResponse(Histogram *latency, int64_t startUs) {
+        latency->record(getNowUs() - startUs);
+        --g_outstanding;
+    }
+
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (conn->connected()) {
+            conn->setTcpNoDelay(true);
+            channel_->setConnection(conn);
+            ++g_connected;
+        }
+    }
+
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+    bench::EchoRequest request_;
+};
+
+/**
+ * 开环发送，只在客户端 loop 线程里访问：每毫秒按 rate 累积额度，
+ * 额度够一个请求就轮流选一条连接发出
+ */
+struct Load {
+    std::vector<Connection *> *connections = NULL;
+    Histogram *latency = NULL;
+    double rate = 0;
+    double credit = 0;
+    size_t next = 0;
+    int64_t skipped = 0;
+};
+
+Load g_load;
+
+void onTick() {
+    if (!g_load.connections || g_load.rate <= 0) {
+        return;
+    }
+    g_load.credit += g_load.rate / 1000.0;
+    while (g_load.credit >= 1.0) {
+        g_load.credit -= 1.0;
+        if (g_outstanding >= kMaxOutstanding) {
+            ++g_load.skipped;
+            continue;
+        }
+        Connection *conn = (*g_load.connections)[g_load.next++ % g_load.connections->size()];
+        conn->send(g_load.latency);
+    }
+}
+
+void runLevel(EventLoop *loop, const char *mode, RpcServer *server,
+              std::vector<Connection *> *connections, double rate) {
+    std::ostringstream name;
+    name << "microbatch_bench." << mode << "_" << static_cast<int64_t>(rate) << "_us";
+    Histogram *latency = MetricsRegistry::instance().histogram(name.str());
+    loop->runInLoop([connections, latency, rate]() {
+        g_load.connections = connections;
+        g_load.latency = latency;
+        g_load.rate = rate;
+        g_load.credit = 0;
+        g_load.skipped = 0;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    MetricsSnapshot before = MetricsRegistry::instance().snapshot();
+    RequestBatcher::Stats batchBefore = server->batcherStats();
+    std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(g_levelSec * 1000)));
+    MetricsSnapshot delta = MetricsRegistry::instance().snapshot().diff(before);
+    RequestBatcher::Stats batchAfter = server->batcherStats();
+
+    // 停止发送，等在途请求都返回
+    std::promise<int64_t> stopped;
+    loop->runInLoop([&stopped]() {
+        g_load.rate = 0;
+        stopped.set_value(g_load.skipped);
+    });
+    int64_t skipped = stopped.get_future().get();
+    while (g_outstanding > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    const LogLinearHistogram::Snapshot &calls = delta.histograms[name.str()];
+    int64_t batches = batchAfter.batches - batchBefore.batches;
+    double avgBatch = batches > 0
+        ? static_cast<double>(batchAfter.requests - batchBefore.requests) / batches : 1.0;
+    printf("%s,%.0f,%.0f,%lld,%lld,%.1f,%lld\n", mode, rate, calls.count / (delta.timestampUs / 1e6),
+           static_cast<long long>(calls.percentile(50)), static_cast<long long>(calls.percentile(99)),
+           avgBatch, static_cast<long long>(skipped));
+    fflush(stdout);
+}
+
+std::vector<Connection *> *connect(EventLoop *loop, uint16_t port) {
+    std::vector<Connection *> *connections = new std::vector<Connection *>;
+    for (int i = 0; i < kConnections; ++i) {
+        Connection *conn = new Connection(loop, InetAddress("127.0.0.1", port));
+        conn->start();
+        connections->push_back(conn);
+    }
+    return connections;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_fixedUs = argc > 1 ? atoll(argv[1]) : 50;
+    g_perItemUs = argc > 2 ? atoll(argv[2]) : 2;
+    g_levelSec = argc > 3 ? atof(argv[3]) : 2.0;
+    std::vector<double> rates;
+    std::istringstream rateList(argc > 4 ? argv[4] : "2000,5000,10000,20000,40000");
+    std::string rate;
+    while (std::getline(rateList, rate, ',')) {
+        rates.push_back(atof(rate.c_str()));
+    }
+
+    EventLoopThread serverThread(startServers, "MicrobatchBenchServer");
+    serverThread.startLoop();
+
+    EventLoopThread clientThread(EventLoopThread::ThreadInitCallback(), "MicrobatchBenchClient");
+    EventLoop *loop = clientThread.startLoop();
+    std::vector<Connection *> *single = connect(loop, kSinglePort);
+    std::vector<Connection *> *batch = connect(loop, kBatchPort);
+    std::vector<Connection *> *batchWait = connect(loop, kBatchWaitPort);
+    while (g_connected < 3 * kConnections) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    loop->runEvery(0.001, onTick);
+
+    printf("mode,offered_per_sec,achieved_per_sec,p50_us,p99_us,avg_batch,skipped\n");
+    for (double r : rates) {
+        runLevel(loop, "single", g_servers[0], single, r);
+        runLevel(loop, "batch", g_servers[1], batch, r);
+        runLevel(loop, "batch_wait", g_servers[2], batchWait, r);
+    }
+
+    // 结果已经输出，直接退出，不等各个 loop 线程
+    _exit(0);
+}
@@ -0,0 +1,46 @@
+#!/bin/bash
+#
+# 网络层基准的参数扫描，结果以 CSV 输出到标准输出。
+#
+# 用法: net_sweep.sh [bin_dir] [seconds]
+#   bin_dir 是 pingpong_bench / throughput_bench 所在目录，默认和脚本同目录
+#
+# 扫描的取值可以用环境变量覆盖，例如:
+#   THREADS="1 2 4 8" SIZES="64 4096" SESSIONS="1 1000" ./net_sweep.sh build/bin 3 > net.csv
+#
+# 两个程序的列不同，所以输出两张表，中间空一行：
+#   1. pingpong：服务端和客户端都用 THREADS 里的线程数，遍历 SESSIONS x SIZES；
+#   2. throughput：同样的线程数，遍历 CONNECTIONS x STREAM_SIZES。
+
+set -e
+
+BIN_DIR=${1:-$(cd "$(dirname "$0")" && pwd)}
+SECONDS_PER_RUN=${2:-5}
+
+THREADS=${THREADS:-"1 2 4"}
+SIZES=${SIZES:-"16 256 4096 65536"}
+SESSIONS=${SESSIONS:-"1 10 100 1000"}
+CONNECTIONS=${CONNECTIONS:-"1 4 16"}
+STREAM_SIZES=${STREAM_SIZES:-"4096 65536"}
+
+# 每个会话在客户端和服务端各占一个 fd
+ulimit -n 65536 2>/dev/null || true
+
+echo "bench,server_threads,client_threads,sessions,block_size,seconds,msgs_per_sec,mib_per_sec,p50_us,p99_us,p999_us"
+for threads in $THREADS; do
+    for sessions in $SESSIONS; do
+        for size in $SIZES; do
+            "$BIN_DIR/pingpong_bench" "$threads" "$threads" "$sessions" "$size" "$SECONDS_PER_RUN" 2>/dev/null
+        done
+    done
+done
+
+echo
+echo "bench,server_threads,client_threads,connections,block_size,seconds,mib_per_sec"
+for threads in $THREADS; do
+    for connections in $CONNECTIONS; do
+        for size in $STREAM_SIZES; do
+            "$BIN_DIR/throughput_bench" "$threads" "$threads" "$connections" "$size" "$SECONDS_PER_RUN" 2>/dev/null
+        done
+    done
+done
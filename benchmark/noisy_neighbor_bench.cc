@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcController.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+
+using namespace network;
+
+/**
+ * 用法: noisy_neighbor_bench [work_us] [bulk_depth] [duration_sec]
+ *
+ * 服务端只有一个 IO 线程，Echo 在 IO 线程里占用 work_us 微秒 CPU。
+ * 两个客户端连接：
+ *   bulk        - 批量流量，始终保持 bulk_depth 个请求在途
+ *   interactive - 交互流量，同一时刻只有一个请求，每次返回后间隔 1ms 再发下一个
+ * 分三种模式各跑一遍（各自一个子进程）：
+ *   fifo     - 不开启调度，请求按解码顺序在 IO 线程里执行
+ *   drr      - 开启调度，两个连接同一优先级，只靠连接间的 DRR 隔离
+ *   priority - 开启调度，interactive 使用 PRIORITY_HIGH，bulk 使用 PRIORITY_LOW
+ * 输出交互请求的延迟分位、批量请求的吞吐，以及服务端每个 band 的平均排队时间。
+ */
+
+namespace {
+
+const uint16_t kPort = 9987;
+
+enum Mode { kFifo, kDrr, kPriority };
+const char *kModeNames[] = { "fifo", "drr", "priority" };
+
+int g_workUs = 50;
+int g_bulkDepth = 256;
+double g_durationSec = 3.0;
+Mode g_mode = kFifo;
+
+bench::BusyEchoService g_service;
+RpcServer *g_server = NULL;
+
+void configureServer(RpcServer *server) {
+    if (g_mode != kFifo) {
+        server->enableScheduling();
+    }
+}
+
+void startServer(EventLoop *loop) {
+    g_service.setWorkUs(g_workUs);
+    g_server = bench::startServer(loop, kPort, &g_service, configureServer);
+}
+
+class NoisyNeighborBench {
+public:
+    NoisyNeighborBench(EventLoop *loop, const InetAddress &serverAddr)
+        : loop_(loop),
+        bulkClient_(loop, serverAddr, "Bulk"),
+        interactiveClient_(loop, serverAddr, "Interactive"),
+        bulkChannel_(new RpcChannel),
+        interactiveChannel_(new RpcChannel),
+        bulkStub_(get_pointer(bulkChannel_)),
+        interactiveStub_(get_pointer(interactiveChannel_)),
+        connected_(0),
+        running_(false),
+        bulkDone_(0) {
+        bulkClient_.setConnectionCallback(
+            std::bind(&NoisyNeighborBench::onConnection, this, bulkChannel_, _1));
+        bulkClient_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(bulkChannel_), _1, _2));
+        interactiveClient_.setConnectionCallback(
+            std::bind(&NoisyNeighborBench::onConnection, this, interactiveChannel_, _1));
+        interactiveClient_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(interactiveChannel_), _1, _2));
+    }
+
+    void connect() {
+        bulkClient_.connect();
+        interactiveClient_.connect();
+    }
+
+private:
+    struct Call {
+        int64_t startUs;
+        RpcController controller;
+        bench::EchoResponse *response;
+    };
+
+    void onConnection(const RpcChannelPtr &channel, const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        channel->setConnection(conn);
+        if (++connected_ < 2) {
+            return;
+        }
+        running_ = true;
+        for (int i = 0; i < g_bulkDepth; ++i) {
+            sendBulk();
+        }
+        // 先让批量流量把服务端压满，再开始发交互请求
+        loop_->runAfter(0.2, std::bind(&NoisyNeighborBench::sendInteractive, this));
+        loop_->runAfter(g_durationSec, std::bind(&NoisyNeighborBench::report, this));
+    }
+
+    Call *newCall(Priority priority) {
+        Call *call = new Call;
+        call->startUs = getNowUs();
+        call->response = new bench::EchoResponse;
+        if (g_mode == kPriority) {
+            call->controller.setPriority(priority);
+        }
+        return call;
+    }
+
+    void sendBulk() {
+        bench::EchoRequest request;
+        request.set_payload(std::string(512, 'b'));
+        Call *call = newCall(PRIORITY_LOW);
+        bulkStub_.Echo(&call->controller, &request, call->response,
+                       ::google::protobuf::NewCallback(this, &NoisyNeighborBench::onBulkDone, call));
+    }
+
+    void onBulkDone(Call *call) {
+        delete call;
+        ++bulkDone_;
+        if (running_) {
+            sendBulk();
+        }
+    }
+
+    void sendInteractive() {
+        if (!running_) {
+            return;
+        }
+        bench::EchoRequest request;
+        request.set_payload("i");
+        Call *call = newCall(PRIORITY_HIGH);
+        interactiveStub_.Echo(
+            &call->controller, &request, call->response,
+            ::google::protobuf::NewCallback(this, &NoisyNeighborBench::onInteractiveDone, call));
+    }
+
+    void onInteractiveDone(Call *call) {
+        latencies_.push_back(getNowUs() - call->startUs);
+        delete call;
+        loop_->runAfter(0.001, std::bind(&NoisyNeighborBench::sendInteractive, this));
+    }
+
+    void report() {
+        running_ = false;
+        printf("[%s]\n", kModeNames[g_mode]);
+        printf("  interactive calls=%zu p50=%.2fms p99=%.2fms max=%.2fms\n", latencies_.size(),
+               bench::percentile(latencies_, 50) / 1000.0, bench::percentile(latencies_, 99) / 1000.0,
+               bench::percentile(latencies_, 100) / 1000.0);
+        printf("  bulk throughput=%.0f qps\n", bulkDone_ / g_durationSec);
+        std::vector<RequestScheduler::BandStats> bands = g_server->schedulerStats();
+        for (size_t i = 0; i < bands.size(); ++i) {
+            if (bands[i].executed > 0) {
+                printf("  band %zu executed=%ld mean_wait=%.2fms max_wait=%.2fms\n", i,
+                       bands[i].executed, bands[i].waitUsTotal / 1000.0 / bands[i].executed,
+                       bands[i].waitUsMax / 1000.0);
+            }
+        }
+        fflush(stdout);
+        loop_->quit();
+    }
+
+    EventLoop *loop_;
+    TcpClient bulkClient_;
+    TcpClient interactiveClient_;
+    RpcChannelPtr bulkChannel_;
+    RpcChannelPtr interactiveChannel_;
+    bench::BenchService::Stub bulkStub_;
+    bench::BenchService::Stub interactiveStub_;
+    int connected_;
+    bool running_;
+    int64_t bulkDone_;
+    std::vector<int64_t> latencies_;
+};
+
+void runBench() {
+    EventLoopThread serverThread(startServer, "NoisyNeighborServer");
+    serverThread.startLoop();
+
+    EventLoop loop;
+    NoisyNeighborBench bench(&loop, InetAddress("127.0.0.1", kPort));
+    bench.connect();
+    loop.loop();
+
+    // 结果已经输出，子进程直接退出，不等在途的批量请求
+    _exit(0);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_workUs = argc > 1 ? atoi(argv[1]) : 50;
+    g_bulkDepth = argc > 2 ? atoi(argv[2]) : 256;
+    g_durationSec = argc > 3 ? atof(argv[3]) : 3.0;
+
+    const Mode modes[] = { kFifo, kDrr, kPriority };
+    for (Mode mode : modes) {
+        bench::runInChild([mode]() {
+            g_mode = mode;
+            runBench();
+        });
+    }
+
+    google::protobuf::ShutdownProtobufLibrary();
+    return 0;
+}
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcController.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+
+using namespace network;
+
+/**
+ * 用法: overload_bench [workers] [service_us] [phase_sec] [slo_ms]
+ *
+ * 两种 handler，每个请求都占用 service_us 微秒：
+ *   async - Echo 交给 workers 个工作线程执行，服务端容量约为 workers * 1000000 / service_us QPS；
+ *   sync  - Echo 在 IO 线程里同步执行（默认写法），容量约为 1000000 / service_us QPS，
+ *           请求排在 socket 和 IO 线程里。开启限制时同时 enableScheduling，排队的请求才计入在途请求数。
+ * 客户端按容量的 50%、100%、150%、200%、250%、300% 逐级加压（开环，按固定速率发送），
+ * 每级持续 phase_sec 秒。每种 handler 不开启和开启自适应并发限制各跑一遍（各自一个子进程），
+ * 输出每一级的 goodput（slo_ms 以内成功返回的 QPS）、OVERLOADED 数和成功请求的延迟分位。
+ */
+
+namespace {
+
+const uint16_t kPort = 9986;
+const double kLoadSteps[] = { 0.5, 1.0, 1.5, 2.0, 2.5, 3.0 };
+const int kPhases = sizeof kLoadSteps / sizeof kLoadSteps[0];
+
+int g_workers = 4;
+int g_serviceUs = 1000;
+double g_phaseSec = 2.0;
+int g_sloMs = 100;
+
+/**
+ * 固定大小的工作线程池，模拟容量有限的后端；队列不设上限，没有并发限制时请求会在这里堆积
+ */
+class WorkerPool {
+public:
+    explicit WorkerPool(int n) {
+        for (int i = 0; i < n; ++i) {
+            threads_.emplace_back(std::bind(&WorkerPool::run, this));
+        }
+    }
+
+    void submit(std::function<void()> task) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+        cond_.notify_one();
+    }
+
+private:
+    void run() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this]() { return !tasks_.empty(); });
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+};
+
+WorkerPool *g_pool = NULL; // sync 模式下为 NULL
+
+class SlowEchoService : public bench::BenchService {
+public:
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        if (!g_pool) {
+            ::usleep(g_serviceUs);
+            response->set_payload("ok");
+            done->Run();
+            return;
+        }
+        g_pool->submit([response, done]() {
+            ::usleep(g_serviceUs);
+            response->set_payload("ok");
+            done->Run();
+        });
+    }
+};
+
+SlowEchoService g_service;
+RpcServer *g_server = NULL;
+bool g_sync = false;
+bool g_limit = false;
+
+void configureServer(RpcServer *server) {
+    if (g_limit) {
+        server->setConcurrencyLimit(ConcurrencyLimiterOptions());
+        if (g_sync) {
+            server->enableScheduling();
+        }
+    }
+}
+
+void startServer(EventLoop *loop) {
+    g_server = bench::startServer(loop, kPort, &g_service, configureServer);
+}
+
+struct PhaseResult {
+    int64_t sent = 0;
+    int64_t ok = 0;
+    int64_t overloaded = 0;
+    int64_t withinSlo = 0;
+    std::vector<int64_t> latencies;
+};
+
+/**
+ * 开环压测：每 1ms 按当前一级的目标速率发出若干请求，不等前面的请求返回。
+ * 每个请求的结果记在发出它的那一级上
+ */
+class OverloadBench {
+public:
+    OverloadBench(EventLoop *loop, const InetAddress &serverAddr, double capacityQps)
+        : loop_(loop),
+        client_(loop, serverAddr, "OverloadBench"),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)),
+        capacityQps_(capacityQps),
+        results_(kPhases),
+        phase_(0),
+        phaseStartUs_(0),
+        lastTickUs_(0),
+        credit_(0),
+        outstanding_(0),
+        tickTimer_(0) {
+        client_.setConnectionCallback(std::bind(&OverloadBench::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+    }
+
+    void connect() { client_.connect(); }
+
+private:
+    struct Call {
+        int phase;
+        int64_t startUs;
+        RpcController controller;
+        bench::EchoResponse *response;
+    };
+
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        channel_->setConnection(conn);
+        phaseStartUs_ = getNowUs();
+        lastTickUs_ = phaseStartUs_;
+        tickTimer_ = loop_->runEvery(0.001, std::bind(&OverloadBench::tick, this));
+    }
+
+    void tick() {
+        int64_t now = getNowUs();
+        if (now - phaseStartUs_ >= static_cast<int64_t>(g_phaseSec * 1000000)) {
+            if (++phase_ == kPhases) {
+                loop_->cancel(tickTimer_);
+                // 最后一级结束后最多再等 10 秒，让没有限制时堆积的请求返回
+                loop_->runAfter(10.0, std::bind(&OverloadBench::report, this));
+                return;
+            }
+            phaseStartUs_ = now;
+        }
+
+        // 按实际经过的时间累积额度，定时器晚到也不会降低发送速率
+        credit_ += capacityQps_ * kLoadSteps[phase_] * (now - lastTickUs_) / 1000000.0;
+        lastTickUs_ = now;
+        bench::EchoRequest request;
+        request.set_payload("x");
+        while (credit_ >= 1.0) {
+            credit_ -= 1.0;
+            Call *call = new Call;
+            call->phase = phase_;
+            call->startUs = now;
+            call->response = new bench::EchoResponse;
+            ++results_[phase_].sent;
+            ++outstanding_;
+            stub_.Echo(&call->controller, &request, call->response,
+                       ::google::protobuf::NewCallback(this, &OverloadBench::onDone, call));
+        }
+    }
+
+    void onDone(Call *call) {
+        std::unique_ptr<Call> d(call);
+        PhaseResult &result = results_[call->phase];
+        if (call->controller.errorCode() == OVERLOADED) {
+            ++result.overloaded;
+        } else if (!call->controller.Failed()) {
+            int64_t latencyUs = getNowUs() - call->startUs;
+            ++result.ok;
+            result.latencies.push_back(latencyUs);
+            if (latencyUs <= g_sloMs * 1000) {
+                ++result.withinSlo;
+            }
+        }
+        if (--outstanding_ == 0 && phase_ == kPhases) {
+            report();
+        }
+    }
+
+    void report() {
+        ConcurrencyLimiter::Stats limiter = g_server->concurrencyLimiterStats();
+        printf("[%s, %s] capacity=%.0f qps, slo=%dms\n", g_sync ? "sync" : "async",
+               g_limit ? "adaptive limit" : "no limit", capacityQps_, g_sloMs);
+        printf("  %-6s %9s %9s %9s %11s %9s %9s\n",
+               "load", "offered", "goodput", "ok", "overloaded", "p50(ms)", "p99(ms)");
+        for (int i = 0; i < kPhases; ++i) {
+            PhaseResult &r = results_[i];
+            printf("  %5.0f%% %9.0f %9.0f %9ld %11ld %9.1f %9.1f\n",
+                   kLoadSteps[i] * 100, r.sent / g_phaseSec, r.withinSlo / g_phaseSec,
+                   r.ok, r.overloaded, bench::percentile(r.latencies, 50) / 1000.0,
+                   bench::percentile(r.latencies, 99) / 1000.0);
+        }
+        if (g_limit) {
+            printf("  final limit=%ld no_load_rtt=%.2fms\n", limiter.limit,
+                   limiter.noLoadRttUs / 1000.0);
+        }
+        fflush(stdout);
+        loop_->quit();
+    }
+
+    EventLoop *loop_;
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+    const double capacityQps_;
+    std::vector<PhaseResult> results_;
+    int phase_;
+    int64_t phaseStartUs_;
+    int64_t lastTickUs_;
+    double credit_;
+    int64_t outstanding_;
+    TimerId tickTimer_;
+};
+
+void runBench() {
+    if (!g_sync) {
+        g_pool = new WorkerPool(g_workers);
+    }
+    EventLoopThread serverThread(startServer, "OverloadBenchServer");
+    serverThread.startLoop();
+
+    EventLoop loop;
+    OverloadBench bench(&loop, InetAddress("127.0.0.1", kPort),
+                        (g_sync ? 1 : g_workers) * 1000000.0 / g_serviceUs);
+    bench.connect();
+    loop.loop();
+
+    // 结果已经输出，工作线程不会退出，子进程直接结束
+    _exit(0);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_workers = argc > 1 ? atoi(argv[1]) : 4;
+    g_serviceUs = argc > 2 ? atoi(argv[2]) : 1000;
+    g_phaseSec = argc > 3 ? atof(argv[3]) : 2.0;
+    g_sloMs = argc > 4 ? atoi(argv[4]) : 100;
+
+    const bool modes[] = { false, true };
+    for (bool sync : modes) {
+        for (bool limit : modes) {
+            bench::runInChild([sync, limit]() {
+                g_sync = sync;
+                g_limit = limit;
+                runBench();
+            });
+        }
+    }
+
+    google::protobuf::ShutdownProtobufLibrary();
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/Buffer.h"
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/EventLoopThreadPool.h"
+#include "network/InetAddress.h"
+#include "network/Metrics.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/TcpServer.h"
+#include "network/util.h"
+
+using namespace network;
+
+/**
+ * 用法: pingpong_bench [server_threads] [client_threads] [sessions] [block_size] [seconds]
+ *
+ * 只用网络层（TcpServer / TcpClient / EventLoopThreadPool），不经过 rpc_framework，
+ * 仿照 muduo 的 pingpong 测试：服务端把收到的数据原样写回，客户端建立 sessions 条连接，
+ * 分布在 client_threads 个 loop 上，每条连接发出 block_size 字节，收齐回显之后立即再发下一块。
+ *   - sessions=1 时测的是单条连接的往返延迟；
+ *   - sessions 很大时就是多连接 echo，看服务端 server_threads 个 IO 线程的扩展性。
+ * 所有连接建立之后计时 seconds 秒，往返次数和延迟记在 MetricsRegistry 里，结束时取两次快照的差。
+ * 输出一行 CSV：
+ *   pingpong,server_threads,client_threads,sessions,block_size,seconds,msgs_per_sec,mib_per_sec,p50_us,p99_us,p999_us
+ * 表头和参数扫描见 net_sweep.sh
+ */
+
+namespace {
+
+const uint16_t kPort = 9994;
+
+int g_serverThreads = 1;
+int g_clientThreads = 1;
+int g_sessions = 1;
+int g_blockSize = 1024;
+double g_durationSec = 5.0;
+
+Histogram *const g_rtt = MetricsRegistry::instance().histogram("pingpong.rtt_us");
+
+// 进程退出时不析构，避免在 server loop 线程之外销毁 TcpServer
+TcpServer *g_server = NULL;
+
+void onServerMessage(const TcpConnectionPtr &conn, Buffer *buf) {
+    conn->send(buf);
+}
+
+void onServerConnection(const TcpConnectionPtr &conn) {
+    if (conn->connected()) {
+        conn->setTcpNoDelay(true);
+    }
+}
+
+void startServer(EventLoop *loop) {
+    g_server = new TcpServer(loop, InetAddress(kPort), "PingpongServer");
+    g_server->setThreadNum(g_serverThreads);
+    g_server->setConnectionCallback(onServerConnection);
+    g_server->setMessageCallback(onServerMessage);
+    g_server->start();
+}
+
+class PingpongClient;
+
+/**
+ * 一条连接：同一时刻只有一块数据在途，收齐 block_size 字节算一次往返
+ */
+class Session {
+public:
+    Session(EventLoop *loop, const InetAddress &serverAddr, const std::string &name,
+            PingpongClient *owner)
+        : client_(loop, serverAddr, name),
+        owner_(owner),
+        sentUs_(0) {
+        client_.setConnectionCallback(std::bind(&Session::onConnection, this, _1));
+        client_.setMessageCallback(std::bind(&Session::onMessage, this, _1, _2));
+    }
+
+    void start() { client_.connect(); }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn);
+
+    void onMessage(const TcpConnectionPtr &conn, Buffer *buf) {
+        if (buf->readableBytes() < static_cast<size_t>(g_blockSize)) {
+            return;
+        }
+        buf->retrieve(g_blockSize);
+        int64_t now = getNowUs();
+        g_rtt->record(now - sentUs_);
+        sendBlock(conn);
+    }
+
+    void sendBlock(const TcpConnectionPtr &conn);
+
+    TcpClient client_;
+    PingpongClient *owner_;
+    int64_t sentUs_;
+};
+
+/**
+ * 客户端：主线程的 loop 只负责计时，连接分布在 client_threads 个 loop 线程上
+ */
+class PingpongClient {
+public:
+    PingpongClient(EventLoop *loop, const InetAddress &serverAddr)
+        : loop_(loop),
+        threadPool_(loop, "PingpongClient"),
+        message_(g_blockSize, 'p'),
+        connected_(0) {
+        threadPool_.setThreadNum(g_clientThreads);
+        threadPool_.start();
+        for (int i = 0; i < g_sessions; ++i) {
+            sessions_.emplace_back(new Session(threadPool_.getNextLoop(), serverAddr,
+                                               "session" + std::to_string(i), this));
+        }
+    }
+
+    void start() {
+        for (std::unique_ptr<Session> &session : sessions_) {
+            session->start();
+        }
+    }
+
+    const std::string &message() const { return message_; }
+
+    // 在各个 client loop 线程里调用
+    void onConnected() {
+        if (connected_.fetch_add(1) + 1 == g_sessions) {
+            loop_->runInLoop(std::bind(&PingpongClient::startTiming, this));
+        }
+    }
+
+private:
+    void startTiming() {
+        before_ = MetricsRegistry::instance().snapshot();
+        loop_->runAfter(g_durationSec, std::bind(&PingpongClient::finish, this));
+    }
+
+    void finish() {
+        MetricsSnapshot delta = MetricsRegistry::instance().snapshot().diff(before_);
+        const LogLinearHistogram::Snapshot &rtt = delta.histograms["pingpong.rtt_us"];
+        double seconds = delta.timestampUs / 1000000.0;
+        double msgsPerSec = rtt.count / seconds;
+        printf("pingpong,%d,%d,%d,%d,%.1f,%.0f,%.2f,%ld,%ld,%ld\n", g_serverThreads,
+               g_clientThreads, g_sessions, g_blockSize, seconds, msgsPerSec,
+               msgsPerSec * g_blockSize / (1024.0 * 1024.0), rtt.percentile(50),
+               rtt.percentile(99), rtt.percentile(99.9));
+        fflush(stdout);
+        loop_->quit();
+    }
+
+    EventLoop *loop_;
+    EventLoopThreadPool threadPool_;
+    std::vector<std::unique_ptr<Session>> sessions_;
+    const std::string message_;
+    std::atomic<int> connected_;
+    MetricsSnapshot before_;
+};
+
+void Session::onConnection(const TcpConnectionPtr &conn) {
+    if (!conn->connected()) {
+        return;
+    }
+    conn->setTcpNoDelay(true);
+    owner_->onConnected();
+    sendBlock(conn);
+}
+
+void Session::sendBlock(const TcpConnectionPtr &conn) {
+    Buffer buf;
+    buf.append(owner_->message());
+    sentUs_ = getNowUs();
+    conn->send(&buf);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_serverThreads = argc > 1 ? atoi(argv[1]) : 1;
+    g_clientThreads = argc > 2 ? atoi(argv[2]) : 1;
+    g_sessions = argc > 3 ? atoi(argv[3]) : 1;
+    g_blockSize = argc > 4 ? atoi(argv[4]) : 1024;
+    g_durationSec = argc > 5 ? atof(argv[5]) : 5.0;
+
+    EventLoopThread serverThread(startServer, "PingpongServer");
+    serverThread.startLoop();
+
+    EventLoop loop;
+    PingpongClient client(&loop, InetAddress("127.0.0.1", kPort));
+    client.start();
+    loop.loop();
+
+    // 结果已经输出，直接退出，不等各个 loop 线程
+    _exit(0);
+}
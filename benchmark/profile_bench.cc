@@ -0,0 +1,215 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+#include "rpc_stats.pb.h"
+
+using namespace network;
+
+/**
+ * 用法: profile_bench [duration_sec] [frequency_hz] [output_file]
+ *
+ * 服务端的 Echo 在 IO 线程里做一段 CPU 计算（hashPayload）。客户端单连接顺序调用 Echo：
+ *   1. 先不采样跑 duration_sec 秒，记录吞吐；
+ *   2. 再通过内置的 RpcStatsService.CpuProfile（服务端 enableProfiling）对服务端采样 duration_sec 秒，同时继续调用 Echo，
+ *      记录采样期间的吞吐。
+ * 输出两段的吞吐、采样方式和样本数、按最内层函数汇总的前 10 名，
+ * collapsed 格式的完整结果写到 output_file（默认 /tmp/profile_bench.folded），可以直接交给 flamegraph.pl。
+ */
+
+namespace {
+
+const uint16_t kPort = 9993;
+
+int g_durationSec = 2;
+int g_frequencyHz = 99;
+std::string g_outputFile = "/tmp/profile_bench.folded";
+
+// 不内联，采样结果里应该占大部分样本
+__attribute__((noinline)) uint64_t hashPayload(const std::string &payload, int rounds) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int round = 0; round < rounds; ++round) {
+        for (char c : payload) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+class BusyEchoService : public bench::BenchService {
+public:
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        uint64_t hash = hashPayload(request->payload(), 200);
+        response->set_payload(std::string(reinterpret_cast<const char *>(&hash), sizeof hash));
+        done->Run();
+    }
+};
+
+BusyEchoService g_service;
+
+void startServer(EventLoop *loop) {
+    bench::startServer(loop, kPort, &g_service, [](RpcServer *server) { server->enableProfiling(); });
+}
+
+class ProfileClient {
+public:
+    ProfileClient(EventLoop *loop, const InetAddress &serverAddr)
+        : loop_(loop),
+        client_(loop, serverAddr, "ProfileClient"),
+        channel_(new RpcChannel),
+        echoStub_(get_pointer(channel_)),
+        statsStub_(get_pointer(channel_)),
+        completed_(0),
+        phaseStartUs_(0),
+        baselineQps_(0) {
+        client_.setConnectionCallback(std::bind(&ProfileClient::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+        request_.set_payload(std::string(1024, 'x'));
+    }
+
+    void connect() { client_.connect(); }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        channel_->setConnection(conn);
+        phaseStartUs_ = getNowUs();
+        loop_->runAfter(g_durationSec, std::bind(&ProfileClient::startProfile, this));
+        sendEcho();
+    }
+
+    void sendEcho() {
+        echoStub_.Echo(NULL, &request_, new bench::EchoResponse,
+                       ::google::protobuf::NewCallback(this, &ProfileClient::onEcho));
+    }
+
+    void onEcho() {
+        ++completed_;
+        sendEcho();
+    }
+
+    double takeQps() {
+        int64_t now = getNowUs();
+        double qps = completed_ * 1000000.0 / (now - phaseStartUs_);
+        completed_ = 0;
+        phaseStartUs_ = now;
+        return qps;
+    }
+
+    void startProfile() {
+        baselineQps_ = takeQps();
+        CpuProfileRequest request;
+        request.set_duration_sec(g_durationSec);
+        request.set_frequency_hz(g_frequencyHz);
+        CpuProfileResponse *response = new CpuProfileResponse;
+        statsStub_.CpuProfile(NULL, &request, response,
+                              ::google::protobuf::NewCallback(this, &ProfileClient::onProfile,
+                                                              response));
+    }
+
+    void onProfile(CpuProfileResponse *response) {
+        double profiledQps = takeQps();
+        printf("echo qps without profiling: %.0f\n", baselineQps_);
+        printf("echo qps while profiling:   %.0f\n", profiledQps);
+        if (!response->error().empty()) {
+            printf("profile failed: %s\n", response->error().c_str());
+        } else {
+            printf("sampler %s, %d threads, %lld samples, %lld dropped\n",
+                   response->sampler().c_str(), response->threads(),
+                   static_cast<long long>(response->samples()),
+                   static_cast<long long>(response->dropped()));
+            printTopFunctions(response->collapsed_stacks());
+
+            FILE *file = ::fopen(g_outputFile.c_str(), "w");
+            if (file) {
+                ::fputs(response->collapsed_stacks().c_str(), file);
+                ::fclose(file);
+                printf("collapsed stacks written to %s\n", g_outputFile.c_str());
+            }
+        }
+        fflush(stdout);
+        loop_->quit();
+    }
+
+    // 按每行最后一帧（最内层函数）汇总样本数
+    static void printTopFunctions(const std::string &collapsed) {
+        std::map<std::string, int64_t> leaves;
+        int64_t total = 0;
+        std::istringstream lines(collapsed);
+        std::string line;
+        while (std::getline(lines, line)) {
+            std::string::size_type space = line.rfind(' ');
+            if (space == std::string::npos) {
+                continue;
+            }
+            int64_t count = atoll(line.c_str() + space + 1);
+            std::string stack = line.substr(0, space);
+            std::string::size_type semicolon = stack.rfind(';');
+            leaves[stack.substr(semicolon == std::string::npos ? 0 : semicolon + 1)] += count;
+            total += count;
+        }
+        std::vector<std::pair<int64_t, std::string>> sorted;
+        for (const std::pair<const std::string, int64_t> &leaf : leaves) {
+            sorted.push_back(std::make_pair(leaf.second, leaf.first));
+        }
+        std::sort(sorted.rbegin(), sorted.rend());
+        for (size_t i = 0; i < sorted.size() && i < 10; ++i) {
+            printf("  %5.1f%%  %s\n", sorted[i].first * 100.0 / total,
+                   sorted[i].second.substr(0, 100).c_str());
+        }
+    }
+
+    EventLoop *loop_;
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub echoStub_;
+    RpcStatsService::Stub statsStub_;
+    bench::EchoRequest request_;
+    int64_t completed_;
+    int64_t phaseStartUs_;
+    double baselineQps_;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_durationSec = argc > 1 ? atoi(argv[1]) : 2;
+    g_frequencyHz = argc > 2 ? atoi(argv[2]) : 99;
+    if (argc > 3) {
+        g_outputFile = argv[3];
+    }
+
+    EventLoopThread serverThread(startServer, "ProfileServer");
+    serverThread.startLoop();
+
+    EventLoop loop;
+    ProfileClient client(&loop, InetAddress("127.0.0.1", kPort));
+    client.connect();
+    loop.loop();
+
+    // 结果已经输出，直接退出，不等服务端线程
+    _exit(0);
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/EventLoopThreadPool.h"
+#include "network/InetAddress.h"
+#include "network/Metrics.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcServer.h"
+#include "bench.pb.h"
+
+using namespace network;
+
+/**
+ * 用法: service_bench [server_threads] [client_threads] [connections] [counters_per_call] [seconds]
+ *
+ * 计数密集的 handler 在两种注册方式下的吞吐：
+ *   shared     - registerService 注册一个实例，所有 IO 线程共用，handler 里用互斥锁保护计数表；
+ *   per_thread - registerServiceFactory 给每个 IO 线程一个实例，handler 不加锁。
+ * 每次调用按请求里的 key 更新 counters_per_call 个计数槽（64K 个槽，512 KiB）。客户端建立 connections
+ * 条连接，分布在 client_threads 个 loop 上，每条连接保持 kPipeline 个请求在途，计时 seconds 秒。
+ * 每种模式输出一行 CSV：
+ *   mode,server_threads,client_threads,connections,counters_per_call,seconds,calls_per_sec,instances
+ * 停止发送、在途请求都返回之后，再核对所有实例的计数总和和客户端收到的响应数是否一致。
+ * 多核机器上 shared 模式的锁和计数表所在的缓存行在核之间来回传递；核数少于 IO 线程数时
+ * 看不到争用，只剩下加解锁本身的开销
+ */
+
+namespace {
+
+const uint16_t kSharedPort = 9998;
+const uint16_t kPerThreadPort = 9999;
+const int kPipeline = 8;
+const int kCounterSlotBits = 16;
+
+int g_serverThreads = 4;
+int g_clientThreads = 2;
+int g_connections = 16;
+int g_countersPerCall = 64;
+double g_durationSec = 3.0;
+
+Counter *const g_calls = MetricsRegistry::instance().counter("service_bench.calls");
+
+std::atomic<bool> g_running(false);
+std::atomic<int> g_connected(0);
+
+/**
+ * 每次调用用请求里的 key 做种子，依次更新 counters_per_call 个伪随机的计数槽。
+ * locked 为 true 时整个更新过程持有互斥锁（shared 模式），否则只有一个线程访问（per_thread 模式）
+ */
+class CountingService : public bench::BenchService {
+public:
+    explicit CountingService(bool locked)
+        : locked_(locked), counts_(1 << kCounterSlotBits, 0), total_(0) {}
+
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        uint64_t key = 0;
+        const std::string &payload = request->payload();
+        memcpy(&key, payload.data(), std::min(sizeof key, payload.size()));
+        if (locked_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            count(key);
+        } else {
+            count(key);
+        }
+        done->Run();
+    }
+
+    // 只在没有请求在处理时读取
+    int64_t total() const { return total_; }
+
+private:
+    void count(uint64_t key) {
+        for (int i = 0; i < g_countersPerCall; ++i) {
+            key = key * 6364136223846793005ULL + 1442695040888963407ULL;
+            ++counts_[key >> (64 - kCounterSlotBits)];
+        }
+        total_ += g_countersPerCall;
+    }
+
+    const bool locked_;
+    std::mutex mutex_;
+    std::vector<int64_t> counts_;
+    int64_t total_;
+};
+
+CountingService g_sharedService(true);
+
+std::mutex g_instancesMutex;
+std::vector<CountingService *> g_perThreadInstances; // 实例归 RpcServer 所有
+
+::google::protobuf::Service *newPerThreadService() {
+    CountingService *service = new CountingService(false);
+    std::lock_guard<std::mutex> lock(g_instancesMutex);
+    g_perThreadInstances.push_back(service);
+    return service;
+}
+
+// 两个 server 都在同一个 loop 线程里创建，进程退出时不析构
+void startServers(EventLoop *loop) {
+    RpcServer *shared = new RpcServer(loop, InetAddress(kSharedPort));
+    shared->setThreadNum(g_serverThreads);
+    shared->registerService(&g_sharedService);
+    shared->start();
+
+    RpcServer *perThread = new RpcServer(loop, InetAddress(kPerThreadPort));
+    perThread->setThreadNum(g_serverThreads);
+    perThread->registerServiceFactory(newPerThreadService);
+    perThread->start();
+}
+
+// 一条连接，保持 kPipeline 个 Echo 在途，g_running 变成 false 后不再补发
+class Connection {
+public:
+    Connection(EventLoop *loop, const InetAddress &serverAddr, const std::string &name, uint64_t seed)
+        : client_(loop, serverAddr, name),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)),
+        key_(seed) {
+        client_.setConnectionCallback(std::bind(&Connection::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+    }
+
+    void start() { client_.connect(); }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        conn->setTcpNoDelay(true);
+        channel_->setConnection(conn);
+        ++g_connected;
+        for (int i = 0; i < kPipeline; ++i) {
+            sendEcho();
+        }
+    }
+
+    void sendEcho() {
+        if (!g_running.load(std::memory_order_relaxed)) {
+            return;
+        }
+        key_ = key_ * 2862933555777941757ULL + 3037000493ULL;
+        bench::EchoRequest request;
+        request.set_payload(std::string(reinterpret_cast<const char *>(&key_), sizeof key_));
+        bench::EchoResponse *response = new bench::EchoResponse;
+        stub_.Echo(NULL, &request, response,
+                   ::google::protobuf::NewCallback(this, &Connection::onResponse));
+    }
+
+    void onResponse() {
+        g_calls->inc();
+        sendEcho();
+    }
+
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+    uint64_t key_;
+};
+
+int64_t calls() {
+    return MetricsRegistry::instance().snapshot().counters["service_bench.calls"];
+}
+
+/**
+ * 连上 port 上的 server，所有连接建立后预热 0.5 秒再计时。结束后停止补发，等在途请求返回，
+ * 返回这一轮客户端收到的响应总数。连接对象不析构，之后一直空闲
+ */
+int64_t runMode(EventLoopThreadPool *pool, const char *mode, uint16_t port, int instances) {
+    int64_t callsBefore = calls();
+    g_connected = 0;
+    g_running = true;
+    for (int i = 0; i < g_connections; ++i) {
+        Connection *conn = new Connection(pool->getNextLoop(), InetAddress("127.0.0.1", port),
+                                          std::string("ServiceBench-") + mode, i + 1);
+        conn->start();
+    }
+    while (g_connected < g_connections) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    MetricsSnapshot before = MetricsRegistry::instance().snapshot();
+    std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(g_durationSec * 1000)));
+    MetricsSnapshot after = MetricsRegistry::instance().snapshot();
+    printf("%s,%d,%d,%d,%d,%.1f,%.0f,%d\n", mode, g_serverThreads, g_clientThreads,
+           g_connections, g_countersPerCall, (after.timestampUs - before.timestampUs) / 1e6,
+           after.rate("service_bench.calls", before), instances);
+    fflush(stdout);
+
+    g_running = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    return calls() - callsBefore;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_serverThreads = argc > 1 ? atoi(argv[1]) : 4;
+    g_clientThreads = argc > 2 ? atoi(argv[2]) : 2;
+    g_connections = argc > 3 ? atoi(argv[3]) : 16;
+    g_countersPerCall = argc > 4 ? atoi(argv[4]) : 64;
+    g_durationSec = argc > 5 ? atof(argv[5]) : 3.0;
+
+    EventLoopThread serverThread(startServers, "ServiceBenchServer");
+    serverThread.startLoop();
+
+    // 只作为客户端线程池的 base loop，不运行
+    EventLoop loop;
+    EventLoopThreadPool pool(&loop, "ServiceBenchClient");
+    pool.setThreadNum(g_clientThreads);
+    pool.start();
+
+    printf("mode,server_threads,client_threads,connections,counters_per_call,seconds,"
+           "calls_per_sec,instances\n");
+    int64_t sharedCalls = runMode(&pool, "shared", kSharedPort, 1);
+    int64_t perThreadCalls = runMode(&pool, "per_thread", kPerThreadPort,
+                                     static_cast<int>(g_perThreadInstances.size()));
+
+    int64_t perThreadTotal = 0;
+    for (CountingService *service : g_perThreadInstances) {
+        perThreadTotal += service->total();
+    }
+    printf("check: shared %s (%lld calls), per_thread %s (%lld calls over %zu instances)\n",
+           g_sharedService.total() == sharedCalls * g_countersPerCall ? "ok" : "MISMATCH",
+           static_cast<long long>(sharedCalls),
+           perThreadTotal == perThreadCalls * g_countersPerCall ? "ok" : "MISMATCH",
+           static_cast<long long>(perThreadCalls), g_perThreadInstances.size());
+    fflush(stdout);
+
+    // 结果已经输出，直接退出，不等各个 loop 线程
+    _exit(0);
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcServer.h"
+#include "rpc_framework/RpcStats.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+#include "rpc_stats.pb.h"
+
+using namespace network;
+
+/**
+ * 用法: stats_bench [iterations] [max_threads]
+ *
+ * 1. 单线程连续调用 RpcStats::record iterations 次，输出每次记录的平均开销；
+ *    再加上服务端每次调用实际多出的两次取时间，输出总开销。
+ * 2. 1、2、4 ... max_threads 个线程同时记录同一个方法，输出每个线程每次记录的开销（按线程 CPU 时间），
+ *    分片是线程私有的，线程数增加时开销应该基本不变。
+ * 开销按线程 CPU 时间计算。数字只在优化编译（-O2）下有意义。
+ * 3. 合并所有分片做一次快照的耗时。
+ * 4. 起一个 RpcServer，发若干 Echo 之后通过内置的 RpcStatsService 查询并打印统计。
+ */
+
+namespace {
+
+const uint16_t kPort = 9989;
+
+const ::google::protobuf::MethodDescriptor *echoMethod() {
+    return bench::BenchService::descriptor()->FindMethodByName("Echo");
+}
+
+// 本线程消耗的 CPU 时间，线程数超过核数时也能反映单次记录的真实开销
+int64_t threadCpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+double recordLoop(int64_t iterations, bool withClock) {
+    const ::google::protobuf::MethodDescriptor *method = echoMethod();
+    RpcStats &stats = RpcStats::instance();
+    int64_t start = threadCpuNs();
+    for (int64_t i = 0; i < iterations; ++i) {
+        int64_t latencyUs = (i * 7919) & 0xffff;
+        if (withClock) {
+            int64_t begin = getNowUs();
+            latencyUs += getNowUs() - begin;
+        }
+        stats.record(RpcStats::kServer, method, (i & 1023) == 0 ? OVERLOADED : NO_ERROR,
+                     latencyUs, 64 + (i & 255), 128 + (i & 1023));
+    }
+    return static_cast<double>(threadCpuNs() - start) / iterations;
+}
+
+void benchRecord(int64_t iterations, int maxThreads) {
+    recordLoop(iterations / 10, false); // 预热，创建本线程的分片
+    printf("record only:          %.1f ns/call\n", recordLoop(iterations, false));
+    printf("record + 2 clock reads: %.1f ns/call\n", recordLoop(iterations, true));
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        std::vector<double> costs(threads);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&costs, t, iterations]() {
+                costs[t] = recordLoop(iterations, false);
+            });
+        }
+        double total = 0;
+        for (int t = 0; t < threads; ++t) {
+            workers[t].join();
+            total += costs[t];
+        }
+        printf("%2d threads:           %.1f ns/call per thread\n", threads, total / threads);
+    }
+
+    int64_t start = getNowUs();
+    std::vector<RpcStats::MethodSnapshot> snapshot = RpcStats::instance().snapshot();
+    printf("snapshot of %zu entries: %.1f us\n", snapshot.size(),
+           static_cast<double>(getNowUs() - start));
+}
+
+class EchoServiceImpl : public bench::BenchService {
+public:
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        response->set_payload(std::string(request->response_size(), 'r'));
+        done->Run();
+    }
+};
+
+EchoServiceImpl g_service;
+
+void startServer(EventLoop *loop) {
+    bench::startServer(loop, kPort, &g_service);
+}
+
+class StatsClient {
+public:
+    StatsClient(EventLoop *loop, const InetAddress &serverAddr)
+        : loop_(loop),
+        client_(loop, serverAddr, "StatsClient"),
+        channel_(new RpcChannel),
+        echoStub_(get_pointer(channel_)),
+        statsStub_(get_pointer(channel_)),
+        remaining_(1000) {
+        client_.setConnectionCallback(std::bind(&StatsClient::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+    }
+
+    void connect() { client_.connect(); }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        channel_->setConnection(conn);
+        sendEcho();
+    }
+
+    void sendEcho() {
+        bench::EchoRequest request;
+        request.set_payload(std::string(remaining_ % 512, 'x'));
+        request.set_response_size(remaining_ % 4096);
+        echoStub_.Echo(NULL, &request, new bench::EchoResponse,
+                       ::google::protobuf::NewCallback(this, &StatsClient::onEcho));
+    }
+
+    void onEcho() {
+        if (--remaining_ > 0) {
+            sendEcho();
+            return;
+        }
+        GetStatsRequest request;
+        request.set_method_prefix("bench.");
+        GetStatsResponse *response = new GetStatsResponse;
+        statsStub_.GetStats(NULL, &request, response,
+                            ::google::protobuf::NewCallback(this, &StatsClient::onStats, response));
+    }
+
+    void onStats(GetStatsResponse *response) {
+        printf("%s", response->DebugString().c_str());
+        fflush(stdout);
+        loop_->quit();
+    }
+
+    EventLoop *loop_;
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub echoStub_;
+    RpcStatsService::Stub statsStub_;
+    int remaining_;
+};
+
+void runIntrospection() {
+    EventLoopThread serverThread(startServer, "StatsServer");
+    serverThread.startLoop();
+
+    EventLoop loop;
+    StatsClient client(&loop, InetAddress("127.0.0.1", kPort));
+    client.connect();
+    loop.loop();
+
+    // 结果已经输出，直接退出，不等服务端线程
+    _exit(0);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    int64_t iterations = argc > 1 ? atoll(argv[1]) : 10000000;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : 8;
+
+    benchRecord(iterations, maxThreads);
+    runIntrospection();
+    return 0;
+}
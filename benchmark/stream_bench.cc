@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <glog/logging.h>
+#include <google/protobuf/descriptor.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcServer.h"
+#include "rpc_framework/RpcStream.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+
+using namespace network;
+
+/**
+ * 用法: stream_bench [rows] [row_size] [rows_per_chunk]
+ *
+ * 分别在两个子进程里测试同一份结果集的两种返回方式，每个子进程里 server 和 client 各占一个线程：
+ *   unary  - FetchAll 把全部行放进一个 RowsResponse 返回
+ *   stream - FetchStream 每次返回 rows_per_chunk 行，受流量控制的额度约束
+ * 输出首字节时间（unary 是整个响应到达的时间）、总耗时和进程的峰值 RSS（VmHWM）。
+ * 默认参数下单个响应约 40 MiB，仍在 kMaxMessageLen（64 MiB）以内。
+ */
+
+namespace {
+
+const uint16_t kPort = 9984;
+
+class RowsService : public bench::BenchService {
+public:
+    void FetchAll(::google::protobuf::RpcController *controller,
+                  const ::bench::RowsRequest *request,
+                  ::bench::RowsResponse *response,
+                  ::google::protobuf::Closure *done) override {
+        std::string row(request->row_size(), 'r');
+        for (int i = 0; i < request->rows(); ++i) {
+            response->add_rows(row);
+        }
+        done->Run();
+    }
+};
+
+/**
+ * FetchStream 的服务端：收到请求后只在流可写时生产下一批，
+ * 额度用完就停下来等 writable 回调，server 端同一时刻最多缓存一个窗口的数据
+ */
+class RowsProducer {
+public:
+    static void handle(const RpcStreamPtr &stream) {
+        std::shared_ptr<RowsProducer> producer(new RowsProducer);
+        stream->setMessageCallback(
+            std::bind(&RowsProducer::onRequest, producer, _1, _2));
+        stream->setWritableCallback(std::bind(&RowsProducer::produce, producer, _1));
+    }
+
+private:
+    void onRequest(const RpcStreamPtr &stream, const RpcStream::MessagePtr &message) {
+        request_.CopyFrom(*message);
+        sent_ = 0;
+        produce(stream);
+    }
+
+    void produce(const RpcStreamPtr &stream) {
+        std::string row(request_.row_size(), 'r');
+        while (stream->writable() && sent_ < request_.rows()) {
+            bench::RowsResponse chunk;
+            for (int i = 0; i < request_.rows_per_chunk() && sent_ < request_.rows(); ++i, ++sent_) {
+                chunk.add_rows(row);
+            }
+            stream->write(chunk);
+        }
+        if (sent_ >= request_.rows()) {
+            stream->closeSend();
+        }
+    }
+
+    bench::RowsRequest request_;
+    int sent_ = 0;
+};
+
+RowsService g_service;
+
+void configureServer(RpcServer *server) {
+    RpcMethodOptions options;
+    options.streamHandler = &RowsProducer::handle;
+    server->setMethodOptions("bench.BenchService.FetchStream", options);
+}
+
+void startServer(EventLoop *loop) {
+    bench::startServer(loop, kPort, &g_service, configureServer);
+}
+
+// 进程的峰值 RSS，单位 KiB
+long peakRssKb() {
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (!fp) {
+        return -1;
+    }
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof line, fp)) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            kb = atol(line + 6);
+            break;
+        }
+    }
+    fclose(fp);
+    return kb;
+}
+
+class StreamBench {
+public:
+    StreamBench(EventLoop *loop, const InetAddress &serverAddr, bool streaming,
+                const bench::RowsRequest &request)
+        : loop_(loop),
+        client_(loop, serverAddr, "StreamBench"),
+        channel_(new RpcChannel),
+        streaming_(streaming),
+        request_(request),
+        startUs_(0),
+        firstByteUs_(0),
+        rows_(0) {
+        client_.setConnectionCallback(std::bind(&StreamBench::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+    }
+
+    void connect() { client_.connect(); }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        channel_->setConnection(conn);
+        startUs_ = getNowUs();
+        if (streaming_) {
+            const ::google::protobuf::MethodDescriptor *method =
+                bench::BenchService::descriptor()->FindMethodByName("FetchStream");
+            RpcStreamPtr stream = channel_->openStream(
+                method,
+                std::bind(&StreamBench::onChunk, this, _1, _2),
+                std::bind(&StreamBench::onStreamClose, this, _1, _2));
+            stream->write(request_);
+            stream->closeSend();
+        } else {
+            bench::RowsResponse *response = new bench::RowsResponse;
+            bench::BenchService::Stub stub(get_pointer(channel_));
+            stub.FetchAll(NULL, &request_, response,
+                          ::google::protobuf::NewCallback(this, &StreamBench::onResponse, response));
+        }
+    }
+
+    void onResponse(bench::RowsResponse *response) {
+        firstByteUs_ = getNowUs();
+        rows_ = response->rows_size();
+        report();
+    }
+
+    void onChunk(const RpcStreamPtr &, const RpcStream::MessagePtr &message) {
+        if (firstByteUs_ == 0) {
+            firstByteUs_ = getNowUs();
+        }
+        rows_ += static_cast<const bench::RowsResponse &>(*message).rows_size();
+    }
+
+    void onStreamClose(const RpcStreamPtr &, ErrorCode status) {
+        if (status != NO_ERROR) {
+            LOG(ERROR) << "stream closed with error " << status;
+        }
+        report();
+    }
+
+    void report() {
+        int64_t now = getNowUs();
+        printf("%-6s rows=%d first_byte=%.2fms total=%.2fms peak_rss=%ldKiB\n",
+               streaming_ ? "stream" : "unary", rows_,
+               (firstByteUs_ - startUs_) / 1000.0, (now - startUs_) / 1000.0, peakRssKb());
+        fflush(stdout);
+        loop_->quit();
+    }
+
+    EventLoop *loop_;
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    const bool streaming_;
+    bench::RowsRequest request_;
+    int64_t startUs_;
+    int64_t firstByteUs_;
+    int rows_;
+};
+
+void runBench(bool streaming, const bench::RowsRequest &request) {
+    EventLoopThread serverThread(startServer, "StreamBenchServer");
+    serverThread.startLoop();
+
+    EventLoop loop;
+    StreamBench bench(&loop, InetAddress("127.0.0.1", kPort), streaming, request);
+    bench.connect();
+    loop.loop();
+
+    // 结果已经输出，子进程直接退出，不等 server 线程和连接按顺序析构
+    _exit(0);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    bench::RowsRequest request;
+    request.set_rows(argc > 1 ? atoi(argv[1]) : 200000);
+    request.set_row_size(argc > 2 ? atoi(argv[2]) : 200);
+    request.set_rows_per_chunk(argc > 3 ? atoi(argv[3]) : 256);
+
+    // 每种方式在单独的子进程里跑，峰值 RSS 互不影响
+    const bool modes[] = { false, true };
+    for (bool streaming : modes) {
+        bench::runInChild([streaming, &request]() { runBench(streaming, request); });
+    }
+
+    google::protobuf::ShutdownProtobufLibrary();
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/Buffer.h"
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/EventLoopThreadPool.h"
+#include "network/InetAddress.h"
+#include "network/Metrics.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/TcpServer.h"
+
+using namespace network;
+
+/**
+ * 用法: throughput_bench [server_threads] [client_threads] [connections] [block_size] [seconds]
+ *
+ * 只用网络层测单向流式吞吐：客户端建立 connections 条连接，分布在 client_threads 个 loop 上，
+ * 每条连接不停地写 block_size 字节的块（上一块写进内核之后，在 WriteCompleteCallback 里写下一块，
+ * 输出缓冲区不会无限增长）；服务端 server_threads 个 IO 线程读出数据直接丢弃，
+ * 收到的字节数记在 MetricsRegistry 的计数器里。
+ * 所有连接建立之后计时 seconds 秒，输出一行 CSV：
+ *   throughput,server_threads,client_threads,connections,block_size,seconds,mib_per_sec
+ * 表头和参数扫描见 net_sweep.sh
+ */
+
+namespace {
+
+const uint16_t kPort = 9995;
+
+int g_serverThreads = 1;
+int g_clientThreads = 1;
+int g_connections = 1;
+int g_blockSize = 65536;
+double g_durationSec = 5.0;
+
+Counter *const g_bytesReceived = MetricsRegistry::instance().counter("throughput.bytes_received");
+
+// 进程退出时不析构，避免在 server loop 线程之外销毁 TcpServer
+TcpServer *g_server = NULL;
+
+void onServerMessage(const TcpConnectionPtr &conn, Buffer *buf) {
+    g_bytesReceived->inc(buf->readableBytes());
+    buf->retrieveAll();
+}
+
+void startServer(EventLoop *loop) {
+    g_server = new TcpServer(loop, InetAddress(kPort), "ThroughputServer");
+    g_server->setThreadNum(g_serverThreads);
+    g_server->setMessageCallback(onServerMessage);
+    g_server->start();
+}
+
+class ThroughputClient {
+public:
+    ThroughputClient(EventLoop *loop, const InetAddress &serverAddr)
+        : loop_(loop),
+        threadPool_(loop, "ThroughputClient"),
+        message_(g_blockSize, 't'),
+        connected_(0) {
+        threadPool_.setThreadNum(g_clientThreads);
+        threadPool_.start();
+        for (int i = 0; i < g_connections; ++i) {
+            TcpClient *client = new TcpClient(threadPool_.getNextLoop(), serverAddr,
+                                              "conn" + std::to_string(i));
+            client->setConnectionCallback(
+                std::bind(&ThroughputClient::onConnection, this, _1));
+            client->setWriteCompleteCallback(
+                std::bind(&ThroughputClient::sendBlock, this, _1));
+            clients_.emplace_back(client);
+        }
+    }
+
+    void start() {
+        for (std::unique_ptr<TcpClient> &client : clients_) {
+            client->connect();
+        }
+    }
+
+private:
+    // 在各个 client loop 线程里调用
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        if (connected_.fetch_add(1) + 1 == g_connections) {
+            loop_->runInLoop(std::bind(&ThroughputClient::startTiming, this));
+        }
+        sendBlock(conn);
+    }
+
+    void sendBlock(const TcpConnectionPtr &conn) {
+        Buffer buf;
+        buf.append(message_);
+        conn->send(&buf);
+    }
+
+    void startTiming() {
+        before_ = MetricsRegistry::instance().snapshot();
+        loop_->runAfter(g_durationSec, std::bind(&ThroughputClient::finish, this));
+    }
+
+    void finish() {
+        MetricsSnapshot now = MetricsRegistry::instance().snapshot();
+        double seconds = (now.timestampUs - before_.timestampUs) / 1000000.0;
+        double bytesPerSec = now.rate("throughput.bytes_received", before_);
+        printf("throughput,%d,%d,%d,%d,%.1f,%.2f\n", g_serverThreads, g_clientThreads,
+               g_connections, g_blockSize, seconds, bytesPerSec / (1024.0 * 1024.0));
+        fflush(stdout);
+        loop_->quit();
+    }
+
+    EventLoop *loop_;
+    EventLoopThreadPool threadPool_;
+    std::vector<std::unique_ptr<TcpClient>> clients_;
+    const std::string message_;
+    std::atomic<int> connected_;
+    MetricsSnapshot before_;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_serverThreads = argc > 1 ? atoi(argv[1]) : 1;
+    g_clientThreads = argc > 2 ? atoi(argv[2]) : 1;
+    g_connections = argc > 3 ? atoi(argv[3]) : 1;
+    g_blockSize = argc > 4 ? atoi(argv[4]) : 65536;
+    g_durationSec = argc > 5 ? atof(argv[5]) : 5.0;
+
+    EventLoopThread serverThread(startServer, "ThroughputServer");
+    serverThread.startLoop();
+
+    EventLoop loop;
+    ThroughputClient client(&loop, InetAddress("127.0.0.1", kPort));
+    client.start();
+    loop.loop();
+
+    // 结果已经输出，直接退出，不等各个 loop 线程
+    _exit(0);
+}
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcServer.h"
+#include "rpc_framework/Tracing.h"
+#include "bench.pb.h"
+#include "bench_util.h"
+
+using namespace network;
+
+/**
+ * 用法: trace_bench [requests] [rounds] [trace_file]
+ *
+ * 1. 不采样时每次调用多出的判断（取当前上下文、startClientContext、recording()、服务端检查采样位）
+ *    的开销，按线程 CPU 时间计算，分 Tracer 没有启动和启动但采样率为 0 两种情况。
+ * 2. 同一进程里起三层服务：tier1 的 Echo 调用 tier2，tier2 调用 tier3，tier3 直接返回，
+ * 下游调用都在 handler 的同步部分发起，trace 上下文自动传给下一层。
+ * 客户端对 tier1 顺序发 requests 个调用，三种模式轮流跑 rounds 遍（每次一个子进程）：
+ *   off       - 不调用 Tracer::start，只有字段判断
+ *   sample=0  - Tracer 在记录，但根 span 的采样率为 0，不产生任何 span
+ *   sample=1  - 全部采样，每个调用产生 6 个 span（每一跳一个 client span，每层一个 server span）
+ * 输出平均和 p99 延迟、每个调用消耗的进程 CPU 时间，以及写出和丢弃的 span 数。
+ * sample=1 的 span 写到 trace_file（默认 /tmp/trace_bench.json，Zipkin v2 JSON）。
+ * 数字只在优化编译（-O2）下有意义；单核机器上端到端的波动比 trace 本身的开销大，看多轮的结果。
+ */
+
+namespace {
+
+const uint16_t kTierPorts[] = { 9990, 9991, 9992 };
+const int kNumTiers = 3;
+
+enum Mode { kOff, kSampleNone, kSampleAll };
+const char *kModeNames[] = { "off", "sample=0", "sample=1" };
+
+int g_requests = 20000;
+std::string g_traceFile = "/tmp/trace_bench.json";
+
+int64_t processCpuUs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+int64_t threadCpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * 和 RpcChannel 里不采样时走的分支相同：客户端决定是否带 trace，服务端检查采样位
+ */
+double offPathLoop(int64_t iterations) {
+    Tracer &tracer = Tracer::instance();
+    RpcMessage message;
+    int64_t traced = 0;
+    int64_t start = threadCpuNs();
+    for (int64_t i = 0; i < iterations; ++i) {
+        TraceContext context;
+        if (tracer.startClientContext(Tracer::current(), &context)) {
+            message.set_trace_id(context.traceId);
+            ++traced;
+        }
+        if ((message.trace_flags() & kTraceFlagSampled) && tracer.recording()) {
+            ++traced;
+        }
+    }
+    double cost = static_cast<double>(threadCpuNs() - start) / iterations;
+    return traced == 0 ? cost : -1;
+}
+
+void benchOffPath(int64_t iterations) {
+    printf("sampling off, tracer stopped:  %.1f ns/call\n", offPathLoop(iterations));
+    Tracer::instance().start("/dev/null", "trace_bench");
+    Tracer::instance().setSampleRate(0);
+    printf("sampling off, tracer running:  %.1f ns/call\n", offPathLoop(iterations));
+    Tracer::instance().stop();
+    fflush(stdout);
+}
+
+/**
+ * 一层服务。有下一层时把请求原样转发，收到下一层的响应后再回复；最后一层直接返回
+ */
+class TierService : public bench::BenchService {
+public:
+    TierService(EventLoop *loop, const InetAddress *next)
+        : channel_(new RpcChannel),
+        stub_(get_pointer(channel_)),
+        hasNext_(next != NULL) {
+        if (hasNext_) {
+            client_.reset(new TcpClient(loop, *next, "TierClient"));
+            client_->setConnectionCallback(std::bind(&TierService::onConnection, this, _1));
+            client_->setMessageCallback(
+                std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+            client_->connect();
+        }
+    }
+
+    void Echo(::google::protobuf::RpcController *controller,
+              const ::bench::EchoRequest *request,
+              ::bench::EchoResponse *response,
+              ::google::protobuf::Closure *done) override {
+        if (!hasNext_) {
+            response->set_payload(request->payload());
+            done->Run();
+            return;
+        }
+        // RpcChannel 在 done 执行完之后释放下一层的响应
+        Forward *forward = new Forward;
+        forward->downstream = new bench::EchoResponse;
+        forward->response = response;
+        forward->done = done;
+        stub_.Echo(NULL, request, forward->downstream,
+                   ::google::protobuf::NewCallback(this, &TierService::onDownstream, forward));
+    }
+
+private:
+    // 一次转发中的调用：下一层的响应和要回复上一层的 response、done
+    struct Forward {
+        bench::EchoResponse *downstream;
+        bench::EchoResponse *response;
+        ::google::protobuf::Closure *done;
+    };
+
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (conn->connected()) {
+            channel_->setConnection(conn);
+        }
+    }
+
+    void onDownstream(Forward *forward) {
+        forward->response->set_payload(forward->downstream->payload());
+        ::google::protobuf::Closure *done = forward->done;
+        delete forward;
+        done->Run();
+    }
+
+    std::unique_ptr<TcpClient> client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+    bool hasNext_;
+};
+
+/**
+ * 每层一个 IO 线程，服务端和去下一层的客户端共用这个 loop。从最后一层开始启动，
+ * 上一层连接时下一层已经在监听
+ */
+class Tier {
+public:
+    explicit Tier(int index)
+        : index_(index),
+        thread_(std::bind(&Tier::init, this, _1), "TierServer") {}
+
+    void start() { thread_.startLoop(); }
+
+private:
+    void init(EventLoop *loop) {
+        std::unique_ptr<InetAddress> next;
+        if (index_ + 1 < kNumTiers) {
+            next.reset(new InetAddress("127.0.0.1", kTierPorts[index_ + 1]));
+        }
+        service_.reset(new TierService(loop, next.get()));
+        server_.reset(new RpcServer(loop, InetAddress(kTierPorts[index_])));
+        server_->registerService(get_pointer(service_));
+        server_->start();
+    }
+
+    const int index_;
+    std::unique_ptr<TierService> service_;
+    std::unique_ptr<RpcServer> server_;
+    EventLoopThread thread_;
+};
+
+class TraceBench {
+public:
+    TraceBench(EventLoop *loop, Mode mode)
+        : loop_(loop),
+        mode_(mode),
+        client_(loop, InetAddress("127.0.0.1", kTierPorts[0]), "TraceBench"),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)),
+        sent_(0),
+        sendUs_(0),
+        startUs_(0),
+        startCpuUs_(0) {
+        client_.setConnectionCallback(std::bind(&TraceBench::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+        request_.set_payload(std::string(64, 'x'));
+        latencies_.reserve(g_requests);
+    }
+
+    void connect() { client_.connect(); }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        channel_->setConnection(conn);
+        // 等中间层之间的连接建立完
+        loop_->runAfter(0.2, std::bind(&TraceBench::begin, this));
+    }
+
+    void begin() {
+        startCpuUs_ = processCpuUs();
+        startUs_ = getNowUs();
+        send();
+    }
+
+    void send() {
+        ++sent_;
+        sendUs_ = getNowUs();
+        stub_.Echo(NULL, &request_, new bench::EchoResponse,
+                   ::google::protobuf::NewCallback(this, &TraceBench::onResponse));
+    }
+
+    void onResponse() {
+        latencies_.push_back(getNowUs() - sendUs_);
+        if (sent_ < g_requests) {
+            send();
+            return;
+        }
+        report();
+        loop_->quit();
+    }
+
+    void report() {
+        int64_t cpuUs = processCpuUs() - startCpuUs_;
+        int64_t wallUs = getNowUs() - startUs_;
+        std::sort(latencies_.begin(), latencies_.end());
+        int64_t total = 0;
+        for (int64_t latency : latencies_) {
+            total += latency;
+        }
+        size_t n = latencies_.size();
+        if (mode_ != kOff) {
+            Tracer::instance().stop();
+        }
+        printf("%-9s mean %6.1f us  p99 %6lld us  cpu %6.1f us/call  qps %7.0f  spans %lld (dropped %lld)\n",
+               kModeNames[mode_], static_cast<double>(total) / n,
+               static_cast<long long>(latencies_[n * 99 / 100]),
+               static_cast<double>(cpuUs) / n, n * 1000000.0 / wallUs,
+               static_cast<long long>(Tracer::instance().spansWritten()),
+               static_cast<long long>(Tracer::instance().spansDropped()));
+        if (mode_ == kSampleAll) {
+            printf("          spans written to %s\n", g_traceFile.c_str());
+        }
+        fflush(stdout);
+    }
+
+    EventLoop *loop_;
+    const Mode mode_;
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    bench::BenchService::Stub stub_;
+    bench::EchoRequest request_;
+    int sent_;
+    int64_t sendUs_;
+    int64_t startUs_;
+    int64_t startCpuUs_;
+    std::vector<int64_t> latencies_;
+};
+
+void runBench(Mode mode) {
+    if (mode == kSampleNone) {
+        Tracer::instance().start("/dev/null", "trace_bench");
+        Tracer::instance().setSampleRate(0);
+    } else if (mode == kSampleAll) {
+        Tracer::instance().start(g_traceFile, "trace_bench");
+        Tracer::instance().setSampleRate(1.0);
+    }
+
+    std::vector<std::unique_ptr<Tier>> tiers;
+    for (int i = kNumTiers - 1; i >= 0; --i) {
+        tiers.emplace_back(new Tier(i));
+        tiers.back()->start();
+    }
+
+    EventLoop loop;
+    TraceBench bench(&loop, mode);
+    bench.connect();
+    loop.loop();
+
+    // 结果已经输出，子进程直接退出，不等各层的线程
+    _exit(0);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    g_requests = argc > 1 ? atoi(argv[1]) : 20000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 3;
+    if (argc > 3) {
+        g_traceFile = argv[3];
+    }
+
+    benchOffPath(100000000);
+
+    const Mode modes[] = { kOff, kSampleNone, kSampleAll };
+    for (int round = 0; round < rounds; ++round) {
+        for (Mode mode : modes) {
+            bench::runInChild([mode]() { runBench(mode); });
+        }
+    }
+
+    google::protobuf::ShutdownProtobufLibrary();
+    return 0;
+}
@@ -109,6 +109,8 @@ private:
         if (conn->connected()) {
             channel_->setConnection(conn);
         } else {
+            // 重连之前结束还没有收到响应的调用，它们的响应不会从新连接上回来
+            channel_->failOutstandingCalls(UNAVAILABLE);
             RpcClient::connect();
         }
     }
@@ -0,0 +1,354 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/EventLoop.h"
+#include "network/EventLoopThread.h"
+#include "network/InetAddress.h"
+#include "network/Metrics.h"
+#include "network/TcpClient.h"
+#include "network/TcpConnection.h"
+#include "network/util.h"
+#include "rpc_framework/RpcChannel.h"
+#include "rpc_framework/RpcController.h"
+#include "monitor.pb.h"
+
+using namespace network;
+
+/**
+ * rpc_bench：对 protobuf_rpc_server（monitor.TestService.MonitorInfo）施压并统计延迟，结果以 JSON 输出。
+ *
+ * 用法: rpc_bench [-h host] [-p port] [-t threads] [-c connections] [-r rate] [-n concurrency]
+ *                 [-s payload_bytes] [-d duration_sec] [-w warmup_sec] [-o output_file]
+ *
+ *   -r rate > 0  开环：所有连接合计每秒 rate 个请求，按固定间隔排好每个请求的计划发送时间，
+ *                不管之前的请求有没有返回都按计划发送。延迟从计划发送时间算起（coordinated omission 修正），
+ *                服务端或客户端卡住时，本该在卡顿期间发出的请求也计入等待时间；同时给出从实际发送时间算起的延迟。
+ *   -r 0（默认） 闭环：每个连接保持 concurrency 个请求在途，返回一个发一个。
+ *                闭环的发送速率由服务端决定，没有计划时间可以修正，只给出从实际发送时间算起的延迟。
+ *
+ * connections 个连接平均分配到 threads 个 EventLoop 线程。先跑 warmup_sec 秒不计入结果，
+ * 再统计 duration_sec 秒；结束后最多等 5 秒让在途的请求返回，还没返回的计入 incomplete。
+ * 延迟直方图是 network::LogLinearHistogram，相对误差不超过 1/16。
+ */
+
+namespace {
+
+struct Options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 9981;
+    int threads = 2;
+    int connections = 4;
+    double rate = 0;
+    int concurrency = 1;
+    int payloadBytes = 64;
+    double durationSec = 10;
+    double warmupSec = 1;
+    std::string output;
+};
+
+Options g_options;
+
+const int64_t kDrainTimeoutUs = 5000000;
+
+/**
+ * 一个 EventLoop 线程的统计。直方图只由该线程写入，计数器用 relaxed 原子变量，
+ * 主线程在结束时读取
+ */
+struct WorkerStats {
+    LogLinearHistogram corrected;
+    LogLinearHistogram uncorrected;
+    std::atomic<int64_t> sent{0};
+    std::atomic<int64_t> completed{0};
+    std::atomic<int64_t> errors{0};
+    std::atomic<int64_t> outstanding{0}; // 统计区间内发出、还没有返回的请求数
+};
+
+class BenchConnection {
+public:
+    BenchConnection(EventLoop *loop, WorkerStats *stats, int index,
+                    int64_t measureStartUs, int64_t measureEndUs)
+        : loop_(loop),
+        stats_(stats),
+        client_(loop, InetAddress(g_options.host, g_options.port), "RpcBench"),
+        channel_(new RpcChannel),
+        stub_(get_pointer(channel_)),
+        measureStartUs_(measureStartUs),
+        measureEndUs_(measureEndUs),
+        intervalUs_(0),
+        nextIntendedUs_(0),
+        sequence_(0),
+        connected_(false) {
+        client_.setConnectionCallback(std::bind(&BenchConnection::onConnection, this, _1));
+        client_.setMessageCallback(
+            std::bind(&RpcChannel::onMessage, get_pointer(channel_), _1, _2));
+        request_.set_name(std::string(g_options.payloadBytes, 'x'));
+
+        /**
+         * 开环时每个连接的间隔是 connections / rate，各连接的起点错开一个总间隔，
+         * 合起来是均匀的 rate 个每秒
+         */
+        if (g_options.rate > 0) {
+            intervalUs_ = 1000000.0 * g_options.connections / g_options.rate;
+            nextIntendedUs_ = getNowUs() + 1000000.0 * index / g_options.rate;
+        }
+    }
+
+    void connect() { client_.connect(); }
+
+private:
+    // 一次调用：计划发送时间、实际发送时间和用来取错误码的 controller
+    struct Call {
+        RpcController controller;
+        int64_t intendedUs;
+        int64_t sentUs;
+    };
+
+    void onConnection(const TcpConnectionPtr &conn) {
+        if (!conn->connected()) {
+            connected_ = false;
+            return;
+        }
+        channel_->setConnection(conn);
+        connected_ = true;
+        if (g_options.rate > 0) {
+            // 连接建立之前错过的计划时间不补发，从现在开始排
+            nextIntendedUs_ = std::max<double>(nextIntendedUs_, getNowUs());
+            sendDue();
+        } else {
+            for (int i = 0; i < g_options.concurrency; ++i) {
+                send(getNowUs());
+            }
+        }
+    }
+
+    /**
+     * 发出所有计划时间已到的请求，再为下一个计划时间设定时器。
+     * 定时器触发晚了（loop 忙）时一次补发多个，它们的延迟仍从各自的计划时间算起
+     */
+    void sendDue() {
+        if (!connected_) {
+            return;
+        }
+        int64_t now = getNowUs();
+        while (nextIntendedUs_ <= now && nextIntendedUs_ < measureEndUs_) {
+            send(static_cast<int64_t>(nextIntendedUs_));
+            nextIntendedUs_ += intervalUs_;
+        }
+        if (nextIntendedUs_ < measureEndUs_) {
+            loop_->runAt(static_cast<int64_t>(nextIntendedUs_),
+                         std::bind(&BenchConnection::sendDue, this));
+        }
+    }
+
+    void send(int64_t intendedUs) {
+        Call *call = new Call;
+        call->intendedUs = intendedUs;
+        call->sentUs = getNowUs();
+        if (measured(call)) {
+            stats_->sent.fetch_add(1, std::memory_order_relaxed);
+            stats_->outstanding.fetch_add(1, std::memory_order_relaxed);
+        }
+        request_.set_count(++sequence_);
+        stub_.MonitorInfo(&call->controller, &request_, new monitor::TestResponse,
+                          ::google::protobuf::NewCallback(this, &BenchConnection::onResponse,
+                                                          call));
+    }
+
+    void onResponse(Call *call) {
+        int64_t now = getNowUs();
+        if (measured(call)) {
+            stats_->outstanding.fetch_sub(1, std::memory_order_relaxed);
+            stats_->completed.fetch_add(1, std::memory_order_relaxed);
+            if (call->controller.Failed()) {
+                stats_->errors.fetch_add(1, std::memory_order_relaxed);
+            }
+            stats_->corrected.record(now - call->intendedUs);
+            stats_->uncorrected.record(now - call->sentUs);
+        }
+        delete call;
+
+        if (g_options.rate <= 0 && now < measureEndUs_) {
+            send(now);
+        }
+    }
+
+    // 计划时间落在统计区间内的请求才计入结果
+    bool measured(const Call *call) const {
+        return call->intendedUs >= measureStartUs_ && call->intendedUs < measureEndUs_;
+    }
+
+    EventLoop *loop_;
+    WorkerStats *stats_;
+    TcpClient client_;
+    RpcChannelPtr channel_;
+    monitor::TestService::Stub stub_;
+    monitor::TestRequest request_;
+    const int64_t measureStartUs_;
+    const int64_t measureEndUs_;
+    double intervalUs_;
+    double nextIntendedUs_;
+    int32_t sequence_;
+    bool connected_;
+};
+
+void printUsage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-h host] [-p port] [-t threads] [-c connections] [-r rate]\n"
+            "          [-n concurrency] [-s payload_bytes] [-d duration_sec] [-w warmup_sec]\n"
+            "          [-o output_file]\n", program);
+}
+
+bool parseOptions(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:t:c:r:n:s:d:w:o:")) != -1) {
+        switch (opt) {
+        case 'h': g_options.host = optarg; break;
+        case 'p': g_options.port = static_cast<uint16_t>(atoi(optarg)); break;
+        case 't': g_options.threads = atoi(optarg); break;
+        case 'c': g_options.connections = atoi(optarg); break;
+        case 'r': g_options.rate = atof(optarg); break;
+        case 'n': g_options.concurrency = atoi(optarg); break;
+        case 's': g_options.payloadBytes = atoi(optarg); break;
+        case 'd': g_options.durationSec = atof(optarg); break;
+        case 'w': g_options.warmupSec = atof(optarg); break;
+        case 'o': g_options.output = optarg; break;
+        default: return false;
+        }
+    }
+    return g_options.threads > 0 && g_options.connections > 0 && g_options.concurrency > 0 &&
+           g_options.payloadBytes >= 0 && g_options.durationSec > 0 && g_options.rate >= 0;
+}
+
+void appendLatency(std::string *json, const char *name, const LogLinearHistogram::Snapshot &s) {
+    char buf[512];
+    snprintf(buf, sizeof buf,
+             "    \"%s\": {\"count\": %lld, \"mean\": %.1f, \"p50\": %lld, \"p90\": %lld, "
+             "\"p99\": %lld, \"p999\": %lld, \"p9999\": %lld, \"max\": %lld}",
+             name, static_cast<long long>(s.count),
+             s.count > 0 ? static_cast<double>(s.sum) / s.count : 0.0,
+             static_cast<long long>(s.percentile(50)), static_cast<long long>(s.percentile(90)),
+             static_cast<long long>(s.percentile(99)), static_cast<long long>(s.percentile(99.9)),
+             static_cast<long long>(s.percentile(99.99)), static_cast<long long>(s.max));
+    *json += buf;
+}
+
+std::string formatReport(const std::vector<std::unique_ptr<WorkerStats>> &stats,
+                         double elapsedSec) {
+    LogLinearHistogram::Snapshot corrected;
+    LogLinearHistogram::Snapshot uncorrected;
+    int64_t sent = 0, completed = 0, errors = 0, incomplete = 0;
+    for (const std::unique_ptr<WorkerStats> &worker : stats) {
+        corrected.merge(worker->corrected.snapshot());
+        uncorrected.merge(worker->uncorrected.snapshot());
+        sent += worker->sent.load(std::memory_order_relaxed);
+        completed += worker->completed.load(std::memory_order_relaxed);
+        errors += worker->errors.load(std::memory_order_relaxed);
+        incomplete += worker->outstanding.load(std::memory_order_relaxed);
+    }
+
+    bool openLoop = g_options.rate > 0;
+    char buf[1024];
+    snprintf(buf, sizeof buf,
+             "{\n"
+             "  \"target\": \"%s:%u\",\n"
+             "  \"method\": \"monitor.TestService.MonitorInfo\",\n"
+             "  \"mode\": \"%s\",\n"
+             "  \"target_rate\": %.1f,\n"
+             "  \"threads\": %d,\n"
+             "  \"connections\": %d,\n"
+             "  \"concurrency\": %d,\n"
+             "  \"payload_bytes\": %d,\n"
+             "  \"duration_sec\": %.3f,\n"
+             "  \"requests\": {\"sent\": %lld, \"completed\": %lld, \"errors\": %lld, "
+             "\"incomplete\": %lld},\n"
+             "  \"throughput_rps\": %.1f,\n"
+             "  \"coordinated_omission_corrected\": %s,\n"
+             "  \"latency_us\": {\n",
+             g_options.host.c_str(), g_options.port, openLoop ? "open_loop" : "closed_loop",
+             g_options.rate, g_options.threads, g_options.connections,
+             openLoop ? 0 : g_options.concurrency, g_options.payloadBytes, elapsedSec,
+             static_cast<long long>(sent), static_cast<long long>(completed),
+             static_cast<long long>(errors), static_cast<long long>(incomplete),
+             completed / elapsedSec, openLoop ? "true" : "false");
+    std::string json = buf;
+    if (openLoop) {
+        appendLatency(&json, "corrected", corrected);
+        json += ",\n";
+    }
+    appendLatency(&json, "uncorrected", uncorrected);
+    json += "\n  }\n}\n";
+    return json;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (!parseOptions(argc, argv)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    int64_t measureStartUs = getNowUs() + static_cast<int64_t>(g_options.warmupSec * 1000000);
+    int64_t measureEndUs = measureStartUs + static_cast<int64_t>(g_options.durationSec * 1000000);
+
+    std::vector<std::unique_ptr<EventLoopThread>> threads;
+    std::vector<EventLoop *> loops;
+    std::vector<std::unique_ptr<WorkerStats>> stats;
+    for (int i = 0; i < g_options.threads; ++i) {
+        threads.emplace_back(new EventLoopThread(EventLoopThread::ThreadInitCallback(),
+                                                 "RpcBench"));
+        loops.push_back(threads.back()->startLoop());
+        stats.emplace_back(new WorkerStats);
+    }
+
+    std::vector<std::unique_ptr<BenchConnection>> connections;
+    for (int i = 0; i < g_options.connections; ++i) {
+        int worker = i % g_options.threads;
+        connections.emplace_back(new BenchConnection(loops[worker], get_pointer(stats[worker]), i,
+                                                     measureStartUs, measureEndUs));
+        connections.back()->connect();
+    }
+
+    // 等统计区间结束，再等在途的请求返回
+    int64_t now = getNowUs();
+    if (now < measureEndUs) {
+        ::usleep(static_cast<useconds_t>(measureEndUs - now));
+    }
+    int64_t drainDeadlineUs = getNowUs() + kDrainTimeoutUs;
+    for (;;) {
+        int64_t outstanding = 0;
+        for (const std::unique_ptr<WorkerStats> &worker : stats) {
+            outstanding += worker->outstanding.load(std::memory_order_relaxed);
+        }
+        if (outstanding == 0 || getNowUs() >= drainDeadlineUs) {
+            break;
+        }
+        ::usleep(1000);
+    }
+
+    std::string report = formatReport(stats, g_options.durationSec);
+    if (g_options.output.empty()) {
+        fputs(report.c_str(), stdout);
+    } else {
+        FILE *file = ::fopen(g_options.output.c_str(), "w");
+        if (!file) {
+            fprintf(stderr, "cannot open %s\n", g_options.output.c_str());
+            _exit(1);
+        }
+        fputs(report.c_str(), file);
+        ::fclose(file);
+    }
+    fflush(stdout);
+
+    // 连接和 loop 线程还在运行，直接退出
+    _exit(0);
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+
+namespace network {
+
+/**
+ * 一个线程的日志暂存区：单生产者单消费者的字节环。
+ * 只有所属线程写入（推进 head_），只有 AsyncLogging 的后台线程读出（推进 tail_），两边都不加锁。
+ * 放不下的整条日志直接丢弃并计数，写日志的线程永远不会等磁盘
+ */
+class LogStaging {
+public:
+    LogStaging(size_t capacity, pid_t tid);
+
+    // 生产者：写入 header + message + '\n'，返回写入后的已用字节数，放不下时返回 0
+    size_t append(const char *header, size_t headerLen, const char *message, size_t messageLen);
+
+    // 消费者：把当前能读的数据全部追加到 out 后面，返回字节数
+    size_t drainTo(std::string *out);
+
+    // 消费者：上次调用以来丢弃的日志条数
+    int64_t takeDropped();
+
+    // 所属线程退出时调用，后台线程读完剩下的数据后释放这个暂存区
+    void abandon() { abandoned_.store(true, std::memory_order_release); }
+    bool abandoned() const { return abandoned_.load(std::memory_order_acquire); }
+
+    size_t capacity() const { return capacity_; }
+    pid_t tid() const { return tid_; }
+
+private:
+    void copyIn(uint64_t pos, const char *data, size_t len);
+
+    const size_t capacity_;     // 2 的幂
+    const pid_t tid_;
+    std::unique_ptr<char[]> data_;
+    alignas(64) std::atomic<uint64_t> head_;
+    std::atomic<int64_t> dropped_;
+    alignas(64) std::atomic<uint64_t> tail_;
+    int64_t reportedDropped_;
+    std::atomic<bool> abandoned_;
+};
+
+/**
+ * 异步日志后端，作为 glog 的 LogSink 接入，已有的 LOG() 调用不用修改。
+ *
+ * send() 在调用 LOG() 的线程里执行：格式化一行和 glog 相同格式的前缀，连同消息一起拷进本线程的
+ * LogStaging 就返回，不做系统调用。后台线程每隔 flushIntervalMs（或者某个暂存区过半时被提前唤醒）
+ * 把所有暂存区的数据收集成一批，一次写到输出。默认输出是按大小和日期滚动的文件
+ * basename.YYYYmmdd-HHMMSS.hostname.pid.log，setOutput() 可以换成别的目标。
+ *
+ * 磁盘变慢时只有后台线程等待；暂存区写满后新的日志被丢弃，计入 log.dropped，
+ * 后台线程在日志里补一行丢弃的条数。FATAL 日志会等到全部写出之后才返回，glog 随后 abort。
+ *
+ * start() 默认同时关闭 glog 自己的日志文件（避免在调用线程同步写盘），之后 glog 只向 stderr
+ * 输出不低于 FLAGS_stderrthreshold 的日志。glog 没有读出原日志目的地的接口，stop() 和析构
+ * 都无法恢复，所以这种用法下实例应该存活到进程结束，stop() 之后的日志只剩 stderr 的部分。
+ * 只是临时使用的实例（测试、对比不同后端的 benchmark）在 start() 之前 setDisableGlogFiles(false)，
+ * 不改动 glog 的全局设置。glog 需要先 InitGoogleLogging()，否则它会把每条日志也写到 stderr。
+ * 一个进程通常只用一个实例
+ */
+class AsyncLogging : public google::LogSink {
+public:
+    typedef std::function<void(const char *data, size_t len)> OutputFunc;
+
+    static const size_t kDefaultStagingBytes = 256 * 1024;
+    static const int kDefaultFlushIntervalMs = 50;
+
+    AsyncLogging(const std::string &basename, off_t rollSize,
+                 int flushIntervalMs = kDefaultFlushIntervalMs);
+    ~AsyncLogging() override;
+
+    AsyncLogging(const AsyncLogging &) = delete;
+    AsyncLogging &operator=(const AsyncLogging &) = delete;
+
+    // 只能在 start() 之前调用；output 只在后台线程里被调用
+    void setOutput(const OutputFunc &output);
+    void setStagingBytes(size_t bytes);
+    // 默认 true：start() 把 glog 各级别的文件目的地设为空，进程内不可恢复
+    void setDisableGlogFiles(bool disable);
+
+    void start();
+    void stop();
+
+    // 等到调用之前写入的日志全部交给输出
+    void flush();
+
+    void send(google::LogSeverity severity, const char *fullFilename, const char *baseFilename,
+              int line, const struct ::tm *tmTime, const char *message, size_t messageLen) override;
+
+private:
+    void threadFunc();
+
+    void collect(std::string *batch);
+
+    LogStaging *localStaging();
+
+    const uint64_t id_;
+    const int flushIntervalMs_;
+    size_t stagingBytes_;
+    bool disableGlogFiles_;
+    OutputFunc output_;
+
+    std::mutex stagingMutex_;   // 保护 stagings_，后台线程收集时持有，不包括写输出
+    std::vector<std::shared_ptr<LogStaging>> stagings_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable flushedCv_;
+    bool running_;
+    uint64_t flushRequests_;
+    uint64_t flushedRequests_;
+    std::unique_ptr<std::thread> thread_;
+};
+
+} // namespace network
@@ -1,8 +1,10 @@
 #pragma once 
 
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 #include <algorithm>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -10,20 +12,108 @@
 
 namespace network {
 
+/**
+ * 进程内所有 Buffer 持有的内存（包括 BufferPool 里空闲的块），同时导出为 net.buffer_bytes 指标。
+ *
+ * 每个线程先在本地累计增减量，超过 kFlushBytes 才加到全局总数上，分配路径上一般没有原子操作；
+ * 总数的误差不超过 线程数 x kFlushBytes。
+ *   - 超过软上限：排空的 Buffer 立即释放扩容过的内存，BufferPool 不再保留空闲块；
+ *   - 超过硬上限：编解码器拒绝新的大帧（见 ProtoRpcCodec::kLargeFrameLen），关闭发来大帧的连接。
+ * 上限为 0 表示不限制，默认都不限制
+ */
+class BufferMemory {
+public:
+    static const int64_t kFlushBytes = 64 * 1024;
+
+    static void setLimits(int64_t softLimitBytes, int64_t hardLimitBytes);
+
+    static int64_t totalBytes();
+
+    static bool overSoftLimit();
+
+    // 再持有 bytes 字节之后是否会超过硬上限
+    static bool wouldExceedHardLimit(int64_t bytes);
+
+    // 由 AccountedAllocator 调用，delta 为负表示释放
+    static void add(int64_t delta);
+};
+
+/**
+ * Buffer 存储用的分配器，分配和释放都记到 BufferMemory 里。
+ * 扩容、拷贝、析构都经过分配器，不需要在 Buffer 的每个成员函数里单独记账
+ */
+template <typename T>
+struct AccountedAllocator {
+    typedef T value_type;
+
+    AccountedAllocator() = default;
+
+    template <typename U>
+    AccountedAllocator(const AccountedAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+        BufferMemory::add(static_cast<int64_t>(n * sizeof(T)));
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, size_t n) {
+        BufferMemory::add(-static_cast<int64_t>(n * sizeof(T)));
+        std::allocator<T>().deallocate(p, n);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const AccountedAllocator<T> &, const AccountedAllocator<U> &) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const AccountedAllocator<T> &, const AccountedAllocator<U> &) { return false; }
+
 class Buffer {
 public:
+    typedef std::vector<char, AccountedAllocator<char>> Storage;
+
     static const size_t kCheapPrepend = 8;
     static const size_t kInitialSize = 1024 * 4;
 
+    // 扩容过的 Buffer 连续 kShrinkRounds 次排空时用量都低于容量的 1/kShrinkWatermarkDivisor 就释放
+    static const uint32_t kShrinkRounds = 16;
+    static const size_t kShrinkWatermarkDivisor = 4;
+
     explicit Buffer(size_t initialSize = kInitialSize)
         : buffer_(kCheapPrepend + initialSize),
         readerIndex_(kCheapPrepend),
-        writerIndex_(kCheapPrepend) {
+        writerIndex_(kCheapPrepend),
+        highWater_(kCheapPrepend),
+        lowUsageRounds_(0) {
         assert(readableBytes() == 0);
         assert(writableBytes() == initialSize);
         assert(prependableBytes() == kCheapPrepend);
     }
 
+    /**
+     * 不持有内存的空 Buffer，第一次写入时才分配，用法: Buffer buf(Buffer::kLazy)。
+     * 没有内存时读、写、前置空间都是 0，写入前由 makeSpace 分配
+     */
+    enum LazyTag { kLazy };
+
+    explicit Buffer(LazyTag)
+        : readerIndex_(0),
+        writerIndex_(0),
+        highWater_(0),
+        lowUsageRounds_(0) {}
+
+    // 是否持有内存，空闲连接的 Buffer 在 release() 之后不持有
+    bool hasStorage() const { return !buffer_.empty(); }
+
+    /**
+     * 连接在数据排空的时候调用（没有可读数据时才生效），之后的第一次写入再重新分配。
+     *   - 初始大小的内存块还给本线程的 BufferPool；
+     *   - 扩容过的内存按收缩策略处理：上一次排空以来的最高用量低于容量的 1/kShrinkWatermarkDivisor
+     *     记一轮，连续 kShrinkRounds 轮才释放，偶尔来一条大消息的连接不会反复扩容；
+     *     BufferMemory 超过软上限时不等，立即释放
+     */
+    void release();
+
     size_t readableBytes() const { return writerIndex_ - readerIndex_; }
 
     size_t writableBytes() const { return buffer_.size() - writerIndex_; }
@@ -61,8 +151,8 @@ public:
      * 通过重置读写指针到初始位置来实现，比逐个删除数据更高效
      */
     void retrieveAll() {
-        readerIndex_ = kCheapPrepend;
-        writerIndex_ = kCheapPrepend;
+        readerIndex_ = buffer_.empty() ? 0 : kCheapPrepend;
+        writerIndex_ = readerIndex_;
     }
 
     std::string retrieveAllAsString(size_t len)  {
@@ -126,6 +216,9 @@ public:
     void hasWritten(size_t len) {
         assert(len <= writableBytes());
         writerIndex_ += len;
+        if (writerIndex_ > highWater_) {
+            highWater_ = static_cast<uint32_t>(writerIndex_);
+        }
     }
     void unwrite(size_t len) {
         assert(len <= readableBytes());
@@ -287,12 +380,16 @@ public:
     ssize_t readFd(int fd, int *savedErrno);
 
 private:
-    char *begin() { return &*buffer_.begin(); }
+    char *begin() { return buffer_.data(); }
+
+    const char *begin() const { return buffer_.data(); }
 
-    const char *begin() const { return &*buffer_.begin(); }
+    // 从本线程的 BufferPool 取内存，len 超过初始大小时直接分配 kCheapPrepend + len
+    void allocate(size_t len);
 
     /**
      * 这个函数的作用是：为 Buffer 腾出足够的空间来写入 len 个字节的数据
+     * 情况零：还没有内存（kLazy 或者 release() 之后），调用 allocate 分配。
      * 如果可写字节数 + 可前置字节数 < 需要的字节数 + 预留空间，说明空间不够。
      * 情况一：空间不够，需要扩容，直接扩容 Buffer 到 writerIndex_ + len 大小。
      * 情况二：空间够，但需要整理
@@ -312,7 +409,9 @@ private:
      * kCheapPrepend  readerIndex_  writerIndex_
      */
     void makeSpace(size_t len) {
-        if (writableBytes() + prependableBytes() < len + kCheapPrepend) {
+        if (buffer_.empty()) {
+            allocate(len);
+        } else if (writableBytes() + prependableBytes() < len + kCheapPrepend) {
             buffer_.resize(writerIndex_ + len);
         } else {
             assert(kCheapPrepend < readerIndex_);
@@ -326,7 +425,7 @@ private:
     }
 
 private:
-    std::vector<char> buffer_;
+    Storage buffer_;
     /**
      * [预留空间]       [已读数据]     [可写区域]
         ^              ^         ^
@@ -336,6 +435,10 @@ private:
     size_t readerIndex_;
     size_t writerIndex_;
 
+    // 上一次 release() 以来 writerIndex_ 的最大值，和连续低用量的轮数，供收缩策略使用
+    uint32_t highWater_;
+    uint32_t lowUsageRounds_;
+
     /**
      * 这是一个静态常量字符数组的声明，用于存储 CRLF（回车换行符）。
      */
@@ -7,6 +7,7 @@
 #include <boost/any.hpp>
 
 #include "network/Callbacks.h"
+#include "network/TimerQueue.h"
 #include "network/util.h"
 
 namespace network {
@@ -39,6 +40,18 @@ public:
 
     size_t queueSize() const;
 
+    /**
+     * 定时器接口，回调都在 loop 线程里执行，可以在任意线程调用。
+     * runAt 的时间是 getNowUs() 的绝对时间，runAfter/runEvery 的单位是秒。
+     */
+    TimerId runAt(int64_t whenUs, Functor cb);
+
+    TimerId runAfter(double delay, Functor cb);
+
+    TimerId runEvery(double interval, Functor cb);
+
+    void cancel(TimerId timerId);
+
     void wakeup();
 
     void updateChannel(Channel *channel);
@@ -75,6 +88,9 @@ public:
     // 用于获取当前线程关联的 EventLoop 对象。
     static EventLoop *getEventLoopOfCurrentThread();
 
+    // 当前存在的所有 EventLoop 所在线程的 tid，供采样分析等诊断工具使用
+    static std::vector<pid_t> loopThreadIds();
+
 private:
     void abortNotInLoopThread();
     void handleRead();
@@ -91,6 +107,7 @@ private:
     int64_t iteration_;
     pid_t threadId_;
     std::unique_ptr<Poller> poller_;
+    std::unique_ptr<TimerQueue> timerQueue_;
     int wakeupFd_;
 
     std::unique_ptr<Channel> wakeupChannel_;
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace network {
+
+/**
+ * HDR 风格的 log-linear 直方图：小于 kSubBuckets 的值每个值一个桶，
+ * 之后每个 2 的幂区间再平均分成 kSubBuckets 个桶，相对误差不超过 1/kSubBuckets。
+ * 超过 2^kMaxExponent 的值记在最后一个桶。
+ *
+ * 每个直方图只由一个线程写入，写入用 relaxed 的 load + store，没有锁也没有原子读改写；
+ * 读取方可以在任意线程用 snapshot() 读出近似一致的快照，再把各线程的快照合并
+ */
+class LogLinearHistogram {
+public:
+    static const int kSubBucketBits = 4;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+    static const int kMaxExponent = 40;
+    static const int kNumBuckets = (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+    struct Snapshot {
+        std::vector<int64_t> buckets;
+        int64_t count = 0;
+        int64_t sum = 0;
+        int64_t max = 0;
+
+        void merge(const Snapshot &other);
+
+        // 减去更早的快照得到区间内的分布；max 无法相减，保留当前值
+        void subtract(const Snapshot &earlier);
+
+        // p 取 0 到 100，返回所在桶的中点（不超过 max），没有样本时返回 0
+        int64_t percentile(double p) const;
+    };
+
+    LogLinearHistogram();
+
+    // 只能由拥有者线程调用，负数按 0 记录
+    void record(int64_t value) {
+        uint64_t v = value > 0 ? static_cast<uint64_t>(value) : 0;
+        increment(buckets_[bucketOf(v)], 1);
+        increment(count_, 1);
+        increment(sum_, static_cast<int64_t>(v));
+        if (static_cast<int64_t>(v) > max_.load(std::memory_order_relaxed)) {
+            max_.store(static_cast<int64_t>(v), std::memory_order_relaxed);
+        }
+    }
+
+    Snapshot snapshot() const;
+
+    static int bucketOf(uint64_t value) {
+        if (value < static_cast<uint64_t>(kSubBuckets)) {
+            return static_cast<int>(value);
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        if (exponent > kMaxExponent) {
+            return kNumBuckets - 1;
+        }
+        int sub = static_cast<int>(value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+        return (exponent - kSubBucketBits + 1) * kSubBuckets + sub;
+    }
+
+    // 桶覆盖的取值范围 [lowerBound, upperBound)
+    static int64_t lowerBound(int bucket);
+    static int64_t upperBound(int bucket);
+
+private:
+    static void increment(std::atomic<int64_t> &cell, int64_t delta) {
+        cell.store(cell.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    std::atomic<int64_t> buckets_[kNumBuckets];
+    std::atomic<int64_t> count_;
+    std::atomic<int64_t> sum_;
+    std::atomic<int64_t> max_;
+};
+
+/**
+ * 一个线程的全部指标单元。计数器和 gauge 共用一个编号空间，按编号分块懒分配；
+ * 直方图单独编号，每个直方图第一次在本线程记录时才分配。
+ *
+ * 只有拥有者线程写，写入不加锁；块和直方图的指针用 release/acquire 发布，
+ * 读取方（MetricsRegistry::snapshot）随时可以遍历。线程退出时（thread_local 析构）
+ * 已经记录的值并入 MetricsRegistry 的退役汇总，单元随即释放，线程反复创建退出也不会累积
+ */
+class ThreadMetricCells {
+public:
+    static const int kBlockBits = 8;
+    static const int kBlockSize = 1 << kBlockBits;
+    static const int kMaxBlocks = 256;          // 最多 65536 个计数器和 gauge
+    static const int kMaxHistograms = 1024;
+
+    ~ThreadMetricCells();
+
+    // 本线程的单元，第一次调用时创建并登记到 MetricsRegistry
+    static ThreadMetricCells *local() {
+        return t_cells ? t_cells : create();
+    }
+
+    std::atomic<int64_t> &scalar(int id) {
+        std::atomic<int64_t> *block = scalarBlocks_[id >> kBlockBits].load(std::memory_order_acquire);
+        if (!block) {
+            block = allocScalarBlock(id >> kBlockBits);
+        }
+        return block[id & (kBlockSize - 1)];
+    }
+
+    LogLinearHistogram &histogram(int id) {
+        LogLinearHistogram *histogram = histograms_[id].load(std::memory_order_acquire);
+        if (!histogram) {
+            histogram = allocHistogram(id);
+        }
+        return *histogram;
+    }
+
+    // 读取方使用，本线程还没有用过该指标时返回 0 / NULL
+    int64_t readScalar(int id) const;
+    const LogLinearHistogram *readHistogram(int id) const;
+
+private:
+    ThreadMetricCells();
+
+    static ThreadMetricCells *create();
+
+    // 线程退出时执行，把本线程的单元交给 MetricsRegistry 汇总后释放
+    struct Retirer {
+        ~Retirer();
+    };
+
+    std::atomic<int64_t> *allocScalarBlock(int block);
+    LogLinearHistogram *allocHistogram(int id);
+
+    static thread_local ThreadMetricCells *t_cells;
+    static thread_local bool t_retired; // 已经退役后（其他 thread_local 析构时）又记录的单元不再退役
+
+    std::atomic<std::atomic<int64_t> *> scalarBlocks_[kMaxBlocks];
+    std::atomic<LogLinearHistogram *> histograms_[kMaxHistograms];
+};
+
+// 单调递增的计数器，例如收到的字节数、处理的请求数
+class Counter {
+public:
+    void inc(int64_t n = 1) {
+        std::atomic<int64_t> &cell = ThreadMetricCells::local()->scalar(id_);
+        cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    const std::string &name() const { return name_; }
+
+private:
+    friend class MetricsRegistry;
+
+    Counter(const std::string &name, int id) : name_(name), id_(id) {}
+
+    const std::string name_;
+    const int id_;
+};
+
+/**
+ * 可增可减的量，例如当前连接数。各线程分别累加增量，读取时求和，
+ * 所以在 A 线程 add(1)、B 线程 sub(1) 也能得到正确的总数
+ */
+class Gauge {
+public:
+    void add(int64_t n) {
+        std::atomic<int64_t> &cell = ThreadMetricCells::local()->scalar(id_);
+        cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void sub(int64_t n) { add(-n); }
+
+    const std::string &name() const { return name_; }
+
+private:
+    friend class MetricsRegistry;
+
+    Gauge(const std::string &name, int id) : name_(name), id_(id) {}
+
+    const std::string name_;
+    const int id_;
+};
+
+// 分布，例如延迟、消息大小
+class Histogram {
+public:
+    void record(int64_t value) { ThreadMetricCells::local()->histogram(id_).record(value); }
+
+    const std::string &name() const { return name_; }
+
+private:
+    friend class MetricsRegistry;
+
+    Histogram(const std::string &name, int id) : name_(name), id_(id) {}
+
+    const std::string name_;
+    const int id_;
+};
+
+struct MetricsSnapshot {
+    int64_t timestampUs = 0;
+    std::map<std::string, int64_t> counters;
+    std::map<std::string, int64_t> gauges;
+    std::map<std::string, LogLinearHistogram::Snapshot> histograms;
+
+    /**
+     * 和更早的快照求差：计数器和直方图变成两次快照之间的增量，gauge 保持当前值，
+     * timestampUs 变成区间长度
+     */
+    MetricsSnapshot diff(const MetricsSnapshot &earlier) const;
+
+    // 计数器在两次快照之间的每秒速率
+    double rate(const std::string &counterName, const MetricsSnapshot &earlier) const;
+};
+
+/**
+ * 进程内全部指标的登记表。
+ *
+ * 指标对象在第一次按名字获取时创建，之后一直存在，返回的指针可以长期保存（通常是静态变量）。
+ * 写入只触碰本线程的单元，没有跨线程共享的缓存行；snapshot() 加锁遍历所有线程的单元求和，
+ * 代价和线程数、指标数成正比，适合秒级的周期采集
+ */
+class MetricsRegistry {
+public:
+    static MetricsRegistry &instance();
+
+    // 同名的指标只创建一次；编号用完时返回 NULL
+    Counter *counter(const std::string &name);
+    Gauge *gauge(const std::string &name);
+    Histogram *histogram(const std::string &name);
+
+    MetricsSnapshot snapshot() const;
+
+private:
+    friend class ThreadMetricCells;
+
+    MetricsRegistry();
+
+    void addThread(ThreadMetricCells *cells);
+
+    // 把退出线程的单元累加进 retiredScalars_/retiredHistograms_，从 threads_ 中移除并释放
+    void retireThread(ThreadMetricCells *cells);
+
+    int64_t retiredScalar(int id) const {
+        return static_cast<size_t>(id) < retiredScalars_.size() ? retiredScalars_[id] : 0;
+    }
+
+    int allocScalarId();
+
+    mutable std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<Counter>> counters_;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges_;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+    int nextScalarId_;
+    int nextHistogramId_;
+    std::vector<std::unique_ptr<ThreadMetricCells>> threads_;
+    std::vector<int64_t> retiredScalars_;                       // 按计数器 / gauge 编号
+    std::vector<LogLinearHistogram::Snapshot> retiredHistograms_; // 按直方图编号，没有样本时 buckets 为空
+};
+
+} // namespace network
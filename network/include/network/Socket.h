@@ -38,6 +38,12 @@ public:
      */
     void setKeepAlive(bool on);
 
+    /**
+     * TCP_USER_TIMEOUT：已发出的数据超过 timeoutMs 毫秒仍未被确认时内核关闭连接，
+     * 读写返回 ETIMEDOUT。0 表示使用内核默认（重传约 15 分钟后才放弃）
+     */
+    void setTcpUserTimeout(int timeoutMs);
+
 private:
     const int sockfd_;
 
@@ -23,9 +23,9 @@ public:
     ~TcpConnection();
 
     EventLoop *getLoop() const { return loop_; }
-    const std::string &name() const { return name_; }
-    const InetAddress &lcoalAddress() const { return localAddr_; }
-    const InetAddress &peerAddress() const { return peerAddr_; }
+    const std::string &name() const { return cold_->name; }
+    const InetAddress &localAddress() const { return cold_->localAddr; }
+    const InetAddress &peerAddress() const { return cold_->peerAddr; }
     bool connected() const { return state_ == kConnected; }
     bool disconnected() const { return state_ == kDisconnected; }
     bool getTcpInfo(struct tcp_info *) const;
@@ -41,20 +41,22 @@ public:
 
     void setTcpNoDelay(bool on);
 
+    void setTcpUserTimeout(int timeoutMs);
+
     void startRead();
 
     void stopRead();
 
     bool isReading() const { return reading_; }
 
-    void setContext(const boost::any &context) { context_ = context; }
+    void setContext(const boost::any &context) { cold_->context = context; }
 
-    const boost::any &getContext() const { return context_; }
+    const boost::any &getContext() const { return cold_->context; }
 
-    boost::any *getMutableContext() { return &context_; }
+    boost::any *getMutableContext() { return &cold_->context; }
 
-    void setConenctionCallback(const ConnectionCallback &cb) {
-        connectionCallback_ = cb;
+    void setConnectionCallback(const ConnectionCallback &cb) {
+        cold_->connectionCallback = cb;
     }
 
     void setMessageCallback(const MessageCallback &cb) {
@@ -69,7 +71,7 @@ public:
 
     Buffer *outputBuffer() { return &outputBuffer_; }
 
-    void setCloseCallback(const CloseCallback &cb) { closeCallback_ = cb; }
+    void setCloseCallback(const CloseCallback &cb) { cold_->closeCallback = cb; }
 
     void connectEstablished();
 
@@ -98,23 +100,38 @@ private:
     void startReadInLoop();
     void stopReadInLoop();
 
+    /**
+     * 只在建立、关闭连接或者打日志时才用到的字段，单独分配一块，
+     * 收发路径上访问的 TcpConnection 本体更小，空闲连接多的时候缓存里放得下更多活跃连接
+     */
+    struct ColdFields {
+        ColdFields(const std::string &nameArg, const InetAddress &localAddrArg,
+                   const InetAddress &peerAddrArg)
+            : name(nameArg),
+            localAddr(localAddrArg),
+            peerAddr(peerAddrArg) {}
+
+        const std::string name;
+        const InetAddress localAddr;
+        const InetAddress peerAddr;
+        ConnectionCallback connectionCallback;
+        CloseCallback closeCallback;
+        boost::any context;
+    };
+
     EventLoop *loop_;
-    const std::string name_;
     StateE state_;
     bool reading_;
     std::unique_ptr<Socket> socket_;
-    std::unique_ptr<Channel channel_;
-    const InetAddress localAddr_;
-    const InetAddress peerAddr_;
+    std::unique_ptr<Channel> channel_;
+    std::unique_ptr<ColdFields> cold_;
 
-    ConnectionCallback connectionCallback_;
     MessageCallback messageCallback_;
     WriteCompleteCallback writeCompleteCallback_;
-    CloseCallback closeCallback_;
 
+    // 两个 Buffer 都是 kLazy 的，没有数据时不持有内存，读完、写完之后 release() 还给 BufferPool
     Buffer inputBuffer_;
     Buffer outputBuffer_;
-    boost::any context_;
 };
 
 typedef std::shared_ptr<TcpConnection> TcpConnectionPtr;
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace network {
+
+/**
+ * 固定线程数的工作线程池，用来把耗 CPU 或会阻塞的工作从 IO 线程移走。
+ * 任务队列不限长度，按提交顺序执行；没有启动线程（start(0)）时 run() 直接在调用线程执行。
+ * stop() 之前已经提交的任务全部执行完才返回
+ */
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    explicit ThreadPool(const std::string &name = std::string("ThreadPool"));
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void start(int numThreads);
+    void stop();
+
+    // 可以在任意线程调用
+    void run(Task task);
+
+    size_t queueSize() const;
+
+    const std::string &name() const { return name_; }
+
+private:
+    void runInThread();
+
+    const std::string name_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Task> queue_;
+    std::vector<std::unique_ptr<std::thread>> threads_;
+    bool running_;
+};
+
+} // namespace network
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <set>
+#include <utility>
+
+#include "network/Channel.h"
+
+namespace network {
+
+class EventLoop;
+
+/**
+ * TimerId 是定时器的唯一编号，由 EventLoop::runAt/runAfter/runEvery 返回，
+ * 用于 EventLoop::cancel 取消定时器
+ */
+typedef int64_t TimerId;
+
+/**
+ * TimerQueue 基于 timerfd 实现，和其他 fd 一样注册到所属 EventLoop 的 Poller 上。
+ * timerfd 总是设置为最早到期的那个定时器的时间，到期后在 loop 线程里依次执行回调。
+ * 时间单位是微秒（getNowUs()）。
+ */
+class TimerQueue {
+public:
+    typedef std::function<void()> TimerCallback;
+
+    explicit TimerQueue(EventLoop *loop);
+    ~TimerQueue();
+
+    // 线程安全，可以在任意线程调用；intervalUs > 0 表示周期定时器
+    TimerId addTimer(TimerCallback cb, int64_t whenUs, int64_t intervalUs);
+
+    // 线程安全，取消一个已经执行过或不存在的定时器没有任何效果
+    void cancel(TimerId timerId);
+
+private:
+    struct Timer {
+        TimerCallback callback;
+        int64_t expirationUs;
+        int64_t intervalUs;
+    };
+
+    typedef std::pair<int64_t, TimerId> Entry; // (到期时间, 编号)，按到期时间排序
+
+    void addTimerInLoop(TimerId timerId, const Timer &timer);
+    void cancelInLoop(TimerId timerId);
+    void handleRead();
+    void resetTimerfd();
+
+    EventLoop *loop_;
+    const int timerfd_;
+    Channel timerfdChannel_;
+    std::atomic<int64_t> nextId_;
+
+    std::set<Entry> timers_;
+    std::map<TimerId, Timer> activeTimers_;
+    bool callingExpiredTimers_;
+    std::set<TimerId> cancelingTimers_; // 在回调里取消的周期定时器，不再重新加入
+};
+
+} // namespace network
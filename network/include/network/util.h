@@ -10,6 +10,8 @@ namespace network {
 
     int64_t getNowMs();
 
+    int64_t getNowUs();
+
     int32_t getInt32FromNetByte(const char *buf);
     
 } // namespace network
\ No newline at end of file
@@ -0,0 +1,404 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+#include "network/AsyncLogging.h"
+#include "network/Metrics.h"
+#include "network/util.h"
+
+namespace network {
+
+const size_t AsyncLogging::kDefaultStagingBytes;
+const int AsyncLogging::kDefaultFlushIntervalMs;
+
+namespace {
+
+const size_t kMaxHeaderLen = 256;
+const size_t kBatchReserveBytes = 1024 * 1024;
+
+std::atomic<uint64_t> g_nextLoggerId(1);
+
+Counter *droppedCounter() {
+    static Counter *counter = MetricsRegistry::instance().counter("log.dropped");
+    return counter;
+}
+
+/**
+ * 本线程正在使用的暂存区。owner 是 AsyncLogging 的编号，换了实例之后重新登记；
+ * 线程退出时把暂存区标记为废弃，由后台线程读完后释放
+ */
+struct LocalStaging {
+    uint64_t owner = 0;
+    std::shared_ptr<LogStaging> staging;
+
+    ~LocalStaging();
+};
+
+// 平凡类型，LocalStaging 析构之后线程里再有日志时用它判断，直接丢弃
+thread_local bool t_stagingDestroyed = false;
+thread_local LocalStaging t_localStaging;
+
+LocalStaging::~LocalStaging() {
+    if (staging) {
+        staging->abandon();
+    }
+    t_stagingDestroyed = true;
+}
+
+// 每秒格式化一次 "MMDD HH:MM:SS"
+thread_local time_t t_lastSecond = 0;
+thread_local char t_timeStr[32];
+
+size_t formatHeader(google::LogSeverity severity, const char *baseFilename, int line,
+                    char *buf, size_t size) {
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec != t_lastSecond) {
+        t_lastSecond = tv.tv_sec;
+        struct tm tmTime;
+        localtime_r(&tv.tv_sec, &tmTime);
+        snprintf(t_timeStr, sizeof t_timeStr, "%02d%02d %02d:%02d:%02d", tmTime.tm_mon + 1,
+                 tmTime.tm_mday, tmTime.tm_hour, tmTime.tm_min, tmTime.tm_sec);
+    }
+    const char kSeverityChars[] = "IWEF";
+    char severityChar = severity >= 0 && severity < 4 ? kSeverityChars[severity] : '?';
+    int n = snprintf(buf, size, "%c%s.%06d %5d %s:%d] ", severityChar, t_timeStr,
+                     static_cast<int>(tv.tv_usec), static_cast<int>(getThreadId()),
+                     baseFilename, line);
+    if (n < 0) {
+        return 0;
+    }
+    return std::min(static_cast<size_t>(n), size - 1);
+}
+
+/**
+ * 默认输出：按大小和日期滚动的日志文件，只在后台线程里使用。
+ * 写满 rollSize 字节或者跨过本地时间的零点时换一个新文件，同一秒内不重复滚动
+ */
+class LogFile {
+public:
+    LogFile(const std::string &basename, off_t rollSize)
+        : basename_(basename),
+          rollSize_(rollSize),
+          fd_(-1),
+          written_(0),
+          lastRoll_(0),
+          day_(-1) {}
+
+    ~LogFile() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    void append(const char *data, size_t len) {
+        time_t now = ::time(NULL);
+        struct tm tmTime;
+        localtime_r(&now, &tmTime);
+        int day = tmTime.tm_year * 1000 + tmTime.tm_yday;
+        if ((fd_ < 0 || written_ >= rollSize_ || day != day_) && now > lastRoll_) {
+            roll(now, tmTime, day);
+        }
+        if (fd_ < 0) {
+            return;
+        }
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = ::write(fd_, data + done, len - done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // 不能再走 LOG()，否则会写回自己的暂存区
+                fprintf(stderr, "AsyncLogging write %s failed: %s\n", filename_.c_str(),
+                        strerror(errno));
+                break;
+            }
+            done += n;
+        }
+        written_ += done;
+    }
+
+private:
+    void roll(time_t now, const struct tm &tmTime, int day) {
+        char timebuf[32];
+        strftime(timebuf, sizeof timebuf, ".%Y%m%d-%H%M%S.", &tmTime);
+        char hostname[256];
+        if (::gethostname(hostname, sizeof hostname) != 0) {
+            strcpy(hostname, "unknownhost");
+        }
+        hostname[sizeof hostname - 1] = '\0';
+        char pidbuf[32];
+        snprintf(pidbuf, sizeof pidbuf, ".%d.log", static_cast<int>(getPid()));
+        std::string filename = basename_ + timebuf + hostname + pidbuf;
+
+        int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "AsyncLogging open %s failed: %s\n", filename.c_str(), strerror(errno));
+            return;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        fd_ = fd;
+        filename_ = filename;
+        written_ = 0;
+        lastRoll_ = now;
+        day_ = day;
+    }
+
+    const std::string basename_;
+    const off_t rollSize_;
+    int fd_;
+    std::string filename_;
+    off_t written_;
+    time_t lastRoll_;
+    int day_;
+};
+
+} // namespace
+
+LogStaging::LogStaging(size_t capacity, pid_t tid)
+    : capacity_(capacity),
+      tid_(tid),
+      data_(new char[capacity]),
+      head_(0),
+      dropped_(0),
+      tail_(0),
+      reportedDropped_(0),
+      abandoned_(false) {
+    assert((capacity & (capacity - 1)) == 0);
+}
+
+void LogStaging::copyIn(uint64_t pos, const char *data, size_t len) {
+    size_t offset = static_cast<size_t>(pos & (capacity_ - 1));
+    size_t first = std::min(len, capacity_ - offset);
+    memcpy(data_.get() + offset, data, first);
+    memcpy(data_.get(), data + first, len - first);
+}
+
+size_t LogStaging::append(const char *header, size_t headerLen,
+                          const char *message, size_t messageLen) {
+    size_t len = headerLen + messageLen + 1;
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    size_t used = static_cast<size_t>(head - tail);
+    if (len > capacity_ - used) {
+        dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return 0;
+    }
+    copyIn(head, header, headerLen);
+    copyIn(head + headerLen, message, messageLen);
+    copyIn(head + headerLen + messageLen, "\n", 1);
+    head_.store(head + len, std::memory_order_release);
+    return used + len;
+}
+
+size_t LogStaging::drainTo(std::string *out) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    size_t len = static_cast<size_t>(head - tail);
+    if (len == 0) {
+        return 0;
+    }
+    size_t offset = static_cast<size_t>(tail & (capacity_ - 1));
+    size_t first = std::min(len, capacity_ - offset);
+    out->append(data_.get() + offset, first);
+    out->append(data_.get(), len - first);
+    tail_.store(head, std::memory_order_release);
+    return len;
+}
+
+int64_t LogStaging::takeDropped() {
+    int64_t total = dropped_.load(std::memory_order_relaxed);
+    int64_t delta = total - reportedDropped_;
+    reportedDropped_ = total;
+    return delta;
+}
+
+AsyncLogging::AsyncLogging(const std::string &basename, off_t rollSize, int flushIntervalMs)
+    : id_(g_nextLoggerId.fetch_add(1)),
+      flushIntervalMs_(flushIntervalMs),
+      stagingBytes_(kDefaultStagingBytes),
+      disableGlogFiles_(true),
+      running_(false),
+      flushRequests_(0),
+      flushedRequests_(0) {
+    std::shared_ptr<LogFile> file = std::make_shared<LogFile>(basename, rollSize);
+    output_ = [file](const char *data, size_t len) { file->append(data, len); };
+}
+
+AsyncLogging::~AsyncLogging() {
+    stop();
+}
+
+void AsyncLogging::setOutput(const OutputFunc &output) {
+    assert(!thread_);
+    output_ = output;
+}
+
+void AsyncLogging::setStagingBytes(size_t bytes) {
+    assert(!thread_);
+    // 向上取到 2 的幂，环形下标用掩码计算
+    size_t capacity = 4096;
+    while (capacity < bytes) {
+        capacity <<= 1;
+    }
+    stagingBytes_ = capacity;
+}
+
+void AsyncLogging::setDisableGlogFiles(bool disable) {
+    assert(!thread_);
+    disableGlogFiles_ = disable;
+}
+
+void AsyncLogging::start() {
+    assert(!thread_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = true;
+    }
+    thread_.reset(new std::thread(std::bind(&AsyncLogging::threadFunc, this)));
+    if (disableGlogFiles_) {
+        for (int severity = google::GLOG_INFO; severity < google::NUM_SEVERITIES; ++severity) {
+            google::SetLogDestination(severity, "");
+        }
+    }
+    google::AddLogSink(this);
+}
+
+void AsyncLogging::stop() {
+    if (!thread_) {
+        return;
+    }
+    // 先摘掉 sink，RemoveLogSink 返回后不会再有线程进入 send()
+    google::RemoveLogSink(this);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_one();
+    thread_->join();
+    thread_.reset();
+}
+
+void AsyncLogging::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!running_) {
+        return;
+    }
+    uint64_t target = ++flushRequests_;
+    cv_.notify_one();
+    flushedCv_.wait(lock, [this, target]() { return flushedRequests_ >= target || !running_; });
+}
+
+void AsyncLogging::send(google::LogSeverity severity, const char *fullFilename,
+                        const char *baseFilename, int line, const struct ::tm *tmTime,
+                        const char *message, size_t messageLen) {
+    (void)fullFilename;
+    (void)tmTime;
+    LogStaging *staging = localStaging();
+    if (!staging) {
+        return;
+    }
+    char header[kMaxHeaderLen];
+    size_t headerLen = formatHeader(severity, baseFilename, line, header, sizeof header);
+    // 单条日志最多占暂存区的 1/4，超出的部分截掉
+    messageLen = std::min(messageLen, staging->capacity() / 4);
+    size_t used = staging->append(header, headerLen, message, messageLen);
+    size_t half = staging->capacity() / 2;
+    if (used == 0) {
+        droppedCounter()->inc();
+    } else if (used >= half && used - (headerLen + messageLen + 1) < half) {
+        // 刚过半时提前唤醒后台线程；不持锁通知，错过的话最多等一个 flushIntervalMs
+        cv_.notify_one();
+    }
+    if (severity == google::GLOG_FATAL) {
+        flush();
+    }
+}
+
+LogStaging *AsyncLogging::localStaging() {
+    if (t_stagingDestroyed) {
+        return NULL;
+    }
+    LocalStaging &local = t_localStaging;
+    if (local.owner != id_) {
+        if (local.staging) {
+            local.staging->abandon();
+        }
+        local.staging = std::make_shared<LogStaging>(stagingBytes_, getThreadId());
+        local.owner = id_;
+        std::lock_guard<std::mutex> lock(stagingMutex_);
+        stagings_.push_back(local.staging);
+    }
+    return local.staging.get();
+}
+
+void AsyncLogging::collect(std::string *batch) {
+    std::lock_guard<std::mutex> lock(stagingMutex_);
+    for (auto it = stagings_.begin(); it != stagings_.end();) {
+        LogStaging *staging = it->get();
+        // 先读废弃标记再读数据，线程退出前写入的日志不会漏掉
+        bool abandoned = staging->abandoned();
+        staging->drainTo(batch);
+        int64_t dropped = staging->takeDropped();
+        if (dropped > 0) {
+            char header[kMaxHeaderLen];
+            size_t headerLen = formatHeader(google::GLOG_WARNING, "AsyncLogging.cc", __LINE__,
+                                            header, sizeof header);
+            char notice[128];
+            snprintf(notice, sizeof notice, "dropped %lld log messages from thread %d\n",
+                     static_cast<long long>(dropped), static_cast<int>(staging->tid()));
+            batch->append(header, headerLen);
+            batch->append(notice);
+        }
+        if (abandoned) {
+            it = stagings_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void AsyncLogging::threadFunc() {
+    std::string batch;
+    batch.reserve(kBatchReserveBytes);
+    bool running = true;
+    while (running) {
+        uint64_t requests = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (running_ && flushRequests_ == flushedRequests_) {
+                cv_.wait_for(lock, std::chrono::milliseconds(flushIntervalMs_));
+            }
+            running = running_;
+            requests = flushRequests_;
+        }
+
+        // 收集和写出都不持有 mutex_，磁盘卡住时 flush() 以外的调用不受影响
+        collect(&batch);
+        if (!batch.empty()) {
+            output_(batch.data(), batch.size());
+            batch.clear();
+        }
+        if (batch.capacity() > 4 * kBatchReserveBytes) {
+            std::string().swap(batch);
+            batch.reserve(kBatchReserveBytes);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            flushedRequests_ = requests;
+        }
+        flushedCv_.notify_all();
+    }
+}
+
+} // namespace network
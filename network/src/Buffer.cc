@@ -1,7 +1,9 @@
 #include <errno.h>
 #include <sys/uio.h>
+#include <atomic>
 
 #include "network/Buffer.h"
+#include "network/Metrics.h"
 #include "network/SocketsOps.h"
 
 namespace network {
@@ -10,16 +12,155 @@ const char Buffer::kCRLF[] = "\r\n";
 
 const size_t Buffer::kCheapPrepend;
 const size_t Buffer::kInitialSize;
+const uint32_t Buffer::kShrinkRounds;
+const size_t Buffer::kShrinkWatermarkDivisor;
+const int64_t BufferMemory::kFlushBytes;
+
+namespace {
+
+std::atomic<int64_t> g_totalBytes(0);
+std::atomic<int64_t> g_softLimitBytes(0);
+std::atomic<int64_t> g_hardLimitBytes(0);
+
+// 本线程还没有加到 g_totalBytes 上的增减量；平凡类型，线程退出的任何阶段都可以访问
+thread_local int64_t t_pendingBytes = 0;
+
+Gauge *bufferBytesGauge() {
+    // 函数内静态变量，其他编译单元静态初始化时创建的 Buffer 也能安全记账
+    static Gauge *gauge = MetricsRegistry::instance().gauge("net.buffer_bytes");
+    return gauge;
+}
+
+void flushPendingBytes() {
+    if (t_pendingBytes != 0) {
+        g_totalBytes.fetch_add(t_pendingBytes, std::memory_order_relaxed);
+        bufferBytesGauge()->add(t_pendingBytes);
+        t_pendingBytes = 0;
+    }
+}
+
+/**
+ * 每个线程一个的空闲内存块池，块的大小固定为 kCheapPrepend + kInitialSize。
+ * 连接的 Buffer 只在所属 loop 线程里读写，取和还都落在同一个线程的池里，不需要加锁；
+ * 池里最多保留 kMaxBlocks 块，多出来的、以及 BufferMemory 超过软上限时还回来的直接释放
+ */
+class BufferPool {
+public:
+    static const size_t kBlockSize = Buffer::kCheapPrepend + Buffer::kInitialSize;
+    static const size_t kMaxBlocks = 64;
+
+    // 线程退出时释放空闲块，并把本线程没有上报的增减量加到总数上
+    ~BufferPool() {
+        blocks_.clear();
+        flushPendingBytes();
+    }
+
+    void take(Buffer::Storage *block) {
+        if (blocks_.empty()) {
+            block->resize(kBlockSize);
+        } else {
+            block->swap(blocks_.back());
+            blocks_.pop_back();
+        }
+    }
+
+    void give(Buffer::Storage *block) {
+        if (blocks_.size() < kMaxBlocks && !BufferMemory::overSoftLimit()) {
+            blocks_.push_back(Buffer::Storage());
+            blocks_.back().swap(*block);
+        } else {
+            Buffer::Storage().swap(*block);
+        }
+    }
+
+    static BufferPool &local() {
+        static thread_local BufferPool pool;
+        return pool;
+    }
+
+private:
+    std::vector<Buffer::Storage> blocks_;
+};
+
+} // namespace
+
+void BufferMemory::setLimits(int64_t softLimitBytes, int64_t hardLimitBytes) {
+    g_softLimitBytes.store(softLimitBytes, std::memory_order_relaxed);
+    g_hardLimitBytes.store(hardLimitBytes, std::memory_order_relaxed);
+}
+
+int64_t BufferMemory::totalBytes() {
+    return g_totalBytes.load(std::memory_order_relaxed);
+}
+
+bool BufferMemory::overSoftLimit() {
+    int64_t limit = g_softLimitBytes.load(std::memory_order_relaxed);
+    return limit > 0 && totalBytes() > limit;
+}
+
+bool BufferMemory::wouldExceedHardLimit(int64_t bytes) {
+    int64_t limit = g_hardLimitBytes.load(std::memory_order_relaxed);
+    return limit > 0 && totalBytes() + bytes > limit;
+}
+
+void BufferMemory::add(int64_t delta) {
+    t_pendingBytes += delta;
+    if (t_pendingBytes > kFlushBytes || t_pendingBytes < -kFlushBytes) {
+        flushPendingBytes();
+    }
+}
+
+void Buffer::allocate(size_t len) {
+    assert(buffer_.empty());
+    if (len <= kInitialSize) {
+        BufferPool::local().take(&buffer_);
+    } else {
+        buffer_.resize(kCheapPrepend + len);
+    }
+    readerIndex_ = kCheapPrepend;
+    writerIndex_ = kCheapPrepend;
+    highWater_ = kCheapPrepend;
+}
+
+void Buffer::release() {
+    if (readableBytes() != 0 || buffer_.empty()) {
+        return;
+    }
+    bool drop = false;
+    if (buffer_.capacity() == BufferPool::kBlockSize) {
+        BufferPool::local().give(&buffer_);
+        drop = true;
+    } else if (BufferMemory::overSoftLimit()) {
+        drop = true;
+    } else {
+        lowUsageRounds_ = highWater_ < buffer_.size() / kShrinkWatermarkDivisor ? lowUsageRounds_ + 1 : 0;
+        drop = lowUsageRounds_ >= kShrinkRounds;
+    }
+
+    if (drop) {
+        Storage().swap(buffer_);
+        readerIndex_ = 0;
+        writerIndex_ = 0;
+        highWater_ = 0;
+        lowUsageRounds_ = 0;
+    } else {
+        highWater_ = static_cast<uint32_t>(writerIndex_);
+    }
+}
 
 ssize_t Buffer::readFd(int fd, int *savedErrno) {
 
     /**
      * 定义一个大小为 1MB 的额外缓冲区，用于处理 Buffer 可写空间不足的情况
      * 定义一个 iovec 结构体数组，用于 readv 系统调用
-     * 获取 Buffer 当前的可写字节数
+     * 获取 Buffer 当前的可写字节数；还没有内存时先从 BufferPool 取一块，
+     * 这样小消息直接读进 Buffer，不用再从 extrabuf 复制一次
      */
     char extrabuf[1024 * 1024];
     struct iovec vec[2];
+    if (buffer_.empty()) {
+        allocate(kInitialSize);
+    }
     const size_t writable = writableBytes();
 
     /**
@@ -48,7 +189,7 @@ ssize_t Buffer::readFd(int fd, int *savedErrno) {
     if (n < 0) {
         *savedErrno = errno;
     } else if (size_t(n) <= writable) {
-        writerIndex_ += n;
+        hasWritten(n);
     } else {
         writerIndex_ = buffer_.size();
         append(extrabuf, n - writable);
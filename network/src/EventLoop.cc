@@ -9,6 +9,7 @@
 #include "network/Channel.h"
 #include "network/Poller.h"
 #include "network/SocketsOps.h"
+#include "network/TimerQueue.h"
 
 using namespace network;
 
@@ -22,6 +23,10 @@ namespace network {
 static thread_local EventLoop *t_loopInThisThread = nullptr;
 const int kPollTimeMs = 10000;
 
+// 所有存活的 EventLoop 的线程 tid，只在构造、析构和诊断时访问
+std::mutex g_loopThreadsMutex;
+std::vector<pid_t> g_loopThreads;
+
 /**
  * createEventfd 函数用于创建一个事件文件描述符（eventfd），
  * 并设置为非阻塞和在执行 exec 时关闭
@@ -45,6 +50,11 @@ EventLoop *EventLoop::getEventLoopOfCurrentThread() {
     return t_loopInThisThread;
 }
 
+std::vector<pid_t> EventLoop::loopThreadIds() {
+    std::unique_lock<std::mutex> lock(g_loopThreadsMutex);
+    return g_loopThreads;
+}
+
 EventLoop::EventLoop()
     : looping_(false),
     quit_(false),
@@ -52,6 +62,7 @@ EventLoop::EventLoop()
     callingPendingFunctors_(false),
     iteration_(0),
     poller_(new Poller(this)),
+    timerQueue_(new TimerQueue(this)),
     wakeupFd_(createEventfd()), 
     wakeupChannel_(new Channel(this, wakeupFd_)),
     currentActiveChannel_(NULL) {
@@ -76,6 +87,9 @@ EventLoop::EventLoop()
     wakeupChannel_->setReadCallback(std::bind(&EventLoop::handleRead, this));
     wakeupChannel_->enableReading();
     threadId_ = getThreadId();
+
+    std::unique_lock<std::mutex> lock(g_loopThreadsMutex);
+    g_loopThreads.push_back(threadId_);
 }
 
 EventLoop::~EventLoop() {
@@ -83,6 +97,9 @@ EventLoop::~EventLoop() {
     wakeupChannel_->remove();
     ::close(wakeupFd_);
     t_loopInThisThread = NULL;
+
+    std::unique_lock<std::mutex> lock(g_loopThreadsMutex);
+    g_loopThreads.erase(std::find(g_loopThreads.begin(), g_loopThreads.end(), threadId_));
 }
 
 void EventLoop::loop() {
@@ -172,6 +189,27 @@ ssize_t EventLoop::queueSize() const {
     return pendingFunctors_.size();
 }
 
+/**
+ * 定时器接口都转发给 TimerQueue，时间统一换算成微秒
+ */
+TimerId EventLoop::runAt(int64_t whenUs, Functor cb) {
+    return timerQueue_->addTimer(std::move(cb), whenUs, 0);
+}
+
+TimerId EventLoop::runAfter(double delay, Functor cb) {
+    int64_t delayUs = static_cast<int64_t>(delay * 1000000);
+    return runAt(getNowUs() + delayUs, std::move(cb));
+}
+
+TimerId EventLoop::runEvery(double interval, Functor cb) {
+    int64_t intervalUs = static_cast<int64_t>(interval * 1000000);
+    return timerQueue_->addTimer(std::move(cb), getNowUs() + intervalUs, intervalUs);
+}
+
+void EventLoop::cancel(TimerId timerId) {
+    timerQueue_->cancel(timerId);
+}
+
 /**
  * updateChannel 函数用于更新通道的事件监听状态，
  * 调用 Poller 的 updateChannel 函数
@@ -0,0 +1,327 @@
+#include <algorithm>
+
+#include "network/Metrics.h"
+#include "network/util.h"
+
+using namespace network;
+
+const int LogLinearHistogram::kSubBucketBits;
+const int LogLinearHistogram::kSubBuckets;
+const int LogLinearHistogram::kMaxExponent;
+const int LogLinearHistogram::kNumBuckets;
+
+LogLinearHistogram::LogLinearHistogram()
+    : count_(0),
+    sum_(0),
+    max_(0) {
+    for (std::atomic<int64_t> &bucket : buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+int64_t LogLinearHistogram::lowerBound(int bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+    int exponent = bucket / kSubBuckets + kSubBucketBits - 1;
+    int sub = bucket % kSubBuckets;
+    return static_cast<int64_t>(kSubBuckets + sub) << (exponent - kSubBucketBits);
+}
+
+int64_t LogLinearHistogram::upperBound(int bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket + 1;
+    }
+    int exponent = bucket / kSubBuckets + kSubBucketBits - 1;
+    return lowerBound(bucket) + (static_cast<int64_t>(1) << (exponent - kSubBucketBits));
+}
+
+LogLinearHistogram::Snapshot LogLinearHistogram::snapshot() const {
+    Snapshot result;
+    result.buckets.resize(kNumBuckets);
+    for (int i = 0; i < kNumBuckets; ++i) {
+        result.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+    result.count = count_.load(std::memory_order_relaxed);
+    result.sum = sum_.load(std::memory_order_relaxed);
+    result.max = max_.load(std::memory_order_relaxed);
+    return result;
+}
+
+void LogLinearHistogram::Snapshot::merge(const Snapshot &other) {
+    if (buckets.size() < other.buckets.size()) {
+        buckets.resize(other.buckets.size());
+    }
+    for (size_t i = 0; i < other.buckets.size(); ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
+
+void LogLinearHistogram::Snapshot::subtract(const Snapshot &earlier) {
+    for (size_t i = 0; i < buckets.size() && i < earlier.buckets.size(); ++i) {
+        buckets[i] -= earlier.buckets[i];
+    }
+    count -= earlier.count;
+    sum -= earlier.sum;
+}
+
+/**
+ * 快照是逐个桶读出来的，桶的总和可能和 count 略有出入，这里以桶的总和为准
+ */
+int64_t LogLinearHistogram::Snapshot::percentile(double p) const {
+    int64_t total = 0;
+    for (int64_t n : buckets) {
+        total += n;
+    }
+    if (total <= 0) {
+        return 0;
+    }
+    int64_t rank = static_cast<int64_t>(p / 100.0 * (total - 1)) + 1;
+    int64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            int bucket = static_cast<int>(i);
+            int64_t mid = (lowerBound(bucket) + upperBound(bucket) - 1) / 2;
+            return std::min(mid, max);
+        }
+    }
+    return max;
+}
+
+const int ThreadMetricCells::kBlockBits;
+const int ThreadMetricCells::kBlockSize;
+const int ThreadMetricCells::kMaxBlocks;
+const int ThreadMetricCells::kMaxHistograms;
+
+thread_local ThreadMetricCells *ThreadMetricCells::t_cells = NULL;
+thread_local bool ThreadMetricCells::t_retired = false;
+
+ThreadMetricCells::ThreadMetricCells() {
+    for (auto &block : scalarBlocks_) {
+        block.store(NULL, std::memory_order_relaxed);
+    }
+    for (auto &histogram : histograms_) {
+        histogram.store(NULL, std::memory_order_relaxed);
+    }
+}
+
+ThreadMetricCells::~ThreadMetricCells() {
+    for (auto &block : scalarBlocks_) {
+        delete[] block.load(std::memory_order_relaxed);
+    }
+    for (auto &histogram : histograms_) {
+        delete histogram.load(std::memory_order_relaxed);
+    }
+}
+
+/**
+ * 单元由 MetricsRegistry 持有，thread_local 里只存一个裸指针，记录时不用经过 TLS 析构的登记检查；
+ * 另一个带析构函数的 thread_local（Retirer）在线程退出时把单元交还登记表汇总。
+ * Retirer 析构之后其他 thread_local 的析构函数里又记录指标时，新建的单元一直留在登记表里
+ */
+ThreadMetricCells *ThreadMetricCells::create() {
+    ThreadMetricCells *cells = new ThreadMetricCells;
+    MetricsRegistry::instance().addThread(cells);
+    t_cells = cells;
+    if (!t_retired) {
+        static thread_local Retirer retirer;
+        (void)retirer;
+    }
+    return cells;
+}
+
+ThreadMetricCells::Retirer::~Retirer() {
+    if (t_cells) {
+        MetricsRegistry::instance().retireThread(t_cells);
+        t_cells = NULL;
+    }
+    t_retired = true;
+}
+
+std::atomic<int64_t> *ThreadMetricCells::allocScalarBlock(int block) {
+    std::atomic<int64_t> *cells = new std::atomic<int64_t>[kBlockSize];
+    for (int i = 0; i < kBlockSize; ++i) {
+        cells[i].store(0, std::memory_order_relaxed);
+    }
+    scalarBlocks_[block].store(cells, std::memory_order_release);
+    return cells;
+}
+
+LogLinearHistogram *ThreadMetricCells::allocHistogram(int id) {
+    LogLinearHistogram *histogram = new LogLinearHistogram;
+    histograms_[id].store(histogram, std::memory_order_release);
+    return histogram;
+}
+
+int64_t ThreadMetricCells::readScalar(int id) const {
+    std::atomic<int64_t> *block = scalarBlocks_[id >> kBlockBits].load(std::memory_order_acquire);
+    return block ? block[id & (kBlockSize - 1)].load(std::memory_order_relaxed) : 0;
+}
+
+const LogLinearHistogram *ThreadMetricCells::readHistogram(int id) const {
+    return histograms_[id].load(std::memory_order_acquire);
+}
+
+MetricsSnapshot MetricsSnapshot::diff(const MetricsSnapshot &earlier) const {
+    MetricsSnapshot result = *this;
+    result.timestampUs = timestampUs - earlier.timestampUs;
+    for (auto &item : result.counters) {
+        auto it = earlier.counters.find(item.first);
+        if (it != earlier.counters.end()) {
+            item.second -= it->second;
+        }
+    }
+    for (auto &item : result.histograms) {
+        auto it = earlier.histograms.find(item.first);
+        if (it != earlier.histograms.end()) {
+            item.second.subtract(it->second);
+        }
+    }
+    return result;
+}
+
+double MetricsSnapshot::rate(const std::string &counterName, const MetricsSnapshot &earlier) const {
+    auto now = counters.find(counterName);
+    if (now == counters.end() || timestampUs <= earlier.timestampUs) {
+        return 0;
+    }
+    auto before = earlier.counters.find(counterName);
+    int64_t delta = now->second - (before == earlier.counters.end() ? 0 : before->second);
+    return delta * 1000000.0 / (timestampUs - earlier.timestampUs);
+}
+
+MetricsRegistry::MetricsRegistry()
+    : nextScalarId_(0),
+    nextHistogramId_(0) {}
+
+/**
+ * 登记表本身不析构：退出阶段仍可能有线程在记录指标
+ */
+MetricsRegistry &MetricsRegistry::instance() {
+    static MetricsRegistry *registry = new MetricsRegistry;
+    return *registry;
+}
+
+void MetricsRegistry::addThread(ThreadMetricCells *cells) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    threads_.emplace_back(cells);
+}
+
+/**
+ * 在退出的线程里执行，此后没有线程再写这些单元，可以直接读出累加；
+ * gauge 也按各线程的增减累加，所以退出线程留下的净值同样要保留
+ */
+void MetricsRegistry::retireThread(ThreadMetricCells *cells) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (retiredScalars_.size() < static_cast<size_t>(nextScalarId_)) {
+        retiredScalars_.resize(nextScalarId_, 0);
+    }
+    for (int id = 0; id < nextScalarId_; ++id) {
+        retiredScalars_[id] += cells->readScalar(id);
+    }
+    if (retiredHistograms_.size() < static_cast<size_t>(nextHistogramId_)) {
+        retiredHistograms_.resize(nextHistogramId_);
+    }
+    for (int id = 0; id < nextHistogramId_; ++id) {
+        const LogLinearHistogram *histogram = cells->readHistogram(id);
+        if (histogram) {
+            LogLinearHistogram::Snapshot &retired = retiredHistograms_[id];
+            retired.buckets.resize(LogLinearHistogram::kNumBuckets);
+            retired.merge(histogram->snapshot());
+        }
+    }
+    for (auto it = threads_.begin(); it != threads_.end(); ++it) {
+        if (it->get() == cells) {
+            threads_.erase(it);
+            break;
+        }
+    }
+}
+
+int MetricsRegistry::allocScalarId() {
+    if (nextScalarId_ >= ThreadMetricCells::kMaxBlocks * ThreadMetricCells::kBlockSize) {
+        return -1;
+    }
+    return nextScalarId_++;
+}
+
+Counter *MetricsRegistry::counter(const std::string &name) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_ptr<Counter> &counter = counters_[name];
+    if (!counter) {
+        int id = allocScalarId();
+        if (id < 0) {
+            counters_.erase(name);
+            return NULL;
+        }
+        counter.reset(new Counter(name, id));
+    }
+    return counter.get();
+}
+
+Gauge *MetricsRegistry::gauge(const std::string &name) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_ptr<Gauge> &gauge = gauges_[name];
+    if (!gauge) {
+        int id = allocScalarId();
+        if (id < 0) {
+            gauges_.erase(name);
+            return NULL;
+        }
+        gauge.reset(new Gauge(name, id));
+    }
+    return gauge.get();
+}
+
+Histogram *MetricsRegistry::histogram(const std::string &name) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_ptr<Histogram> &histogram = histograms_[name];
+    if (!histogram) {
+        if (nextHistogramId_ >= ThreadMetricCells::kMaxHistograms) {
+            histograms_.erase(name);
+            return NULL;
+        }
+        histogram.reset(new Histogram(name, nextHistogramId_++));
+    }
+    return histogram.get();
+}
+
+MetricsSnapshot MetricsRegistry::snapshot() const {
+    MetricsSnapshot result;
+    std::unique_lock<std::mutex> lock(mutex_);
+    result.timestampUs = getNowUs();
+    for (const auto &item : counters_) {
+        int64_t total = retiredScalar(item.second->id_);
+        for (const auto &cells : threads_) {
+            total += cells->readScalar(item.second->id_);
+        }
+        result.counters[item.first] = total;
+    }
+    for (const auto &item : gauges_) {
+        int64_t total = retiredScalar(item.second->id_);
+        for (const auto &cells : threads_) {
+            total += cells->readScalar(item.second->id_);
+        }
+        result.gauges[item.first] = total;
+    }
+    for (const auto &item : histograms_) {
+        LogLinearHistogram::Snapshot &merged = result.histograms[item.first];
+        merged.buckets.resize(LogLinearHistogram::kNumBuckets);
+        int id = item.second->id_;
+        if (static_cast<size_t>(id) < retiredHistograms_.size() &&
+            !retiredHistograms_[id].buckets.empty()) {
+            merged.merge(retiredHistograms_[id]);
+        }
+        for (const auto &cells : threads_) {
+            const LogLinearHistogram *histogram = cells->readHistogram(id);
+            if (histogram) {
+                merged.merge(histogram->snapshot());
+            }
+        }
+    }
+    return result;
+}
@@ -142,4 +142,22 @@ void Socket::setKeepAlive(bool on) {
                     static_cast<socklen_t>(sizeof optval));
 }
 
+// setTcpUserTimeout 函数：
+// 使用 setsockopt 系统调用设置 TCP_USER_TIMEOUT 选项，
+// 对端不再确认数据时尽快断开，系统不支持时记录错误信息
+void Socket::setTcpUserTimeout(int timeoutMs) {
+#ifdef TCP_USER_TIMEOUT
+    unsigned int optval = timeoutMs > 0 ? static_cast<unsigned int>(timeoutMs) : 0;
+    int ret = ::setsockopt(sockfd_, IPPROTO_TCP, TCP_USER_TIMEOUT, &optval,
+                            static_cast<socklen_t>(sizeof optval));
+    if (ret < 0) {
+        LOG(ERROR) << "TCP_USER_TIMEOUT failed.";
+    }
+#else
+    if (timeoutMs > 0) {
+        LOG(ERROR) << "TCP_USER_TIMEOUT is not supported.";
+    }
+#endif
+}
+
 } // namespace network
\ No newline at end of file
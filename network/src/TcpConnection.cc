@@ -7,10 +7,20 @@
 #include "network/TcpConnection.h"
 #include "network/Channel.h"
 #include "netwrok/EventLoop.h"
+#include "network/Metrics.h"
 #include "network/Socket.h"
 #include "network/SocketOps.h"
 
 using namespace network;
+
+namespace {
+
+// 所有连接共用的网络层指标，写入只触碰本线程的计数单元
+Counter *const g_bytesRead = MetricsRegistry::instance().counter("net.bytes_read");
+Counter *const g_bytesWritten = MetricsRegistry::instance().counter("net.bytes_written");
+Gauge *const g_connections = MetricsRegistry::instance().gauge("net.connections");
+
+} // namespace
 namespace network {
 
 /**
@@ -35,18 +45,18 @@ TcpConnection::TcpConnection(EventLoop *loop, const std::string &nameArg,
                             int sockfd, const InetAddress &localAddr, 
                             const InetAddress &peerAddr)
     : loop_(CHECK_NOTNULL(loop)),
-    name_(nameArg),
     state_(kConnecting),
     reading_(true),
     socket_(new Socket(sockfd)),
     channel_(new Channel(loop, sockfd)),
-    localAddr_(localAddr),
-    peerAddr_(peerAddr) {
+    cold_(new ColdFields(nameArg, localAddr, peerAddr)),
+    inputBuffer_(Buffer::kLazy),
+    outputBuffer_(Buffer::kLazy) {
     channel_->setReadCallback(std::bind(&TcpConnection::handleRead, this));
     channel_->setWriteCallback(std::bind(&TcpConnection::handleWrite, this));
     channel_->setCloseCallback(std::bind(&TcpConnection::handleClose, this));
     channel_->setErrorCallback(std::bind(&TcpConnection::handleError, this));
-    LOG(INFO) << " TcpConnection::ctor[ " << name << "] at " << this
+    LOG(INFO) << " TcpConnection::ctor[ " << name() << "] at " << this
                 << " fd = " << sockfd;
     socket_->setKeepAlive(true);
 }
@@ -55,7 +65,7 @@ TcpConnection::TcpConnection(EventLoop *loop, const std::string &nameArg,
  * 析构函数：记录析构信息，并断言连接状态为 kDisconnected
  */
 TcpConnection::~TcpConnection() {
-    LOG(INFO) << " TcpConnection::dtor[ " << name_ << "] at " << this
+    LOG(INFO) << " TcpConnection::dtor[ " << name() << "] at " << this
                 << " fd = " << channel_->fd() << " state = " << stateToString();
     assert(state_ == kDisconnected);
 }
@@ -107,6 +117,7 @@ void TcpConnection::sendInLoop(const void *data, size_t len) {
     if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0) {
         nwrote = sockets::write(channel_->fd(), data, len);
         if (nwrote >= 0) {
+            g_bytesWritten->inc(nwrote);
             remaining = len - nwrote;
             if (remaining == 0 && writeCompleteCallback_) {
                 loop_->queueInLoop(
@@ -209,6 +220,12 @@ const char *TcpCOnnection::stateToString() const {
  */
 void TcpConnection::setTcpNoDelay(bool on) { socket_->setTcpNoDelay(on); }
 
+/**
+ * setTcpUserTimeout：设置 TCP 连接的 TCP_USER_TIMEOUT 选项，
+ * 对端不再确认数据时在 timeoutMs 毫秒后断开，而不是等内核重传十几分钟
+ */
+void TcpConnection::setTcpUserTimeout(int timeoutMs) { socket_->setTcpUserTimeout(timeoutMs); }
+
 /**
  * startRead：在事件循环线程中调用 startReadInLoop 启用读事件
  */
@@ -254,9 +271,10 @@ void TcpConnection::connectEstablished() {
     assert(state_ == kConencting);
     setState(kConencted);
     channel_->enableReading();
+    g_connections->add(1);
 
     // 它的作用是在一个对象内部安全地获取指向自身的 std::shared_ptr 智能指针
-    connectionCallback_(shared_from_this());
+    cold_->connectionCallback(shared_from_this());
 }
 
 /**
@@ -269,8 +287,9 @@ void TcpConnection::connectionDestroyed() {
         setState(kDisconnected);
         channel_->disableAll();
 
-        connectionCallback_(shared_from_this());
+        cold_->connectionCallback(shared_from_this());
     }
+    g_connections->sub(1);
     channel_->remove();
 }
 
@@ -284,8 +303,11 @@ void TcpConnection::handleRead() {
     int savedErrno = 0;
     ssize_t n = inputBuffer_.readFd(channel_->fd(), &savedErrno);
     if (n > 0) {
+        g_bytesRead->inc(n);
         // messageCallback_ 调用的是 RpcChannel::onMessage
         messageCallback_(shared_from_this(), &inputBuffer_);
+        // 消息都处理完了就把内存还回去，空闲连接不占 Buffer 内存
+        inputBuffer_.release();
     } else if (n == 0) {
         handleClose();
     } else {
@@ -308,10 +330,12 @@ void TcpConnection::handleWrite() {
 
         // sockets::write 函数的返回值，表示实际写入到 socket 文件描述符的数据字节数。
         if (n > 0) {
+            g_bytesWritten->inc(n);
 
             // 这个函数的作用是丢弃缓冲区前面 len 字节的数据，并调整读指针。
             outputBuffer_.retrieve(n);
             if (outputBuffer_.readableBytes() == 0) {
+                outputBuffer_.release();
                 channel_->disableWriting();
                 if (writeCompleteCallback_) {
                     loop_->queueInLoop(
@@ -344,8 +368,8 @@ void TcpConnection::handleClose() {
     channel_->disableAll();
 
     TcpConnectionPtr guardThis(shared_from_this());
-    connectionCallback_(guardThis);
-    closeCallback_(guradThis);
+    cold_->connectionCallback(guardThis);
+    cold_->closeCallback(guardThis);
 }
 
 /**
@@ -353,7 +377,7 @@ void TcpConnection::handleClose() {
  */
 void TcpConnection::handleError() {
     int err = sockets::getSocketErro(channel_->fd());
-    LOG(ERROR) << " TcpConnection::handleError [ " << name_
+    LOG(ERROR) << " TcpConnection::handleError [ " << name()
                 << " ] - SO_ERROR = " << err;
 }
 
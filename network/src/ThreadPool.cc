@@ -0,0 +1,72 @@
+#include "network/ThreadPool.h"
+
+#include <cassert>
+
+namespace network {
+
+ThreadPool::ThreadPool(const std::string &name)
+    : name_(name),
+    running_(false) {}
+
+ThreadPool::~ThreadPool() {
+    if (running_) {
+        stop();
+    }
+}
+
+void ThreadPool::start(int numThreads) {
+    assert(threads_.empty());
+    running_ = true;
+    threads_.reserve(numThreads);
+    for (int i = 0; i < numThreads; ++i) {
+        threads_.emplace_back(new std::thread(std::bind(&ThreadPool::runInThread, this)));
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    for (auto &thread : threads_) {
+        thread->join();
+    }
+    threads_.clear();
+}
+
+void ThreadPool::run(Task task) {
+    if (threads_.empty()) {
+        task();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+size_t ThreadPool::queueSize() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+// 队列空了并且已经 stop() 时退出，stop() 之前提交的任务都会执行
+void ThreadPool::runInThread() {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return !queue_.empty() || !running_; });
+            if (queue_.empty()) {
+                return;
+            }
+            task = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace network
@@ -0,0 +1,152 @@
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cassert>
+#include <vector>
+#include <glog/logging.h>
+
+#include "network/TimerQueue.h"
+#include "network/EventLoop.h"
+#include "network/util.h"
+
+using namespace network;
+
+namespace {
+
+/**
+ * 创建一个非阻塞的 timerfd，使用 CLOCK_MONOTONIC，不受系统时间调整的影响
+ */
+int createTimerfd() {
+    int timerfd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerfd < 0) {
+        LOG(FATAL) << " Failed in timerfd_create ";
+    }
+    return timerfd;
+}
+
+/**
+ * timerfd 设置的是相对时间，最少 100 微秒，避免设置为 0 导致定时器被关闭
+ */
+struct timespec howMuchTimeFromNow(int64_t whenUs) {
+    int64_t us = whenUs - getNowUs();
+    if (us < 100) {
+        us = 100;
+    }
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(us / 1000000);
+    ts.tv_nsec = static_cast<long>((us % 1000000) * 1000);
+    return ts;
+}
+
+} // namespace
+
+TimerQueue::TimerQueue(EventLoop *loop)
+    : loop_(loop),
+    timerfd_(createTimerfd()),
+    timerfdChannel_(loop, timerfd_),
+    nextId_(0),
+    callingExpiredTimers_(false) {
+    timerfdChannel_.setReadCallback(std::bind(&TimerQueue::handleRead, this));
+    timerfdChannel_.enableReading();
+}
+
+TimerQueue::~TimerQueue() {
+    timerfdChannel_.disableAll();
+    timerfdChannel_.remove();
+    ::close(timerfd_);
+}
+
+/**
+ * 编号在调用线程里分配，真正的插入操作转到 loop 线程执行，
+ * 这样 timers_ 只会在 loop 线程里被访问，不需要加锁
+ */
+TimerId TimerQueue::addTimer(TimerCallback cb, int64_t whenUs, int64_t intervalUs) {
+    TimerId timerId = nextId_.fetch_add(1) + 1;
+    Timer timer = { std::move(cb), whenUs, intervalUs };
+    loop_->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timerId, timer));
+    return timerId;
+}
+
+void TimerQueue::cancel(TimerId timerId) {
+    loop_->runInLoop(std::bind(&TimerQueue::cancelInLoop, this, timerId));
+}
+
+void TimerQueue::addTimerInLoop(TimerId timerId, const Timer &timer) {
+    loop_->assertInLoopThread();
+    bool earliestChanged = timers_.empty() || timer.expirationUs < timers_.begin()->first;
+    timers_.insert(Entry(timer.expirationUs, timerId));
+    activeTimers_[timerId] = timer;
+    if (earliestChanged) {
+        resetTimerfd();
+    }
+}
+
+void TimerQueue::cancelInLoop(TimerId timerId) {
+    loop_->assertInLoopThread();
+    auto it = activeTimers_.find(timerId);
+    if (it != activeTimers_.end()) {
+        timers_.erase(Entry(it->second.expirationUs, timerId));
+        activeTimers_.erase(it);
+    } else if (callingExpiredTimers_) {
+        // 周期定时器正在执行回调，记下来，回调结束后不再重新加入
+        cancelingTimers_.insert(timerId);
+    }
+}
+
+/**
+ * timerfd 可读说明最早的定时器已经到期：
+ * 先把所有到期的定时器取出来，再依次执行回调，
+ * 周期定时器在回调结束后按新的到期时间重新加入
+ */
+void TimerQueue::handleRead() {
+    loop_->assertInLoopThread();
+    uint64_t howmany = 0;
+    ssize_t n = ::read(timerfd_, &howmany, sizeof howmany);
+    if (n != sizeof howmany) {
+        LOG(ERROR) << " TimerQueue::handleRead() reads " << n << " bytes instead of 8 ";
+    }
+
+    int64_t now = getNowUs();
+    std::vector<std::pair<TimerId, Timer>> expired;
+    while (!timers_.empty() && timers_.begin()->first <= now) {
+        TimerId timerId = timers_.begin()->second;
+        timers_.erase(timers_.begin());
+        auto it = activeTimers_.find(timerId);
+        assert(it != activeTimers_.end());
+        expired.push_back(std::make_pair(timerId, std::move(it->second)));
+        activeTimers_.erase(it);
+    }
+
+    callingExpiredTimers_ = true;
+    cancelingTimers_.clear();
+    for (auto &item : expired) {
+        item.second.callback();
+    }
+    callingExpiredTimers_ = false;
+
+    for (auto &item : expired) {
+        Timer &timer = item.second;
+        if (timer.intervalUs > 0 && cancelingTimers_.count(item.first) == 0) {
+            timer.expirationUs = now + timer.intervalUs;
+            timers_.insert(Entry(timer.expirationUs, item.first));
+            activeTimers_[item.first] = std::move(timer);
+        }
+    }
+
+    resetTimerfd();
+}
+
+/**
+ * 把 timerfd 设置为当前最早的定时器的到期时间；没有定时器时不需要设置
+ */
+void TimerQueue::resetTimerfd() {
+    if (timers_.empty()) {
+        return;
+    }
+    struct itimerspec newValue;
+    memset(&newValue, 0, sizeof newValue);
+    newValue.it_value = howMuchTimeFromNow(timers_.begin()->first);
+    if (::timerfd_settime(timerfd_, 0, &newValue, NULL) != 0) {
+        LOG(ERROR) << " timerfd_settime() ";
+    }
+}
@@ -37,6 +37,14 @@ int64_t getNowMs() {
     return val.tv_sec * 1000 + val.tv_usec / 1000;
 }
 
+int64_t getNowUs() {
+    timeval val;
+    gettimeofday(&val, NULL);
+
+    // 与 getNowMs 相同，只是精度为微秒，定时器和延迟统计使用
+    return val.tv_sec * 1000000 + val.tv_usec;
+}
+
 // 定义一个 int32_t 类型的变量 re，用于存储转换后的整数
 int32_t getInt32FromNetByte(const char *buf) {
     int32_t re;
@@ -0,0 +1,106 @@
+#include <math.h>
+#include <algorithm>
+
+#include "ConcurrencyLimiter.h"
+
+using namespace network;
+
+ConcurrencyLimiter::ConcurrencyLimiter(const ConcurrencyLimiterOptions &options)
+    : options_(options),
+    limit_(options.initialLimit),
+    inflight_(0),
+    accepted_(0),
+    rejected_(0),
+    noLoadRttUsSnapshot_(0),
+    estimatedLimit_(options.initialLimit),
+    noLoadRttUs_(0),
+    windows_(0),
+    samples_(0),
+    sumUs_(0),
+    minUs_(0),
+    maxInflight_(0) {}
+
+/**
+ * 先加再比较，超出限制时减回去。并发的 tryAcquire 最多短暂地让 inflight_ 超出限制，
+ * 但不会让超出限制的请求通过
+ */
+bool ConcurrencyLimiter::tryAcquire() {
+    int inflight = inflight_.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (inflight > limit_.load(std::memory_order_relaxed)) {
+        inflight_.fetch_sub(1, std::memory_order_relaxed);
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    accepted_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void ConcurrencyLimiter::release(int64_t latencyUs) {
+    int inflight = inflight_.fetch_sub(1, std::memory_order_relaxed);
+
+    int64_t windowMinUs = 0;
+    int64_t windowAvgUs = 0;
+    int64_t maxInflight = 0;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (samples_ == 0 || latencyUs < minUs_) {
+            minUs_ = latencyUs;
+        }
+        sumUs_ += latencyUs;
+        maxInflight_ = std::max(maxInflight_, inflight);
+        if (++samples_ < options_.windowSamples) {
+            return;
+        }
+        windowMinUs = minUs_;
+        windowAvgUs = sumUs_ / samples_;
+        maxInflight = maxInflight_;
+        samples_ = 0;
+        sumUs_ = 0;
+        maxInflight_ = 0;
+        updateLimit(windowMinUs, windowAvgUs, maxInflight);
+    }
+}
+
+/**
+ * 在 mutex_ 内调用。空载延迟取历史窗口最小延迟的最小值，
+ * 每 probeIntervalWindows 个窗口用当前窗口的最小延迟重置一次
+ */
+void ConcurrencyLimiter::updateLimit(int64_t windowMinUs, int64_t windowAvgUs,
+                                     int64_t maxInflight) {
+    if (noLoadRttUs_ == 0 || windowMinUs < noLoadRttUs_ ||
+        ++windows_ >= options_.probeIntervalWindows) {
+        noLoadRttUs_ = std::max<int64_t>(windowMinUs, 1);
+        windows_ = 0;
+    }
+    noLoadRttUsSnapshot_.store(noLoadRttUs_, std::memory_order_relaxed);
+
+    double limit = estimatedLimit_;
+    double queue = limit * (1.0 - static_cast<double>(noLoadRttUs_) /
+                                  static_cast<double>(std::max<int64_t>(windowAvgUs, 1)));
+    double log = std::max(1.0, log10(limit));
+    double alpha = 3 * log;
+    double beta = 6 * log;
+
+    double target = limit;
+    if (queue < alpha) {
+        if (maxInflight * 2 >= limit) {
+            target = limit + log;
+        }
+    } else if (queue > beta) {
+        target = limit - log;
+    }
+    target = std::min<double>(std::max<double>(target, options_.minLimit), options_.maxLimit);
+
+    estimatedLimit_ = limit * (1 - options_.smoothing) + target * options_.smoothing;
+    limit_.store(static_cast<int>(estimatedLimit_ + 0.5), std::memory_order_relaxed);
+}
+
+ConcurrencyLimiter::Stats ConcurrencyLimiter::stats() const {
+    Stats s;
+    s.accepted = accepted_.load(std::memory_order_relaxed);
+    s.rejected = rejected_.load(std::memory_order_relaxed);
+    s.inflight = inflight_.load(std::memory_order_relaxed);
+    s.limit = limit_.load(std::memory_order_relaxed);
+    s.noLoadRttUs = noLoadRttUsSnapshot_.load(std::memory_order_relaxed);
+    return s;
+}
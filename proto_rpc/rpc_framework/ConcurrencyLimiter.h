@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace google {
+namespace protobuf {
+
+class MethodDescriptor;
+
+} // namespace protobuf
+} // namespace google
+
+namespace network {
+
+/**
+ * 自适应并发限制的参数，默认值适合处理时间在毫秒级的 handler
+ */
+struct ConcurrencyLimiterOptions {
+    int initialLimit = 20;
+    int minLimit = 4;
+    int maxLimit = 1000;
+
+    int windowSamples = 50;         // 每收集这么多个延迟样本调整一次限制
+    int probeIntervalWindows = 100; // 每隔多少个窗口重新估计一次空载延迟，跟上后端性能的变化
+    double smoothing = 0.5;         // 新限制 = 旧限制 * (1 - smoothing) + 目标限制 * smoothing
+};
+
+/**
+ * ConcurrencyLimiter 是 Vegas 风格的自适应并发限制：
+ *
+ *   - 每个请求开始时 tryAcquire()，在途请求数达到限制时立即拒绝（服务端返回 OVERLOADED）；
+ *     结束时 release() 并带上从读到请求开始的延迟，包括在 IO 线程里排队的时间。
+ *   - 每 windowSamples 个样本为一个窗口。窗口内的最小延迟用来估计空载延迟 noLoadRtt，
+ *     平均延迟 sampleRtt 反映了排队之后的实际延迟。
+ *   - 估计的排队长度 queue = limit * (1 - noLoadRtt / sampleRtt)：
+ *     queue 小于 alpha 说明几乎没有排队，限制加 log10(limit)；
+ *     queue 大于 beta 说明开始排队，限制减 log10(limit)。
+ *     alpha、beta 随限制按 log10 增长，限制越大允许的排队越多。
+ *   - 窗口内在途请求数始终不到限制一半时不增加限制，避免低负载时限制无意义地膨胀。
+ *
+ * 线程安全：tryAcquire 只用原子变量；release 可能在任意线程调用（done->Run() 的线程），
+ * 窗口统计用互斥锁保护，锁内只做少量计算。
+ */
+class ConcurrencyLimiter {
+public:
+    struct Stats {
+        int64_t accepted = 0;
+        int64_t rejected = 0;
+        int64_t inflight = 0;
+        int64_t limit = 0;
+        int64_t noLoadRttUs = 0;
+    };
+
+    explicit ConcurrencyLimiter(const ConcurrencyLimiterOptions &options);
+
+    bool tryAcquire();
+
+    void release(int64_t latencyUs);
+
+    // 拿到了许可但没有执行 handler（例如被另一级限制拒绝），归还许可但不记录样本
+    void abandon() { inflight_.fetch_sub(1, std::memory_order_relaxed); }
+
+    int limit() const { return limit_.load(std::memory_order_relaxed); }
+
+    Stats stats() const;
+
+private:
+    void updateLimit(int64_t windowMinUs, int64_t windowAvgUs, int64_t maxInflight);
+
+    const ConcurrencyLimiterOptions options_;
+
+    std::atomic<int> limit_;
+    std::atomic<int> inflight_;
+    std::atomic<int64_t> accepted_;
+    std::atomic<int64_t> rejected_;
+    std::atomic<int64_t> noLoadRttUsSnapshot_;
+
+    std::mutex mutex_;
+    double estimatedLimit_;  // 未取整的限制，limit_ 是它取整后的值
+    int64_t noLoadRttUs_;    // 0 表示还没有估计
+    int windows_;
+    int samples_;
+    int64_t sumUs_;
+    int64_t minUs_;
+    int maxInflight_;
+};
+
+typedef std::map<const ::google::protobuf::MethodDescriptor *, std::unique_ptr<ConcurrencyLimiter>>
+    ConcurrencyLimiterMap;
+
+} // namespace network
@@ -0,0 +1,472 @@
+#include <cxxabi.h>
+#include <elf.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <glog/logging.h>
+
+#include "CpuProfiler.h"
+
+using namespace network;
+
+namespace {
+
+const int kMaxDepth = 48;
+const int kMaxSamples = 32768;
+const int kMaxThreads = 256;
+
+// backtrace() 在信号处理函数里取到的前两帧是处理函数自己和内核放置的 __restore_rt
+const int kSkipFrames = 2;
+
+struct Sample {
+    pid_t tid;
+    int depth;
+    void *pcs[kMaxDepth];
+};
+
+/**
+ * 信号处理函数访问的状态。g_samples 和 g_threads 在 g_active 置位之前准备好，
+ * 在 g_active 清零并且 g_inHandler 回到 0 之后才读取或释放
+ */
+std::atomic<bool> g_active(false);
+std::atomic<int> g_inHandler(0);
+std::atomic<int> g_next(0);
+Sample *g_samples = NULL;
+pid_t g_threads[kMaxThreads];
+int g_numThreads = 0;
+
+bool isTarget(pid_t tid) {
+    for (int i = 0; i < g_numThreads; ++i) {
+        if (g_threads[i] == tid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * 只调用 async-signal-safe 的函数；backtrace() 第一次调用时会加载 libgcc，
+ * start() 里已经提前调用过一次
+ */
+void onProfSignal(int, siginfo_t *, void *) {
+    int savedErrno = errno;
+    g_inHandler.fetch_add(1);
+    if (g_active.load()) {
+        pid_t tid = static_cast<pid_t>(::syscall(SYS_gettid));
+        if (isTarget(tid)) {
+            int index = g_next.fetch_add(1, std::memory_order_relaxed);
+            if (index < kMaxSamples) {
+                Sample &sample = g_samples[index];
+                sample.tid = tid;
+                sample.depth = ::backtrace(sample.pcs, kMaxDepth);
+            }
+        }
+    }
+    g_inHandler.fetch_sub(1);
+    errno = savedErrno;
+}
+
+void installHandler() {
+    static bool installed = false;
+    if (installed) {
+        return;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_sigaction = onProfSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGPROF, &action, NULL);
+    installed = true;
+}
+
+/**
+ * 用 dl_iterate_phdr 找到进程里加载的所有 ELF 对象，按需读取它们的 .symtab（没有时用 .dynsym），
+ * 把地址换算成函数名。只在 stop() 的调用线程里使用
+ */
+class Symbolizer {
+public:
+    Symbolizer() { ::dl_iterate_phdr(&Symbolizer::onObject, this); }
+
+    // exact 为 false 表示 pc 是返回地址，查找时减一落回 call 指令
+    const std::string &symbolize(uintptr_t pc, bool exact) {
+        uintptr_t key = exact ? pc : pc - 1;
+        auto it = cache_.find(key);
+        if (it != cache_.end()) {
+            return it->second;
+        }
+        return cache_[key] = lookup(key);
+    }
+
+private:
+    struct Symbol {
+        uintptr_t addr;
+        uintptr_t size;
+        std::string name;
+
+        bool operator<(const Symbol &other) const { return addr < other.addr; }
+    };
+
+    struct Module {
+        std::string path;
+        uintptr_t base;
+        std::vector<std::pair<uintptr_t, uintptr_t>> ranges; // PT_LOAD 段的 [begin, end)
+        bool loaded;
+        std::vector<Symbol> symbols;
+    };
+
+    static int onObject(struct dl_phdr_info *info, size_t, void *data) {
+        Symbolizer *self = static_cast<Symbolizer *>(data);
+        Module module;
+        module.path = (info->dlpi_name && info->dlpi_name[0]) ? info->dlpi_name : "/proc/self/exe";
+        module.base = info->dlpi_addr;
+        module.loaded = false;
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+            const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+            if (phdr.p_type == PT_LOAD) {
+                uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+                module.ranges.push_back(std::make_pair(begin, begin + phdr.p_memsz));
+            }
+        }
+        self->modules_.push_back(std::move(module));
+        return 0;
+    }
+
+    Module *findModule(uintptr_t pc) {
+        for (Module &module : modules_) {
+            for (const std::pair<uintptr_t, uintptr_t> &range : module.ranges) {
+                if (pc >= range.first && pc < range.second) {
+                    return &module;
+                }
+            }
+        }
+        return NULL;
+    }
+
+    static void loadSymbols(Module *module) {
+        module->loaded = true;
+        int fd = ::open(module->path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(ElfW(Ehdr)))) {
+            ::close(fd);
+            return;
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        void *mapped = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return;
+        }
+
+        const char *image = static_cast<const char *>(mapped);
+        const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(image);
+        if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0 && ehdr->e_shoff != 0 &&
+            ehdr->e_shoff + ehdr->e_shnum * sizeof(ElfW(Shdr)) <= size) {
+            const ElfW(Shdr) *shdrs = reinterpret_cast<const ElfW(Shdr) *>(image + ehdr->e_shoff);
+            // 优先用完整的 .symtab，剥离过符号的库只剩 .dynsym
+            const uint32_t types[] = { SHT_SYMTAB, SHT_DYNSYM };
+            for (uint32_t type : types) {
+                for (int i = 0; i < ehdr->e_shnum; ++i) {
+                    const ElfW(Shdr) &shdr = shdrs[i];
+                    if (shdr.sh_type != type || shdr.sh_link >= ehdr->e_shnum ||
+                        shdr.sh_offset + shdr.sh_size > size) {
+                        continue;
+                    }
+                    const ElfW(Shdr) &strtab = shdrs[shdr.sh_link];
+                    if (strtab.sh_offset + strtab.sh_size > size) {
+                        continue;
+                    }
+                    const ElfW(Sym) *syms = reinterpret_cast<const ElfW(Sym) *>(image + shdr.sh_offset);
+                    size_t count = shdr.sh_size / sizeof(ElfW(Sym));
+                    for (size_t j = 0; j < count; ++j) {
+                        const ElfW(Sym) &sym = syms[j];
+                        int symType = ELF64_ST_TYPE(sym.st_info);
+                        if ((symType != STT_FUNC && symType != STT_GNU_IFUNC) ||
+                            sym.st_shndx == SHN_UNDEF || sym.st_value == 0 ||
+                            sym.st_name >= strtab.sh_size) {
+                            continue;
+                        }
+                        Symbol symbol = { module->base + sym.st_value, sym.st_size,
+                                          image + strtab.sh_offset + sym.st_name };
+                        module->symbols.push_back(std::move(symbol));
+                    }
+                }
+                if (!module->symbols.empty()) {
+                    break;
+                }
+            }
+        }
+        ::munmap(mapped, size);
+        std::sort(module->symbols.begin(), module->symbols.end());
+    }
+
+    static std::string demangle(const std::string &name) {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(name.c_str(), NULL, NULL, &status);
+        if (status != 0 || !demangled) {
+            return name;
+        }
+        std::string result(demangled);
+        free(demangled);
+        return result;
+    }
+
+    std::string lookup(uintptr_t pc) {
+        char buf[64];
+        Module *module = findModule(pc);
+        if (!module) {
+            snprintf(buf, sizeof buf, "0x%lx", static_cast<unsigned long>(pc));
+            return buf;
+        }
+        if (!module->loaded) {
+            loadSymbols(module);
+        }
+
+        Symbol probe = { pc, 0, std::string() };
+        auto it = std::upper_bound(module->symbols.begin(), module->symbols.end(), probe);
+        if (it != module->symbols.begin()) {
+            --it;
+            if (it->size == 0 || pc < it->addr + it->size) {
+                std::string name = demangle(it->name);
+                std::replace(name.begin(), name.end(), ';', ':');
+                return name;
+            }
+        }
+
+        // 没有符号时用 模块名+偏移，可以之后再用 addr2line 离线解析
+        std::string::size_type slash = module->path.rfind('/');
+        snprintf(buf, sizeof buf, "+0x%lx", static_cast<unsigned long>(pc - module->base));
+        return module->path.substr(slash == std::string::npos ? 0 : slash + 1) + buf;
+    }
+
+    std::vector<Module> modules_;
+    std::unordered_map<uintptr_t, std::string> cache_;
+};
+
+std::string threadName(pid_t tid) {
+    char path[64];
+    snprintf(path, sizeof path, "/proc/self/task/%d/comm", static_cast<int>(tid));
+    char name[64] = { 0 };
+    FILE *file = ::fopen(path, "r");
+    if (file) {
+        if (::fgets(name, sizeof name, file)) {
+            name[strcspn(name, "\n")] = '\0';
+        }
+        ::fclose(file);
+    }
+    std::string result = name[0] ? name : "thread";
+    std::replace(result.begin(), result.end(), ';', ':');
+    std::replace(result.begin(), result.end(), ' ', '_');
+    char suffix[32];
+    snprintf(suffix, sizeof suffix, "-%d", static_cast<int>(tid));
+    return result + suffix;
+}
+
+} // namespace
+
+CpuProfiler::CpuProfiler()
+    : running_(false),
+    usingPerfEvents_(false) {}
+
+CpuProfiler &CpuProfiler::instance() {
+    static CpuProfiler profiler;
+    return profiler;
+}
+
+bool CpuProfiler::running() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return running_;
+}
+
+bool CpuProfiler::start(const std::vector<pid_t> &threads, int frequencyHz, std::string *error) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (running_) {
+        *error = "a profile is already running";
+        return false;
+    }
+    if (threads.empty()) {
+        *error = "no threads to profile";
+        return false;
+    }
+    frequencyHz = std::min(std::max(frequencyHz, 1), 1000);
+
+    // 让 backtrace() 在信号处理函数之外完成第一次调用时的初始化
+    void *pcs[2];
+    ::backtrace(pcs, 2);
+    installHandler();
+
+    threads_.assign(threads.begin(),
+                    threads.begin() + std::min<size_t>(threads.size(), kMaxThreads));
+    std::copy(threads_.begin(), threads_.end(), g_threads);
+    g_numThreads = static_cast<int>(threads_.size());
+    g_samples = new Sample[kMaxSamples];
+    g_next.store(0);
+    g_active.store(true);
+
+    if (startPerfEvents(frequencyHz)) {
+        usingPerfEvents_ = true;
+    } else if (startTimer(frequencyHz)) {
+        usingPerfEvents_ = false;
+    } else {
+        g_active.store(false);
+        while (g_inHandler.load() != 0) {
+            ::sched_yield();
+        }
+        delete[] g_samples;
+        g_samples = NULL;
+        *error = std::string("cannot start sampling: ") + strerror(errno);
+        return false;
+    }
+    running_ = true;
+    LOG(INFO) << "CpuProfiler::start - " << threads_.size() << " threads at " << frequencyHz
+              << " Hz using " << (usingPerfEvents_ ? "perf_event" : "sigprof");
+    return true;
+}
+
+/**
+ * 每个线程一个按线程 CPU 时间计数的软件事件，溢出时通过 F_SETSIG/F_SETOWN_EX 把 SIGPROF 发给该线程。
+ * 不需要 mmap 环形缓冲，调用栈由信号处理函数自己取。
+ * 只统计用户态，perf_event_paranoid 为 2 时也可以监控本进程的线程
+ */
+bool CpuProfiler::startPerfEvents(int frequencyHz) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    attr.sample_period = 1000000000ULL / frequencyHz;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    for (pid_t tid : threads_) {
+        int fd = static_cast<int>(::syscall(__NR_perf_event_open, &attr, tid, -1, -1,
+                                            PERF_FLAG_FD_CLOEXEC));
+        if (fd < 0) {
+            if (errno == ESRCH) { // 线程已经退出
+                continue;
+            }
+            int savedErrno = errno;
+            for (int opened : perfFds_) {
+                ::close(opened);
+            }
+            perfFds_.clear();
+            errno = savedErrno;
+            return false;
+        }
+        struct f_owner_ex owner;
+        owner.type = F_OWNER_TID;
+        owner.pid = tid;
+        ::fcntl(fd, F_SETFL, O_ASYNC);
+        ::fcntl(fd, F_SETSIG, SIGPROF);
+        ::fcntl(fd, F_SETOWN_EX, &owner);
+        perfFds_.push_back(fd);
+    }
+    for (int fd : perfFds_) {
+        ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    return true;
+}
+
+/**
+ * ITIMER_PROF 按整个进程的 CPU 时间计时，信号发给当时正在运行的线程，
+ * 处理函数丢弃非目标线程的样本
+ */
+bool CpuProfiler::startTimer(int frequencyHz) {
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = std::max(1000000 / frequencyHz, 1);
+    timer.it_value = timer.it_interval;
+    return ::setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+void CpuProfiler::stopSampling() {
+    if (usingPerfEvents_) {
+        for (int fd : perfFds_) {
+            ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            ::close(fd);
+        }
+        perfFds_.clear();
+    } else {
+        struct itimerval timer;
+        memset(&timer, 0, sizeof timer);
+        ::setitimer(ITIMER_PROF, &timer, NULL);
+    }
+    g_active.store(false);
+    while (g_inHandler.load() != 0) {
+        ::sched_yield();
+    }
+}
+
+/**
+ * 符号化和汇总在调用线程里完成，耗时和不同调用栈的个数成正比（第一次解析一个库时要读它的符号表）
+ */
+CpuProfiler::Result CpuProfiler::stop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Result result;
+    if (!running_) {
+        return result;
+    }
+    stopSampling();
+
+    int taken = g_next.load();
+    int count = std::min(taken, kMaxSamples);
+    result.sampler = usingPerfEvents_ ? "perf_event" : "sigprof";
+    result.threads = static_cast<int>(threads_.size());
+    result.samples = count;
+    result.dropped = taken - count;
+
+    Symbolizer symbolizer;
+    std::map<pid_t, std::string> names;
+    std::map<std::string, int64_t> stacks;
+    for (int i = 0; i < count; ++i) {
+        const Sample &sample = g_samples[i];
+        auto name = names.find(sample.tid);
+        if (name == names.end()) {
+            name = names.insert(std::make_pair(sample.tid, threadName(sample.tid))).first;
+        }
+        std::string stack = name->second;
+        for (int frame = sample.depth - 1; frame >= kSkipFrames; --frame) {
+            stack += ';';
+            stack += symbolizer.symbolize(reinterpret_cast<uintptr_t>(sample.pcs[frame]),
+                                          frame == kSkipFrames);
+        }
+        ++stacks[stack];
+    }
+    for (const std::pair<const std::string, int64_t> &stack : stacks) {
+        result.collapsed += stack.first;
+        result.collapsed += ' ';
+        result.collapsed += std::to_string(stack.second);
+        result.collapsed += '\n';
+    }
+
+    delete[] g_samples;
+    g_samples = NULL;
+    g_numThreads = 0;
+    threads_.clear();
+    running_ = false;
+    LOG(INFO) << "CpuProfiler::stop - " << result.samples << " samples, "
+              << stacks.size() << " distinct stacks";
+    return result;
+}
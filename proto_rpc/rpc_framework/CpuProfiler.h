@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace network {
+
+/**
+ * 进程内的 CPU 采样分析器，用来在不重启进程的情况下抓取 EventLoop 线程的热点。
+ *
+ *   - 每个目标线程打开一个 perf_event（PERF_COUNT_SW_TASK_CLOCK，按线程 CPU 时间计数），
+ *     计数溢出时内核向该线程发送 SIGPROF；perf_event_open 不可用时退回 setitimer(ITIMER_PROF)，
+ *     信号发给正在消耗 CPU 的线程，处理函数只记录目标线程的样本；
+ *   - 信号处理函数用 backtrace() 取调用栈，写进预先分配的样本数组，只有一次原子加法，不加锁不分配内存；
+ *   - stop() 之后在调用线程里用进程自己的 ELF 符号表符号化，汇总成 flame graph 使用的 collapsed 格式。
+ *
+ * 没有在采样时不打开任何 perf_event 也不设置定时器，请求路径上没有任何开销。
+ * SIGPROF 的处理函数在第一次 start() 时安装，之后一直保留（不在采样时直接返回），
+ * 避免停止之后还在路上的信号按默认动作终止进程；因此不能和其他使用 SIGPROF 的分析器同时使用。
+ * 同一时刻只能有一次采样。
+ */
+class CpuProfiler {
+public:
+    struct Result {
+        std::string sampler;   // "perf_event" 或 "sigprof"
+        int threads = 0;
+        int64_t samples = 0;
+        int64_t dropped = 0;   // 样本数组满了之后丢弃的样本数
+        std::string collapsed; // 每行 "线程名;最外层函数;...;最内层函数 次数"
+    };
+
+    static CpuProfiler &instance();
+
+    /**
+     * 开始对 threads 里的线程采样，frequencyHz 是每个线程每秒 CPU 时间的采样次数。
+     * 已经在采样或者无法启动时返回 false 并在 error 里说明原因
+     */
+    bool start(const std::vector<pid_t> &threads, int frequencyHz, std::string *error);
+
+    // 停止采样并汇总，没有在采样时返回空结果
+    Result stop();
+
+    bool running() const;
+
+private:
+    CpuProfiler();
+
+    bool startPerfEvents(int frequencyHz);
+    bool startTimer(int frequencyHz);
+    void stopSampling();
+
+    mutable std::mutex mutex_;
+    bool running_;
+    bool usingPerfEvents_;
+    std::vector<pid_t> threads_;
+    std::vector<int> perfFds_;
+};
+
+} // namespace network
@@ -0,0 +1,182 @@
+#include <mutex>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+
+#include "FanOut.h"
+#include "RpcController.h"
+#include "network/EventLoop.h"
+#include "network/util.h"
+
+using namespace network;
+
+/**
+ * Gather 保存一次扇出调用的状态，各个下游调用的回调和 deadline 定时器共同持有，
+ * 最后一个下游调用返回后释放。finished 之后到达的响应直接忽略
+ */
+struct FanOut::Gather {
+    DoneCallback done;
+    size_t quorum;
+    int64_t startUs;
+    TimerId timerId;
+
+    std::mutex mutex;
+    bool finished;
+    size_t failed;
+    std::vector<char> returned;
+    FanOutResult result;
+
+    // 每个下游调用一个 controller，带回后端的错误码，完成时用来取消 straggler
+    std::vector<std::unique_ptr<RpcController>> controllers;
+    // 下游调用的 response 归 RpcChannel 所有，只在回调里访问
+    std::vector<::google::protobuf::Message *> responses;
+};
+
+FanOut::FanOut(EventLoop *loop, const std::vector<::google::protobuf::RpcChannel *> &channels)
+    : loop_(loop),
+    channels_(channels),
+    calls_(0),
+    quorumCompletions_(0),
+    deadlineCompletions_(0),
+    stragglersCancelled_(0) {}
+
+FanOut::~FanOut() {}
+
+/**
+ * 先为每个后端准备好 controller，再注册 deadline 定时器，最后依次发出下游调用。
+ * 前面的后端可能在后面的调用发出之前就返回，甚至已经完成整个扇出，
+ * 所以 complete 会用到的状态都要在第一个调用发出之前准备好
+ */
+void FanOut::call(const ::google::protobuf::MethodDescriptor *method,
+                  const ::google::protobuf::Message &request,
+                  const FanOutOptions &options,
+                  const DoneCallback &done) {
+    calls_.fetch_add(1, std::memory_order_relaxed);
+    size_t n = channels_.size();
+    GatherPtr gather(new Gather);
+    gather->done = done;
+    gather->quorum = (options.quorum == 0 || options.quorum > n) ? n : options.quorum;
+    gather->startUs = getNowUs();
+    gather->timerId = 0;
+    gather->finished = false;
+    gather->failed = 0;
+    gather->returned.assign(n, 0);
+    gather->result.replies.resize(n);
+    gather->responses.assign(n, NULL);
+    for (size_t i = 0; i < n; ++i) {
+        gather->controllers.emplace_back(new RpcController);
+        gather->controllers[i]->setTimeoutMs(options.timeoutMs);
+    }
+
+    if (n == 0) {
+        gather->finished = true;
+        gather->result.quorumReached = true;
+        finish(gather, false);
+        return;
+    }
+
+    if (options.timeoutMs > 0) {
+        gather->timerId = loop_->runAt(gather->startUs + options.timeoutMs * 1000,
+                                       std::bind(&FanOut::onDeadline, this, gather));
+    }
+
+    const ::google::protobuf::Message *prototype =
+        ::google::protobuf::MessageFactory::generated_factory()->GetPrototype(method->output_type());
+    for (size_t i = 0; i < n; ++i) {
+        gather->responses[i] = prototype->New();
+        channels_[i]->CallMethod(method, gather->controllers[i].get(), &request,
+                                 gather->responses[i],
+                                 ::google::protobuf::NewCallback(this, &FanOut::onReply, gather, i));
+    }
+}
+
+FanOut::Stats FanOut::stats() const {
+    Stats s;
+    s.calls = calls_.load(std::memory_order_relaxed);
+    s.quorumCompletions = quorumCompletions_.load(std::memory_order_relaxed);
+    s.deadlineCompletions = deadlineCompletions_.load(std::memory_order_relaxed);
+    s.stragglersCancelled = stragglersCancelled_.load(std::memory_order_relaxed);
+    return s;
+}
+
+/**
+ * 某个后端返回（在它的连接所在的 IO 线程执行）。response 本函数返回后就会被 RpcChannel delete，
+ * 成功时把内容交换到结果里。成功数达到 quorum，或者失败数多到已经不可能达到 quorum 时完成
+ */
+void FanOut::onReply(GatherPtr gather, size_t index) {
+    int64_t now = getNowUs();
+    std::unique_lock<std::mutex> lock(gather->mutex);
+    if (gather->finished) {
+        return;
+    }
+
+    gather->returned[index] = 1;
+    FanOutReply &reply = gather->result.replies[index];
+    reply.latencyUs = now - gather->startUs;
+    RpcController *controller = gather->controllers[index].get();
+    if (controller->Failed()) {
+        reply.error = controller->errorCode() != NO_ERROR ? controller->errorCode() : INVALID_RESPONSE;
+        reply.errorText = controller->ErrorText();
+        ++gather->failed;
+    } else {
+        ::google::protobuf::Message *response = gather->responses[index];
+        reply.error = NO_ERROR;
+        reply.response.reset(response->New());
+        response->GetReflection()->Swap(reply.response.get(), response);
+        ++gather->result.succeeded;
+    }
+
+    size_t n = gather->result.replies.size();
+    if (gather->result.succeeded < gather->quorum && gather->failed <= n - gather->quorum) {
+        return;
+    }
+    if (gather->result.succeeded + gather->failed < n && gather->result.succeeded >= gather->quorum) {
+        quorumCompletions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    complete(gather.get(), CANCELLED, now);
+    lock.unlock();
+    finish(gather, true);
+}
+
+// deadline 定时器回调（在 loop 线程执行），还没返回的后端记为 TIMEOUT
+void FanOut::onDeadline(const GatherPtr &gather) {
+    std::unique_lock<std::mutex> lock(gather->mutex);
+    if (gather->finished) {
+        return;
+    }
+    deadlineCompletions_.fetch_add(1, std::memory_order_relaxed);
+    complete(gather.get(), TIMEOUT, getNowUs());
+    lock.unlock();
+    finish(gather, false);
+}
+
+void FanOut::complete(Gather *gather, ErrorCode pendingError, int64_t now) {
+    gather->finished = true;
+    gather->result.quorumReached = gather->result.succeeded >= gather->quorum;
+    gather->result.elapsedUs = now - gather->startUs;
+    for (size_t i = 0; i < gather->returned.size(); ++i) {
+        if (gather->returned[i]) {
+            continue;
+        }
+        FanOutReply &reply = gather->result.replies[i];
+        reply.error = pendingError;
+        reply.errorText = ErrorCode_Name(pendingError);
+        reply.latencyUs = gather->result.elapsedUs;
+        gather->controllers[i]->StartCancel();
+        stragglersCancelled_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * 在 loop 线程里执行用户回调。straggler 返回之前 gather 还活着，
+ * 回调执行完后先释放结果和回调本身
+ */
+void FanOut::finish(const GatherPtr &gather, bool cancelTimer) {
+    if (cancelTimer && gather->timerId != 0) {
+        loop_->cancel(gather->timerId);
+    }
+    loop_->runInLoop([gather]() {
+        gather->done(gather->result);
+        gather->done = DoneCallback();
+        gather->result.replies.clear();
+    });
+}
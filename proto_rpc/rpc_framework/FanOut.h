@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <google/protobuf/service.h>
+
+#include "rpc.pb.h"
+
+namespace google {
+namespace protobuf {
+
+class MethodDescriptor;
+class Message;
+
+} // namespace protobuf
+} // namespace google
+
+namespace network {
+
+class EventLoop;
+
+/**
+ * 一次扇出调用的完成条件
+ */
+struct FanOutOptions {
+    size_t quorum = 0;     // 收到这么多个成功响应就完成，0 或超过后端数时等所有后端
+    int64_t timeoutMs = 0; // 整体 deadline，0 表示没有；同时作为每个下游请求的时间预算发给后端
+};
+
+/**
+ * 一个后端的结果。error 是后端返回的错误码；完成时还没有返回的后端，
+ * 因为 deadline 完成的是 TIMEOUT，因为达到 quorum（或已经不可能达到）完成的是 CANCELLED
+ */
+struct FanOutReply {
+    ErrorCode error = CANCELLED;
+    std::string errorText;
+    std::unique_ptr<::google::protobuf::Message> response; // 只有成功时非空
+    int64_t latencyUs = 0;                                  // 没有返回的后端是完成时已经等待的时间
+
+    bool ok() const { return error == NO_ERROR && response; }
+
+    template <typename Response>
+    const Response *get() const { return static_cast<const Response *>(response.get()); }
+};
+
+struct FanOutResult {
+    std::vector<FanOutReply> replies; // 下标与构造 FanOut 时的 channels 一一对应
+    size_t succeeded = 0;
+    bool quorumReached = false;
+    int64_t elapsedUs = 0;
+};
+
+/**
+ * FanOut 把同一个请求并发发给一组后端，按“全部返回”“前 K 个成功”或 deadline 三种条件中
+ * 先满足的一个完成，回调拿到每个后端各自的响应或错误，用于聚合类服务一次调用几十个后端。
+ *
+ *   FanOut fanOut(loop, channels);
+ *   FanOutOptions options;
+ *   options.quorum = channels.size() - 1;
+ *   options.timeoutMs = 20;
+ *   fanOut.call(SearchService::descriptor()->FindMethodByName("Search"), request, options,
+ *               [](FanOutResult &result) { ... result.replies[i].get<SearchResponse>() ... });
+ *
+ * 失败的后端多到已经不可能凑够 quorum 时也立即完成，quorumReached 为 false。
+ * 完成之后还没返回的后端（straggler）不再等待：它们的 RpcController 被 StartCancel，
+ * 响应到达时 RpcChannel 不再解析，直接丢弃。取消不会传到服务端，但设置了 timeoutMs 时
+ * 每个下游请求都带着这个时间预算，开启了调度的服务端会丢弃来不及执行的请求。
+ *
+ * 回调总是在 loop 线程里执行（在 loop 线程里完成时直接执行），每次 call 恰好执行一次。
+ * call 可以在任意线程调用；channels 在最后一个下游调用返回之前都必须有效。
+ *
+ * 后端的连接断开时，它的回复要靠 RpcChannel::failOutstandingCalls 以 UNAVAILABLE 结束
+ * （RpcChannel 析构和心跳超时时自动执行，复用 RpcChannel 重连的客户端要在连接回调里调用）。
+ * 没有设置 timeoutMs 时扇出调用只能等所有后端都返回或者失败，channels 的持有者不这样做，
+ * 断开的后端会让需要它的扇出调用一直不完成
+ */
+class FanOut {
+public:
+    struct Stats {
+        int64_t calls = 0;               // 扇出调用次数
+        int64_t quorumCompletions = 0;   // 达到 quorum 提前完成、还有后端没有返回的次数
+        int64_t deadlineCompletions = 0; // 因为 deadline 完成的次数
+        int64_t stragglersCancelled = 0; // 完成时被放弃的下游调用数
+    };
+
+    typedef std::function<void(FanOutResult &result)> DoneCallback;
+
+    FanOut(EventLoop *loop, const std::vector<::google::protobuf::RpcChannel *> &channels);
+    ~FanOut();
+
+    FanOut(const FanOut &) = delete;
+    FanOut &operator=(const FanOut &) = delete;
+
+    size_t size() const { return channels_.size(); }
+
+    void call(const ::google::protobuf::MethodDescriptor *method,
+              const ::google::protobuf::Message &request,
+              const FanOutOptions &options,
+              const DoneCallback &done);
+
+    Stats stats() const;
+
+private:
+    struct Gather;
+    typedef std::shared_ptr<Gather> GatherPtr;
+
+    void onReply(GatherPtr gather, size_t index);
+
+    void onDeadline(const GatherPtr &gather);
+
+    // 调用时持有 gather->mutex，把还没返回的后端标记为 error，返回之后再 finish
+    void complete(Gather *gather, ErrorCode pendingError, int64_t now);
+
+    // 定时器触发之前完成时 cancelTimer 为 true，取消 deadline 定时器
+    void finish(const GatherPtr &gather, bool cancelTimer);
+
+    EventLoop *loop_;
+    const std::vector<::google::protobuf::RpcChannel *> channels_;
+
+    std::atomic<int64_t> calls_;
+    std::atomic<int64_t> quorumCompletions_;
+    std::atomic<int64_t> deadlineCompletions_;
+    std::atomic<int64_t> stragglersCancelled_;
+};
+
+} // namespace network
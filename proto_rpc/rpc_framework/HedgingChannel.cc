@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <glog/logging.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+
+#include "HedgingChannel.h"
+#include "RpcChannel.h"
+#include "network/EventLoop.h"
+#include "network/util.h"
+
+using namespace network;
+
+/**
+ * HedgedCall 保存一次对冲调用的状态，主请求、对冲请求和定时器共同持有。
+ * finished 保证只有第一个返回的请求会填充用户的 response 并调用 done
+ */
+struct HedgingChannel::HedgedCall {
+    const ::google::protobuf::MethodDescriptor *method;
+    MethodState *state;
+    std::unique_ptr<::google::protobuf::Message> request; // 对冲时需要再次发送，保存一份副本
+    ::google::protobuf::Message *response;
+    ::google::protobuf::Closure *done;
+    ::google::protobuf::Message *attemptResponses[2];
+    int64_t startUs;
+    std::atomic<TimerId> timerId;
+    std::atomic<bool> finished;
+};
+
+HedgingChannel::HedgingChannel(EventLoop *loop, RpcChannel *primary, RpcChannel *secondary)
+    : loop_(loop),
+    primary_(primary),
+    secondary_(secondary),
+    budgetPercent_(5.0),
+    calls_(0),
+    hedgesSent_(0),
+    hedgesWon_(0),
+    hedgesThrottled_(0) {}
+
+HedgingChannel::~HedgingChannel() {}
+
+bool HedgingChannel::enableHedging(const std::string &methodFullName,
+                                   const HedgingOptions &options) {
+    const ::google::protobuf::MethodDescriptor *method =
+        ::google::protobuf::DescriptorPool::generated_pool()->FindMethodByName(methodFullName);
+    if (!method) {
+        LOG(ERROR) << "HedgingChannel::enableHedging - unknown method " << methodFullName;
+        return false;
+    }
+    std::unique_ptr<MethodState> state(new MethodState);
+    state->options = options;
+    state->samples.reserve(kSampleSize);
+    state->delayUs = options.initialDelayUs;
+    methods_[method] = std::move(state);
+    return true;
+}
+
+/**
+ * 没有开启对冲的方法直接转发给 primary。
+ * 开启对冲的方法先在 loop 上注册一个“对冲延迟”之后触发的定时器，再把请求发给 primary；
+ * 定时器触发时如果请求还没完成，就把请求再发给 secondary
+ */
+void HedgingChannel::CallMethod(const ::google::protobuf::MethodDescriptor *method,
+                                ::google::protobuf::RpcController *controller,
+                                const ::google::protobuf::Message *request,
+                                ::google::protobuf::Message *response,
+                                ::google::protobuf::Closure *done) {
+    auto it = methods_.find(method);
+    if (it == methods_.end()) {
+        primary_->CallMethod(method, controller, request, response, done);
+        return;
+    }
+
+    calls_.fetch_add(1, std::memory_order_relaxed);
+    HedgedCallPtr call(new HedgedCall);
+    call->method = method;
+    call->state = it->second.get();
+    call->request.reset(request->New());
+    call->request->CopyFrom(*request);
+    call->response = response;
+    call->done = done;
+    call->attemptResponses[0] = response->New();
+    call->attemptResponses[1] = NULL;
+    call->startUs = getNowUs();
+    call->timerId = 0;
+    call->finished = false;
+
+    int64_t delayUs = call->state->delayUs.load(std::memory_order_relaxed);
+    call->timerId = loop_->runAt(call->startUs + delayUs,
+                                 std::bind(&HedgingChannel::sendHedge, this, call));
+
+    primary_->CallMethod(method, controller, call->request.get(), call->attemptResponses[0],
+                         NewCallback(this, &HedgingChannel::onAttemptDone, call, 0));
+}
+
+HedgingChannel::Stats HedgingChannel::stats() const {
+    Stats s;
+    s.calls = calls_.load(std::memory_order_relaxed);
+    s.hedgesSent = hedgesSent_.load(std::memory_order_relaxed);
+    s.hedgesWon = hedgesWon_.load(std::memory_order_relaxed);
+    s.hedgesThrottled = hedgesThrottled_.load(std::memory_order_relaxed);
+    return s;
+}
+
+/**
+ * 定时器回调（在 loop 线程执行）：主请求还没返回，并且对冲请求数没有超出 budget，
+ * 就把同一个请求发给 secondary
+ */
+void HedgingChannel::sendHedge(const HedgedCallPtr &call) {
+    if (call->finished.load()) {
+        return;
+    }
+
+    int64_t calls = calls_.load(std::memory_order_relaxed);
+    int64_t sent = hedgesSent_.load(std::memory_order_relaxed);
+    if (static_cast<double>(sent + 1) * 100.0 > budgetPercent_ * static_cast<double>(calls)) {
+        hedgesThrottled_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    hedgesSent_.fetch_add(1, std::memory_order_relaxed);
+    call->attemptResponses[1] = call->response->New();
+    secondary_->CallMethod(call->method, NULL, call->request.get(), call->attemptResponses[1],
+                           NewCallback(this, &HedgingChannel::onAttemptDone, call, 1));
+}
+
+/**
+ * 某一路请求返回。attemptResponses[attempt] 的所有权属于底层 RpcChannel，
+ * 本函数返回后就会被 delete，所以胜出时把内容交换到用户的 response 里。
+ * 后返回的一路直接忽略
+ */
+void HedgingChannel::onAttemptDone(HedgedCallPtr call, int attempt) {
+    int64_t now = getNowUs();
+    if (attempt == 0) {
+        // 只统计主请求的延迟，作为后端本身的延迟分布
+        recordLatency(call->state, now - call->startUs);
+    }
+
+    if (call->finished.exchange(true)) {
+        return;
+    }
+
+    if (attempt == 0) {
+        loop_->cancel(call->timerId.load());
+    } else {
+        hedgesWon_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<::google::protobuf::Message> d(call->response);
+    call->response->GetReflection()->Swap(call->response, call->attemptResponses[attempt]);
+    if (call->done) {
+        call->done->Run();
+    }
+}
+
+/**
+ * 把主请求的延迟写入环形样本，每 kRecomputeInterval 个样本用 nth_element
+ * 重新计算一次配置的分位，作为新的对冲延迟
+ */
+void HedgingChannel::recordLatency(MethodState *state, int64_t latencyUs) {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (state->samples.size() < kSampleSize) {
+        state->samples.push_back(latencyUs);
+    } else {
+        state->samples[state->next] = latencyUs;
+        state->next = (state->next + 1) % kSampleSize;
+    }
+
+    if (++state->sinceRecompute < kRecomputeInterval) {
+        return;
+    }
+    state->sinceRecompute = 0;
+
+    std::vector<int64_t> sorted(state->samples);
+    size_t rank = static_cast<size_t>(state->options.percentile / 100.0 * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    int64_t delayUs = std::max(sorted[rank], state->options.minDelayUs);
+    state->delayUs.store(delayUs, std::memory_order_relaxed);
+}
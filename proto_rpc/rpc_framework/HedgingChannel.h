@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <google/protobuf/service.h>
+
+#include "network/TimerQueue.h"
+
+namespace google {
+namespace protobuf {
+
+class MethodDescriptor;
+class Message;
+
+} // namespace protobuf
+} // namespace google
+
+namespace network {
+
+class EventLoop;
+class RpcChannel;
+
+/**
+ * 某个方法的对冲配置
+ */
+struct HedgingOptions {
+    double percentile = 95.0;       // 主请求等待超过该分位延迟后发出对冲请求
+    int64_t initialDelayUs = 10000; // 延迟样本不足时使用的对冲延迟
+    int64_t minDelayUs = 100;       // 对冲延迟的下限，避免样本偏小时几乎每个请求都对冲
+};
+
+/**
+ * HedgingChannel 用于幂等的读请求降低长尾延迟。
+ * 请求先发给 primary，如果等待时间超过该方法最近延迟的某个分位（如 p95）仍未返回，
+ * 就把同一个请求再发给 secondary（另一条连接或另一个后端），谁先返回就用谁的结果，
+ * 后返回的那个直接丢弃。
+ *
+ * 两个 RpcChannel 各自只看到一次普通的调用，所以 outstandings_ 仍然是“一个 id 一个响应”。
+ * 对冲请求的总量受 hedge budget 限制（占总请求数的百分比）。
+ *
+ * 和 RpcChannel 一样，response 的所有权交给通道，done->Run() 之后会被 delete。
+ */
+class HedgingChannel : public ::google::protobuf::RpcChannel {
+public:
+    struct Stats {
+        int64_t calls = 0;           // 开启对冲的方法的调用次数
+        int64_t hedgesSent = 0;      // 发出的对冲请求数
+        int64_t hedgesWon = 0;       // 对冲请求先于主请求返回的次数
+        int64_t hedgesThrottled = 0; // 因为超出 budget 而没有发出的对冲请求数
+    };
+
+    HedgingChannel(EventLoop *loop, RpcChannel *primary, RpcChannel *secondary);
+    ~HedgingChannel() override;
+
+    // 为某个方法开启对冲，methodFullName 形如 "monitor.TestService.MonitorInfo"
+    bool enableHedging(const std::string &methodFullName, const HedgingOptions &options);
+
+    // 对冲请求最多占开启对冲的方法总调用数的百分比，默认 5%
+    void setHedgeBudgetPercent(double percent) { budgetPercent_ = percent; }
+
+    void CallMethod(const ::google::protobuf::MethodDescriptor *method,
+                    ::google::protobuf::RpcController *controller,
+                    const ::google::protobuf::Message *request,
+                    ::google::protobuf::Message *response,
+                    ::google::protobuf::Closure *done) override;
+
+    Stats stats() const;
+
+private:
+    /**
+     * 每个开启对冲的方法记录最近 kSampleSize 个主请求的延迟，
+     * 每收集 kRecomputeInterval 个样本重新计算一次对冲延迟
+     */
+    struct MethodState {
+        HedgingOptions options;
+        std::mutex mutex;
+        std::vector<int64_t> samples;
+        size_t next = 0;
+        size_t sinceRecompute = 0;
+        std::atomic<int64_t> delayUs;
+    };
+
+    struct HedgedCall;
+    typedef std::shared_ptr<HedgedCall> HedgedCallPtr;
+
+    static const size_t kSampleSize = 1024;
+    static const size_t kRecomputeInterval = 64;
+
+    void sendHedge(const HedgedCallPtr &call);
+
+    void onAttemptDone(HedgedCallPtr call, int attempt);
+
+    void recordLatency(MethodState *state, int64_t latencyUs);
+
+    EventLoop *loop_;
+    RpcChannel *primary_;
+    RpcChannel *secondary_;
+    double budgetPercent_;
+
+    // 只在使用前通过 enableHedging 写入，之后只读
+    std::map<const ::google::protobuf::MethodDescriptor *, std::unique_ptr<MethodState>> methods_;
+
+    std::atomic<int64_t> calls_;
+    std::atomic<int64_t> hedgesSent_;
+    std::atomic<int64_t> hedgesWon_;
+    std::atomic<int64_t> hedgesThrottled_;
+};
+
+} // namespace network
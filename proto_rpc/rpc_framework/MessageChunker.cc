@@ -0,0 +1,170 @@
+#include <algorithm>
+
+#include "MessageChunker.h"
+#include "network/Buffer.h"
+#include "network/EventLoop.h"
+#include "network/Metrics.h"
+#include "network/TcpConnection.h"
+
+using namespace network;
+
+namespace {
+
+Counter *const g_chunkedMessages = MetricsRegistry::instance().counter("rpc.chunked_messages");
+Counter *const g_chunksSent = MetricsRegistry::instance().counter("rpc.chunks_sent");
+Counter *const g_chunkedMessagesRefused =
+    MetricsRegistry::instance().counter("rpc.chunked_messages_refused");
+
+} // namespace
+
+ChunkWriter::ChunkWriter(size_t chunkBytes, Policy policy)
+    : chunkBytes_(chunkBytes > 0 ? chunkBytes : kDefaultChunkBytes),
+    policy_(policy),
+    codec_(ProtoRpcCodec::ProtobufMessageCallback()) {}
+
+void ChunkWriter::send(const TcpConnectionPtr &conn, RpcMessage *message) {
+    TransferPtr transfer = std::make_shared<Transfer>();
+    transfer->message.Swap(message);
+    std::string *payload = transfer->message.type() == REQUEST
+        ? transfer->message.mutable_request() : transfer->message.mutable_response();
+    transfer->payload.swap(*payload);
+    transfer->message.set_chunked(true);
+    transfer->offset = 0;
+    g_chunkedMessages->inc();
+    conn->getLoop()->runInLoop(
+        std::bind(&ChunkWriter::enqueue, shared_from_this(), conn, transfer));
+}
+
+/**
+ * 队列非空时总有一次 WriteCompleteCallback 在等着（刚写出的一块写完，或者输出缓冲区里的其他数据写完），
+ * 所以只有队列从空变成非空时才需要主动写第一块
+ */
+void ChunkWriter::enqueue(const TcpConnectionPtr &conn, const TransferPtr &transfer) {
+    if (!conn->connected()) {
+        return;
+    }
+    bool idle = transfers_.empty();
+    transfers_.push_back(transfer);
+    conn->setWriteCompleteCallback(
+        std::bind(&ChunkWriter::writeNextChunk, shared_from_this(), _1));
+    if (idle) {
+        writeNextChunk(conn);
+    }
+}
+
+/**
+ * 输出缓冲区里还有数据时不写，等它写空再回调到这里，
+ * 这样新来的小消息最多排在一块后面，而不是排在整个大消息后面。
+ * 一个消息的最后一块和去掉了 request/response 的原消息一起写出
+ */
+void ChunkWriter::writeNextChunk(const TcpConnectionPtr &conn) {
+    if (!conn->connected()) {
+        transfers_.clear();
+        return;
+    }
+    if (transfers_.empty() || conn->outputBuffer()->readableBytes() > 0) {
+        return;
+    }
+
+    std::deque<TransferPtr>::iterator it = transfers_.begin();
+    if (policy_ == kSmallestFirst) {
+        it = std::min_element(transfers_.begin(), transfers_.end(),
+                              [](const TransferPtr &a, const TransferPtr &b) {
+                                  return a->remaining() < b->remaining();
+                              });
+    }
+    TransferPtr transfer = *it;
+    size_t n = std::min(chunkBytes_, transfer->remaining());
+
+    RpcMessage chunk;
+    chunk.set_type(CHUNK);
+    chunk.set_id(transfer->message.id());
+    chunk.set_chunk_type(transfer->message.type());
+    chunk.set_chunk(transfer->payload.data() + transfer->offset, n);
+    if (transfer->offset == 0) {
+        chunk.set_chunk_total(static_cast<int64_t>(transfer->payload.size()));
+    }
+    transfer->offset += n;
+
+    Buffer buf;
+    codec_.appendMessage(&buf, chunk);
+    g_chunksSent->inc();
+    bool last = transfer->remaining() == 0;
+    if (last) {
+        codec_.appendMessage(&buf, transfer->message);
+    }
+
+    // 发完的消息出队；轮转时没发完的消息放到队尾
+    if (last || policy_ == kRoundRobin) {
+        transfers_.erase(it);
+        if (!last) {
+            transfers_.push_back(transfer);
+        }
+    }
+    conn->send(&buf);
+}
+
+ChunkAssembler::~ChunkAssembler() {
+    if (pendingBytes_ > 0) {
+        BufferMemory::add(-static_cast<int64_t>(pendingBytes_));
+    }
+}
+
+void ChunkAssembler::account(size_t oldCapacity, size_t newCapacity) {
+    if (newCapacity != oldCapacity) {
+        pendingBytes_ += newCapacity - oldCapacity;
+        BufferMemory::add(static_cast<int64_t>(newCapacity) - static_cast<int64_t>(oldCapacity));
+    }
+}
+
+/**
+ * 第一块检查上限之后按声明的 chunk_total 一次分配好，之后的块不能超过声明的总数，不再分配内存
+ */
+bool ChunkAssembler::add(const RpcMessage &chunk) {
+    if (chunk.chunk_type() != REQUEST && chunk.chunk_type() != RESPONSE) {
+        return false;
+    }
+    std::pair<int, int64_t> key(static_cast<int>(chunk.chunk_type()), chunk.id());
+    auto it = partials_.find(key);
+    if (it == partials_.end()) {
+        if (chunk.chunk_total() <= 0 ||
+            static_cast<uint64_t>(chunk.chunk_total()) > kMaxMessageBytes) {
+            return false;
+        }
+        size_t total = static_cast<size_t>(chunk.chunk_total());
+        if (pendingBytes_ + total > kMaxPendingBytes ||
+            BufferMemory::wouldExceedHardLimit(static_cast<int64_t>(total))) {
+            g_chunkedMessagesRefused->inc();
+            return false;
+        }
+        it = partials_.insert(std::make_pair(key, Partial())).first;
+        it->second.total = total;
+        it->second.bytes.reserve(total);
+        account(0, it->second.bytes.capacity());
+    }
+
+    Partial &partial = it->second;
+    if (partial.bytes.size() + chunk.chunk().size() > partial.total) {
+        return false;
+    }
+    partial.bytes.append(chunk.chunk());
+    return true;
+}
+
+bool ChunkAssembler::complete(RpcMessage *message) {
+    auto it = partials_.find(std::make_pair(static_cast<int>(message->type()), message->id()));
+    if (it == partials_.end()) {
+        return false;
+    }
+    Partial &partial = it->second;
+    account(partial.bytes.capacity(), 0);
+    bool ok = partial.bytes.size() == partial.total;
+    if (ok) {
+        std::string *payload =
+            message->type() == REQUEST ? message->mutable_request() : message->mutable_response();
+        payload->swap(partial.bytes);
+        message->set_chunked(false);
+    }
+    partials_.erase(it);
+    return ok;
+}
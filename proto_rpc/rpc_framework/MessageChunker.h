@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "RpcCodec.h"
+#include "network/Callbacks.h"
+#include "rpc.pb.h"
+
+namespace network {
+
+/**
+ * ChunkWriter 负责一条连接上大消息的分块发送，避免一个大响应（如 50 MiB）独占连接：
+ * 整帧写出时，排在它后面的小响应要等它全部写完，接收方也要等它全部收齐才能解析后面的帧。
+ *
+ * request/response 超过 chunkBytes 的消息，这个字段拆成 chunkBytes 大小的 CHUNK 帧，
+ * 全部发完之后再发出去掉了这个字段、标记为 chunked 的原消息。
+ * 不是一次全部写进连接，而是每次连接的输出缓冲区写空（WriteCompleteCallback）时才写下一块，
+ * 这期间其他调用的小消息照常直接发送，在 TcpConnection 的输出缓冲区里最多排在一块后面。
+ * 同时有多个大消息在发送时，按 policy 选下一块：
+ *   kRoundRobin    - 各个消息轮流发一块；
+ *   kSmallestFirst - 先发剩余字节最少的消息，小一些的大消息先完成。
+ *
+ * send 可以在任意线程调用，分块队列只在连接的 IO 线程里访问。
+ * 开始分块发送时会接管连接的 WriteCompleteCallback
+ */
+class ChunkWriter : public std::enable_shared_from_this<ChunkWriter> {
+public:
+    enum Policy {
+        kRoundRobin,
+        kSmallestFirst,
+    };
+
+    static const size_t kDefaultChunkBytes = 64 * 1024;
+
+    ChunkWriter(size_t chunkBytes, Policy policy);
+
+    ChunkWriter(const ChunkWriter &) = delete;
+    ChunkWriter &operator=(const ChunkWriter &) = delete;
+
+    size_t chunkBytes() const { return chunkBytes_; }
+
+    bool shouldChunk(const RpcMessage &message) const {
+        return (message.type() == REQUEST && message.request().size() > chunkBytes_) ||
+            (message.type() == RESPONSE && message.response().size() > chunkBytes_);
+    }
+
+    // 把 message 的 request/response 换出来分块发送，不拷贝；返回后 message 的这个字段为空
+    void send(const TcpConnectionPtr &conn, RpcMessage *message);
+
+private:
+    struct Transfer {
+        RpcMessage message; // 去掉了 request/response 的原消息，最后发出
+        std::string payload;
+        size_t offset;      // 已经发出的字节数
+
+        size_t remaining() const { return payload.size() - offset; }
+    };
+
+    typedef std::shared_ptr<Transfer> TransferPtr;
+
+    void enqueue(const TcpConnectionPtr &conn, const TransferPtr &transfer);
+
+    // 连接的输出缓冲区空了时写下一块，作为连接的 WriteCompleteCallback
+    void writeNextChunk(const TcpConnectionPtr &conn);
+
+    const size_t chunkBytes_;
+    const Policy policy_;
+    ProtoRpcCodec codec_; // 只用来编码，不解析
+    std::deque<TransferPtr> transfers_;
+};
+
+typedef std::shared_ptr<ChunkWriter> ChunkWriterPtr;
+
+/**
+ * ChunkAssembler 在接收方拼接 CHUNK 帧，只在连接的 IO 线程里使用。
+ * 请求和响应的 id 分别由两端分配，所以按 (chunk_type, id) 区分正在拼接的消息。
+ *
+ * 每个 CHUNK 帧都很小，编解码器的 kMaxMessageLen 和 BufferMemory 硬上限的检查看不到拼接的总量，
+ * 所以这里单独检查：一个消息不超过 kMaxMessageLen 且和第一块声明的 chunk_total 一致，
+ * 正在拼接的字节记到 BufferMemory 里，会超过硬上限时拒绝
+ */
+class ChunkAssembler {
+public:
+    // 拼好的一个消息的字节数上限，和不分块时一帧的上限相同
+    static const size_t kMaxMessageBytes = ProtoRpcCodec::kMaxMessageLen;
+
+    // 一条连接上所有正在拼接的消息的字节数上限
+    static const size_t kMaxPendingBytes = 4 * kMaxMessageBytes;
+
+    ChunkAssembler() : pendingBytes_(0) {}
+    ~ChunkAssembler();
+
+    ChunkAssembler(const ChunkAssembler &) = delete;
+    ChunkAssembler &operator=(const ChunkAssembler &) = delete;
+
+    // 追加一个 CHUNK 帧，类型不对、第一块没有声明总字节数、超过声明的总字节数或者超过上限时返回 false
+    bool add(const RpcMessage &chunk);
+
+    // 把拼好的字节换进 chunked 消息的 request/response，没有对应的 CHUNK 帧或者字节数不对时返回 false
+    bool complete(RpcMessage *message);
+
+    // 正在拼接的消息占用的内存（按容量计）
+    size_t pendingBytes() const { return pendingBytes_; }
+
+private:
+    struct Partial {
+        std::string bytes;
+        size_t total = 0; // 第一块声明的 chunk_total
+    };
+
+    // 按 Partial::bytes 的容量变化调整 pendingBytes_ 和 BufferMemory
+    void account(size_t oldCapacity, size_t newCapacity);
+
+    std::map<std::pair<int, int64_t>, Partial> partials_;
+    size_t pendingBytes_;
+};
+
+} // namespace network
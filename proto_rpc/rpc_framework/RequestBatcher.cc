@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <google/protobuf/stubs/callback.h>
+
+#include "RequestBatcher.h"
+#include "network/EventLoop.h"
+
+using namespace network;
+
+RequestBatcher::RequestBatcher(EventLoop *loop)
+    : loop_(loop),
+    batches_(0),
+    requests_(0),
+    fullBatches_(0) {}
+
+RequestBatcher::~RequestBatcher() {}
+
+/**
+ * 请求进入方法的待处理队列。队列从空变成非空时安排一次提交，攒满时立即提交，
+ * 这时 batchHandler 在解码这个请求的 onMessage 里同步执行
+ */
+void RequestBatcher::add(const void *connKey,
+                         const ::google::protobuf::MethodDescriptor *method,
+                         const RpcMethodOptions *options,
+                         const ::google::protobuf::Message *request,
+                         ::google::protobuf::Message *response,
+                         ::google::protobuf::Closure *done,
+                         ::google::protobuf::Closure *drop) {
+    Pending &pending = pending_[method];
+    pending.options = options;
+    Item item = { connKey, { request, response, done }, drop };
+    pending.calls.push_back(item);
+    requests_.fetch_add(1, std::memory_order_relaxed);
+
+    size_t maxBatchSize = options->maxBatchSize > 0 ? options->maxBatchSize : 1;
+    if (pending.calls.size() >= maxBatchSize) {
+        fullBatches_.fetch_add(1, std::memory_order_relaxed);
+        flush(&pending);
+        return;
+    }
+    if (pending.calls.size() > 1) {
+        return;
+    }
+    if (options->maxBatchDelayUs > 0) {
+        pending.timerId = loop_->runAfter(options->maxBatchDelayUs / 1e6,
+                                          std::bind(&RequestBatcher::onTimer, this, method));
+    } else if (!pending.flushQueued) {
+        pending.flushQueued = true;
+        loop_->queueInLoop(std::bind(&RequestBatcher::onQueuedFlush, this, method));
+    }
+}
+
+/**
+ * 只从队列里移除，不取消定时器和 queueInLoop：到时队列为空就什么都不做
+ */
+void RequestBatcher::removeConnection(const void *connKey) {
+    loop_->assertInLoopThread();
+    for (auto &entry : pending_) {
+        std::vector<Item> &calls = entry.second.calls;
+        auto removed = std::stable_partition(calls.begin(), calls.end(),
+                                             [connKey](const Item &item) {
+                                                 return item.connKey != connKey;
+                                             });
+        for (auto it = removed; it != calls.end(); ++it) {
+            delete it->call.done;
+            it->drop->Run();
+        }
+        calls.erase(removed, calls.end());
+    }
+}
+
+RequestBatcher::Stats RequestBatcher::stats() const {
+    Stats s;
+    s.batches = batches_.load(std::memory_order_relaxed);
+    s.requests = requests_.load(std::memory_order_relaxed);
+    s.fullBatches = fullBatches_.load(std::memory_order_relaxed);
+    return s;
+}
+
+void RequestBatcher::onTimer(const ::google::protobuf::MethodDescriptor *method) {
+    Pending &pending = pending_[method];
+    pending.timerId = 0;
+    if (!pending.calls.empty()) {
+        flush(&pending);
+    }
+}
+
+void RequestBatcher::onQueuedFlush(const ::google::protobuf::MethodDescriptor *method) {
+    Pending &pending = pending_[method];
+    pending.flushQueued = false;
+    if (!pending.calls.empty()) {
+        flush(&pending);
+    }
+}
+
+/**
+ * 先把队列换出来再调用 batchHandler：handler 里同步完成的请求会发送响应，
+ * 之后新到的请求进入新的队列
+ */
+void RequestBatcher::flush(Pending *pending) {
+    if (pending->timerId != 0) {
+        loop_->cancel(pending->timerId);
+        pending->timerId = 0;
+    }
+    std::vector<BatchedCall> calls;
+    calls.reserve(pending->calls.size());
+    for (const Item &item : pending->calls) {
+        calls.push_back(item.call);
+        delete item.drop;
+    }
+    size_t n = pending->calls.size();
+    pending->calls.clear();
+    pending->calls.reserve(n);
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    pending->options->batchHandler(calls);
+}
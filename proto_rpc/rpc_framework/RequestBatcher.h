@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <vector>
+
+#include "RpcMethodOptions.h"
+#include "network/TimerQueue.h"
+
+namespace google {
+namespace protobuf {
+
+class MethodDescriptor;
+class Message;
+class Closure;
+
+} // namespace protobuf
+} // namespace google
+
+namespace network {
+
+class EventLoop;
+
+/**
+ * RequestBatcher 为设置了 RpcMethodOptions::batchHandler 的方法攒批，每个 IO 线程（EventLoop）一个，
+ * 这个线程上所有连接的请求进同一批，只在所属的 loop 线程里使用，内部不加锁。
+ *
+ * 每个方法一个待处理队列：第一个请求进队时开始计时，maxBatchDelayUs 为 0 时在 loop 这一轮的
+ * 事件处理完之后（queueInLoop）提交，否则用定时器；攒满 maxBatchSize 个时立即提交。
+ * 每一项带着自己的 done，完成时由所属连接的 RpcChannel 按请求 ID 发回响应。
+ * 请求的 request/response/done 都属于所在的连接，连接断开（RpcChannel 析构）时
+ * 调用 removeConnection 丢弃它还在排队的请求，之后提交的批次里不会再有它们。
+ */
+class RequestBatcher {
+public:
+    struct Stats {
+        int64_t batches = 0;     // 调用 batchHandler 的次数
+        int64_t requests = 0;    // 进入批处理的请求数
+        int64_t fullBatches = 0; // 攒满 maxBatchSize 提交的批次数
+    };
+
+    explicit RequestBatcher(EventLoop *loop);
+    ~RequestBatcher();
+
+    RequestBatcher(const RequestBatcher &) = delete;
+    RequestBatcher &operator=(const RequestBatcher &) = delete;
+
+    /**
+     * 只能在 loop 线程里调用，options 在 server 的生命周期内保持有效。
+     * connKey 标识请求所在的连接；drop 在请求被 removeConnection 丢弃时代替 done 执行，
+     * 负责释放请求占用的资源，请求进入批次时删除，不执行
+     */
+    void add(const void *connKey, const ::google::protobuf::MethodDescriptor *method,
+             const RpcMethodOptions *options,
+             const ::google::protobuf::Message *request, ::google::protobuf::Message *response,
+             ::google::protobuf::Closure *done, ::google::protobuf::Closure *drop);
+
+    // 丢弃这个连接还在排队的请求：删除 done、执行 drop。只能在 loop 线程里调用
+    void removeConnection(const void *connKey);
+
+    // 可以在任意线程调用
+    Stats stats() const;
+
+private:
+    struct Item {
+        const void *connKey;
+        BatchedCall call;
+        ::google::protobuf::Closure *drop;
+    };
+
+    struct Pending {
+        const RpcMethodOptions *options = NULL;
+        std::vector<Item> calls;
+        TimerId timerId = 0;      // 等待中的定时器，0 表示没有
+        bool flushQueued = false; // 已经 queueInLoop 了一次提交
+    };
+
+    void onTimer(const ::google::protobuf::MethodDescriptor *method);
+
+    void onQueuedFlush(const ::google::protobuf::MethodDescriptor *method);
+
+    void flush(Pending *pending);
+
+    EventLoop *loop_;
+    std::map<const ::google::protobuf::MethodDescriptor *, Pending> pending_;
+
+    std::atomic<int64_t> batches_;
+    std::atomic<int64_t> requests_;
+    std::atomic<int64_t> fullBatches_;
+};
+
+} // namespace network
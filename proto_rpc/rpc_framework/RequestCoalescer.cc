@@ -0,0 +1,64 @@
+#include "RequestCoalescer.h"
+
+using namespace network;
+
+RequestCoalescer::RequestCoalescer()
+    : leaders_(0),
+    coalesced_(0),
+    bypassed_(0) {}
+
+RequestCoalescer::~RequestCoalescer() {}
+
+/**
+ * 哈希相同时还要比较方法和请求字节，确认是完全相同的请求才合并；
+ * 哈希冲突的请求不能替换掉正在执行的 leader，只能绕过
+ */
+RequestCoalescer::JoinResult RequestCoalescer::join(
+    const ::google::protobuf::MethodDescriptor *method, uint64_t hash,
+    const std::string &request, size_t maxWaiters,
+    const std::shared_ptr<TcpConnection> &conn, int64_t id) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = flights_.find(hash);
+    if (it == flights_.end()) {
+        Flight &flight = flights_[hash];
+        flight.method = method;
+        flight.request = request;
+        leaders_.fetch_add(1, std::memory_order_relaxed);
+        return kLeader;
+    }
+
+    Flight &flight = it->second;
+    if (flight.method != method || flight.request != request ||
+        flight.waiters.size() >= maxWaiters) {
+        bypassed_.fetch_add(1, std::memory_order_relaxed);
+        return kBypass;
+    }
+
+    Waiter waiter = { conn, id };
+    flight.waiters.push_back(waiter);
+    coalesced_.fetch_add(1, std::memory_order_relaxed);
+    return kJoined;
+}
+
+std::vector<RequestCoalescer::Waiter> RequestCoalescer::complete(uint64_t hash) {
+    std::vector<Waiter> waiters;
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = flights_.find(hash);
+    if (it != flights_.end()) {
+        waiters.swap(it->second.waiters);
+        flights_.erase(it);
+    }
+    return waiters;
+}
+
+RequestCoalescer::Stats RequestCoalescer::stats() const {
+    Stats s;
+    s.leaders = leaders_.load(std::memory_order_relaxed);
+    s.coalesced = coalesced_.load(std::memory_order_relaxed);
+    s.bypassed = bypassed_.load(std::memory_order_relaxed);
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        s.inflight = static_cast<int64_t>(flights_.size());
+    }
+    return s;
+}
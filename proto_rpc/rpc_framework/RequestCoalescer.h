@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace google {
+namespace protobuf {
+
+class MethodDescriptor;
+
+} // namespace protobuf
+} // namespace google
+
+namespace network {
+
+class TcpConnection;
+
+/**
+ * RequestCoalescer 实现服务端的 singleflight：同一个方法、请求字节完全相同的请求，
+ * 在第一个请求（leader）的 handler 执行期间到达的后续请求不再执行 handler，
+ * 而是作为 waiter 挂在 leader 上，leader 的 done->Run() 时把同一份序列化响应发给所有 waiter。
+ *
+ * 整个 RpcServer 共用一个实例，不同 IO 线程上的连接之间也能合并，所以内部用互斥锁保护。
+ * 每个 leader 挂的 waiter 数有上限，超过上限的请求照常执行 handler。
+ */
+class RequestCoalescer {
+public:
+    enum JoinResult {
+        kLeader,  // 没有相同的请求在执行，调用方成为 leader，执行 handler 后必须调用 complete
+        kJoined,  // 已经挂到正在执行的相同请求上，调用方不需要执行 handler
+        kBypass,  // 哈希冲突或 waiter 数已满，调用方照常执行 handler，不需要调用 complete
+    };
+
+    struct Waiter {
+        std::weak_ptr<TcpConnection> conn; // 等待期间连接可能已经断开
+        int64_t id;                        // waiter 自己的请求 ID
+    };
+
+    struct Stats {
+        int64_t leaders = 0;   // 实际执行了 handler 的合并组数
+        int64_t coalesced = 0; // 挂到 leader 上、没有执行 handler 的请求数
+        int64_t bypassed = 0;  // 因哈希冲突或 waiter 数已满而没有合并的请求数
+        int64_t inflight = 0;  // 当前正在执行的合并组数
+    };
+
+    RequestCoalescer();
+    ~RequestCoalescer();
+
+    JoinResult join(const ::google::protobuf::MethodDescriptor *method, uint64_t hash,
+                    const std::string &request, size_t maxWaiters,
+                    const std::shared_ptr<TcpConnection> &conn, int64_t id);
+
+    // leader 完成，取出并返回所有 waiter，之后到达的相同请求会成为新的 leader
+    std::vector<Waiter> complete(uint64_t hash);
+
+    Stats stats() const;
+
+private:
+    struct Flight {
+        const ::google::protobuf::MethodDescriptor *method;
+        std::string request;
+        std::vector<Waiter> waiters;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, Flight> flights_;
+
+    std::atomic<int64_t> leaders_;
+    std::atomic<int64_t> coalesced_;
+    std::atomic<int64_t> bypassed_;
+};
+
+} // namespace network
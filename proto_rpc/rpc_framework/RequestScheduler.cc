@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <limits>
+
+#include "RequestScheduler.h"
+#include "network/EventLoop.h"
+#include "network/util.h"
+
+using namespace network;
+
+const int RequestScheduler::kNumBands;
+
+RequestScheduler::RequestScheduler(EventLoop *loop, const RequestSchedulerOptions &options)
+    : loop_(loop),
+    options_(options),
+    drainQueued_(false),
+    sequence_(0) {}
+
+RequestScheduler::~RequestScheduler() {}
+
+int RequestScheduler::bandOf(Priority priority) {
+    switch (priority) {
+    case PRIORITY_CRITICAL:
+        return 0;
+    case PRIORITY_HIGH:
+        return 1;
+    case PRIORITY_LOW:
+        return 3;
+    default:
+        return 2;
+    }
+}
+
+void RequestScheduler::enqueue(Request request) {
+    loop_->assertInLoopThread();
+    Band &band = bands_[bandOf(request.priority)];
+    Item item = { std::move(request.task), std::move(request.expire), request.connKey,
+                  std::max<int64_t>(request.cost, 1), getNowUs(),
+                  request.deadlineUs, request.serviceTimeUs };
+    if (options_.earliestDeadlineFirst) {
+        int64_t key = item.deadlineUs > 0 ? item.deadlineUs : std::numeric_limits<int64_t>::max();
+        band.byDeadline.emplace(DeadlineKey(key, sequence_++), std::move(item));
+    } else {
+        Flow &flow = band.flows[request.connKey];
+        if (flow.items.empty()) {
+            band.activeFlows.push_back(request.connKey);
+        }
+        flow.items.push_back(std::move(item));
+    }
+    band.depth.fetch_add(1, std::memory_order_relaxed);
+    band.enqueued.fetch_add(1, std::memory_order_relaxed);
+
+    if (!drainQueued_) {
+        drainQueued_ = true;
+        loop_->queueInLoop(std::bind(&RequestScheduler::drain, this));
+    }
+}
+
+void RequestScheduler::removeConnection(const void *connKey) {
+    loop_->assertInLoopThread();
+    for (Band &band : bands_) {
+        int64_t n = 0;
+        auto it = band.flows.find(connKey);
+        if (it != band.flows.end()) {
+            n += static_cast<int64_t>(it->second.items.size());
+            band.flows.erase(it);
+            band.activeFlows.erase(
+                std::remove(band.activeFlows.begin(), band.activeFlows.end(), connKey),
+                band.activeFlows.end());
+        }
+        // EDF 队列没有按连接索引，断开连接不频繁，直接扫一遍
+        for (auto e = band.byDeadline.begin(); e != band.byDeadline.end();) {
+            if (e->second.connKey == connKey) {
+                e = band.byDeadline.erase(e);
+                ++n;
+            } else {
+                ++e;
+            }
+        }
+        band.depth.fetch_sub(n, std::memory_order_relaxed);
+        band.dropped.fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * 队头连接的额度不够支付它的队头请求时，给它加一个 quantum 并轮到下一个连接；
+ * 够支付时取出请求，连接留在队头继续用剩下的额度。连接的队列空了就移出 activeFlows，
+ * 额度清零，避免空闲的连接攒下额度之后突发。
+ * EDF 模式下请求都在 byDeadline 里，直接取 deadline 最早的一个
+ */
+RequestScheduler::Item RequestScheduler::dequeue(Band &band) {
+    if (!band.byDeadline.empty()) {
+        Item item = std::move(band.byDeadline.begin()->second);
+        band.byDeadline.erase(band.byDeadline.begin());
+        return item;
+    }
+    for (;;) {
+        const void *connKey = band.activeFlows.front();
+        Flow &flow = band.flows[connKey];
+        if (flow.deficit < flow.items.front().cost) {
+            flow.deficit += options_.quantumBytes;
+            band.activeFlows.pop_front();
+            band.activeFlows.push_back(connKey);
+            continue;
+        }
+
+        Item item = std::move(flow.items.front());
+        flow.items.pop_front();
+        flow.deficit -= item.cost;
+        if (flow.items.empty()) {
+            band.activeFlows.pop_front();
+            band.flows.erase(connKey);
+        }
+        return item;
+    }
+}
+
+/**
+ * 每次从优先级最高的非空 band 取一个请求执行。
+ * 请求在执行前已经从队列里移除，handler 里断开连接（removeConnection）不会影响这里的迭代。
+ * 剩余时间不够典型执行时间的请求只调用 expire，同样计入本轮的个数
+ */
+void RequestScheduler::drain() {
+    drainQueued_ = false;
+    int64_t batchEndUs = getNowUs() + options_.maxBatchUs;
+    for (int executed = 0; executed < options_.maxBatch; ++executed) {
+        Band *band = NULL;
+        for (Band &b : bands_) {
+            if (!b.empty()) {
+                band = &b;
+                break;
+            }
+        }
+        if (!band) {
+            return;
+        }
+
+        int64_t now = getNowUs();
+        if (executed > 0 && now >= batchEndUs) {
+            break;
+        }
+
+        Item item = dequeue(*band);
+        band->depth.fetch_sub(1, std::memory_order_relaxed);
+        if (options_.dropHopeless && item.deadlineUs > 0 &&
+            now + item.serviceTimeUs + options_.deadlineSlackUs > item.deadlineUs) {
+            band->expired.fetch_add(1, std::memory_order_relaxed);
+            if (item.expire) {
+                item.expire();
+            }
+            continue;
+        }
+
+        int64_t waitUs = now - item.enqueueUs;
+        band->executed.fetch_add(1, std::memory_order_relaxed);
+        band->waitUsTotal.fetch_add(waitUs, std::memory_order_relaxed);
+        if (waitUs > band->waitUsMax.load(std::memory_order_relaxed)) {
+            band->waitUsMax.store(waitUs, std::memory_order_relaxed);
+        }
+        item.task();
+    }
+
+    // 还有请求没有执行完，让 loop 先处理一轮 IO 再继续
+    for (Band &b : bands_) {
+        if (!b.empty()) {
+            if (!drainQueued_) {
+                drainQueued_ = true;
+                loop_->queueInLoop(std::bind(&RequestScheduler::drain, this));
+            }
+            return;
+        }
+    }
+}
+
+std::vector<RequestScheduler::BandStats> RequestScheduler::stats() const {
+    std::vector<BandStats> result(kNumBands);
+    for (int i = 0; i < kNumBands; ++i) {
+        const Band &band = bands_[i];
+        result[i].depth = band.depth.load(std::memory_order_relaxed);
+        result[i].enqueued = band.enqueued.load(std::memory_order_relaxed);
+        result[i].executed = band.executed.load(std::memory_order_relaxed);
+        result[i].dropped = band.dropped.load(std::memory_order_relaxed);
+        result[i].expired = band.expired.load(std::memory_order_relaxed);
+        result[i].waitUsTotal = band.waitUsTotal.load(std::memory_order_relaxed);
+        result[i].waitUsMax = band.waitUsMax.load(std::memory_order_relaxed);
+    }
+    return result;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "rpc.pb.h"
+
+namespace network {
+
+class EventLoop;
+
+struct RequestSchedulerOptions {
+    // DRR 每一轮给每个连接增加的额度（字节），请求的开销按请求字节数计算
+    int64_t quantumBytes = 4096;
+
+    /**
+     * 每次最多连续执行 maxBatch 个请求或 maxBatchUs 微秒，之后让出 loop 处理 IO，
+     * 新到的高优先级请求最多等这么久就能插队
+     */
+    int maxBatch = 64;
+    int64_t maxBatchUs = 500;
+
+    /**
+     * band 内按 deadline 最早优先（EDF）执行，而不是按连接 DRR。
+     * 没有 deadline 的请求排在有 deadline 的请求之后，彼此之间按到达顺序
+     */
+    bool earliestDeadlineFirst = false;
+
+    // 轮到执行时剩余时间已经不够方法的典型执行时间，就直接回复 TIMEOUT，不再调用 handler
+    bool dropHopeless = true;
+
+    // 判断时在典型执行时间之外再留出的余量，给响应发回客户端的时间
+    int64_t deadlineSlackUs = 1000;
+};
+
+/**
+ * RequestScheduler 位于请求解码和 handler 执行之间，每个 IO 线程一个，只在所属的 loop 线程里访问。
+ *
+ * 开启调度后，RpcChannel 解码出的请求不再立即执行，而是按优先级放进对应的 band：
+ *   - band 之间是严格优先级，只要高优先级的 band 里还有请求，低优先级的 band 就不执行；
+ *   - band 内部按连接做 deficit round-robin，每个连接一个队列，每一轮增加 quantumBytes 的额度，
+ *     额度够支付队头请求的字节数才执行。一个连接堆积了大量请求也只能按轮次占用 IO 线程。
+ *
+ * 开启 earliestDeadlineFirst 后 band 内改为按请求的 deadline 排序，先执行最紧迫的请求，
+ * 连接之间不再做隔离。
+ *
+ * 入队时如果还没有安排执行，就通过 queueInLoop 安排一次 drain()。一次 poll 读到的所有请求会先入队，
+ * 再在 pending functors 阶段按优先级执行；每次执行的个数和时间都有上限，剩下的留到下一轮。
+ * 带 deadline 的请求出队时如果已经来不及执行完（dropHopeless），调用 expire 回调而不是 task，
+ * 避免在注定超时的请求上浪费 CPU。
+ */
+class RequestScheduler {
+public:
+    typedef std::function<void()> Task;
+
+    // 优先级 PRIORITY_CRITICAL .. PRIORITY_LOW 依次对应 band 0 .. 3
+    static const int kNumBands = 4;
+
+    struct BandStats {
+        int64_t depth = 0;       // 当前排队的请求数
+        int64_t enqueued = 0;
+        int64_t executed = 0;
+        int64_t dropped = 0;     // 连接断开时丢弃的请求数
+        int64_t expired = 0;     // 剩余时间不够执行而回复 TIMEOUT 的请求数
+        int64_t waitUsTotal = 0; // 已执行请求的排队时间总和，除以 executed 得到平均等待时间
+        int64_t waitUsMax = 0;
+    };
+
+    RequestScheduler(EventLoop *loop, const RequestSchedulerOptions &options);
+    ~RequestScheduler();
+
+    // PRIORITY_UNSET 按 PRIORITY_NORMAL 处理
+    static int bandOf(Priority priority);
+
+    struct Request {
+        const void *connKey = NULL;         // 请求所属的连接（RpcChannel 的地址）
+        Priority priority = PRIORITY_UNSET;
+        int64_t cost = 1;                   // 请求的字节数
+        int64_t deadlineUs = 0;             // 绝对时间（getNowUs()），0 表示没有 deadline
+        int64_t serviceTimeUs = 0;          // 方法的典型执行时间，0 表示未知
+        Task task;
+        Task expire;                        // 来不及执行而被丢弃时调用，用来回复 TIMEOUT
+    };
+
+    void enqueue(Request request);
+
+    // 连接断开，丢弃它所有还没执行的请求
+    void removeConnection(const void *connKey);
+
+    // 可以在任意线程调用，读到的是近似快照
+    std::vector<BandStats> stats() const;
+
+private:
+    struct Item {
+        Task task;
+        Task expire;
+        const void *connKey;
+        int64_t cost;
+        int64_t enqueueUs;
+        int64_t deadlineUs;
+        int64_t serviceTimeUs;
+    };
+
+    // EDF 队列的排序键：deadline，相同时按入队序号
+    typedef std::pair<int64_t, uint64_t> DeadlineKey;
+
+    struct Flow {
+        std::deque<Item> items;
+        int64_t deficit = 0;
+    };
+
+    struct Band {
+        std::map<const void *, Flow> flows;
+        std::deque<const void *> activeFlows; // 有请求排队的连接，队头是当前轮到的连接
+        std::map<DeadlineKey, Item> byDeadline; // earliestDeadlineFirst 时使用，代替 flows
+
+        bool empty() const { return activeFlows.empty() && byDeadline.empty(); }
+
+        std::atomic<int64_t> depth{0};
+        std::atomic<int64_t> enqueued{0};
+        std::atomic<int64_t> executed{0};
+        std::atomic<int64_t> dropped{0};
+        std::atomic<int64_t> expired{0};
+        std::atomic<int64_t> waitUsTotal{0};
+        std::atomic<int64_t> waitUsMax{0};
+    };
+
+    void drain();
+
+    // 从 band 里按 DRR 或 EDF 取出下一个请求
+    Item dequeue(Band &band);
+
+    EventLoop *loop_;
+    const RequestSchedulerOptions options_;
+    Band bands_[kNumBands];
+    bool drainQueued_;
+    uint64_t sequence_;
+};
+
+} // namespace network
@@ -0,0 +1,127 @@
+#include <cassert>
+#include <functional>
+
+#include "ResponseCache.h"
+
+using namespace network;
+
+ResponseCache::ResponseCache(size_t capacityBytes)
+    : capacityBytes_(capacityBytes),
+    bytes_(0),
+    hits_(0),
+    misses_(0),
+    insertions_(0),
+    evictions_(0),
+    expirations_(0),
+    bytesSnapshot_(0),
+    entriesSnapshot_(0) {}
+
+ResponseCache::~ResponseCache() {}
+
+/**
+ * 用请求字节的哈希和方法描述符的地址混合出 key，
+ * 不同方法的相同请求字节不会落到同一个 key 上
+ */
+uint64_t ResponseCache::hashRequest(const ::google::protobuf::MethodDescriptor *method,
+                                    const std::string &request) {
+    uint64_t h = std::hash<std::string>()(request);
+    uint64_t m = reinterpret_cast<uintptr_t>(method);
+    return h ^ (m + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+/**
+ * 命中时把条目移到链表头部；过期的条目直接删除并计为未命中。
+ * 哈希相同但请求字节不同（哈希冲突）也按未命中处理。
+ */
+const std::string *ResponseCache::lookup(const ::google::protobuf::MethodDescriptor *method,
+                                         uint64_t hash, const std::string &request,
+                                         int64_t nowMs) {
+    auto it = index_.find(hash);
+    if (it == index_.end()) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    EntryList::iterator entry = it->second;
+    if (entry->expireAtMs <= nowMs) {
+        erase(entry);
+        expirations_.fetch_add(1, std::memory_order_relaxed);
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    if (entry->method != method || entry->request != request) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    lru_.splice(lru_.begin(), lru_, entry);
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return &entry->response;
+}
+
+/**
+ * 插入或覆盖一个条目，然后按 LRU 顺序淘汰到容量以内。
+ * 单个条目就超过容量时不缓存，避免把整个分片清空。
+ */
+void ResponseCache::insert(const ::google::protobuf::MethodDescriptor *method, uint64_t hash,
+                           const std::string &request, const std::string &response,
+                           int64_t expireAtMs) {
+    auto it = index_.find(hash);
+    if (it != index_.end()) {
+        erase(it->second);
+    }
+
+    Entry entry = { hash, method, request, response, expireAtMs };
+    size_t n = entryBytes(entry);
+    if (n > capacityBytes_) {
+        return;
+    }
+
+    lru_.push_front(std::move(entry));
+    index_[hash] = lru_.begin();
+    bytes_ += n;
+    insertions_.fetch_add(1, std::memory_order_relaxed);
+
+    evictIfNeeded();
+    bytesSnapshot_.store(static_cast<int64_t>(bytes_), std::memory_order_relaxed);
+    entriesSnapshot_.store(static_cast<int64_t>(lru_.size()), std::memory_order_relaxed);
+}
+
+ResponseCache::Stats ResponseCache::stats() const {
+    Stats s;
+    s.hits = hits_.load(std::memory_order_relaxed);
+    s.misses = misses_.load(std::memory_order_relaxed);
+    s.insertions = insertions_.load(std::memory_order_relaxed);
+    s.evictions = evictions_.load(std::memory_order_relaxed);
+    s.expirations = expirations_.load(std::memory_order_relaxed);
+    s.bytes = bytesSnapshot_.load(std::memory_order_relaxed);
+    s.entries = entriesSnapshot_.load(std::memory_order_relaxed);
+    return s;
+}
+
+/**
+ * 估算一个条目占用的内存：请求和响应的字节数，加上链表节点和索引的固定开销
+ */
+size_t ResponseCache::entryBytes(const Entry &entry) {
+    return entry.request.size() + entry.response.size() + sizeof(Entry) + 64;
+}
+
+void ResponseCache::erase(EntryList::iterator it) {
+    size_t n = entryBytes(*it);
+    assert(bytes_ >= n);
+    bytes_ -= n;
+    index_.erase(it->hash);
+    lru_.erase(it);
+    bytesSnapshot_.store(static_cast<int64_t>(bytes_), std::memory_order_relaxed);
+    entriesSnapshot_.store(static_cast<int64_t>(lru_.size()), std::memory_order_relaxed);
+}
+
+void ResponseCache::evictIfNeeded() {
+    while (bytes_ > capacityBytes_ && !lru_.empty()) {
+        EntryList::iterator last = lru_.end();
+        --last;
+        erase(last);
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
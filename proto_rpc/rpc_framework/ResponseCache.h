@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+namespace google {
+namespace protobuf {
+
+class MethodDescriptor;
+
+} // namespace protobuf
+} // namespace google
+
+namespace network {
+
+/**
+ * ResponseCache 是服务端的响应缓存，每个 IO 线程（EventLoop）持有一个分片，
+ * 只在所属的 loop 线程里读写，所以内部不加锁。
+ *
+ * key 是 (method, 序列化后的请求字节) 的哈希，value 是序列化后的响应字节，
+ * 命中时既跳过 handler，也跳过响应消息的再次序列化。
+ * 条目带 TTL，总字节数超过 capacityBytes 时按 LRU 淘汰。
+ */
+class ResponseCache {
+public:
+    struct Stats {
+        int64_t hits = 0;
+        int64_t misses = 0;
+        int64_t insertions = 0;
+        int64_t evictions = 0;   // 因容量不足被淘汰
+        int64_t expirations = 0; // 因 TTL 过期被丢弃
+        int64_t bytes = 0;
+        int64_t entries = 0;
+    };
+
+    explicit ResponseCache(size_t capacityBytes);
+    ~ResponseCache();
+
+    static uint64_t hashRequest(const ::google::protobuf::MethodDescriptor *method,
+                                const std::string &request);
+
+    /**
+     * 查找缓存，命中时返回指向缓存响应的指针，未命中返回 NULL。
+     * 返回的指针只在下一次 insert 之前有效，调用方应立即拷贝出去。
+     */
+    const std::string *lookup(const ::google::protobuf::MethodDescriptor *method,
+                              uint64_t hash, const std::string &request, int64_t nowMs);
+
+    void insert(const ::google::protobuf::MethodDescriptor *method, uint64_t hash,
+                const std::string &request, const std::string &response, int64_t expireAtMs);
+
+    size_t capacityBytes() const { return capacityBytes_; }
+
+    // 可以在任意线程调用，计数用 relaxed 原子变量维护，读到的是近似快照
+    Stats stats() const;
+
+private:
+    struct Entry {
+        uint64_t hash;
+        const ::google::protobuf::MethodDescriptor *method;
+        std::string request;
+        std::string response;
+        int64_t expireAtMs;
+    };
+
+    typedef std::list<Entry> EntryList;
+
+    static size_t entryBytes(const Entry &entry);
+
+    void erase(EntryList::iterator it);
+
+    void evictIfNeeded();
+
+    const size_t capacityBytes_;
+
+    // 链表头部是最近使用的条目，尾部是最久未使用的条目
+    EntryList lru_;
+    std::unordered_map<uint64_t, EntryList::iterator> index_;
+    size_t bytes_;
+
+    std::atomic<int64_t> hits_;
+    std::atomic<int64_t> misses_;
+    std::atomic<int64_t> insertions_;
+    std::atomic<int64_t> evictions_;
+    std::atomic<int64_t> expirations_;
+    std::atomic<int64_t> bytesSnapshot_;
+    std::atomic<int64_t> entriesSnapshot_;
+};
+
+} // namespace network
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <google/protobuf/service.h>
+
+#include "RpcController.h"
+#include "rpc.pb.h"
+
+namespace google {
+namespace protobuf {
+
+class MethodDescriptor;
+class Message;
+
+} // namespace protobuf
+} // namespace google
+
+namespace network {
+
+class RpcChannel;
+
+/**
+ * RpcBatch 是一批发往同一个 RpcChannel 的小请求，通过 RpcChannel::callBatch 一起发出：
+ * 所有请求编码进同一次写，在未完成调用表里一次加锁登记，全部返回后只执行一次 done。
+ *
+ *   RpcBatch batch;
+ *   for (size_t i = 0; i < keys.size(); ++i) {
+ *       batch.add(method, &requests[i], &responses[i]);
+ *   }
+ *   channel->callBatch(&batch, NULL, done); // done 里用 batch.error(i) 检查每一项
+ *
+ * 和 CallMethod 不同，request 和 response 都归调用方所有，不会被 delete；
+ * batch、request 和 response 都要保持有效直到 done 执行。request 在 callBatch 返回前就已经编码。
+ * 每一项在线上仍然是一个普通的请求帧，服务端不需要任何改动，调度、并发限制等也按项生效。
+ */
+class RpcBatch {
+public:
+    RpcBatch() : remaining_(0), controller_(NULL), done_(NULL) {}
+
+    RpcBatch(const RpcBatch &) = delete;
+    RpcBatch &operator=(const RpcBatch &) = delete;
+
+    void add(const ::google::protobuf::MethodDescriptor *method,
+             const ::google::protobuf::Message *request,
+             ::google::protobuf::Message *response) {
+        Item item = { method, request, response, NO_ERROR };
+        items_.push_back(item);
+    }
+
+    void reserve(size_t n) { items_.reserve(n); }
+
+    // 只能在不在调用中的时候清空，之后可以重新 add 复用
+    void clear() { items_.clear(); }
+
+    size_t size() const { return items_.size(); }
+
+    // 第 i 项服务端返回的错误码，NO_ERROR 表示 response 已经填好
+    ErrorCode error(size_t i) const { return items_[i].error; }
+
+    size_t failed() const {
+        size_t n = 0;
+        for (const Item &item : items_) {
+            if (item.error != NO_ERROR) {
+                ++n;
+            }
+        }
+        return n;
+    }
+
+private:
+    friend class RpcChannel;
+
+    struct Item {
+        const ::google::protobuf::MethodDescriptor *method;
+        const ::google::protobuf::Message *request;
+        ::google::protobuf::Message *response;
+        ErrorCode error;
+    };
+
+    void start(RpcController *controller, ::google::protobuf::Closure *done) {
+        for (Item &item : items_) {
+            item.error = NO_ERROR;
+        }
+        controller_ = controller;
+        done_ = done;
+        remaining_.store(items_.size(), std::memory_order_relaxed);
+    }
+
+    /**
+     * 一项返回（在连接的 IO 线程执行），最后一项返回时执行 done。
+     * 有失败的项时把第一个错误码设置到 controller 上
+     */
+    void finishItem() {
+        if (remaining_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        if (controller_) {
+            for (const Item &item : items_) {
+                if (item.error != NO_ERROR) {
+                    controller_->setErrorCode(item.error);
+                    break;
+                }
+            }
+        }
+        ::google::protobuf::Closure *done = done_;
+        done_ = NULL;
+        if (done) {
+            done->Run();
+        }
+    }
+
+    std::vector<Item> items_;
+    std::atomic<size_t> remaining_;
+    RpcController *controller_;
+    ::google::protobuf::Closure *done_;
+};
+
+} // namespace network
@@ -1,15 +1,65 @@
+#include <algorithm>
 #include <cassert>
 #include <glog/logging>
 #include <google/protobuf/descriptor.h>
 
 #include "RpcChannel.h"
+#include "RequestBatcher.h"
+#include "RequestCoalescer.h"
+#include "RequestScheduler.h"
+#include "ServiceTimeEstimator.h"
+#include "RpcController.h"
+#include "ResponseCache.h"
+#include "RpcStats.h"
+#include "network/Buffer.h"
+#include "network/TcpConnection.h"
+#include "network/EventLoop.h"
+#include "network/Metrics.h"
+#include "network/util.h"
 #include "rpc.pb.h"
 
 using namespace network;
 
+namespace {
+
+Counter *const g_heartbeatPings = MetricsRegistry::instance().counter("rpc.heartbeat_pings");
+Counter *const g_heartbeatTimeouts = MetricsRegistry::instance().counter("rpc.heartbeat_timeouts");
+
+thread_local RpcChannel *t_currentChannel = NULL;
+
+// handler 同步执行期间设置 RpcChannel::current()，handler 里收到其他连接的请求时可以嵌套
+class CurrentChannelScope {
+public:
+    explicit CurrentChannelScope(RpcChannel *channel) : saved_(t_currentChannel) {
+        t_currentChannel = channel;
+    }
+
+    ~CurrentChannelScope() { t_currentChannel = saved_; }
+
+private:
+    RpcChannel *saved_;
+};
+
+} // namespace
+
 RpcChannel::RpcChannel() : codec_(std::bind(&RpcChannel::onRpcMessage, this, 
                                             std::placeholders::_1, std::placeholders::_2)),
-                            services_(NULL) {
+                            services_(NULL),
+                            methodOptions_(NULL),
+                            responseCache_(NULL),
+    coalescer_(NULL),
+    batcher_(NULL),
+    streams_(new RpcStreamTable),
+    serverCalls_(new ServerCallTable),
+    serverLimiter_(NULL),
+    methodLimiters_(NULL),
+    scheduler_(NULL),
+    serviceTimes_(NULL),
+    lastReadUs_(0),
+    pendingResponses_(NULL),
+    heartbeatEnabled_(false),
+    heartbeatMisses_(0) {
+    serverCalls_->channel = this;
     LOG(INFO) << " RpcChannel::ctor - " << this;
 }
 
@@ -17,17 +67,45 @@ RpcChannel::RpcChannel(const TcpConenctionPtr &conn)
     : codec_(std::bind(&RpcChannel::onRpcMessage, this, 
                         std::placeholders::_1, std::placeholders::_2)),
     conn_(conn),
-    services_(NULL) {
+    services_(NULL),
+    methodOptions_(NULL),
+    responseCache_(NULL),
+    coalescer_(NULL),
+    batcher_(NULL),
+    streams_(new RpcStreamTable),
+    serverCalls_(new ServerCallTable),
+    serverLimiter_(NULL),
+    methodLimiters_(NULL),
+    scheduler_(NULL),
+    serviceTimes_(NULL),
+    lastReadUs_(0),
+    pendingResponses_(NULL),
+    heartbeatEnabled_(false),
+    heartbeatMisses_(0) {
+    serverCalls_->channel = this;
     LOG(INFO) << " RpcChannel::ctor - " << this;
 }
 
 RpcChannel::~RpcChannel() {
     LOG(INFO) << " RpcChannel:dtor - " << this;
-    for (const auto &outstanding : outstandings_) {
-        OutstandingCall out = outstanding.second;
-        delete out.response;
-        delete out.done;
+    std::vector<std::function<void()>> closeCallbacks;
+    closeCallbacks.swap(closeCallbacks_);
+    for (const std::function<void()> &cb : closeCallbacks) {
+        cb();
     }
+    detachServerCalls();
+    abortStreams(CANCELLED);
+    if (scheduler_) {
+        scheduler_->removeConnection(this);
+    }
+    if (batcher_) {
+        batcher_->removeConnection(this);
+    }
+    /**
+     * 还没有收到响应的调用以 UNAVAILABLE 结束，每个 done 都执行一次：
+     * 等待 rpcCall 的协程能恢复执行，调用方持有的资源（如上游请求的并发许可）也能释放
+     */
+    failOutstandingCalls(UNAVAILABLE);
 }
 
 /**
@@ -47,15 +125,52 @@ void RpcChannel::CallMethod(const ::google::protobuf::MethodDescriptor *method,
     message.set_service(method->service()->full_name());
     message.set_method(method->name());
 
+    /**
+     * 父 trace 上下文来自 RpcController，没有时取当前线程的（在 handler 里发起的调用）。
+     * 有父上下文或者被采样为新的 trace 时，为本次调用分配 span ID 并随请求发出；
+     * 已采样且本进程在记录时才创建 span，收到响应时写入 Tracer
+     */
+    RpcController *rpcController = dynamic_cast<RpcController *>(controller);
+    const TraceContext &parent = (rpcController && rpcController->traceContext().valid())
+        ? rpcController->traceContext() : Tracer::current();
+    TraceContext context;
+    TraceSpanPtr span;
+    Tracer &tracer = Tracer::instance();
+    if (tracer.startClientContext(parent, &context)) {
+        message.set_trace_id(context.traceId);
+        message.set_span_id(context.spanId);
+        message.set_trace_flags(context.sampled ? kTraceFlagSampled : 0);
+        if (context.sampled && tracer.recording()) {
+            span = std::make_shared<TraceSpan>();
+            span->traceId = context.traceId;
+            span->spanId = context.spanId;
+            span->parentId = parent.spanId;
+            span->name = &method->full_name();
+            span->startUs = getNowUs();
+        }
+    }
+
     // 把请求消息序列化为字符串，填入 message
     message.set_request(request->SerializeAsString());
+    if (span) {
+        span->mark(kStageEncode, getNowUs());
+    }
+
+    // 调用方通过 RpcController 指定了优先级和时间预算时随请求发出
+    if (rpcController && rpcController->priority() != PRIORITY_UNSET) {
+        message.set_priority(rpcController->priority());
+    }
+    if (rpcController && rpcController->timeoutMs() > 0) {
+        message.set_timeout_ms(rpcController->timeoutMs());
+    }
 
     /**
      * 构造一个 OutstandingCall 结构体，保存响应对象和回调
      * 用互斥锁保护，把这次调用的信息（以请求 ID 为 key）存入 outstandings_ 容器，
      * 方便后续收到响应时能找到对应的回调和响应对象
      */ 
-    OutstandingCall out = { response, done };
+    OutstandingCall out = { response, done, controller, method, getNowUs(),
+                            static_cast<int64_t>(message.request().size()), span, NULL, 0 };
     {
         std::unique_lock<std::mutex> lock(mutex_);
         outstandings_[id] = out;
@@ -63,7 +178,75 @@ void RpcChannel::CallMethod(const ::google::protobuf::MethodDescriptor *method,
 
     // 通过 codec_（编解码器）把构造好的 RpcMessage 发送到远程服务器，
     // 底层用的是网络连接 conn_
-    codec_.send(conn_, message);
+    if (!sendChunked(&message)) {
+        codec_.send(conn_, message);
+    }
+}
+
+/**
+ * 和 CallMethod 的区别：一次 fetch_add 分配整批的请求 ID，所有请求帧编码进同一个 Buffer，
+ * 一次加锁登记到 outstandings_（ID 递增，插在 map 末尾），最后一次 send。
+ * 必须先登记再发送，否则响应可能在登记之前到达
+ */
+void RpcChannel::callBatch(RpcBatch *batch, RpcController *controller,
+                           ::google::protobuf::Closure *done) {
+    size_t n = batch->size();
+    batch->start(controller, done);
+    if (n == 0) {
+        batch->done_ = NULL;
+        if (done) {
+            done->Run();
+        }
+        return;
+    }
+
+    int64_t firstId = id_.fetch_add(static_cast<int64_t>(n)) + 1;
+    RpcMessage message;
+    message.set_type(REQUEST);
+
+    const TraceContext &parent = (controller && controller->traceContext().valid())
+        ? controller->traceContext() : Tracer::current();
+    TraceContext context;
+    if (Tracer::instance().startClientContext(parent, &context)) {
+        message.set_trace_id(context.traceId);
+        message.set_span_id(context.spanId);
+        message.set_trace_flags(context.sampled ? kTraceFlagSampled : 0);
+    }
+    if (controller && controller->priority() != PRIORITY_UNSET) {
+        message.set_priority(controller->priority());
+    }
+    if (controller && controller->timeoutMs() > 0) {
+        message.set_timeout_ms(controller->timeoutMs());
+    }
+
+    // 同一个 RpcMessage 逐项复用，字符串字段的内存不用每项重新分配
+    int64_t startUs = getNowUs();
+    Buffer buf;
+    std::vector<OutstandingCall> outs;
+    outs.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        const RpcBatch::Item &item = batch->items_[i];
+        message.set_id(firstId + static_cast<int64_t>(i));
+        message.set_service(item.method->service()->full_name());
+        message.set_method(item.method->name());
+        item.request->SerializeToString(message.mutable_request());
+        codec_.appendMessage(&buf, message);
+
+        OutstandingCall out = { item.response, NULL, NULL, item.method, startUs,
+                                static_cast<int64_t>(message.request().size()), TraceSpanPtr(),
+                                batch, i };
+        outs.push_back(out);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < n; ++i) {
+            outstandings_.emplace_hint(outstandings_.end(), firstId + static_cast<int64_t>(i),
+                                       outs[i]);
+        }
+    }
+
+    conn_->send(&buf);
 }
 
 /**
@@ -72,7 +255,27 @@ void RpcChannel::CallMethod(const ::google::protobuf::MethodDescriptor *method,
  * 这是典型的 RPC 框架消息分发逻辑
  */
 void RpcChannel::onMessage(const TcpConnectionPtr &conn, Buffer *buf) {
+    if (heartbeatEnabled_ || limited() || Tracer::instance().recording()) {
+        lastReadUs_ = getNowUs();
+    }
+
+    /**
+     * 一次读到的多个请求（如客户端的 callBatch）在 handler 里同步完成时，
+     * 响应先攒在 responses 里，处理完这次读到的数据后一次写出，而不是每个响应一次写
+     */
+    Buffer responses(Buffer::kLazy);
+    pendingResponses_ = &responses;
     codec_.onMessage(conn, buf);
+    pendingResponses_ = NULL;
+    if (responses.readableBytes() > 0) {
+        conn->send(&responses);
+        /**
+         * 内存块取自本线程的 BufferPool，Buffer 析构时不会归还，显式还回去，
+         * 否则每次读到同步完成的请求都会从池里拿走一块。连接已经断开时 send 不取走数据，先丢弃
+         */
+        responses.retrieveAll();
+        responses.release();
+    }
 }
 
 /**
@@ -88,6 +291,10 @@ void RpcChannel::onRpcMessage(const TcpConnectionPtr &conn, const RpcMessagePtr
      * 不会产生对象的拷贝，效率高
      */
     RpcMessage &message = *messagePtr;
+    // 大消息的 request/response 分块到达，见 ChunkWriter
+    if ((message.type() == CHUNK || message.chunked()) && !handle_chunk_msg(conn, &message)) {
+        return;
+    }
 
     /**
      * 如果消息类型是 RESPONSE（响应），调用 handle_reponse_msg 处理响应消息。
@@ -96,7 +303,27 @@ void RpcChannel::onRpcMessage(const TcpConnectionPtr &conn, const RpcMessagePtr
     if (message.type() == RESPONSE) {
         handle_reponse_msg(messagePtr);
     } else if (message.type() == REQUEST) {
-        handle_request_msg(conn, messagePtr);
+        TraceSpanPtr span = startServerSpan(message);
+        if (scheduler_) {
+            schedule_request_msg(conn, messagePtr, span);
+        } else {
+            handle_request_msg(conn, messagePtr, span, limited() ? lastReadUs_ : 0,
+                               LimiterPermitsPtr());
+        }
+    } else if (message.type() == PING) {
+        // 收到 PONG 时 onMessage 已经更新了 lastReadUs_，不需要其他处理
+        RpcMessage pong;
+        pong.set_type(PONG);
+        pong.set_id(message.id());
+        codec_.send(conn, pong);
+    } else if (message.type() == STREAM_REQUEST) {
+        handle_stream_request(conn, messagePtr);
+    } else if (message.type() == STREAM_RESPONSE) {
+        // 本端发起的流，已经结束的流的迟到帧直接丢弃
+        RpcStreamPtr stream = streams_->find(message.id(), true);
+        if (stream) {
+            stream->onFrame(message);
+        }
     }
 }
 
@@ -111,7 +338,7 @@ void RpcChannel::handle_response_msg(const RpcMessagePtr &messagePtr) {
     int64_t id = message.id();
 
     // 准备查找未完成的调用
-    OutstandingCall out = { NULL, NULL };
+    OutstandingCall out = { NULL, NULL, NULL, NULL, 0, 0, TraceSpanPtr(), NULL, 0 };
 
     // 查找并移除对应的未完成调用
     {
@@ -125,17 +352,53 @@ void RpcChannel::handle_response_msg(const RpcMessagePtr &messagePtr) {
 
     // 处理响应对象和回调
     if (out.response) {
-        std::unique_ptr<google::protobuf::Message> d(out.response);
+        // 批量调用的 response 归调用方所有
+        std::unique_ptr<google::protobuf::Message> d(out.batch ? NULL : out.response);
+        if (out.span) {
+            out.span->mark(kStageResponse, getNowUs());
+        }
 
-        // 如果响应消息内容不为空，就用 ParseFromString 反序列化填充响应对象。
-        if (!message.response().empty()) {
+        /**
+         * 服务端返回了错误（如 OVERLOADED）时不解析响应，把错误码交给调用方的 controller；
+         * 是本框架的 RpcController 时带上错误码，其他实现只能拿到错误名
+         */
+        if (message.error() != NO_ERROR) {
+            if (out.batch) {
+                out.batch->items_[out.batchIndex].error = message.error();
+            } else if (out.controller) {
+                RpcController *controller = dynamic_cast<RpcController *>(out.controller);
+                if (controller) {
+                    controller->setErrorCode(message.error());
+                } else {
+                    out.controller->SetFailed(ErrorCode_Name(message.error()));
+                }
+            }
+        } else if (out.controller && out.controller->IsCanceled()) {
+            // 调用方已经放弃这次调用（如扇出调用达到 quorum 后的 straggler），不再解析响应
+        } else if (!message.response().empty()) {
+            // 如果响应消息内容不为空，就用 ParseFromString 反序列化填充响应对象。
             out.response->ParseFromString(message.response());
         }
 
+        // 用户回调之前记录，延迟不包括回调本身的执行时间
+        RpcStats::instance().record(RpcStats::kClient, out.method, message.error(),
+                                    getNowUs() - out.startUs, out.requestBytes,
+                                    static_cast<int64_t>(message.response().size()));
+
         // 如果有回调（done），就调用回调，通知用户“RPC 响应已收到并处理”。
-        if (out.done) {
+        // 批量调用的最后一项返回时执行整批的 done，之后 batch 可能已经被释放
+        if (out.batch) {
+            out.batch->finishItem();
+        } else if (out.done) {
             out.done->Run();
         }
+
+        // 客户端 span 到用户回调执行完为止
+        if (out.span) {
+            out.span->error = message.error();
+            out.span->endUs = getNowUs();
+            Tracer::instance().record(*out.span);
+        }
     }
 }
 
@@ -144,9 +407,12 @@ void RpcChannel::handle_response_msg(const RpcMessagePtr &messagePtr) {
  * 它负责查找服务和方法、解析请求消息、调用服务方法，并处理可能出现的错误。
  * 通过该函数，RPC 服务端能够正确处理客户端的请求，并返回相应的响应消息
  */
-void RpcChannel::handle_request_msg(const TcpConenctionPtr &conn, const RpcMessagePtr &messagePtr) {
+void RpcChannel::handle_request_msg(const TcpConenctionPtr &conn, const RpcMessagePtr &messagePtr,
+                                    const TraceSpanPtr &span, int64_t readUs,
+                                    const LimiterPermitsPtr &permits) {
     RpcChannel &message = *messagePtr;
     ErrorCode error = WRONG_PROTO;
+    int64_t startUs = getNowUs();
     if (services_) {
         std::map<std::string, google::protobuf::Service *>::const_iterator it = 
             services_->find(message.service());
@@ -163,14 +429,117 @@ void RpcChannel::handle_request_msg(const TcpConenctionPtr &conn, const RpcMessa
 
             // 找到方法
             if (method) {
+                if (span) {
+                    span->name = &method->full_name();
+                    if (scheduler_) {
+                        span->mark(kStageDequeue, startUs);
+                    }
+                }
+                const RpcMethodOptions *options = findMethodOptions(method);
+                int64_t cacheTtlMs = 
+                    (options && responseCache_) ? options->cacheTtlMs : 0;
+                bool coalesce = options && coalescer_ && options->coalesceInflight;
+                uint64_t requestHash = 0;
+                if (cacheTtlMs > 0 || coalesce) {
+                    requestHash = ResponseCache::hashRequest(method, message.request());
+                }
+
+                /**
+                 * 开启了响应缓存的方法先查本线程的缓存分片，
+                 * 命中时直接把缓存的序列化响应发回去，不解析请求、不调用 handler
+                 */
+                if (cacheTtlMs > 0) {
+                    const std::string *cached = responseCache_->lookup(
+                        method, requestHash, message.request(), getNowMs());
+                    if (cached) {
+                        RpcMessage response;
+                        response.set_type(RESPONSE);
+                        response.set_id(message.id());
+                        response.set_response(*cached);
+                        if (!sendChunked(&response)) {
+                            codec_.send(conn_, response);
+                        }
+                        RpcStats::instance().record(
+                            RpcStats::kServer, method, NO_ERROR, getNowUs() - startUs,
+                            static_cast<int64_t>(message.request().size()),
+                            static_cast<int64_t>(cached->size()));
+                        if (span) {
+                            span->endUs = getNowUs();
+                            span->mark(kStageFlush, span->endUs);
+                            Tracer::instance().record(*span);
+                        }
+                        return;
+                    }
+                }
 
                 // 创建请求消息对象
                 std::unique_ptr<google::protobuf::Message> request(
                     service->GetRequestPrototype(method).New());
                 if (request->ParseFromString(message.request())) { // 成功解析请求消息
-                    google::protobuf::Message *response =  // 创建响应消息对象
-                        service->GetResponsePrototype(method).New();
-                    int64_t id = message.id();
+                    /**
+                     * 开启了合并的方法：相同的请求正在执行时，挂到它上面等待同一份响应，
+                     * 不再调用 handler；否则自己成为 leader，done 时负责通知 waiter
+                     */
+                    bool coalesceLeader = false;
+                    if (coalesce) {
+                        RequestCoalescer::JoinResult result = coalescer_->join(
+                            method, requestHash, message.request(),
+                            options->maxCoalescedWaiters, conn, message.id());
+                        if (result == RequestCoalescer::kJoined) {
+                            return;
+                        }
+                        coalesceLeader = result == RequestCoalescer::kLeader;
+                    }
+
+                    /**
+                     * 超出并发限制时立即返回 OVERLOADED，不执行 handler。
+                     * 如果本请求是合并的 leader，已经挂上来的 waiter 也一起收到 OVERLOADED。
+                     * 入队时已经取得许可的请求在这里取走许可，由 doneCallback 归还
+                     */
+                    ConcurrencyLimiter *serverLimiter = serverLimiter_;
+                    ConcurrencyLimiter *methodLimiter = findMethodLimiter(method);
+                    if (permits) {
+                        serverLimiter = permits->serverLimiter;
+                        methodLimiter = permits->methodLimiter;
+                        permits->serverLimiter = NULL;
+                        permits->methodLimiter = NULL;
+                    } else if (!acquireLimiters(methodLimiter)) {
+                        if (coalesceLeader) {
+                            std::vector<RequestCoalescer::Waiter> waiters =
+                                coalescer_->complete(requestHash);
+                            for (const RequestCoalescer::Waiter &waiter : waiters) {
+                                TcpConnectionPtr waiterConn = waiter.conn.lock();
+                                if (waiterConn) {
+                                    sendError(waiterConn, waiter.id, OVERLOADED);
+                                }
+                            }
+                        }
+                        rejectRequest(conn_, method, messagePtr, OVERLOADED, startUs, span);
+                        return;
+                    }
+
+                    ServerCall *call = new ServerCall;
+                    call->id = message.id();
+                    call->method = method;
+                    call->request = std::move(request);
+                    call->response.reset( // 创建响应消息对象
+                        service->GetResponsePrototype(method).New());
+                    call->requestHash = requestHash;
+                    call->cacheTtlMs = cacheTtlMs;
+                    call->coalesceLeader = coalesceLeader;
+                    call->serverLimiter = serverLimiter;
+                    call->methodLimiter = methodLimiter;
+                    call->readUs = readUs > 0 ? readUs : startUs;
+                    call->startUs = startUs;
+                    call->requestBytes = static_cast<int64_t>(message.request().size());
+                    call->span = span;
+                    if (cacheTtlMs > 0) {
+                        call->requestMessage = messagePtr;
+                    }
+                    {
+                        std::unique_lock<std::mutex> lock(serverCalls_->mutex);
+                        serverCalls_->calls.insert(call);
+                    }
 
                     /**
                      * 这里的 CallMethod 是 protobuf Service 的虚函数，
@@ -179,15 +548,41 @@ void RpcChannel::handle_request_msg(const TcpConenctionPtr &conn, const RpcMessa
                      * 当 CallMethod 被调用时，最终会分发到你实现的 MonitorInfo。
                      * 你在 MonitorInfo 里处理完业务逻辑，填充 response。
                      * 你需要在业务逻辑最后调用 done->Run();
-                     * 这时，done 实际上就是 NewCallback(this, &RpcChannel::doneCallback, response, id) 生成的 Closure。
-                     * 所以，当你调用 done->Run() 时，框架就会自动调用 RpcChannel::doneCallback(response, id)
+                     * 这时，done 实际上就是 NewCallback(&RpcChannel::finishServerCall, serverCalls_, call) 生成的 Closure。
+                     * 所以，当你调用 done->Run() 时，连接还在的话框架就会自动调用 RpcChannel::doneCallback(call)
+                     */
+                    /**
+                     * handler 同步执行期间把请求的 trace 设为当前线程的上下文，
+                     * handler 里发起的下游调用会成为本 span 的子 span
                      */
-                    service->CallMethod(
-                        method, NULL, request.get(), response,
-                        NewCallback(this, &RpcChannel::doneCallback, response, id));
+                    TraceContext context;
+                    context.traceId = message.trace_id();
+                    context.spanId = span ? span->spanId : message.span_id();
+                    context.sampled = (message.trace_flags() & kTraceFlagSampled) != 0;
+                    TraceScope scope(context);
+                    if (span) {
+                        span->mark(kStageHandlerStart, getNowUs());
+                    }
+                    /**
+                     * 开启了批处理的方法交给本线程的 batcher，和其他连接的请求一起调用 batchHandler；
+                     * 提交之前连接断开时 batcher 丢弃这个请求，执行 dropBatchedCall
+                     */
+                    ::google::protobuf::Closure *done =
+                        ::google::protobuf::NewCallback(&RpcChannel::finishServerCall,
+                                                        serverCalls_, call);
+                    if (batcher_ && options && options->batchHandler) {
+                        batcher_->add(this, method, options, call->request.get(),
+                                      call->response.get(), done,
+                                      NewCallback(this, &RpcChannel::dropBatchedCall, call));
+                    } else {
+                        CurrentChannelScope current(this);
+                        service->CallMethod(method, &call->controller, call->request.get(),
+                                            call->response.get(), done);
+                    }
                     error = NO_ERROR; // 设置错误码为 NO_ERROR
                 } else {
-                    error = INVALID_REQUEST; // 解析请求消息失败
+                    rejectRequest(conn_, method, messagePtr, INVALID_REQUEST, startUs, span);
+                    return; // 解析请求消息失败
                 }
             } else {
                 error = NO_SERVICE; // 未找到服务
@@ -199,25 +594,553 @@ void RpcChannel::handle_request_msg(const TcpConenctionPtr &conn, const RpcMessa
 
     // 如果出现错误，发送包含错误信息的响应消息
     if (error != NO_ERROR) {
-        RpcMessage response;
-        repsonse.set_type(RESPONSE);
-        response.set_id(message.id());
-        response.set_error(error);
-        codec_.send(conn_, response);
+        sendError(conn_, message.id(), error);
     }
 }
 
+/**
+ * 连接断开之后才执行的 done 和 dropBatchedCall 一样不发响应，归还并发许可但不作为延迟样本；
+ * 合并的 leader 身份已经在 detachServerCalls 里交出去了
+ */
+void RpcChannel::finishServerCall(ServerCallTablePtr table, ServerCall *call) {
+    RpcChannel *channel = NULL;
+    {
+        std::unique_lock<std::mutex> lock(table->mutex);
+        table->calls.erase(call);
+        channel = table->channel;
+        if (channel) {
+            ++table->running;
+        }
+    }
+    if (channel) {
+        channel->doneCallback(call);
+        std::unique_lock<std::mutex> lock(table->mutex);
+        if (--table->running == 0) {
+            table->idle.notify_all();
+        }
+        return;
+    }
+
+    std::unique_ptr<ServerCall> d(call);
+    if (call->methodLimiter) {
+        call->methodLimiter->abandon();
+    }
+    if (call->serverLimiter) {
+        call->serverLimiter->abandon();
+    }
+    RpcStats::instance().record(RpcStats::kServer, call->method, CANCELLED,
+                                getNowUs() - call->startUs, call->requestBytes, 0);
+}
+
 /**
  * RpcChannel::doneCallback 函数是在 RPC 服务端处理完客户端请求后，
  * 用于将响应消息发送回客户端的回调函数。
  */
-void RpcChannel::doneCallback(::google::protobuf::Message *response, int64_t id) {
+void RpcChannel::doneCallback(ServerCall *call) {
+
+    // 使用智能指针管理本次调用的状态（请求、响应对象），确保资源自动释放
+    std::unique_ptr<ServerCall> d(call);
+
+    /**
+     * 归还并发限制的许可，从读到请求到现在的延迟（包括在 IO 线程和调度器里排队的时间）
+     * 作为调整限制的样本；处理请求的延迟作为该方法典型执行时间的样本和按方法统计的延迟
+     */
+    int64_t nowUs = getNowUs();
+    int64_t latencyUs = nowUs - call->startUs;
+    if (call->span) {
+        call->span->mark(kStageHandlerEnd, nowUs);
+    }
+    if (serviceTimes_) {
+        serviceTimes_->record(call->method, latencyUs);
+    }
+    if (call->methodLimiter) {
+        call->methodLimiter->release(nowUs - call->readUs);
+    }
+    if (call->serverLimiter) {
+        call->serverLimiter->release(nowUs - call->readUs);
+    }
+
+    /**
+     * handler 通过 controller 报告了失败（协程 handler 抛出异常时由 serveCoroutine 设置）：
+     * 回复错误码而不是响应，也不写缓存，只设置了错误文本时回复 INTERNAL；
+     * 合并在它上面的 waiter 收到同样的错误
+     */
+    if (call->controller.Failed()) {
+        ErrorCode error = call->controller.errorCode() != NO_ERROR
+            ? call->controller.errorCode() : INTERNAL;
+        sendError(conn_, call->id, error);
+        RpcStats::instance().record(RpcStats::kServer, call->method, error, latencyUs,
+                                    call->requestBytes, 0);
+        if (call->span) {
+            call->span->error = error;
+            call->span->endUs = getNowUs();
+            Tracer::instance().record(*call->span);
+        }
+        if (call->coalesceLeader) {
+            std::vector<RequestCoalescer::Waiter> waiters = coalescer_->complete(call->requestHash);
+            for (const RequestCoalescer::Waiter &waiter : waiters) {
+                TcpConnectionPtr conn = waiter.conn.lock();
+                if (conn) {
+                    sendError(conn, waiter.id, error);
+                    RpcStats::instance().record(RpcStats::kServer, call->method, error, latencyUs,
+                                                call->requestBytes, 0);
+                }
+            }
+        }
+        return;
+    }
 
-    // 使用智能指针管理响应消息对象，确保资源自动释放
-    std::unique_ptr<google::protobuf::Message> d(response);
     RpcMessage message; // 创建一个 RpcMessage 对象，用于封装响应消息
     message.set_type(RESPONSE); // 设置消息类型为 RESPONSE
-    message.set_id(id); // 设置消息的唯一标识符
-    message.set_response(reponse->SerializeAsString()); // 将响应消息序列化为字符串并设置到 RpcMessage 中
-    codec_.send(conn_, message); // 使用 ProtoRpcCodec 发送封装好的 RpcMessage 到指定的 TCP 连接
-}
\ No newline at end of file
+    message.set_id(call->id); // 设置消息的唯一标识符
+    message.set_response(call->response->SerializeAsString()); // 将响应消息序列化为字符串并设置到 RpcMessage 中
+    if (call->span) {
+        call->span->mark(kStageEncode, getNowUs());
+    }
+
+    /**
+     * 可缓存的方法把序列化后的响应写入缓存分片。
+     * handler 可能在其他线程调用 done->Run()，缓存分片只能在所属的 IO 线程里修改，
+     * 所以通过 runInLoop 转到连接所在的 loop 执行
+     */
+    if (call->cacheTtlMs > 0 && responseCache_) {
+        conn_->getLoop()->runInLoop(std::bind(&ResponseCache::insert, responseCache_,
+                                              call->method, call->requestHash,
+                                              call->requestMessage->request(),
+                                              message.response(),
+                                              getNowMs() + call->cacheTtlMs));
+    }
+    /**
+     * 超过一块的响应分块发送，分块会换走 response，合并的 leader 之后还要把它发给 waiter，这时发一份拷贝；
+     * 在 onMessage 里同步完成的响应攒起来一起写，pendingResponses_ 只在 IO 线程里访问
+     */
+    int64_t responseBytes = static_cast<int64_t>(message.response().size());
+    if (chunkWriter_ && chunkWriter_->shouldChunk(message)) {
+        RpcMessage copy;
+        if (call->coalesceLeader) {
+            copy = message;
+        }
+        chunkWriter_->send(conn_, call->coalesceLeader ? &copy : &message);
+    } else if (conn_->getLoop()->isInLoopThread() && pendingResponses_) {
+        codec_.appendMessage(pendingResponses_, message);
+    } else {
+        codec_.send(conn_, message); // 使用 ProtoRpcCodec 发送封装好的 RpcMessage 到指定的 TCP 连接
+    }
+    RpcStats::instance().record(RpcStats::kServer, call->method, NO_ERROR, latencyUs,
+                                call->requestBytes, responseBytes);
+    if (call->span) {
+        call->span->endUs = getNowUs();
+        call->span->mark(kStageFlush, call->span->endUs);
+        Tracer::instance().record(*call->span);
+    }
+
+    /**
+     * leader 完成后把同一份响应字节发给所有 waiter，只替换请求 ID。
+     * waiter 可能在其他 IO 线程的连接上，TcpConnection::send 是线程安全的；
+     * 等待期间已经断开的连接直接跳过
+     */
+    if (call->coalesceLeader) {
+        std::vector<RequestCoalescer::Waiter> waiters = coalescer_->complete(call->requestHash);
+        for (const RequestCoalescer::Waiter &waiter : waiters) {
+            TcpConnectionPtr conn = waiter.conn.lock();
+            if (conn) {
+                message.set_id(waiter.id);
+                codec_.send(conn, message);
+                // waiter 没有单独计时，记为和 leader 相同的延迟
+                RpcStats::instance().record(RpcStats::kServer, call->method, NO_ERROR, latencyUs,
+                                            call->requestBytes, responseBytes);
+            }
+        }
+    }
+}
+
+RpcChannel *RpcChannel::current() {
+    return t_currentChannel;
+}
+
+void RpcChannel::addCloseCallback(const std::function<void()> &cb) {
+    closeCallbacks_.push_back(cb);
+}
+
+/**
+ * 排队等待攒批的请求因为连接断开被丢弃：不发响应，归还并发许可但不作为延迟样本；
+ * 如果它是合并的 leader，挂在它上面的 waiter（可能在其他连接上）收到 CANCELLED
+ */
+void RpcChannel::dropBatchedCall(ServerCall *call) {
+    std::unique_ptr<ServerCall> d(call);
+    {
+        std::unique_lock<std::mutex> lock(serverCalls_->mutex);
+        serverCalls_->calls.erase(call);
+    }
+    if (call->methodLimiter) {
+        call->methodLimiter->abandon();
+    }
+    if (call->serverLimiter) {
+        call->serverLimiter->abandon();
+    }
+    RpcStats::instance().record(RpcStats::kServer, call->method, CANCELLED,
+                                getNowUs() - call->startUs, call->requestBytes, 0);
+    if (call->coalesceLeader) {
+        std::vector<RequestCoalescer::Waiter> waiters = coalescer_->complete(call->requestHash);
+        for (const RequestCoalescer::Waiter &waiter : waiters) {
+            TcpConnectionPtr conn = waiter.conn.lock();
+            if (conn) {
+                sendError(conn, waiter.id, CANCELLED);
+            }
+        }
+    }
+}
+
+void RpcChannel::detachServerCalls() {
+    ServerCallTablePtr table = serverCalls_;
+    std::vector<uint64_t> leaderHashes;
+    {
+        std::unique_lock<std::mutex> lock(table->mutex);
+        table->channel = NULL;
+        table->idle.wait(lock, [&table] { return table->running == 0; });
+        for (ServerCall *call : table->calls) {
+            if (call->coalesceLeader) {
+                leaderHashes.push_back(call->requestHash);
+                call->coalesceLeader = false;
+            }
+        }
+    }
+    for (uint64_t requestHash : leaderHashes) {
+        std::vector<RequestCoalescer::Waiter> waiters = coalescer_->complete(requestHash);
+        for (const RequestCoalescer::Waiter &waiter : waiters) {
+            TcpConnectionPtr conn = waiter.conn.lock();
+            if (conn) {
+                sendError(conn, waiter.id, CANCELLED);
+            }
+        }
+    }
+}
+
+/**
+ * 开启调度时请求先进入本线程的 RequestScheduler，按优先级和连接间的 DRR（或 deadline）顺序
+ * 再调用 handle_request_msg。请求没有带优先级时使用方法的默认优先级。
+ * 请求带了时间预算时，deadline 从解码出请求的时刻算起；轮到执行时剩余时间不够
+ * 方法的典型执行时间，调度器直接回复 TIMEOUT。
+ * 调度器在连接断开（本对象析构）时丢弃它排队的请求，所以这里可以直接绑定 this。
+ * 开启了并发限制时入队前就取得许可，超出限制的请求不进入队列，直接回复 OVERLOADED
+ */
+void RpcChannel::schedule_request_msg(const TcpConnectionPtr &conn,
+                                      const RpcMessagePtr &messagePtr,
+                                      const TraceSpanPtr &span) {
+    RpcMessage &message = *messagePtr;
+    const google::protobuf::MethodDescriptor *method = NULL;
+    if (services_) {
+        auto it = services_->find(message.service());
+        if (it != services_->end()) {
+            method = it->second->GetDescriptor()->FindMethodByName(message.method());
+        }
+    }
+
+    RequestScheduler::Request request;
+    request.connKey = this;
+    request.priority = message.priority();
+    if (request.priority == PRIORITY_UNSET && method) {
+        const RpcMethodOptions *options = findMethodOptions(method);
+        if (options) {
+            request.priority = options->priority;
+        }
+    }
+    request.cost = static_cast<int64_t>(message.request().size());
+    if (message.timeout_ms() > 0) {
+        request.deadlineUs = getNowUs() + message.timeout_ms() * 1000;
+        request.serviceTimeUs = (method && serviceTimes_) ? serviceTimes_->estimateUs(method) : 0;
+        request.expire = std::bind(&RpcChannel::rejectRequest, this, conn, method, messagePtr,
+                                   TIMEOUT, getNowUs(), span);
+    }
+    int64_t readUs = 0;
+    LimiterPermitsPtr permits;
+    if (limited()) {
+        ConcurrencyLimiter *methodLimiter = method ? findMethodLimiter(method) : NULL;
+        if (!acquireLimiters(methodLimiter)) {
+            rejectRequest(conn, method, messagePtr, OVERLOADED, getNowUs(), span);
+            return;
+        }
+        readUs = lastReadUs_;
+        permits = std::make_shared<LimiterPermits>();
+        permits->serverLimiter = serverLimiter_;
+        permits->methodLimiter = methodLimiter;
+    }
+    request.task = std::bind(&RpcChannel::handle_request_msg, this, conn, messagePtr, span,
+                             readUs, permits);
+    scheduler_->enqueue(std::move(request));
+}
+
+/**
+ * 流 ID 和一元调用共用 id_ 分配，保证同一个 RpcChannel 上发起的流 ID 不重复
+ */
+RpcStreamPtr RpcChannel::openStream(const ::google::protobuf::MethodDescriptor *method,
+                                    const RpcStream::MessageCallback &messageCb,
+                                    const RpcStream::CloseCallback &closeCb) {
+    int64_t id = id_.fetch_add(1) + 1;
+    RpcStreamPtr stream(new RpcStream(conn_, streams_, id, method, true));
+    stream->setMessageCallback(messageCb);
+    stream->setCloseCallback(closeCb);
+    streams_->add(stream, true);
+    stream->sendOpen();
+    return stream;
+}
+
+void RpcChannel::abortStreams(ErrorCode error) {
+    std::vector<RpcStreamPtr> streams = streams_->takeAll();
+    for (const RpcStreamPtr &stream : streams) {
+        stream->abort(error);
+    }
+}
+
+/**
+ * 对端发起的流：STREAM_OPEN 时按 service/method 找到服务端登记的 streamHandler，
+ * 创建 RpcStream 交给 handler；其余的帧按流 ID 转给对应的 RpcStream。
+ * 找不到服务或者方法没有登记 streamHandler 时，用 STREAM_CANCEL 拒绝
+ */
+void RpcChannel::handle_stream_request(const TcpConnectionPtr &conn,
+                                       const RpcMessagePtr &messagePtr) {
+    RpcMessage &message = *messagePtr;
+    if (message.frame() != STREAM_OPEN) {
+        RpcStreamPtr stream = streams_->find(message.id(), false);
+        if (stream) {
+            stream->onFrame(message);
+        }
+        return;
+    }
+
+    ErrorCode error = NO_SERVICE;
+    const StreamHandler *handler = NULL;
+    const google::protobuf::MethodDescriptor *method = NULL;
+    if (services_) {
+        auto it = services_->find(message.service());
+        if (it != services_->end()) {
+            method = it->second->GetDescriptor()->FindMethodByName(message.method());
+            const RpcMethodOptions *options = method ? findMethodOptions(method) : NULL;
+            if (options && options->streamHandler) {
+                handler = &options->streamHandler;
+                error = NO_ERROR;
+            } else {
+                error = NO_METHOD;
+            }
+        }
+    }
+
+    if (error != NO_ERROR) {
+        RpcMessage response;
+        response.set_type(STREAM_RESPONSE);
+        response.set_id(message.id());
+        response.set_frame(STREAM_CANCEL);
+        response.set_error(error);
+        codec_.send(conn, response);
+        return;
+    }
+
+    RpcStreamPtr stream(new RpcStream(conn, streams_, message.id(), method, false));
+    streams_->add(stream, false);
+    (*handler)(stream);
+}
+
+ConcurrencyLimiter *RpcChannel::findMethodLimiter(
+    const ::google::protobuf::MethodDescriptor *method) const {
+    if (!methodLimiters_) {
+        return NULL;
+    }
+    ConcurrencyLimiterMap::const_iterator it = methodLimiters_->find(method);
+    return it == methodLimiters_->end() ? NULL : get_pointer(it->second);
+}
+
+/**
+ * 先检查方法的限制再检查整体限制，整体限制拒绝时归还已经拿到的方法许可
+ */
+bool RpcChannel::acquireLimiters(ConcurrencyLimiter *methodLimiter) {
+    if (methodLimiter && !methodLimiter->tryAcquire()) {
+        return false;
+    }
+    if (serverLimiter_ && !serverLimiter_->tryAcquire()) {
+        if (methodLimiter) {
+            methodLimiter->abandon();
+        }
+        return false;
+    }
+    return true;
+}
+
+void RpcChannel::setChunking(size_t chunkBytes, ChunkWriter::Policy policy) {
+    if (chunkBytes > 0) {
+        chunkWriter_ = std::make_shared<ChunkWriter>(chunkBytes, policy);
+    } else {
+        chunkWriter_.reset();
+    }
+}
+
+bool RpcChannel::sendChunked(RpcMessage *message) {
+    if (!chunkWriter_ || !chunkWriter_->shouldChunk(*message)) {
+        return false;
+    }
+    chunkWriter_->send(conn_, message);
+    return true;
+}
+
+/**
+ * 拼接的字节数超过上限或者拼出的消息不合法时关闭连接，和 ProtoRpcCodec 拒绝过大的帧一样
+ */
+bool RpcChannel::handle_chunk_msg(const TcpConnectionPtr &conn, RpcMessage *message) {
+    bool ok = message->type() == CHUNK ? chunkAssembler_.add(*message)
+                                       : chunkAssembler_.complete(message);
+    if (!ok) {
+        LOG(ERROR) << "RpcChannel::handle_chunk_msg - bad chunk from " << conn->name()
+                   << ", id " << message->id() << ", pending " << chunkAssembler_.pendingBytes()
+                   << " bytes";
+        conn->forceClose();
+        return false;
+    }
+    return message->type() != CHUNK;
+}
+
+/**
+ * 和收到服务端返回的错误走同一条路径：设置错误码、记录统计、执行 done。
+ * 取出 ID 之后对应的响应可能已经到达，这时 handle_response_msg 找不到这个 ID，什么也不做
+ */
+void RpcChannel::failOutstandingCalls(ErrorCode error) {
+    std::vector<int64_t> ids;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ids.reserve(outstandings_.size());
+        for (const auto &outstanding : outstandings_) {
+            ids.push_back(outstanding.first);
+        }
+    }
+    for (int64_t id : ids) {
+        RpcMessagePtr response(new RpcMessage());
+        response->set_type(RESPONSE);
+        response->set_id(id);
+        response->set_error(error);
+        handle_response_msg(response);
+    }
+}
+
+/**
+ * intervalMs 不大于 0 时定时器会以 0 间隔空转、第一次检查就超时，missThreshold 不大于 0 时
+ * 第一次空闲就关闭连接，所以两者都至少取 1
+ */
+void RpcChannel::enableHeartbeat(const HeartbeatOptions &options) {
+    conn_->getLoop()->assertInLoopThread();
+    if (options.intervalMs < 1 || options.missThreshold < 1) {
+        LOG(WARNING) << "RpcChannel::enableHeartbeat - intervalMs " << options.intervalMs
+                     << " and missThreshold " << options.missThreshold << " must be >= 1, clamped";
+    }
+    heartbeatEnabled_ = true;
+    heartbeat_ = options;
+    heartbeat_.intervalMs = std::max<int64_t>(options.intervalMs, 1);
+    heartbeat_.missThreshold = std::max(options.missThreshold, 1);
+    heartbeatMisses_ = 0;
+    lastReadUs_ = getNowUs();
+    conn_->setTcpUserTimeout(heartbeat_.tcpUserTimeoutMs > 0
+        ? heartbeat_.tcpUserTimeoutMs
+        : static_cast<int>(heartbeat_.intervalMs * (heartbeat_.missThreshold + 1)));
+    conn_->getLoop()->runAfter(heartbeat_.intervalMs / 1000.0,
+                               std::bind(&RpcChannel::onHeartbeatTimer,
+                                         std::weak_ptr<RpcChannel>(shared_from_this()),
+                                         std::weak_ptr<TcpConnection>(conn_)));
+}
+
+void RpcChannel::onHeartbeatTimer(const std::weak_ptr<RpcChannel> &weakChannel,
+                                  const std::weak_ptr<TcpConnection> &weakConn) {
+    RpcChannelPtr channel = weakChannel.lock();
+    TcpConnectionPtr conn = weakConn.lock();
+    if (!channel || !conn || !conn->connected() || channel->conn_ != conn) {
+        return;
+    }
+    if (channel->checkHeartbeat(conn)) {
+        conn->getLoop()->runAfter(channel->heartbeat_.intervalMs / 1000.0,
+                                  std::bind(&RpcChannel::onHeartbeatTimer, weakChannel, weakConn));
+    }
+}
+
+/**
+ * 连接忙的时候一直有数据到达，不发 PING；空闲了 intervalMs 才发，
+ * 所以 PING 只出现在空闲的连接上。PONG 或其他任何数据到达都会让下一次检查清零计数
+ */
+bool RpcChannel::checkHeartbeat(const TcpConnectionPtr &conn) {
+    if (getNowUs() - lastReadUs_ < heartbeat_.intervalMs * 1000) {
+        heartbeatMisses_ = 0;
+        return true;
+    }
+    if (heartbeatMisses_ >= heartbeat_.missThreshold) {
+        LOG(WARNING) << "RpcChannel::checkHeartbeat - " << conn->name() << " no data for "
+                     << (getNowUs() - lastReadUs_) / 1000 << " ms after " << heartbeatMisses_
+                     << " pings, closing";
+        g_heartbeatTimeouts->inc();
+        failOutstandingCalls(UNAVAILABLE);
+        abortStreams(UNAVAILABLE);
+        conn->forceClose();
+        return false;
+    }
+    RpcMessage ping;
+    ping.set_type(PING);
+    ping.set_id(++heartbeatMisses_);
+    codec_.send(conn, ping);
+    g_heartbeatPings->inc();
+    return true;
+}
+
+void RpcChannel::sendError(const TcpConnectionPtr &conn, int64_t id, ErrorCode error) {
+    RpcMessage response;
+    response.set_type(RESPONSE);
+    response.set_id(id);
+    response.set_error(error);
+    codec_.send(conn, response);
+}
+
+/**
+ * 找不到方法时（method 为 NULL）没有可以归属的统计项，只回复错误
+ */
+void RpcChannel::rejectRequest(const TcpConnectionPtr &conn,
+                               const ::google::protobuf::MethodDescriptor *method,
+                               const RpcMessagePtr &messagePtr, ErrorCode error,
+                               int64_t startUs, const TraceSpanPtr &span) {
+    sendError(conn, messagePtr->id(), error);
+    if (method) {
+        RpcStats::instance().record(RpcStats::kServer, method, error, getNowUs() - startUs,
+                                    static_cast<int64_t>(messagePtr->request().size()), 0);
+        if (span) {
+            span->name = &method->full_name();
+            span->error = error;
+            span->endUs = getNowUs();
+            Tracer::instance().record(*span);
+        }
+    }
+}
+
+/**
+ * 服务端 span 从读到请求数据开始，以客户端的 span 为父 span；
+ * 方法名在 handle_request_msg 找到方法之后再填
+ */
+TraceSpanPtr RpcChannel::startServerSpan(const RpcMessage &message) {
+    if (!(message.trace_flags() & kTraceFlagSampled) || message.trace_id() == 0 ||
+        !Tracer::instance().recording()) {
+        return TraceSpanPtr();
+    }
+    int64_t nowUs = getNowUs();
+    TraceSpanPtr span = std::make_shared<TraceSpan>();
+    span->traceId = message.trace_id();
+    span->spanId = Tracer::newId();
+    span->parentId = message.span_id();
+    span->server = true;
+    span->startUs = lastReadUs_ > 0 ? lastReadUs_ : nowUs;
+    span->mark(kStageRead, span->startUs);
+    span->mark(kStageDecode, nowUs);
+    return span;
+}
+
+/**
+ * 查找服务端为该方法登记的配置，没有登记时返回 NULL
+ */
+const RpcMethodOptions *RpcChannel::findMethodOptions(
+    const ::google::protobuf::MethodDescriptor *method) const {
+    if (!methodOptions_) {
+        return NULL;
+    }
+    MethodOptionsMap::const_iterator it = methodOptions_->find(method);
+    return it == methodOptions_->end() ? NULL : &it->second;
+}
@@ -1,10 +1,22 @@
 #pragma once 
 
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <vector>
 #include <googl/protobuf/service.h>
 
+#include "ConcurrencyLimiter.h"
+#include "MessageChunker.h"
+#include "RpcBatch.h"
+#include "Tracing.h"
 #include "RpcCodec.h"
+#include "RpcController.h"
+#include "RpcMethodOptions.h"
+#include "RpcStream.h"
 #include "rpc.pb.h"
 
 namespace google {
@@ -26,7 +38,23 @@ class Service;
 
 namespace network {
 
-class RpcChannel : public ::google::protobuf::RpcChannel {
+class RequestBatcher;
+class RequestCoalescer;
+class RequestScheduler;
+class ServiceTimeEstimator;
+class ResponseCache;
+
+/**
+ * 连接的应用层心跳配置，见 RpcChannel::enableHeartbeat
+ */
+struct HeartbeatOptions {
+    int64_t intervalMs = 1000; // 超过这么久没有收到任何数据时发一次 PING
+    int missThreshold = 3;     // 连续这么多个 PING 之后仍然没有收到任何数据，认为对端已经失效
+    int tcpUserTimeoutMs = 0;  // TCP_USER_TIMEOUT，0 表示取 intervalMs * (missThreshold + 1)
+};
+
+class RpcChannel : public ::google::protobuf::RpcChannel,
+                   public std::enable_shared_from_this<RpcChannel> {
 public:
     RpcChannel();
 
@@ -36,30 +64,245 @@ public:
 
     void setConnection(const TcpConnectionPtr &conn) { conn_ = conn; }
 
-    void setServices(const std::map<std::string, ::gogle::protobuf::Service *>services) {
+    void setServices(const std::map<std::string, ::google::protobuf::Service *> *services) {
         services_ = services;
     }
 
+    void setMethodOptions(const MethodOptionsMap *methodOptions) {
+        methodOptions_ = methodOptions;
+    }
+
+    // 当前连接所在 IO 线程的响应缓存分片，由 RpcServer 在建立连接时设置
+    void setResponseCache(ResponseCache *cache) { responseCache_ = cache; }
+
+    // 当前连接所在 IO 线程的批处理器，由 RpcServer 在建立连接时设置，没有方法开启批处理时为 NULL
+    void setRequestBatcher(RequestBatcher *batcher) { batcher_ = batcher; }
+
+    // 整个 RpcServer 共用的请求合并器，由 RpcServer 在建立连接时设置
+    void setRequestCoalescer(RequestCoalescer *coalescer) { coalescer_ = coalescer; }
+
+    // 整个 server 的并发限制和按方法的并发限制，都可以为 NULL
+    // 当前连接所在 IO 线程的请求调度器，为 NULL 时请求解码后立即执行
+    void setScheduler(RequestScheduler *scheduler) { scheduler_ = scheduler; }
+
+    // 记录每个方法 handler 的执行时间，调度器据此丢弃来不及执行的请求，可以为 NULL
+    void setServiceTimeEstimator(ServiceTimeEstimator *serviceTimes) {
+        serviceTimes_ = serviceTimes;
+    }
+
+    void setConcurrencyLimiters(ConcurrencyLimiter *serverLimiter,
+                                const ConcurrencyLimiterMap *methodLimiters) {
+        serverLimiter_ = serverLimiter;
+        methodLimiters_ = methodLimiters;
+    }
+
+    /**
+     * 开启大消息分块发送：request/response 超过 chunkBytes 的消息把这个字段拆成 CHUNK 帧，和其他调用交错发送，
+     * 见 ChunkWriter。chunkBytes 为 0 时关闭。CHUNK 帧总是能被接收，但对端是不认识 CHUNK 的旧版本时不能开启。
+     * 需要在这个连接上发送消息之前调用
+     */
+    void setChunking(size_t chunkBytes, ChunkWriter::Policy policy = ChunkWriter::kRoundRobin);
+
     void CallMethod(const ::google::protobuf::MethodDescriptor *method, 
                     ::google::protobuf::RpcController *controller,
                     const ::google:protobuf::Message *request, 
                     ::google::protobuf::Message *response,
                     ::google::protobuf::Closure *done) override;
 
+    /**
+     * 批量调用，见 RpcBatch。controller 可以为 NULL，不为 NULL 时它的优先级、时间预算和
+     * trace 上下文用于每一项，有项失败时第一个错误码设置到它上面。
+     * 整批共用一个 trace span ID，不为每一项单独记录客户端 span
+     */
+    void callBatch(RpcBatch *batch, RpcController *controller, ::google::protobuf::Closure *done);
+
     void onMessage(const TcpConnectionPtr &conn, Buffer *buf);
 
+    /**
+     * 在当前连接上发起一个流式调用，method 必须是 proto 里声明为 stream 的方法。
+     * 回调在发出 STREAM_OPEN 之前设置好，之后用返回的 RpcStream 写消息、半关闭或取消。
+     * 只能在连接所在的 IO 线程里调用
+     */
+    RpcStreamPtr openStream(const ::google::protobuf::MethodDescriptor *method,
+                            const RpcStream::MessageCallback &messageCb,
+                            const RpcStream::CloseCallback &closeCb);
+
+    // 中止所有未结束的流，close 回调收到 error。客户端在连接断开时调用，析构时也会调用
+    void abortStreams(ErrorCode error);
+
+    /**
+     * 未完成的调用立即以 error 结束：和收到服务端返回的错误一样，错误码设置到 RpcController 上，
+     * 执行 done。客户端在连接断开时以 UNAVAILABLE 调用（之后还要复用本对象重连时必须调用），
+     * 心跳超时和析构时自动以 UNAVAILABLE 调用
+     */
+    void failOutstandingCalls(ErrorCode error);
+
+    /**
+     * 开启应用层心跳，只依赖 SO_KEEPALIVE 时半死的连接要约两小时才会被发现。
+     * 每 intervalMs 检查一次，这段时间里没有收到任何数据就发 PING，对端回 PONG，收到任何数据都算对端存活；
+     * 连续 missThreshold 个 PING 都没有等到数据时认为对端失效：未完成的调用以 UNAVAILABLE 结束，
+     * 流被中止，连接被关闭，连接回调随之收到断开，调用方可以马上把流量转到其他连接。
+     * 最后一次收到数据之后 intervalMs * (missThreshold + 1) 到 intervalMs * (missThreshold + 2) 之间被发现。
+     * 同时设置 TCP_USER_TIMEOUT，有数据一直没有被确认时内核也会更早断开。
+     *
+     * 必须已经由 RpcChannelPtr 持有，在连接建立之后、连接所在的 IO 线程里调用。
+     * 对端总会回复 PING，但对端是不认识 PING 的旧版本时不能开启
+     */
+    void enableHeartbeat(const HeartbeatOptions &options = HeartbeatOptions());
+
+    /**
+     * 服务端 handler 同步执行期间（service->CallMethod 之内）返回处理这个请求的 RpcChannel，
+     * 其他时候返回 NULL。handler 把 done 留到之后执行时，用它登记连接断开时的清理
+     */
+    static RpcChannel *current();
+
+    /**
+     * 登记一个在本对象析构（连接断开）时执行的回调，按登记顺序、在释放其他成员之前执行。
+     * 长时间持有 done 的 handler 用它提前执行 done、释放自己持有的资源（连接断开之后才执行的 done 不再回复）。
+     * 只能在连接所在的 IO 线程里调用
+     */
+    void addCloseCallback(const std::function<void()> &cb);
+
 private:
     void onRpcMessage(const TcpConnectionPtr &conn, const RpcMessagePtr &messagePtr);
 
-    void doneCallback(::google::protobuf::Message *response, int64_t id);
+    /**
+     * ServerCall 保存一次服务端调用从分发到 done->Run() 之间需要的全部状态。
+     * 请求对象也放在这里，这样异步 handler 在 done 之前都能安全地访问 request。
+     */
+    struct ServerCall {
+        int64_t id;
+        const ::google::protobuf::MethodDescriptor *method;
+        std::unique_ptr<::google::protobuf::Message> request;
+        std::unique_ptr<::google::protobuf::Message> response;
+        RpcMessagePtr requestMessage; // 保留原始请求字节，写缓存时用来做冲突校验
+        uint64_t requestHash;
+        int64_t cacheTtlMs;
+        bool coalesceLeader;          // 完成时需要把响应发给挂在它上面的 waiter
+        ConcurrencyLimiter *serverLimiter;
+        ConcurrencyLimiter *methodLimiter;
+        int64_t readUs;               // 读到请求数据的时间，并发限制的延迟样本从这里算起，包括排队的时间
+        int64_t startUs;              // 开始处理请求的时间，用于执行时间和按方法统计的延迟样本
+        int64_t requestBytes;
+        TraceSpanPtr span;            // 采样的请求才有
+        RpcController controller;     // 传给 handler，handler 通过它报告失败，done 时回复错误而不是响应
+    };
+
+    /**
+     * 已经分发、还没有执行 done 的服务端调用。done 不直接绑定 this：协程 handler 挂起期间、
+     * 异步 handler 在其他线程完成之前连接都可能断开，析构时把 channel 置为 NULL，
+     * 之后才执行的 done 只归还许可、释放 ServerCall，不再访问本对象；
+     * 析构等待正在执行的 doneCallback 结束
+     */
+    struct ServerCallTable {
+        std::mutex mutex;
+        std::condition_variable idle;
+        RpcChannel *channel = NULL;
+        int running = 0;              // 正在执行的 doneCallback 个数
+        std::set<ServerCall *> calls;
+    };
+
+    typedef std::shared_ptr<ServerCallTable> ServerCallTablePtr;
+
+    // 服务端调用的 done，channel 还在时执行 doneCallback
+    static void finishServerCall(ServerCallTablePtr table, ServerCall *call);
+
+    void doneCallback(ServerCall *call);
+
+    void dropBatchedCall(ServerCall *call);
+
+    /**
+     * 析构时调用：之后执行的 done 不再访问本对象。合并的 leader 没法再回复 waiter，
+     * 挂在它们上面的 waiter 立即收到 CANCELLED
+     */
+    void detachServerCalls();
+
+    const RpcMethodOptions *findMethodOptions(const ::google::protobuf::MethodDescriptor *method) const;
+
+    ConcurrencyLimiter *findMethodLimiter(const ::google::protobuf::MethodDescriptor *method) const;
+
+    bool acquireLimiters(ConcurrencyLimiter *methodLimiter);
+
+    /**
+     * 开启调度时请求入队就取得的并发许可，这样排队等待的请求也计入在途请求数，
+     * 同步 handler 在 IO 线程里的排队才能被并发限制看到。
+     * 执行时由 handle_request_msg 取走；请求没有执行（TIMEOUT、连接断开）时析构归还，不记录样本
+     */
+    struct LimiterPermits {
+        ConcurrencyLimiter *serverLimiter = NULL;
+        ConcurrencyLimiter *methodLimiter = NULL;
+
+        ~LimiterPermits() {
+            if (methodLimiter) {
+                methodLimiter->abandon();
+            }
+            if (serverLimiter) {
+                serverLimiter->abandon();
+            }
+        }
+    };
+
+    typedef std::shared_ptr<LimiterPermits> LimiterPermitsPtr;
+
+    bool limited() const {
+        return serverLimiter_ || (methodLimiters_ && !methodLimiters_->empty());
+    }
+
+    void sendError(const TcpConnectionPtr &conn, int64_t id, ErrorCode error);
+
+    /**
+     * 开启了分块且 message 的 request/response 超过一块时分块发送并返回 true，
+     * 这个字段被换走，之后为空；否则返回 false，由调用方照常发送
+     */
+    bool sendChunked(RpcMessage *message);
+
+    /**
+     * CHUNK 帧追加到拼接中的字段，返回 false；chunked 的消息换回拼好的 request/response，
+     * 返回 true 表示接着按消息类型处理。拼接失败时关闭连接并返回 false
+     */
+    bool handle_chunk_msg(const TcpConnectionPtr &conn, RpcMessage *message);
+
+    // 心跳定时器，channel 已经释放或者连接已经断开、被替换时不再继续
+    static void onHeartbeatTimer(const std::weak_ptr<RpcChannel> &weakChannel,
+                                 const std::weak_ptr<TcpConnection> &weakConn);
+
+    // 需要时发 PING；对端已经失效时关闭连接并返回 false
+    bool checkHeartbeat(const TcpConnectionPtr &conn);
+
+    // 回复错误并计入该方法的服务端统计
+    void rejectRequest(const TcpConnectionPtr &conn,
+                       const ::google::protobuf::MethodDescriptor *method,
+                       const RpcMessagePtr &messagePtr, ErrorCode error, int64_t startUs,
+                       const TraceSpanPtr &span);
+
+    // 请求带着已采样的 trace 且本进程在记录时创建服务端 span，否则返回空
+    TraceSpanPtr startServerSpan(const RpcMessage &message);
 
     void handle_response_msg(const RpcMessagePtr &messagePtr);
 
-    void handle_request_msg(const TcpConnectionPtr &conn, const RpcMessagePtr &messagePtr);
+    /**
+     * readUs 是读到请求数据的时间（没有开启并发限制时为 0）；
+     * permits 是入队时已经取得的并发许可，为空时在这里取得
+     */
+    void handle_request_msg(const TcpConnectionPtr &conn, const RpcMessagePtr &messagePtr,
+                            const TraceSpanPtr &span, int64_t readUs,
+                            const LimiterPermitsPtr &permits);
+
+    void schedule_request_msg(const TcpConnectionPtr &conn, const RpcMessagePtr &messagePtr,
+                              const TraceSpanPtr &span);
+
+    void handle_stream_request(const TcpConnectionPtr &conn, const RpcMessagePtr &messagePtr);
 
     struct OutstandingCall {
         ::google::protobuf::Message *response;
         ::google::protbuf::Closure *done;
+        ::google::protobuf::RpcController *controller; // 用于把服务端的错误码带回给调用方
+        const ::google::protobuf::MethodDescriptor *method;
+        int64_t startUs;
+        int64_t requestBytes;
+        TraceSpanPtr span;
+        RpcBatch *batch;   // 批量调用的一项时不为 NULL，response 归调用方所有，done 为 NULL
+        size_t batchIndex;
     };
 
     ProtoRpcCodec codec_;
@@ -73,7 +316,25 @@ private:
      * 让客户端能在收到响应时，准确找到是哪个请求的结果，并调用正确的回调。
      */
     std::map<int64_t, OutstandingCall> outstandings_;
-    const std::map<std::string, ::google::protobuf::Service *> services_;
+    const std::map<std::string, ::google::protobuf::Service *> *services_;
+    const MethodOptionsMap *methodOptions_;
+    ResponseCache *responseCache_;
+    RequestCoalescer *coalescer_;
+    RequestBatcher *batcher_;
+    std::shared_ptr<RpcStreamTable> streams_;
+    ServerCallTablePtr serverCalls_;
+    ConcurrencyLimiter *serverLimiter_;
+    const ConcurrencyLimiterMap *methodLimiters_;
+    RequestScheduler *scheduler_;
+    ServiceTimeEstimator *serviceTimes_;
+    int64_t lastReadUs_; // 最近一次读到数据的时间，只在 Tracer 记录、开启了心跳或并发限制时更新
+    Buffer *pendingResponses_; // onMessage 处理期间指向攒着的响应，其他时候为 NULL
+    ChunkWriterPtr chunkWriter_; // 没有开启分块时为空
+    ChunkAssembler chunkAssembler_;
+    bool heartbeatEnabled_;
+    HeartbeatOptions heartbeat_;
+    int heartbeatMisses_; // 连续发出、还没有等到数据的 PING 数，只在 IO 线程里访问
+    std::vector<std::function<void()>> closeCallbacks_; // 只在 IO 线程里访问
 };
 
 typedef std::shared_ptr<RpcChannel> RpcChannelPtr;
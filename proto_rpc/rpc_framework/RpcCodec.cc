@@ -1,11 +1,21 @@
 #include <zlib.h>
 #include <google/protobuf/message.h>
+#include <glog/logging.h>
 
 #include "RpcCodec.h"
 #include "network/Endian.h"
+#include "network/Metrics.h"
 #include "network/TcpConnection.h"
 
 using namespace network;
+
+namespace {
+
+Counter *const g_largeFramesRefused =
+    MetricsRegistry::instance().counter("rpc.large_frames_refused");
+
+} // namespace
+
 namespace network
 {
 
@@ -58,6 +68,18 @@ namespace network
             }
             else
             { // 如果缓冲区数据还不够一条完整消息，退出循环，等待更多数据。
+                // 大帧收齐还要再占 len - 已收到 的内存，超过 Buffer 内存的硬上限时拒绝，关闭连接
+                size_t received = buf->readableBytes() - kHeaderLen;
+                if (len >= kLargeFrameLen &&
+                    BufferMemory::wouldExceedHardLimit(static_cast<int64_t>(len - received)))
+                {
+                    LOG(ERROR) << "ProtoRpcCodec::onMessage - refuse " << len
+                               << " bytes frame from " << conn->name() << ", buffer memory "
+                               << BufferMemory::totalBytes() << " bytes";
+                    g_largeFramesRefused->inc();
+                    buf->retrieveAll();
+                    conn->forceClose();
+                }
                 break;
             }
         }
@@ -196,6 +218,24 @@ namespace network
         buf->prepend(&len, sizeof len);
     }
 
+    /**
+     * 和 fillEmptyBuffer 的帧格式相同。buf 前面已经有数据，不能 prepend 长度字段，
+     * 所以先占住长度字段的位置，整帧写完后再回填
+     */
+    void ProtoRpcCodec::appendMessage(Buffer *buf, const google::protobuf::Message &message)
+    {
+        buf->appendInt32(0);
+        buf->append(tag_);
+        int byte_size = serializeToBuffer(message, buf);
+
+        int32_t body = static_cast<int32_t>(tag_.size()) + byte_size;
+        int32_t checkSum = checksum(buf->beginWrite() - body, body);
+        buf->appendInt32(checkSum);
+
+        int32_t len = sockets::hostToNetwork32(body + kChecksumLen);
+        ::memcpy(buf->beginWrite() - kChecksumLen - body - kHeaderLen, &len, sizeof len);
+    }
+
     /**
      * 这段代码是 ProtoRpcCodec::asInt32 方法的实现，
      * 作用是把一段二进制数据（4字节）按网络字节序（大端）解析为本地的 int32_t 整数
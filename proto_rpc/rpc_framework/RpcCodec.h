@@ -31,6 +31,8 @@ public:
     const static int kChecksumLen = sizeof(int32_t);
     const static int kMaxMessageLen = 
         64 * 1024 * 1024; // same as codec_stream.h kDefaultTotalBytesLimit
+    // 不小于这个长度的帧在收齐之前检查 BufferMemory 的硬上限，超过上限时关闭连接
+    const static int kLargeFrameLen = 1024 * 1024;
     
     enum ErrorCode {
         kNoError = 0, // 不写 "= 0"的话，C++ 默认第一个就是 0。
@@ -62,6 +64,9 @@ public:
 
     void fillEmptyBuffer(Buffer *buf, const google::protbuf::Message &message);
 
+    // 把一帧追加到 buf 末尾，buf 里可以已经有其他帧，用于把多条消息合并成一次写
+    void appendMessage(Buffer *buf, const ::google::protobuf::Message &message);
+
     static int32_t checksum(const void *buf, int len);
 
     static bool validateChecksum(const char *buf. int len);
@@ -0,0 +1,41 @@
+#include "RpcController.h"
+
+using namespace network;
+
+RpcController::RpcController()
+    : errorCode_(NO_ERROR),
+    priority_(PRIORITY_UNSET),
+    timeoutMs_(0),
+    canceled_(false) {}
+
+RpcController::~RpcController() {}
+
+void RpcController::Reset() {
+    errorCode_ = NO_ERROR;
+    errorText_.clear();
+    priority_ = PRIORITY_UNSET;
+    timeoutMs_ = 0;
+    traceContext_ = TraceContext();
+    canceled_ = false;
+}
+
+void RpcController::SetFailed(const std::string &reason) {
+    errorText_ = reason;
+}
+
+/**
+ * NotifyOnCancel 是服务端接口，而取消不会传到服务端，请求不会被取消，
+ * 按 protobuf “回调恰好执行一次”的约定立即执行
+ */
+void RpcController::NotifyOnCancel(::google::protobuf::Closure *callback) {
+    if (callback) {
+        callback->Run();
+    }
+}
+
+void RpcController::setErrorCode(ErrorCode code) {
+    errorCode_ = code;
+    if (code != NO_ERROR && errorText_.empty()) {
+        errorText_ = ErrorCode_Name(code);
+    }
+}
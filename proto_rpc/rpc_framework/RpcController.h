@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <google/protobuf/service.h>
+
+#include "Tracing.h"
+#include "rpc.pb.h"
+
+namespace network {
+
+/**
+ * RpcController 把服务端返回的错误码带回给客户端。
+ * 调用时把它作为 controller 传给 Stub，done 里通过 Failed()/errorCode() 判断调用是否成功，
+ * 例如收到 OVERLOADED 时退避或者换一个后端重试。
+ *
+ * 一个 RpcController 同一时刻只能用于一次调用，复用前调用 Reset()。
+ * 取消（StartCancel）不会通知服务端，只在本地记录：已取消的调用返回时不再解析响应，
+ * 可以在调用进行中从其他线程取消。
+ */
+class RpcController : public ::google::protobuf::RpcController {
+public:
+    RpcController();
+    ~RpcController() override;
+
+    void Reset() override;
+    bool Failed() const override { return errorCode_ != NO_ERROR || !errorText_.empty(); }
+    std::string ErrorText() const override { return errorText_; }
+    void StartCancel() override { canceled_.store(true, std::memory_order_relaxed); }
+
+    void SetFailed(const std::string &reason) override;
+    bool IsCanceled() const override { return canceled_.load(std::memory_order_relaxed); }
+    void NotifyOnCancel(::google::protobuf::Closure *callback) override;
+
+    ErrorCode errorCode() const { return errorCode_; }
+    void setErrorCode(ErrorCode code);
+
+    // 请求的优先级，随请求发给服务端；PRIORITY_UNSET 表示使用服务端为该方法设置的默认优先级
+    Priority priority() const { return priority_; }
+    void setPriority(Priority priority) { priority_ = priority; }
+
+    /**
+     * 请求的时间预算，随请求发给服务端。服务端开启调度后据此按 deadline 排序，
+     * 并丢弃来不及执行完的请求（回复 TIMEOUT）；0 表示没有 deadline
+     */
+    int64_t timeoutMs() const { return timeoutMs_; }
+    void setTimeoutMs(int64_t timeoutMs) { timeoutMs_ = timeoutMs; }
+
+    /**
+     * 本次调用的父 trace 上下文。没有设置时使用当前线程的 Tracer::current()，
+     * 异步 handler 在其他线程发起下游调用时需要显式设置
+     */
+    const TraceContext &traceContext() const { return traceContext_; }
+    void setTraceContext(const TraceContext &context) { traceContext_ = context; }
+
+private:
+    ErrorCode errorCode_;
+    Priority priority_;
+    int64_t timeoutMs_;
+    TraceContext traceContext_;
+    std::string errorText_;
+    std::atomic<bool> canceled_;
+};
+
+} // namespace network
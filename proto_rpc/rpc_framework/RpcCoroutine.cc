@@ -0,0 +1,138 @@
+#include "RpcCoroutine.h"
+
+#include "network/Metrics.h"
+
+namespace network {
+
+const size_t CoroutineFramePool::kGranularity;
+const size_t CoroutineFramePool::kMaxPooledSize;
+const size_t CoroutineFramePool::kMaxCachedPerClass;
+
+namespace {
+
+// 池里没有空闲块、需要向 operator new 申请的帧数，稳定运行时应该不再增长
+Counter *const g_frameAllocations =
+    MetricsRegistry::instance().counter("rpc.coroutine_frame_allocations");
+
+// 平凡类型，FrameCache 析构之后线程里再释放的帧用它判断，直接交还 operator delete
+thread_local bool t_frameCacheDestroyed = false;
+
+class FrameCache {
+public:
+    static const size_t kClasses = CoroutineFramePool::kMaxPooledSize /
+                                   CoroutineFramePool::kGranularity;
+
+    FrameCache() {
+        for (size_t i = 0; i < kClasses; ++i) {
+            heads_[i] = NULL;
+            counts_[i] = 0;
+        }
+    }
+
+    ~FrameCache() {
+        for (size_t i = 0; i < kClasses; ++i) {
+            while (heads_[i]) {
+                FreeBlock *block = heads_[i];
+                heads_[i] = block->next;
+                ::operator delete(block);
+            }
+        }
+        t_frameCacheDestroyed = true;
+    }
+
+    void *take(size_t sizeClass) {
+        FreeBlock *block = heads_[sizeClass];
+        if (block) {
+            heads_[sizeClass] = block->next;
+            --counts_[sizeClass];
+        }
+        return block;
+    }
+
+    bool give(size_t sizeClass, void *ptr) {
+        if (counts_[sizeClass] >= CoroutineFramePool::kMaxCachedPerClass) {
+            return false;
+        }
+        FreeBlock *block = static_cast<FreeBlock *>(ptr);
+        block->next = heads_[sizeClass];
+        heads_[sizeClass] = block;
+        ++counts_[sizeClass];
+        return true;
+    }
+
+    static FrameCache &local() {
+        static thread_local FrameCache cache;
+        return cache;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    FreeBlock *heads_[kClasses];
+    size_t counts_[kClasses];
+};
+
+size_t sizeClassOf(size_t size) {
+    return (size - 1) / CoroutineFramePool::kGranularity;
+}
+
+} // namespace
+
+/**
+ * 不超过 kMaxPooledSize 的帧总是按整档大小申请，
+ * 这样线程退出阶段直接向 operator new 申请的块以后也能放回任何线程的池里
+ */
+void *CoroutineFramePool::allocate(size_t size) {
+    if (size > kMaxPooledSize) {
+        g_frameAllocations->inc();
+        return ::operator new(size);
+    }
+    size_t sizeClass = sizeClassOf(size);
+    if (!t_frameCacheDestroyed) {
+        void *ptr = FrameCache::local().take(sizeClass);
+        if (ptr) {
+            return ptr;
+        }
+    }
+    g_frameAllocations->inc();
+    return ::operator new((sizeClass + 1) * kGranularity);
+}
+
+void CoroutineFramePool::deallocate(void *ptr, size_t size) {
+    if (size > kMaxPooledSize || t_frameCacheDestroyed ||
+        !FrameCache::local().give(sizeClassOf(size), ptr)) {
+        ::operator delete(ptr);
+    }
+}
+
+namespace detail {
+
+void resumeOn(EventLoop *home, std::coroutine_handle<> handle, const TraceContext &context) {
+    if (home == NULL || home->isInLoopThread()) {
+        TraceScope scope(context);
+        handle.resume();
+    } else {
+        home->queueInLoop([handle, context]() {
+            TraceScope scope(context);
+            handle.resume();
+        });
+    }
+}
+
+} // namespace detail
+
+void SleepAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    EventLoop *loop = EventLoop::getEventLoopOfCurrentThread();
+    if (loop == NULL) {
+        LOG(FATAL) << "sleepFor must be awaited in an EventLoop thread";
+    }
+    TraceContext context = Tracer::current();
+    loop->runAfter(seconds_, [handle, context]() {
+        TraceScope scope(context);
+        handle.resume();
+    });
+}
+
+} // namespace network
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <glog/logging.h>
+#include <google/protobuf/service.h>
+
+#include "network/EventLoop.h"
+#include "network/ThreadPool.h"
+#include "RpcController.h"
+#include "Tracing.h"
+
+/**
+ * C++20 协程风格的 handler，需要链接 rpc_coroutine（编译器支持 C++20 时才构建）。
+ *
+ * 服务方法写成返回 RpcTask<Response> 的协程，在里面 co_await 下游调用、定时器和工作线程池，
+ * 最后 co_return 响应；生成的虚函数里用 serveCoroutine 启动它：
+ *
+ *     RpcTask<bench::EchoResponse> echo(const bench::EchoRequest &request) {
+ *         RpcResult<bench::EchoResponse> user = co_await rpcCall(&userStub_, &Stub::Echo, request);
+ *         co_await sleepFor(0.001);
+ *         std::string payload = co_await offload(&pool_, [&]() { return render(user.response); });
+ *         bench::EchoResponse response;
+ *         response.set_payload(payload);
+ *         co_return response;
+ *     }
+ *
+ *     void Echo(RpcController *controller, const EchoRequest *request, EchoResponse *response,
+ *               Closure *done) override {
+ *         serveCoroutine(echo(*request), controller, response, done);
+ *     }
+ *
+ * request 在 done 执行之前一直有效，所以协程可以按引用持有它。
+ * 协程在哪个 loop 上开始，每次 co_await 之后就回到哪个 loop 继续执行（下游响应、工作线程的结果
+ * 都通过 runInLoop 转回来），按 IO 线程注册的服务实例里的状态仍然只有一个线程访问；
+ * 恢复时也会重新设置挂起前的 trace 上下文，下游调用仍然是本请求 span 的子 span。
+ * 协程帧从所在线程的 CoroutineFramePool 分配，稳定运行时不经过 malloc
+ */
+
+namespace network {
+
+/**
+ * 协程帧的内存池，每个线程一个，也就是每个 loop 一个。
+ * 帧按 kGranularity 字节向上取整分成若干档，每档缓存最多 kMaxCachedPerClass 块；
+ * 超过 kMaxPooledSize 的帧直接用 operator new。
+ * 帧在哪个线程释放就还到哪个线程的池里，协程总是回到原来的 loop 结束，所以一般就是分配它的线程
+ */
+class CoroutineFramePool {
+public:
+    static const size_t kGranularity = 64;
+    static const size_t kMaxPooledSize = 4096;
+    static const size_t kMaxCachedPerClass = 256;
+
+    static void *allocate(size_t size);
+    static void deallocate(void *ptr, size_t size);
+};
+
+template <class T = void>
+class RpcTask;
+
+namespace detail {
+
+// 在 home loop 里恢复协程（已经在 home loop 线程里时直接恢复），恢复期间设置 trace 上下文
+void resumeOn(EventLoop *home, std::coroutine_handle<> handle, const TraceContext &context);
+
+// 所有 promise 都继承这里的 operator new/delete，帧从 CoroutineFramePool 分配
+struct PooledFrame {
+    static void *operator new(size_t size) { return CoroutineFramePool::allocate(size); }
+    static void operator delete(void *ptr, size_t size) { CoroutineFramePool::deallocate(ptr, size); }
+};
+
+// RpcTask 结束时直接切换到 co_await 它的协程（对称转移），没有等待者时停在 final_suspend
+struct TaskFinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+        std::coroutine_handle<> continuation = handle.promise().continuation;
+        return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+};
+
+class TaskPromiseBase : public PooledFrame {
+public:
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    TaskFinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { exception_ = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+
+protected:
+    void rethrowIfFailed() {
+        if (exception_) {
+            std::rethrow_exception(exception_);
+        }
+    }
+
+    std::exception_ptr exception_;
+};
+
+template <class T>
+class TaskPromise : public TaskPromiseBase {
+public:
+    RpcTask<T> get_return_object();
+
+    template <class U>
+    void return_value(U &&value) { value_.emplace(std::forward<U>(value)); }
+
+    T result() {
+        rethrowIfFailed();
+        return std::move(*value_);
+    }
+
+private:
+    std::optional<T> value_;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+    RpcTask<void> get_return_object();
+
+    void return_void() {}
+
+    void result() { rethrowIfFailed(); }
+};
+
+} // namespace detail
+
+/**
+ * 惰性启动的协程任务：创建时不执行，被 co_await 时才开始，结束后把结果交给等待者。
+ * 只能移动，只能 co_await 一次；协程里没有捕获的异常在 co_await 处重新抛出
+ */
+template <class T>
+class [[nodiscard]] RpcTask {
+public:
+    typedef detail::TaskPromise<T> promise_type;
+
+    RpcTask(RpcTask &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    RpcTask(const RpcTask &) = delete;
+    RpcTask &operator=(const RpcTask &) = delete;
+    RpcTask &operator=(RpcTask &&) = delete;
+
+    ~RpcTask() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    class Awaiter {
+    public:
+        explicit Awaiter(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+            handle_.promise().continuation = continuation;
+            return handle_;
+        }
+
+        T await_resume() { return handle_.promise().result(); }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    Awaiter operator co_await() && noexcept { return Awaiter(handle_); }
+
+private:
+    friend promise_type;
+
+    explicit RpcTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <class T>
+RpcTask<T> TaskPromise<T>::get_return_object() {
+    return RpcTask<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline RpcTask<void> TaskPromise<void>::get_return_object() {
+    return RpcTask<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// 把 handler 的失败记到服务端的 controller 上；不是本框架的 RpcController 时只设置错误文本
+inline void failHandler(::google::protobuf::RpcController *controller, const std::string &reason) {
+    if (!controller) {
+        return;
+    }
+    controller->SetFailed(reason);
+    RpcController *rpcController = dynamic_cast<RpcController *>(controller);
+    if (rpcController) {
+        rpcController->setErrorCode(INTERNAL);
+    }
+}
+
+// serveCoroutine 的驱动协程：立即开始执行，结束时自动销毁
+struct DetachedTask {
+    struct promise_type : PooledFrame {
+        DetachedTask get_return_object() const noexcept { return DetachedTask(); }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+/**
+ * 等 handler 协程返回响应，交换进框架的 response 后执行 done。
+ * handler 抛出异常时记日志，并通过 controller 把 INTERNAL 带回给客户端（框架回复错误而不是空响应）
+ */
+template <class Response>
+DetachedTask runHandler(RpcTask<Response> task, ::google::protobuf::RpcController *controller,
+                        Response *response, ::google::protobuf::Closure *done) {
+    try {
+        Response result = co_await std::move(task);
+        response->Swap(&result);
+    } catch (const std::exception &e) {
+        LOG(ERROR) << "coroutine handler for " << response->GetDescriptor()->full_name()
+                   << " failed: " << e.what();
+        failHandler(controller, e.what());
+    } catch (...) {
+        LOG(ERROR) << "coroutine handler for " << response->GetDescriptor()->full_name()
+                   << " failed with an unknown exception";
+        failHandler(controller, "unknown exception");
+    }
+    done->Run();
+}
+
+} // namespace detail
+
+/**
+ * 在服务方法的虚函数里启动协程 handler，第一次挂起之前的部分同步执行。
+ * controller 传服务方法收到的那个；handler 抛出异常时客户端收到 INTERNAL
+ */
+template <class Response>
+void serveCoroutine(RpcTask<Response> task, ::google::protobuf::RpcController *controller,
+                    Response *response, ::google::protobuf::Closure *done) {
+    detail::runHandler(std::move(task), controller, response, done);
+}
+
+// 下游调用的结果：error 和 errorText 来自调用用的 RpcController
+template <class Response>
+struct RpcResult {
+    Response response;
+    ErrorCode error = NO_ERROR;
+    std::string errorText;
+
+    bool ok() const { return error == NO_ERROR && errorText.empty(); }
+};
+
+/**
+ * co_await rpcCall(...) 的等待体：通过 Stub 发起调用，响应到达时把内容交换出来
+ * （RpcChannel 在 done 之后释放它 new 出来的响应对象），再回到发起调用的 loop 恢复协程
+ */
+template <class Stub, class Request, class Response>
+class RpcCallAwaiter {
+public:
+    typedef void (Stub::*Method)(::google::protobuf::RpcController *, const Request *, Response *,
+                                 ::google::protobuf::Closure *);
+
+    RpcCallAwaiter(Stub *stub, Method method, const Request &request, int64_t timeoutMs)
+        : stub_(stub), method_(method), request_(&request), home_(NULL) {
+        controller_.setTimeoutMs(timeoutMs);
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        home_ = EventLoop::getEventLoopOfCurrentThread();
+        context_ = Tracer::current();
+        Response *response = new Response;
+        // 调用之后不能再访问成员：响应可能已经在其他线程到达并恢复了协程
+        (stub_->*method_)(&controller_, request_, response,
+                          ::google::protobuf::NewCallback(this, &RpcCallAwaiter::onDone, response));
+    }
+
+    RpcResult<Response> await_resume() { return std::move(result_); }
+
+private:
+    void onDone(Response *response) {
+        result_.response.Swap(response);
+        result_.error = controller_.errorCode();
+        result_.errorText = controller_.ErrorText();
+        detail::resumeOn(home_, handle_, context_);
+    }
+
+    Stub *stub_;
+    Method method_;
+    const Request *request_;
+    RpcController controller_;
+    RpcResult<Response> result_;
+    std::coroutine_handle<> handle_;
+    EventLoop *home_;
+    TraceContext context_;
+};
+
+/**
+ * 在协程里调用下游服务：co_await rpcCall(&stub, &Stub::Method, request)，返回 RpcResult。
+ * timeoutMs 作为时间预算随请求发给下游，0 表示不限
+ */
+template <class Stub, class Request, class Response>
+RpcCallAwaiter<Stub, Request, Response> rpcCall(
+        Stub *stub,
+        void (Stub::*method)(::google::protobuf::RpcController *, const Request *, Response *,
+                             ::google::protobuf::Closure *),
+        const Request &request, int64_t timeoutMs = 0) {
+    return RpcCallAwaiter<Stub, Request, Response>(stub, method, request, timeoutMs);
+}
+
+// co_await sleepFor(seconds)：用当前 loop 的定时器挂起 seconds 秒，只能在 loop 线程里使用
+class SleepAwaiter {
+public:
+    explicit SleepAwaiter(double seconds) : seconds_(seconds) {}
+
+    bool await_ready() const noexcept { return seconds_ <= 0; }
+    void await_suspend(std::coroutine_handle<> handle);
+    void await_resume() const noexcept {}
+
+private:
+    const double seconds_;
+};
+
+inline SleepAwaiter sleepFor(double seconds) { return SleepAwaiter(seconds); }
+
+/**
+ * co_await offload(&pool, func)：在工作线程里执行 func，返回它的结果，然后回到原来的 loop 继续。
+ * func 抛出的异常在 co_await 处重新抛出
+ */
+template <class Func>
+class OffloadAwaiter {
+public:
+    typedef std::invoke_result_t<Func &> Result;
+
+    OffloadAwaiter(ThreadPool *pool, Func func) : pool_(pool), func_(std::move(func)), home_(NULL) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        home_ = EventLoop::getEventLoopOfCurrentThread();
+        context_ = Tracer::current();
+        pool_->run([this, handle]() {
+            try {
+                if constexpr (std::is_void_v<Result>) {
+                    func_();
+                } else {
+                    result_.emplace(func_());
+                }
+            } catch (...) {
+                exception_ = std::current_exception();
+            }
+            detail::resumeOn(home_, handle, context_);
+        });
+    }
+
+    Result await_resume() {
+        if (exception_) {
+            std::rethrow_exception(exception_);
+        }
+        if constexpr (!std::is_void_v<Result>) {
+            return std::move(*result_);
+        }
+    }
+
+private:
+    typedef std::conditional_t<std::is_void_v<Result>, char, Result> Storage;
+
+    ThreadPool *pool_;
+    Func func_;
+    EventLoop *home_;
+    TraceContext context_;
+    std::optional<Storage> result_;
+    std::exception_ptr exception_;
+};
+
+template <class Func>
+OffloadAwaiter<std::decay_t<Func>> offload(ThreadPool *pool, Func &&func) {
+    return OffloadAwaiter<std::decay_t<Func>>(pool, std::forward<Func>(func));
+}
+
+} // namespace network
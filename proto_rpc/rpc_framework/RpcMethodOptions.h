@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "ConcurrencyLimiter.h"
+#include "rpc.pb.h"
+
+namespace google {
+namespace protobuf {
+
+class MethodDescriptor;
+class Message;
+class Closure;
+
+} // namespace protobuf
+} // namespace google
+
+namespace network {
+
+class RpcStream;
+
+// 流式方法的服务端入口，在收到 STREAM_OPEN 时调用，handler 需要在返回前设置好流的回调
+typedef std::function<void(const std::shared_ptr<RpcStream> &)> StreamHandler;
+
+/**
+ * 批量 handler 收到的一个请求，和普通 handler 的参数相同：填好 response 后调用 done->Run()，
+ * 响应发回这个请求所在的连接。每一项可以各自、在任意线程完成
+ */
+struct BatchedCall {
+    const ::google::protobuf::Message *request;
+    ::google::protobuf::Message *response;
+    ::google::protobuf::Closure *done;
+};
+
+// 批量方法的服务端入口，在 IO 线程里调用，calls 里至少有一项
+typedef std::function<void(std::vector<BatchedCall> &calls)> BatchHandler;
+
+/**
+ * RpcMethodOptions 是服务端按方法维度的配置，在 RpcServer::setMethodOptions 时登记。
+ * 默认值表示“不开启任何额外功能”，和原来的处理流程完全一致。
+ */
+struct RpcMethodOptions {
+    /**
+     * 响应缓存的有效期（毫秒），0 表示不缓存。
+     * 只有幂等、只读的方法才应该开启：命中时直接返回缓存的序列化结果，不再调用 handler。
+     */
+    int64_t cacheTtlMs = 0;
+
+    /**
+     * 是否合并正在执行中的相同请求（singleflight）。
+     * 同样只适用于幂等的方法：相同请求在 handler 返回前到达时，直接复用第一个请求的响应。
+     */
+    bool coalesceInflight = false;
+
+    // 每个正在执行的请求最多挂多少个 waiter，超过后的相同请求照常执行 handler
+    size_t maxCoalescedWaiters = 1024;
+
+    /**
+     * proto 里声明为 stream 的方法（客户端流、服务端流、双向流）必须设置，
+     * 这类方法不经过 Service::CallMethod，而是把整个 RpcStream 交给 streamHandler
+     */
+    StreamHandler streamHandler;
+
+    /**
+     * 为该方法单独开启自适应并发限制，和 RpcServer::setConcurrencyLimit 的整体限制同时生效，
+     * 任意一级超出限制都返回 OVERLOADED。流式方法不受并发限制
+     */
+    bool limitConcurrency = false;
+    ConcurrencyLimiterOptions concurrencyLimit;
+
+    // 请求没有带优先级时使用的默认优先级，只在服务端开启调度时生效
+    Priority priority = PRIORITY_UNSET;
+
+    /**
+     * 设置后该方法的请求不再逐个调用 Service 的 handler，而是在每个 IO 线程里跨连接攒成一批，
+     * 攒到 maxBatchSize 个或者第一个请求等了 maxBatchDelayUs 微秒时调用一次 batchHandler。
+     * maxBatchDelayUs 为 0 时不额外等待，把 loop 这一轮读到的请求攒成一批。
+     * 适合写存储、调用批量计算接口这类每次调用有固定开销的 handler
+     */
+    BatchHandler batchHandler;
+    size_t maxBatchSize = 64;
+    int64_t maxBatchDelayUs = 0;
+};
+
+/**
+ * 以 MethodDescriptor 指针为 key：描述符由 protobuf 全局持有，地址在进程内稳定，
+ * 查找时不需要再拼接 "service.method" 字符串
+ */
+typedef std::map<const ::google::protobuf::MethodDescriptor *, RpcMethodOptions> MethodOptionsMap;
+
+} // namespace network
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <glog/logging.h>
 #include <google/protobuf/descriptor.h>
@@ -5,6 +6,7 @@
 
 #include "RpcServer.h"
 #include "RpcChannel.h"
+#include "network/EventLoopThreadPool.h"
 
 using namespace network;
 
@@ -16,8 +18,16 @@ using namespace network;
  * 这样每当有新连接时，server_ 会自动调用 RpcServer::onConnection 方法
  */
 RpcServer::RpcServer(EventLoop *loop, const InetAddress &listenAddr)
-    : server_(loop, listenAddr, "RpcServer") {
+    : server_(loop, listenAddr, "RpcServer"),
+    responseCacheBytes_(kDefaultResponseCacheBytes),
+    chunkBytes_(0),
+    chunkPolicy_(ChunkWriter::kRoundRobin),
+    heartbeatEnabled_(false),
+    tcpNoDelay_(true),
+    schedulingEnabled_(false) {
     server_.setConnectionCallback(std::bind(&RpcServer::onConnection, this, _1));
+    server_.setThreadInitCallback(std::bind(&RpcServer::onThreadInit, this, _1));
+    registerService(&statsService_);
 }
 
 /**
@@ -32,7 +42,196 @@ void RpcServer::registerService(google::protobuf::Service *service) {
     services_[desc->full_name()] = service;
 }
 
-void RpcServer::start() { server_.start(); }
+void RpcServer::registerServiceFactory(const ServiceFactory &factory) {
+    serviceFactories_.push_back(factory);
+}
+
+/**
+ * 在 IO 线程里创建实例，实例的内存从这个线程分配，之后也只被这个线程访问。
+ * 每个线程的服务表是 services_ 的副本再覆盖上本线程的实例，连接直接使用所属线程的服务表。
+ * EventLoopThreadPool::start() 等所有线程执行完这个回调才返回，所以 start() 之后 loopServiceMaps_ 只读
+ */
+void RpcServer::onThreadInit(EventLoop *loop) {
+    if (serviceFactories_.empty()) {
+        return;
+    }
+    ServiceMap services = services_;
+    std::vector<std::unique_ptr<::google::protobuf::Service>> instances;
+    for (const ServiceFactory &factory : serviceFactories_) {
+        ::google::protobuf::Service *service = factory();
+        services[service->GetDescriptor()->full_name()] = service;
+        instances.emplace_back(service);
+    }
+
+    std::lock_guard<std::mutex> lock(loopServicesMutex_);
+    loopServiceMaps_[loop].swap(services);
+    for (auto &instance : instances) {
+        loopServices_.push_back(std::move(instance));
+    }
+}
+
+const RpcServer::ServiceMap *RpcServer::servicesForLoop(EventLoop *loop) const {
+    auto it = loopServiceMaps_.find(loop);
+    return it == loopServiceMaps_.end() ? &services_ : &it->second;
+}
+
+/**
+ * 按方法全名在 protobuf 的全局描述符池里查找 MethodDescriptor，
+ * 找到后以描述符指针为 key 保存配置，RpcChannel 分发请求时直接按指针查找
+ */
+bool RpcServer::setMethodOptions(const std::string &methodFullName,
+                                 const RpcMethodOptions &options) {
+    const google::protobuf::MethodDescriptor *method =
+        google::protobuf::DescriptorPool::generated_pool()->FindMethodByName(methodFullName);
+    if (!method) {
+        LOG(ERROR) << "RpcServer::setMethodOptions - unknown method " << methodFullName;
+        return false;
+    }
+    methodOptions_[method] = options;
+    return true;
+}
+
+/**
+ * 启动 TcpServer 之后，如果有方法开启了响应缓存，就为每个 IO 线程创建一个缓存分片；
+ * 如果有方法开启了请求合并，就创建整个 server 共用的 RequestCoalescer；
+ * 开启了并发限制的方法各自创建一个 ConcurrencyLimiter；开启了调度时每个 IO 线程一个 RequestScheduler，
+ * 再为所有已注册的方法创建一个共用的 ServiceTimeEstimator。
+ * 此时 base loop 还没有开始 loop()，不会有新连接进来，所以之后 responseCaches_ 只读即可
+ */
+void RpcServer::start() {
+    server_.start();
+
+    bool cacheEnabled = false;
+    bool coalesceEnabled = false;
+    bool batchEnabled = false;
+    for (const auto &item : methodOptions_) {
+        if (item.second.cacheTtlMs > 0) {
+            cacheEnabled = true;
+        }
+        if (item.second.coalesceInflight) {
+            coalesceEnabled = true;
+        }
+        if (item.second.batchHandler) {
+            batchEnabled = true;
+        }
+        if (item.second.limitConcurrency) {
+            methodLimiters_[item.first].reset(
+                new ConcurrencyLimiter(item.second.concurrencyLimit));
+        }
+    }
+    if (coalesceEnabled) {
+        coalescer_.reset(new RequestCoalescer);
+    }
+    if (schedulingEnabled_) {
+        for (EventLoop *loop : server_.threadPool()->getAllLoops()) {
+            schedulers_[loop].reset(new RequestScheduler(loop, schedulerOptions_));
+        }
+        // 按 IO 线程注册的服务也要统计，各个线程的服务表内容相同，取任意一个
+        const ServiceMap *services = loopServiceMaps_.empty() ? &services_
+                                                              : &loopServiceMaps_.begin()->second;
+        std::vector<const ::google::protobuf::MethodDescriptor *> methods;
+        for (const auto &item : *services) {
+            const ::google::protobuf::ServiceDescriptor *desc = item.second->GetDescriptor();
+            for (int i = 0; i < desc->method_count(); ++i) {
+                methods.push_back(desc->method(i));
+            }
+        }
+        serviceTimes_.reset(new ServiceTimeEstimator(methods));
+    }
+    if (cacheEnabled) {
+        for (EventLoop *loop : server_.threadPool()->getAllLoops()) {
+            responseCaches_[loop].reset(new ResponseCache(responseCacheBytes_));
+        }
+    }
+    if (batchEnabled) {
+        for (EventLoop *loop : server_.threadPool()->getAllLoops()) {
+            batchers_[loop].reset(new RequestBatcher(loop));
+        }
+    }
+}
+
+ResponseCache::Stats RpcServer::responseCacheStats() const {
+    ResponseCache::Stats total;
+    for (const auto &item : responseCaches_) {
+        ResponseCache::Stats s = item.second->stats();
+        total.hits += s.hits;
+        total.misses += s.misses;
+        total.insertions += s.insertions;
+        total.evictions += s.evictions;
+        total.expirations += s.expirations;
+        total.bytes += s.bytes;
+        total.entries += s.entries;
+    }
+    return total;
+}
+
+void RpcServer::enableScheduling(const RequestSchedulerOptions &options) {
+    schedulingEnabled_ = true;
+    schedulerOptions_ = options;
+}
+
+std::vector<RequestScheduler::BandStats> RpcServer::schedulerStats() const {
+    std::vector<RequestScheduler::BandStats> total;
+    for (const auto &item : schedulers_) {
+        std::vector<RequestScheduler::BandStats> bands = item.second->stats();
+        total.resize(bands.size());
+        for (size_t i = 0; i < bands.size(); ++i) {
+            total[i].depth += bands[i].depth;
+            total[i].enqueued += bands[i].enqueued;
+            total[i].executed += bands[i].executed;
+            total[i].dropped += bands[i].dropped;
+            total[i].expired += bands[i].expired;
+            total[i].waitUsTotal += bands[i].waitUsTotal;
+            total[i].waitUsMax = std::max(total[i].waitUsMax, bands[i].waitUsMax);
+        }
+    }
+    return total;
+}
+
+RequestBatcher::Stats RpcServer::batcherStats() const {
+    RequestBatcher::Stats total;
+    for (const auto &item : batchers_) {
+        RequestBatcher::Stats s = item.second->stats();
+        total.batches += s.batches;
+        total.requests += s.requests;
+        total.fullBatches += s.fullBatches;
+    }
+    return total;
+}
+
+RequestBatcher *RpcServer::batcherForLoop(EventLoop *loop) const {
+    auto it = batchers_.find(loop);
+    return it == batchers_.end() ? NULL : get_pointer(it->second);
+}
+
+RequestScheduler *RpcServer::schedulerForLoop(EventLoop *loop) const {
+    auto it = schedulers_.find(loop);
+    return it == schedulers_.end() ? NULL : get_pointer(it->second);
+}
+
+void RpcServer::setConcurrencyLimit(const ConcurrencyLimiterOptions &options) {
+    serverLimiter_.reset(new ConcurrencyLimiter(options));
+}
+
+ConcurrencyLimiter::Stats RpcServer::concurrencyLimiterStats(
+    const std::string &methodFullName) const {
+    if (methodFullName.empty()) {
+        return serverLimiter_ ? serverLimiter_->stats() : ConcurrencyLimiter::Stats();
+    }
+    const google::protobuf::MethodDescriptor *method =
+        google::protobuf::DescriptorPool::generated_pool()->FindMethodByName(methodFullName);
+    auto it = methodLimiters_.find(method);
+    return it == methodLimiters_.end() ? ConcurrencyLimiter::Stats() : it->second->stats();
+}
+
+RequestCoalescer::Stats RpcServer::coalescerStats() const {
+    return coalescer_ ? coalescer_->stats() : RequestCoalescer::Stats();
+}
+
+ResponseCache *RpcServer::responseCacheForLoop(EventLoop *loop) const {
+    auto it = responseCaches_.find(loop);
+    return it == responseCaches_.end() ? NULL : get_pointer(it->second);
+}
 
 /**
  * 这段代码是 RpcServer 类中 onConnection 方法的实现，主要用于处理 TCP 连接的建立和断开。
@@ -45,15 +244,33 @@ void RpcServer::onConnection(const TcpConnectionPtr &conn) {
                 << (conn->connected() ? "UP" : "DOWN");
     // 检查连接是否处于已连接状态
     if (conn->connected()) {
+        if (tcpNoDelay_) {
+            conn->setTcpNoDelay(true);
+        }
         // 创建一个新的 RpcChannel 对象，并传入当前连接
         RpcChannelPtr channel(new RpcChannel(conn));
-        // 将服务列表的指针设置到 RpcChannel 中，以便 RpcChannel 可以查找和调用相应的服务
-        channel->setServices(&services_);
+        // 将服务列表的指针设置到 RpcChannel 中，以便 RpcChannel 可以查找和调用相应的服务；
+        // 按 IO 线程注册的服务使用连接所属线程的实例
+        channel->setServices(servicesForLoop(conn->getLoop()));
+        channel->setMethodOptions(&methodOptions_);
+        // 连接只在它所属的 IO 线程里处理请求，绑定该线程的缓存分片
+        channel->setResponseCache(responseCacheForLoop(conn->getLoop()));
+        channel->setRequestCoalescer(get_pointer(coalescer_));
+        channel->setRequestBatcher(batcherForLoop(conn->getLoop()));
+        channel->setScheduler(schedulerForLoop(conn->getLoop()));
+        channel->setServiceTimeEstimator(get_pointer(serviceTimes_));
+        channel->setConcurrencyLimiters(get_pointer(serverLimiter_), &methodLimiters_);
+        if (chunkBytes_ > 0) {
+            channel->setChunking(chunkBytes_, chunkPolicy_);
+        }
         // 为连接设置消息回调函数，当有消息到达时，会调用 RpcChannel 的 onMessage 函数进行处理
         conn->setMessageCallback(
             std::bind(&RpcChannel::onMessage, get_pointer(channel), _1, _2));
         // 把当前连接（conn）和它对应的 RpcChannel 对象关联起来，存储在连接的“上下文（context）”中
         conn->setContext(channel);
+        if (heartbeatEnabled_) {
+            channel->enableHeartbeat(heartbeatOptions_);
+        }
     } else {
         // 如果连接断开，将连接的上下文设置为空
         conn->setContext(RpcChannelPtr());
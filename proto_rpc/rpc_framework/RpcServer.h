@@ -1,32 +1,174 @@
 #pragma once
 
-#include "network/TcpServer.h"
-
-namespace google {
-namespace protobuf {
-
-class Service;
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <google/protobuf/service.h>
 
-
-} // namespace protobuf
-} // namespace google
+#include "network/TcpServer.h"
+#include "ConcurrencyLimiter.h"
+#include "MessageChunker.h"
+#include "RequestBatcher.h"
+#include "RequestCoalescer.h"
+#include "RequestScheduler.h"
+#include "ResponseCache.h"
+#include "RpcChannel.h"
+#include "RpcMethodOptions.h"
+#include "ServiceTimeEstimator.h"
+#include "StatsService.h"
 
 namespace network {
 
 class RpcServer {
 public:
+    // 返回新建的服务实例，所有权交给 RpcServer
+    typedef std::function<::google::protobuf::Service *()> ServiceFactory;
+
+    // 构造时自动注册内置的 StatsService，客户端可以通过 RpcStatsService 查询按方法的统计，CPU 采样需要 enableProfiling
     RpcServer(EventLoop *loop, const InetAddress &listenAddr);
 
     void setThreadNum(int numThreads) { server_.setThreadNum(numThreads); }
 
     void registerService(::google::protobuf::Service *);
 
+    /**
+     * 按 IO 线程注册服务：start() 时 TcpServer 的 ThreadInitCallback 在每个 IO 线程里调用一次 factory，
+     * 得到的实例只处理这个线程上的连接的请求，handler 里的缓存、计数器等状态只有一个线程访问，不需要加锁。
+     * 没有设置 IO 线程时只创建一个实例，由 base loop 使用。
+     * 和 registerService 注册了同名服务时以这里的实例为准。需要在 start() 之前调用
+     */
+    void registerServiceFactory(const ServiceFactory &factory);
+
+    /**
+     * 为某个方法登记服务端配置（如响应缓存），methodFullName 形如 "monitor.TestService.MonitorInfo"。
+     * 需要在 start() 之前调用。
+     */
+    bool setMethodOptions(const std::string &methodFullName, const RpcMethodOptions &options);
+
+    // 每个 IO 线程的响应缓存分片的字节上限，需要在 start() 之前调用
+    void setResponseCacheBytes(size_t bytes) { responseCacheBytes_ = bytes; }
+
+    // 汇总所有 IO 线程的缓存命中/未命中等计数
+    ResponseCache::Stats responseCacheStats() const;
+
+    // 请求合并的计数，没有方法开启合并时全部为 0
+    RequestCoalescer::Stats coalescerStats() const;
+
+    // 汇总所有 IO 线程的批处理计数，没有方法设置 batchHandler 时全部为 0
+    RequestBatcher::Stats batcherStats() const;
+
+    /**
+     * 开启整个 server 的自适应并发限制，超出限制的请求立即返回 OVERLOADED。
+     * 按方法的限制通过 RpcMethodOptions::limitConcurrency 开启。需要在 start() 之前调用。
+     * 在 IO 线程里同步完成的 handler 同一时刻最多只有一个在执行，请求排在 socket 和输入缓冲区里，
+     * 这时要同时 enableScheduling：请求入队就计入在途请求数，排队超出限制的请求直接返回 OVERLOADED
+     */
+    void setConcurrencyLimit(const ConcurrencyLimiterOptions &options);
+
+    // methodFullName 为空时返回整个 server 的限制状态；没有开启对应的限制时全部为 0
+    ConcurrencyLimiter::Stats concurrencyLimiterStats(
+        const std::string &methodFullName = std::string()) const;
+
+    /**
+     * 开启请求调度：请求按优先级（严格优先）和连接间的 DRR（或 deadline）顺序执行，
+     * 而不是按解码顺序立即执行。同时按方法统计 handler 的执行时间，
+     * 带时间预算的请求来不及执行完时直接回复 TIMEOUT。需要在 start() 之前调用
+     */
+    void enableScheduling(const RequestSchedulerOptions &options = RequestSchedulerOptions());
+
+    // 汇总所有 IO 线程每个优先级 band 的排队深度和等待时间，没有开启调度时为空
+    std::vector<RequestScheduler::BandStats> schedulerStats() const;
+
+    /**
+     * 响应分块发送：序列化后超过 chunkBytes 的响应拆成 CHUNK 帧，和同一连接上其他调用的响应交错发送，
+     * 大响应不再阻塞它后面的小响应，见 ChunkWriter。默认关闭，客户端都能处理 CHUNK 帧之后才能开启。
+     * 需要在 start() 之前调用
+     */
+    void setChunking(size_t chunkBytes, ChunkWriter::Policy policy = ChunkWriter::kRoundRobin) {
+        chunkBytes_ = chunkBytes;
+        chunkPolicy_ = policy;
+    }
+
+    /**
+     * 是否对接受的连接设置 TCP_NODELAY，默认开启。RPC 的请求和响应大多是小包，
+     * 开着 Nagle 时前一个响应还没被确认，后一个要等对端的延迟 ACK（约 40ms）才发出；
+     * 以吞吐为主、响应都很大的服务可以关掉。需要在 start() 之前调用
+     */
+    void setTcpNoDelay(bool on) { tcpNoDelay_ = on; }
+
+    /**
+     * 每个连接开启应用层心跳（见 RpcChannel::enableHeartbeat），半死的客户端连接在几秒内被关闭，
+     * 不再长期占用连接和缓冲区。intervalMs 和 missThreshold 小于 1 时按 1 处理。需要在 start() 之前调用
+     */
+    void setHeartbeat(const HeartbeatOptions &options) {
+        heartbeatEnabled_ = true;
+        heartbeatOptions_ = options;
+        heartbeatOptions_.intervalMs = std::max<int64_t>(options.intervalMs, 1);
+        heartbeatOptions_.missThreshold = std::max(options.missThreshold, 1);
+    }
+
+    /**
+     * 允许通过内置的 RpcStatsService.CpuProfile 对本进程采样，默认关闭：任何能连上来的客户端
+     * 都可以打开整个进程的采样，且 SIGPROF 处理函数一经安装就不再移除。需要在 start() 之前调用
+     */
+    void enableProfiling() { statsService_.enableProfiling(); }
+
     void start();
 private:
-    void onConnection(const TcpConenctionPtr &conn);
+    typedef std::map<std::string, ::google::protobuf::Service *> ServiceMap;
+
+    void onConnection(const TcpConnectionPtr &conn);
+
+    // 在每个 IO 线程里执行，用 serviceFactories_ 创建这个线程的服务实例
+    void onThreadInit(EventLoop *loop);
+
+    const ServiceMap *servicesForLoop(EventLoop *loop) const;
+
+    ResponseCache *responseCacheForLoop(EventLoop *loop) const;
+
+    RequestScheduler *schedulerForLoop(EventLoop *loop) const;
+
+    RequestBatcher *batcherForLoop(EventLoop *loop) const;
+
+    static const size_t kDefaultResponseCacheBytes = 64 * 1024 * 1024;
 
     TcpServer server_;
-    std::map<std::string. ::google::protobuf::Service *> services_;
+    ServiceMap services_;
+
+    std::vector<ServiceFactory> serviceFactories_;
+    std::mutex loopServicesMutex_; // 各个 IO 线程的 onThreadInit 并发执行
+    std::map<EventLoop *, ServiceMap> loopServiceMaps_; // start() 之后只读
+    std::vector<std::unique_ptr<::google::protobuf::Service>> loopServices_;
+    MethodOptionsMap methodOptions_;
+    size_t responseCacheBytes_;
+    size_t chunkBytes_; // 0 表示不分块
+    ChunkWriter::Policy chunkPolicy_;
+    bool heartbeatEnabled_;
+    HeartbeatOptions heartbeatOptions_;
+    bool tcpNoDelay_;
+
+    // start() 之后只读，IO 线程可以无锁查找自己的分片
+    std::map<EventLoop *, std::unique_ptr<ResponseCache>> responseCaches_;
+
+    // 批处理只在 IO 线程内跨连接攒批，每个线程一个，有方法设置 batchHandler 时在 start() 中创建
+    std::map<EventLoop *, std::unique_ptr<RequestBatcher>> batchers_; // start() 之后只读
+
+    // 合并需要跨 IO 线程，所以整个 server 只有一个，有方法开启合并时在 start() 中创建
+    std::unique_ptr<RequestCoalescer> coalescer_;
+
+    std::unique_ptr<ConcurrencyLimiter> serverLimiter_;
+    ConcurrencyLimiterMap methodLimiters_; // start() 之后只读
+
+    bool schedulingEnabled_;
+    RequestSchedulerOptions schedulerOptions_;
+    std::map<EventLoop *, std::unique_ptr<RequestScheduler>> schedulers_; // start() 之后只读
+    std::unique_ptr<ServiceTimeEstimator> serviceTimes_;
+
+    StatsService statsService_;
 };
 
 } // namespace network
\ No newline at end of file
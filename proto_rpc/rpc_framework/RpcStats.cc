@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <map>
+
+#include "RpcStats.h"
+
+using namespace network;
+
+const int RpcStats::kNumErrorCodes;
+
+RpcStats::Cell::Cell() {
+    for (std::atomic<int64_t> &error : errors) {
+        error.store(0, std::memory_order_relaxed);
+    }
+}
+
+RpcStats::RpcStats() {}
+
+RpcStats &RpcStats::instance() {
+    static RpcStats stats;
+    return stats;
+}
+
+/**
+ * 分片由 RpcStats 持有，线程退出后依然保留；thread_local 里只存一个裸指针
+ */
+RpcStats::Shard *RpcStats::localShard() {
+    static thread_local Shard *shard = NULL;
+    if (!shard) {
+        std::unique_ptr<Shard> created(new Shard);
+        shard = created.get();
+        std::unique_lock<std::mutex> lock(mutex_);
+        shards_.push_back(std::move(created));
+    }
+    return shard;
+}
+
+RpcStats::Cell *RpcStats::findCell(Shard *shard, Side side,
+                                   const ::google::protobuf::MethodDescriptor *method) {
+    auto &cells = shard->cells[side];
+    auto it = cells.find(method);
+    if (it != cells.end()) {
+        return it->second.get();
+    }
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    std::unique_ptr<Cell> &cell = cells[method];
+    cell.reset(new Cell);
+    return cell.get();
+}
+
+void RpcStats::record(Side side, const ::google::protobuf::MethodDescriptor *method,
+                      ErrorCode error, int64_t latencyUs, int64_t requestBytes,
+                      int64_t responseBytes) {
+    Cell *cell = findCell(localShard(), side, method);
+    cell->calls.store(cell->calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (error != NO_ERROR && error >= 0 && error < kNumErrorCodes) {
+        std::atomic<int64_t> &errors = cell->errors[error];
+        errors.store(errors.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    cell->latencyUs.record(latencyUs);
+    cell->requestBytes.record(requestBytes);
+    cell->responseBytes.record(responseBytes);
+}
+
+std::vector<RpcStats::MethodSnapshot> RpcStats::snapshot() const {
+    typedef std::pair<int, const ::google::protobuf::MethodDescriptor *> Key;
+    std::map<Key, MethodSnapshot> merged;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+        std::unique_lock<std::mutex> shardLock(shard->mutex);
+        for (int side = 0; side < 2; ++side) {
+            for (const auto &item : shard->cells[side]) {
+                const Cell &cell = *item.second;
+                MethodSnapshot &result = merged[Key(side, item.first)];
+                result.side = static_cast<Side>(side);
+                result.method = item.first;
+                result.calls += cell.calls.load(std::memory_order_relaxed);
+                for (int i = 0; i < kNumErrorCodes; ++i) {
+                    result.errors[i] += cell.errors[i].load(std::memory_order_relaxed);
+                }
+                result.latencyUs.merge(cell.latencyUs.snapshot());
+                result.requestBytes.merge(cell.requestBytes.snapshot());
+                result.responseBytes.merge(cell.responseBytes.snapshot());
+            }
+        }
+    }
+
+    std::vector<MethodSnapshot> result;
+    result.reserve(merged.size());
+    for (auto &item : merged) {
+        result.push_back(std::move(item.second));
+    }
+    return result;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "network/Metrics.h"
+#include "rpc.pb.h"
+
+namespace google {
+namespace protobuf {
+
+class MethodDescriptor;
+
+} // namespace protobuf
+} // namespace google
+
+namespace network {
+
+/**
+ * RpcStats 是进程内所有 RpcChannel 共用的按方法统计：调用次数、按 ErrorCode 分类的错误数、
+ * 延迟（微秒）、请求和响应大小（字节）的直方图，客户端和服务端分开统计。
+ *
+ * 每个线程第一次记录时创建自己的分片，之后只写自己的分片，不同 IO 线程之间没有共享的缓存行；
+ * snapshot() 加锁遍历所有分片合并。线程退出后分片保留，统计不会丢失。
+ * 计数都是累计值，QPS 等速率由调用方对两次快照求差得到
+ */
+class RpcStats {
+public:
+    enum Side { kClient = 0, kServer = 1 };
+
+    static const int kNumErrorCodes = ErrorCode_ARRAYSIZE;
+
+    struct MethodSnapshot {
+        Side side;
+        const ::google::protobuf::MethodDescriptor *method;
+        int64_t calls = 0;
+        int64_t errors[kNumErrorCodes] = {};
+        LogLinearHistogram::Snapshot latencyUs;
+        LogLinearHistogram::Snapshot requestBytes;
+        LogLinearHistogram::Snapshot responseBytes;
+    };
+
+    static RpcStats &instance();
+
+    // 记录一次结束的调用；失败的调用没有响应时 responseBytes 传 0
+    void record(Side side, const ::google::protobuf::MethodDescriptor *method, ErrorCode error,
+                int64_t latencyUs, int64_t requestBytes, int64_t responseBytes);
+
+    // 按方法合并所有线程的分片，同一个方法客户端、服务端各一条
+    std::vector<MethodSnapshot> snapshot() const;
+
+private:
+    struct Cell {
+        std::atomic<int64_t> calls{0};
+        std::atomic<int64_t> errors[kNumErrorCodes];
+        LogLinearHistogram latencyUs;
+        LogLinearHistogram requestBytes;
+        LogLinearHistogram responseBytes;
+
+        Cell();
+    };
+
+    /**
+     * 拥有者线程无锁查找 cells；只有插入新方法时才加锁，
+     * 读取方遍历时持有同一把锁，所以不会和插入冲突
+     */
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<const ::google::protobuf::MethodDescriptor *,
+                           std::unique_ptr<Cell>> cells[2];
+    };
+
+    RpcStats();
+
+    Shard *localShard();
+
+    Cell *findCell(Shard *shard, Side side, const ::google::protobuf::MethodDescriptor *method);
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+} // namespace network
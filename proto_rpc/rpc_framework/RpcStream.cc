@@ -0,0 +1,256 @@
+#include <glog/logging.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+
+#include "RpcStream.h"
+#include "network/EventLoop.h"
+#include "network/TcpConnection.h"
+
+using namespace network;
+
+const int RpcStream::kInitialWindow;
+
+/**
+ * 发起方接收的是方法的返回类型，接收方接收的是方法的参数类型，
+ * 两者都从 protobuf 的全局 MessageFactory 取原型，客户端不需要持有 Service 对象
+ */
+RpcStream::RpcStream(const TcpConnectionPtr &conn, const std::shared_ptr<RpcStreamTable> &table,
+                     int64_t id, const ::google::protobuf::MethodDescriptor *method, bool opener)
+    : loop_(conn->getLoop()),
+    conn_(conn),
+    table_(table),
+    codec_(ProtoRpcCodec::ProtobufMessageCallback()),
+    id_(id),
+    method_(method),
+    opener_(opener),
+    recvPrototype_(::google::protobuf::MessageFactory::generated_factory()->GetPrototype(
+        opener ? method->output_type() : method->input_type())),
+    sendCredit_(kInitialWindow),
+    recvAllowed_(kInitialWindow),
+    recvConsumed_(0),
+    sendClosed_(false),
+    closePending_(false),
+    closeStatus_(NO_ERROR),
+    recvClosed_(false),
+    finished_(false) {}
+
+RpcStream::~RpcStream() {}
+
+bool RpcStream::write(const ::google::protobuf::Message &message) {
+    loop_->assertInLoopThread();
+    if (sendClosed_) {
+        return false;
+    }
+    std::string payload = message.SerializeAsString();
+    if (sendCredit_ > 0 && pending_.empty()) {
+        --sendCredit_;
+        sendFrame(STREAM_DATA, &payload, 0, NO_ERROR);
+    } else {
+        pending_.push_back(std::move(payload));
+    }
+    return true;
+}
+
+void RpcStream::closeSend(ErrorCode status) {
+    loop_->assertInLoopThread();
+    if (sendClosed_) {
+        return;
+    }
+    sendClosed_ = true;
+    closeStatus_ = status;
+    if (pending_.empty()) {
+        sendFrame(STREAM_HALF_CLOSE, NULL, 0, status);
+        if (!opener_) {
+            finish(status, false);
+        }
+    } else {
+        closePending_ = true;
+    }
+}
+
+void RpcStream::cancel(ErrorCode error) {
+    loop_->assertInLoopThread();
+    if (finished_) {
+        return;
+    }
+    sendFrame(STREAM_CANCEL, NULL, 0, error);
+    finish(error, false);
+}
+
+void RpcStream::abort(ErrorCode error) {
+    if (!finished_) {
+        finish(error, true);
+    }
+}
+
+void RpcStream::sendOpen() {
+    TcpConnectionPtr conn = conn_.lock();
+    if (!conn) {
+        return;
+    }
+    RpcMessage message;
+    message.set_type(STREAM_REQUEST);
+    message.set_id(id_);
+    message.set_service(method_->service()->full_name());
+    message.set_method(method_->name());
+    message.set_frame(STREAM_OPEN);
+    codec_.send(conn, message);
+}
+
+/**
+ * 处理对端发来的一帧。消息回调里可能调用 cancel() 结束流，
+ * 所以回调之后要重新检查 finished_
+ */
+void RpcStream::onFrame(const RpcMessage &message) {
+    if (finished_) {
+        return;
+    }
+
+    RpcStreamPtr self(shared_from_this());
+    switch (message.frame()) {
+    case STREAM_DATA: {
+        if (recvClosed_) {
+            return;
+        }
+        MessagePtr msg(recvPrototype_->New());
+        const std::string &payload = opener_ ? message.response() : message.request();
+        // 对端超出了额度或者消息解析失败，说明对端不可信，直接中止整个流
+        if (--recvAllowed_ < 0 || !msg->ParseFromString(payload)) {
+            LOG(ERROR) << "RpcStream::onFrame - bad data frame on stream " << id_;
+            ErrorCode error = opener_ ? INVALID_RESPONSE : INVALID_REQUEST;
+            sendFrame(STREAM_CANCEL, NULL, 0, error);
+            finish(error, true);
+            return;
+        }
+        if (messageCallback_) {
+            messageCallback_(self, msg);
+        }
+        if (finished_ || recvClosed_) {
+            return;
+        }
+        // 处理完半个窗口再归还额度，避免每条消息都回一帧 CREDIT
+        if (++recvConsumed_ >= kInitialWindow / 2) {
+            sendFrame(STREAM_CREDIT, NULL, recvConsumed_, NO_ERROR);
+            recvAllowed_ += recvConsumed_;
+            recvConsumed_ = 0;
+        }
+        break;
+    }
+    case STREAM_CREDIT: {
+        bool wasWritable = writable();
+        sendCredit_ += message.credit();
+        flushPending();
+        if (!finished_ && !wasWritable && writable() && writableCallback_) {
+            writableCallback_(self);
+        }
+        break;
+    }
+    case STREAM_HALF_CLOSE:
+        recvClosed_ = true;
+        if (opener_) {
+            // 服务端半关闭带着最终状态，整个流结束
+            finish(message.error(), true);
+        } else if (closeCallback_) {
+            closeCallback_(self, message.error());
+        }
+        break;
+    case STREAM_CANCEL:
+        finish(message.error(), true);
+        break;
+    default:
+        LOG(ERROR) << "RpcStream::onFrame - unexpected frame " << message.frame();
+        break;
+    }
+}
+
+void RpcStream::sendFrame(StreamFrame frame, const std::string *payload, int32_t credit,
+                          ErrorCode error) {
+    TcpConnectionPtr conn = conn_.lock();
+    if (!conn) {
+        return;
+    }
+    RpcMessage message;
+    message.set_type(opener_ ? STREAM_REQUEST : STREAM_RESPONSE);
+    message.set_id(id_);
+    message.set_frame(frame);
+    if (payload) {
+        if (opener_) {
+            message.set_request(*payload);
+        } else {
+            message.set_response(*payload);
+        }
+    }
+    message.set_credit(credit);
+    message.set_error(error);
+    codec_.send(conn, message);
+}
+
+/**
+ * 用新到的额度把待发送队列里的消息发出去，
+ * 队列发完并且之前调用过 closeSend 时补发 HALF_CLOSE
+ */
+void RpcStream::flushPending() {
+    while (sendCredit_ > 0 && !pending_.empty()) {
+        --sendCredit_;
+        sendFrame(STREAM_DATA, &pending_.front(), 0, NO_ERROR);
+        pending_.pop_front();
+    }
+    if (pending_.empty() && closePending_) {
+        closePending_ = false;
+        sendFrame(STREAM_HALF_CLOSE, NULL, 0, closeStatus_);
+        if (!opener_) {
+            finish(closeStatus_, false);
+        }
+    }
+}
+
+/**
+ * 流结束：从 RpcStreamTable 里删除，释放待发送队列，
+ * 清空回调以打断用户回调里捕获的 RpcStreamPtr 形成的循环引用
+ */
+void RpcStream::finish(ErrorCode status, bool notify) {
+    finished_ = true;
+    sendClosed_ = true;
+    recvClosed_ = true;
+    pending_.clear();
+
+    std::shared_ptr<RpcStreamTable> table = table_.lock();
+    if (table) {
+        table->remove(id_, opener_);
+    }
+
+    CloseCallback closeCallback;
+    closeCallback.swap(closeCallback_);
+    messageCallback_ = MessageCallback();
+    writableCallback_ = WritableCallback();
+    if (notify && closeCallback) {
+        closeCallback(shared_from_this(), status);
+    }
+}
+
+void RpcStreamTable::add(const RpcStreamPtr &stream, bool opened) {
+    (opened ? opened_ : accepted_)[stream->id()] = stream;
+}
+
+RpcStreamPtr RpcStreamTable::find(int64_t id, bool opened) const {
+    const std::map<int64_t, RpcStreamPtr> &streams = opened ? opened_ : accepted_;
+    auto it = streams.find(id);
+    return it == streams.end() ? RpcStreamPtr() : it->second;
+}
+
+void RpcStreamTable::remove(int64_t id, bool opened) {
+    (opened ? opened_ : accepted_).erase(id);
+}
+
+std::vector<RpcStreamPtr> RpcStreamTable::takeAll() {
+    std::vector<RpcStreamPtr> streams;
+    for (const auto &item : opened_) {
+        streams.push_back(item.second);
+    }
+    for (const auto &item : accepted_) {
+        streams.push_back(item.second);
+    }
+    opened_.clear();
+    accepted_.clear();
+    return streams;
+}
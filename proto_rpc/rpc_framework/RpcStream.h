@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "network/Callbacks.h"
+#include "RpcCodec.h"
+#include "rpc.pb.h"
+
+namespace google {
+namespace protobuf {
+
+class MethodDescriptor;
+class Message;
+
+} // namespace protobuf
+} // namespace google
+
+namespace network {
+
+class EventLoop;
+class RpcStream;
+class RpcStreamTable;
+
+typedef std::shared_ptr<RpcStream> RpcStreamPtr;
+
+/**
+ * RpcStream 是一条流式调用，复用 RpcChannel 所在的连接，用流 ID 和普通的一元调用区分开。
+ * proto 里用 stream 关键字声明的方法都走流式调用：
+ *
+ *   rpc Query(QueryRequest) returns (stream Row);        // 服务端流
+ *   rpc Upload(stream Chunk) returns (UploadResult);     // 客户端流
+ *   rpc Chat(stream ChatMessage) returns (stream ChatMessage); // 双向流
+ *
+ * 三种形式在线上的格式是一样的，区别只在于双方各自发送多少条消息。
+ * 客户端用 RpcChannel::openStream 发起，服务端用 RpcMethodOptions::streamHandler 接收。
+ *
+ * 流量控制按消息条数计算：每个方向的初始额度是 kInitialWindow 条，接收方每处理完一半窗口的消息
+ * 就用 STREAM_CREDIT 把额度还给发送方。没有额度时 write() 把消息放进本地的待发送队列，
+ * 生产方应该在 writable() 为 false 时停下来，等 writable 回调再继续，这样两端的内存都是有界的。
+ *
+ * 关闭语义：
+ *   - closeSend() 是半关闭，表示本端不再发送消息。客户端半关闭后仍然可以接收服务端的消息；
+ *     服务端的半关闭带上最终状态，同时结束整个流（和 gRPC 的 trailers 类似）。
+ *   - cancel() 立即中止整个流，对端的 close 回调收到 cancel 时带的错误码。
+ *   - 连接断开时，所有未结束的流的 close 回调收到 CANCELLED。
+ *
+ * 除了 id()/method() 之外的接口都只能在连接所在的 IO 线程里调用，回调也都在该线程里执行；
+ * 其他线程的生产者可以通过 getLoop()->runInLoop 转过来。
+ */
+class RpcStream : public std::enable_shared_from_this<RpcStream> {
+public:
+    typedef std::shared_ptr<::google::protobuf::Message> MessagePtr;
+    typedef std::function<void(const RpcStreamPtr &, const MessagePtr &)> MessageCallback;
+    // 对端半关闭或者流被中止时调用；status 为 NO_ERROR 表示对端正常结束发送
+    typedef std::function<void(const RpcStreamPtr &, ErrorCode status)> CloseCallback;
+    typedef std::function<void(const RpcStreamPtr &)> WritableCallback;
+
+    static const int kInitialWindow = 32;
+
+    RpcStream(const TcpConnectionPtr &conn, const std::shared_ptr<RpcStreamTable> &table,
+              int64_t id, const ::google::protobuf::MethodDescriptor *method, bool opener);
+    ~RpcStream();
+
+    int64_t id() const { return id_; }
+    const ::google::protobuf::MethodDescriptor *method() const { return method_; }
+    EventLoop *getLoop() const { return loop_; }
+
+    void setMessageCallback(const MessageCallback &cb) { messageCallback_ = cb; }
+    void setCloseCallback(const CloseCallback &cb) { closeCallback_ = cb; }
+    // 额度耗尽之后重新变为可写时调用
+    void setWritableCallback(const WritableCallback &cb) { writableCallback_ = cb; }
+
+    /**
+     * 发送一条消息。本端已经半关闭或者流已经结束时返回 false。
+     * 没有额度时消息进入待发送队列，收到额度后按顺序发出
+     */
+    bool write(const ::google::protobuf::Message &message);
+
+    // 有发送额度并且待发送队列为空
+    bool writable() const { return !sendClosed_ && sendCredit_ > 0 && pending_.empty(); }
+
+    // 半关闭，待发送队列里的消息发完之后才发出 HALF_CLOSE
+    void closeSend(ErrorCode status = NO_ERROR);
+
+    void cancel(ErrorCode error = CANCELLED);
+
+    bool finished() const { return finished_; }
+
+    /**
+     * 以下由 RpcChannel 调用
+     */
+    void onFrame(const RpcMessage &message);
+
+    // 连接断开，不再发送任何帧，直接以 error 结束
+    void abort(ErrorCode error);
+
+    // 发起方发出 STREAM_OPEN
+    void sendOpen();
+
+private:
+    void sendFrame(StreamFrame frame, const std::string *payload, int32_t credit, ErrorCode error);
+    void flushPending();
+    void finish(ErrorCode status, bool notify);
+
+    EventLoop *loop_;
+    std::weak_ptr<TcpConnection> conn_;
+    std::weak_ptr<RpcStreamTable> table_;
+    ProtoRpcCodec codec_;
+    const int64_t id_;
+    const ::google::protobuf::MethodDescriptor *method_;
+    const bool opener_;                                // 本端是否是发起方
+    const ::google::protobuf::Message *recvPrototype_; // 本端接收的消息类型
+
+    MessageCallback messageCallback_;
+    CloseCallback closeCallback_;
+    WritableCallback writableCallback_;
+
+    int sendCredit_;    // 还能发送多少条消息
+    int recvAllowed_;   // 对端还能发送多少条消息，超出说明对端没有遵守流量控制
+    int recvConsumed_;  // 已处理但还没有归还额度的消息数
+    std::deque<std::string> pending_;
+    bool sendClosed_;
+    bool closePending_; // closeSend 时队列非空，等队列发完再发 HALF_CLOSE
+    ErrorCode closeStatus_;
+    bool recvClosed_;
+    bool finished_;
+};
+
+/**
+ * RpcChannel 上所有未结束的流，按方向分成本端发起的和对端发起的两张表，
+ * 因为两端各自分配 ID，同一个 ID 可能同时出现在两张表里。
+ * 流结束时通过 weak_ptr 把自己从表里删掉，RpcChannel 先析构也没有问题。
+ */
+class RpcStreamTable {
+public:
+    void add(const RpcStreamPtr &stream, bool opened);
+    RpcStreamPtr find(int64_t id, bool opened) const;
+    void remove(int64_t id, bool opened);
+
+    // 取出所有的流，用于连接断开时中止
+    std::vector<RpcStreamPtr> takeAll();
+
+private:
+    std::map<int64_t, RpcStreamPtr> opened_;   // 本端发起的流
+    std::map<int64_t, RpcStreamPtr> accepted_; // 对端发起的流
+};
+
+} // namespace network
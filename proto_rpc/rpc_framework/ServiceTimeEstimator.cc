@@ -0,0 +1,37 @@
+#include <algorithm>
+
+#include "ServiceTimeEstimator.h"
+
+using namespace network;
+
+const int ServiceTimeEstimator::kShift;
+
+ServiceTimeEstimator::ServiceTimeEstimator(
+    const std::vector<const ::google::protobuf::MethodDescriptor *> &methods) {
+    for (const ::google::protobuf::MethodDescriptor *method : methods) {
+        estimates_[method].reset(new std::atomic<int64_t>(0));
+    }
+}
+
+ServiceTimeEstimator::~ServiceTimeEstimator() {}
+
+/**
+ * 第一个样本直接作为估计值，之后按 1/8 的权重平滑
+ */
+void ServiceTimeEstimator::record(const ::google::protobuf::MethodDescriptor *method,
+                                  int64_t serviceUs) {
+    EstimateMap::const_iterator it = estimates_.find(method);
+    if (it == estimates_.end()) {
+        return;
+    }
+    std::atomic<int64_t> &estimate = *it->second;
+    int64_t old = estimate.load(std::memory_order_relaxed);
+    int64_t updated = old == 0 ? serviceUs : old + ((serviceUs - old) >> kShift);
+    estimate.store(std::max<int64_t>(updated, 1), std::memory_order_relaxed);
+}
+
+int64_t ServiceTimeEstimator::estimateUs(
+    const ::google::protobuf::MethodDescriptor *method) const {
+    EstimateMap::const_iterator it = estimates_.find(method);
+    return it == estimates_.end() ? 0 : it->second->load(std::memory_order_relaxed);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+#include <google/protobuf/descriptor.h>
+
+namespace network {
+
+/**
+ * 按方法统计 handler 的典型执行时间（从调用 handler 到 done->Run() 的 EWMA），
+ * 调度器用它判断一个请求剩下的时间预算还够不够执行完。
+ *
+ * 方法表在构造时建好，之后只读；每个方法的估计值是一个原子变量，可以在任意线程记录和读取。
+ * 更新是 load + store 而不是 CAS，并发记录时偶尔丢一个样本，对 EWMA 没有影响
+ */
+class ServiceTimeEstimator {
+public:
+    // 新样本的权重为 1 / 2^kShift
+    static const int kShift = 3;
+
+    explicit ServiceTimeEstimator(
+        const std::vector<const ::google::protobuf::MethodDescriptor *> &methods);
+    ~ServiceTimeEstimator();
+
+    void record(const ::google::protobuf::MethodDescriptor *method, int64_t serviceUs);
+
+    // 还没有样本或者不认识的方法返回 0
+    int64_t estimateUs(const ::google::protobuf::MethodDescriptor *method) const;
+
+private:
+    typedef std::map<const ::google::protobuf::MethodDescriptor *,
+                     std::unique_ptr<std::atomic<int64_t>>> EstimateMap;
+
+    EstimateMap estimates_;
+};
+
+} // namespace network
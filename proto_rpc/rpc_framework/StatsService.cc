@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <google/protobuf/descriptor.h>
+
+#include "StatsService.h"
+#include "CpuProfiler.h"
+#include "RpcChannel.h"
+#include "RpcStats.h"
+#include "network/EventLoop.h"
+#include "network/util.h"
+
+using namespace network;
+
+namespace {
+
+void fillSummary(const LogLinearHistogram::Snapshot &snapshot, HistogramSummary *summary) {
+    summary->set_count(snapshot.count);
+    summary->set_sum(snapshot.sum);
+    summary->set_max(snapshot.max);
+    summary->set_p50(snapshot.percentile(50));
+    summary->set_p90(snapshot.percentile(90));
+    summary->set_p99(snapshot.percentile(99));
+    summary->set_p999(snapshot.percentile(99.9));
+}
+
+/**
+ * 一次进行中的采样，只在发起调用的连接的 IO 线程里访问。
+ * 定时器到期和连接断开谁先发生谁停止采样；done 执行之后置为 NULL，另一方什么都不做
+ */
+struct PendingProfile {
+    EventLoop *loop;
+    ThreadPool *profilerThread;
+    CpuProfileResponse *response;
+    ::google::protobuf::Closure *done;
+    TimerId timerId; // 0 表示定时器已经到期或者被取消
+};
+
+typedef std::shared_ptr<PendingProfile> PendingProfilePtr;
+
+void finishCpuProfile(const PendingProfilePtr &pending,
+                      const std::shared_ptr<CpuProfiler::Result> &result) {
+    if (!pending->done) {
+        return;
+    }
+    CpuProfileResponse *response = pending->response;
+    response->set_sampler(result->sampler);
+    response->set_threads(result->threads);
+    response->set_samples(result->samples);
+    response->set_dropped(result->dropped);
+    response->set_collapsed_stacks(result->collapsed);
+    ::google::protobuf::Closure *done = pending->done;
+    pending->done = NULL;
+    done->Run();
+}
+
+// 在 profilerThread 里停止采样并符号化，结果回到 IO 线程；连接已经断开时结果直接丢弃
+void stopCpuProfile(const PendingProfilePtr &pending) {
+    std::shared_ptr<CpuProfiler::Result> result =
+        std::make_shared<CpuProfiler::Result>(CpuProfiler::instance().stop());
+    pending->loop->runInLoop(std::bind(finishCpuProfile, pending, result));
+}
+
+void onCpuProfileTimer(const PendingProfilePtr &pending) {
+    pending->timerId = 0;
+    pending->profilerThread->run(std::bind(stopCpuProfile, pending));
+}
+
+/**
+ * 在 RpcChannel 析构时执行：提前停止采样，以空结果执行 done（响应发不出去，只是释放这次调用），
+ * 之后采样的结果到达时 finishCpuProfile 发现 done 已经执行过
+ */
+void cancelCpuProfile(const std::weak_ptr<PendingProfile> &weakPending) {
+    PendingProfilePtr pending = weakPending.lock();
+    if (!pending || !pending->done) {
+        return;
+    }
+    if (pending->timerId != 0) {
+        pending->loop->cancel(pending->timerId);
+        pending->timerId = 0;
+        pending->profilerThread->run(std::bind(stopCpuProfile, pending));
+    }
+    pending->response->set_error("connection closed");
+    ::google::protobuf::Closure *done = pending->done;
+    pending->done = NULL;
+    done->Run();
+}
+
+} // namespace
+
+StatsService::StatsService() : profilingEnabled_(false), profilerThread_("CpuProfiler") {}
+
+void StatsService::enableProfiling() {
+    if (!profilingEnabled_) {
+        profilingEnabled_ = true;
+        profilerThread_.start(1);
+    }
+}
+
+/**
+ * 合并各线程分片的开销和方法数、线程数成正比，统计服务本身不应该被高频调用
+ */
+void StatsService::GetStats(::google::protobuf::RpcController *controller,
+                            const GetStatsRequest *request,
+                            GetStatsResponse *response,
+                            ::google::protobuf::Closure *done) {
+    std::vector<RpcStats::MethodSnapshot> snapshots = RpcStats::instance().snapshot();
+    std::sort(snapshots.begin(), snapshots.end(),
+              [](const RpcStats::MethodSnapshot &a, const RpcStats::MethodSnapshot &b) {
+                  if (a.method->full_name() != b.method->full_name()) {
+                      return a.method->full_name() < b.method->full_name();
+                  }
+                  return a.side < b.side;
+              });
+
+    response->set_timestamp_us(getNowUs());
+    const std::string &prefix = request->method_prefix();
+    for (const RpcStats::MethodSnapshot &snapshot : snapshots) {
+        const std::string &name = snapshot.method->full_name();
+        if (name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        MethodStats *stats = response->add_methods();
+        stats->set_method(name);
+        stats->set_server_side(snapshot.side == RpcStats::kServer);
+        stats->set_calls(snapshot.calls);
+        for (int i = 0; i < RpcStats::kNumErrorCodes; ++i) {
+            if (snapshot.errors[i] > 0) {
+                ErrorCount *error = stats->add_errors();
+                error->set_error(static_cast<ErrorCode>(i));
+                error->set_count(snapshot.errors[i]);
+            }
+        }
+        fillSummary(snapshot.latencyUs, stats->mutable_latency_us());
+        fillSummary(snapshot.requestBytes, stats->mutable_request_bytes());
+        fillSummary(snapshot.responseBytes, stats->mutable_response_bytes());
+    }
+    done->Run();
+}
+
+void StatsService::CpuProfile(::google::protobuf::RpcController *controller,
+                              const CpuProfileRequest *request,
+                              CpuProfileResponse *response,
+                              ::google::protobuf::Closure *done) {
+    int durationSec = request->duration_sec() > 0 ? std::min(request->duration_sec(), 300) : 10;
+    int frequencyHz = request->frequency_hz() > 0 ? request->frequency_hz() : 99;
+
+    EventLoop *loop = EventLoop::getEventLoopOfCurrentThread();
+    RpcChannel *channel = RpcChannel::current();
+    std::string error;
+    if (!profilingEnabled_) {
+        error = "cpu profiling is not enabled on this server";
+    } else if (!loop || !channel) {
+        error = "not called from an RpcChannel handler";
+    } else if (CpuProfiler::instance().start(EventLoop::loopThreadIds(), frequencyHz, &error)) {
+        PendingProfilePtr pending = std::make_shared<PendingProfile>();
+        pending->loop = loop;
+        pending->profilerThread = &profilerThread_;
+        pending->response = response;
+        pending->done = done;
+        pending->timerId = loop->runAfter(durationSec, std::bind(onCpuProfileTimer, pending));
+        channel->addCloseCallback(
+            std::bind(cancelCpuProfile, std::weak_ptr<PendingProfile>(pending)));
+        return;
+    }
+    response->set_error(error);
+    done->Run();
+}
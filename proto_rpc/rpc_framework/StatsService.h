@@ -0,0 +1,41 @@
+#pragma once
+
+#include "network/ThreadPool.h"
+#include "rpc_stats.pb.h"
+
+namespace network {
+
+/**
+ * RpcServer 内置的统计服务，返回 RpcStats 里本进程所有方法的统计（包括本进程作为客户端发起的调用），
+ * 以及按需的 CPU 采样（CpuProfiler）。
+ * 每个 RpcServer 构造时自动注册，客户端用 RpcStatsService::Stub 在同一个连接上查询。
+ * CPU 采样会在整个进程上打开 perf_event/SIGPROF，默认关闭，由 RpcServer::enableProfiling 打开
+ */
+class StatsService : public RpcStatsService {
+public:
+    StatsService();
+
+    // 允许 CpuProfile，同时启动符号化用的线程。没有调用时 CpuProfile 直接返回错误
+    void enableProfiling();
+
+    void GetStats(::google::protobuf::RpcController *controller,
+                  const GetStatsRequest *request,
+                  GetStatsResponse *response,
+                  ::google::protobuf::Closure *done) override;
+
+    /**
+     * 不阻塞 IO 线程：开始采样后用 loop 的定时器在 duration_sec 秒后停止，
+     * 停止和符号化在 profilerThread_ 里完成，再回到 IO 线程回复；期间本线程照常处理请求，同样会被采样。
+     * 采样期间连接断开时立即停止采样并结束这次调用，不再等定时器
+     */
+    void CpuProfile(::google::protobuf::RpcController *controller,
+                    const CpuProfileRequest *request,
+                    CpuProfileResponse *response,
+                    ::google::protobuf::Closure *done) override;
+
+private:
+    bool profilingEnabled_;
+    ThreadPool profilerThread_; // 一个线程，CpuProfiler::stop() 读符号表可能要几十毫秒
+};
+
+} // namespace network
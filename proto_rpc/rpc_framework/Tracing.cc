@@ -0,0 +1,224 @@
+#include <inttypes.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <glog/logging.h>
+
+#include "Tracing.h"
+
+using namespace network;
+
+namespace {
+
+thread_local TraceContext t_current;
+
+const char *kStageNames[kNumTraceStages] = {
+    "read", "decode", "dequeue", "handler_start", "handler_end", "encode", "flush", "response"
+};
+
+uint64_t randomId() {
+    static thread_local std::mt19937_64 engine(std::random_device{}());
+    return engine();
+}
+
+} // namespace
+
+TraceScope::TraceScope(const TraceContext &context)
+    : saved_(t_current) {
+    t_current = context;
+}
+
+TraceScope::~TraceScope() {
+    t_current = saved_;
+}
+
+const uint64_t Tracer::SpanRing::kCapacity;
+
+bool Tracer::SpanRing::push(const TraceSpan &span) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= kCapacity) {
+        return false;
+    }
+    spans_[head % kCapacity] = span;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename F>
+void Tracer::SpanRing::drain(F &&f) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    for (; tail != head; ++tail) {
+        f(spans_[tail % kCapacity]);
+    }
+    tail_.store(tail, std::memory_order_release);
+}
+
+Tracer::Tracer()
+    : recording_(false),
+    sampleThreshold_(0),
+    file_(NULL),
+    firstSpan_(true),
+    stopping_(false),
+    flushIntervalMs_(100),
+    written_(0),
+    dropped_(0) {}
+
+/**
+ * 不析构：退出阶段其他线程可能还在记录 span
+ */
+Tracer &Tracer::instance() {
+    static Tracer *tracer = new Tracer;
+    return *tracer;
+}
+
+const TraceContext &Tracer::current() {
+    return t_current;
+}
+
+uint64_t Tracer::newId() {
+    uint64_t id = 0;
+    while (id == 0) {
+        id = randomId();
+    }
+    return id;
+}
+
+void Tracer::setSampleRate(double rate) {
+    if (rate <= 0) {
+        sampleThreshold_.store(0, std::memory_order_relaxed);
+    } else if (rate >= 1) {
+        sampleThreshold_.store(UINT64_MAX, std::memory_order_relaxed);
+    } else {
+        sampleThreshold_.store(static_cast<uint64_t>(rate * 18446744073709551615.0),
+                               std::memory_order_relaxed);
+    }
+}
+
+bool Tracer::startClientContext(const TraceContext &parent, TraceContext *child) {
+    if (parent.valid()) {
+        child->traceId = parent.traceId;
+        child->sampled = parent.sampled;
+    } else {
+        uint64_t threshold = sampleThreshold_.load(std::memory_order_relaxed);
+        if (threshold == 0 || !recording() || randomId() > threshold) {
+            return false;
+        }
+        child->traceId = newId();
+        child->sampled = true;
+    }
+    child->spanId = newId();
+    return true;
+}
+
+bool Tracer::start(const std::string &path, const std::string &serviceName,
+                   int flushIntervalMs) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (file_) {
+        return false;
+    }
+    file_ = ::fopen(path.c_str(), "w");
+    if (!file_) {
+        LOG(ERROR) << "Tracer::start - cannot open " << path;
+        return false;
+    }
+    ::fputs("[\n", file_);
+    serviceName_ = serviceName;
+    firstSpan_ = true;
+    stopping_ = false;
+    flushIntervalMs_ = flushIntervalMs;
+    flusher_ = std::thread(std::bind(&Tracer::flushLoop, this));
+    recording_.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void Tracer::stop() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!file_) {
+            return;
+        }
+        recording_.store(false, std::memory_order_relaxed);
+        stopping_ = true;
+        cond_.notify_all();
+    }
+    flusher_.join();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    drainAll();
+    ::fputs("\n]\n", file_);
+    ::fclose(file_);
+    file_ = NULL;
+}
+
+/**
+ * 环形缓冲由 Tracer 持有，线程退出后里面的 span 仍会被后台线程取走
+ */
+Tracer::SpanRing *Tracer::localRing() {
+    static thread_local SpanRing *ring = NULL;
+    if (!ring) {
+        std::unique_ptr<SpanRing> created(new SpanRing);
+        ring = created.get();
+        std::unique_lock<std::mutex> lock(mutex_);
+        rings_.push_back(std::move(created));
+    }
+    return ring;
+}
+
+void Tracer::record(const TraceSpan &span) {
+    if (!recording()) {
+        return;
+    }
+    if (!localRing()->push(span)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Tracer::flushLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        cond_.wait_for(lock, std::chrono::milliseconds(flushIntervalMs_));
+        drainAll();
+        ::fflush(file_);
+    }
+}
+
+// 调用方持有 mutex_
+void Tracer::drainAll() {
+    for (const std::unique_ptr<SpanRing> &ring : rings_) {
+        ring->drain([this](const TraceSpan &span) { writeSpan(span); });
+    }
+}
+
+/**
+ * Zipkin v2 格式：时间单位是微秒，阶段时间戳写成 annotations，错误码写进 tags
+ */
+void Tracer::writeSpan(const TraceSpan &span) {
+    ::fprintf(file_, "%s{\"traceId\":\"%016" PRIx64 "\",\"id\":\"%016" PRIx64 "\"",
+              firstSpan_ ? "" : ",\n", span.traceId, span.spanId);
+    firstSpan_ = false;
+    if (span.parentId != 0) {
+        ::fprintf(file_, ",\"parentId\":\"%016" PRIx64 "\"", span.parentId);
+    }
+    ::fprintf(file_, ",\"name\":\"%s\",\"kind\":\"%s\",\"timestamp\":%" PRId64
+              ",\"duration\":%" PRId64 ",\"localEndpoint\":{\"serviceName\":\"%s\"}",
+              span.name ? span.name->c_str() : "", span.server ? "SERVER" : "CLIENT",
+              span.startUs, std::max<int64_t>(span.endUs - span.startUs, 1),
+              serviceName_.c_str());
+    ::fputs(",\"annotations\":[", file_);
+    bool first = true;
+    for (int i = 0; i < kNumTraceStages; ++i) {
+        if (span.stages[i] != 0) {
+            ::fprintf(file_, "%s{\"timestamp\":%" PRId64 ",\"value\":\"%s\"}",
+                      first ? "" : ",", span.stages[i], kStageNames[i]);
+            first = false;
+        }
+    }
+    ::fputs("]", file_);
+    if (span.error != NO_ERROR) {
+        ::fprintf(file_, ",\"tags\":{\"error\":\"%s\"}", ErrorCode_Name(span.error).c_str());
+    }
+    ::fputs("}", file_);
+    written_.fetch_add(1, std::memory_order_relaxed);
+}
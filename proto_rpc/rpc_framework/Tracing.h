@@ -0,0 +1,174 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rpc.pb.h"
+
+namespace network {
+
+/**
+ * 随请求传播的 trace 上下文：traceId 标识一整条调用链，spanId 是发起本次调用的 span。
+ * traceId 为 0 表示没有 trace
+ */
+struct TraceContext {
+    uint64_t traceId = 0;
+    uint64_t spanId = 0;
+    bool sampled = false;
+
+    bool valid() const { return traceId != 0; }
+};
+
+// RpcMessage.trace_flags 的位
+const uint32_t kTraceFlagSampled = 1;
+
+/**
+ * 一次调用经过的阶段，时间戳为 0 表示没有经过这个阶段。
+ * 服务端：read（读到数据）、decode（解出 RpcMessage）、dequeue（离开调度队列）、
+ *        handler_start、handler_end（done->Run()）、encode（响应序列化完）、flush（交给连接发送）；
+ * 客户端：encode（请求序列化完）、response（收到响应）。客户端发送之后响应可能已经在其他线程到达，
+ *        所以不记录 flush
+ */
+enum TraceStage {
+    kStageRead,
+    kStageDecode,
+    kStageDequeue,
+    kStageHandlerStart,
+    kStageHandlerEnd,
+    kStageEncode,
+    kStageFlush,
+    kStageResponse,
+    kNumTraceStages
+};
+
+struct TraceSpan {
+    uint64_t traceId = 0;
+    uint64_t spanId = 0;
+    uint64_t parentId = 0;
+    const std::string *name = NULL; // MethodDescriptor::full_name()，和描述符池的生命周期相同
+    bool server = false;
+    ErrorCode error = NO_ERROR;
+    int64_t startUs = 0;
+    int64_t endUs = 0;
+    int64_t stages[kNumTraceStages] = {};
+
+    void mark(TraceStage stage, int64_t nowUs) { stages[stage] = nowUs; }
+};
+
+typedef std::shared_ptr<TraceSpan> TraceSpanPtr;
+
+/**
+ * 把当前线程的 trace 上下文设为 context，析构时恢复。
+ * 服务端在同步执行 handler 期间设置，handler 里发起的调用自动成为它的子 span；
+ * 异步 handler 需要在同步部分取出 Tracer::current()，之后通过 RpcController::setTraceContext 传给下游调用
+ */
+class TraceScope {
+public:
+    explicit TraceScope(const TraceContext &context);
+    ~TraceScope();
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    TraceContext saved_;
+};
+
+/**
+ * Tracer 负责采样决策和 span 的落盘，进程内只有一个。
+ *
+ *   - 默认不记录：没有调用 start() 时只传播上游带来的 trace id，不创建 span，
+ *     请求路径上只多几次字段判断；
+ *   - 根 span（没有上游 trace 的客户端调用）按 setSampleRate 的比例采样，
+ *     下游沿用上游的采样决定；
+ *   - 采样的 span 写入本线程的环形缓冲（单生产者单消费者，无锁），满了就丢弃并计数；
+ *     后台线程定期取出所有线程的 span，以 Zipkin v2 JSON（span 数组）格式追加到文件。
+ */
+class Tracer {
+public:
+    static Tracer &instance();
+
+    // 开始记录，path 是输出文件，serviceName 写入每个 span 的 localEndpoint
+    bool start(const std::string &path, const std::string &serviceName,
+               int flushIntervalMs = 100);
+
+    // 写出剩余的 span 并关闭文件
+    void stop();
+
+    // 根 span 的采样率，0 到 1，默认 0
+    void setSampleRate(double rate);
+
+    bool recording() const { return recording_.load(std::memory_order_relaxed); }
+
+    // 当前线程的 trace 上下文（由 TraceScope 设置），没有时 valid() 为 false
+    static const TraceContext &current();
+
+    /**
+     * 为一次客户端调用确定要传播的上下文：有 parent 时沿用它的 traceId 和采样决定，
+     * 否则按采样率决定是否开启新的 trace。返回 false 表示这次调用不带 trace
+     */
+    bool startClientContext(const TraceContext &parent, TraceContext *child);
+
+    // 把结束的 span 放进本线程的环形缓冲；没有在记录时直接忽略
+    void record(const TraceSpan &span);
+
+    static uint64_t newId();
+
+    int64_t spansWritten() const { return written_.load(std::memory_order_relaxed); }
+    int64_t spansDropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    /**
+     * 生产者是拥有者线程，消费者是后台刷新线程。
+     * head_ 只由生产者推进，tail_ 只由消费者推进
+     */
+    class SpanRing {
+    public:
+        static const uint64_t kCapacity = 4096; // 按 100ms 刷新一次，够单线程 40k span/s
+
+        bool push(const TraceSpan &span);
+
+        template <typename F>
+        void drain(F &&f);
+
+    private:
+        TraceSpan spans_[kCapacity];
+        std::atomic<uint64_t> head_{0};
+        std::atomic<uint64_t> tail_{0};
+    };
+
+    Tracer();
+
+    SpanRing *localRing();
+
+    void flushLoop();
+
+    void drainAll();
+
+    void writeSpan(const TraceSpan &span);
+
+    std::atomic<bool> recording_;
+    std::atomic<uint64_t> sampleThreshold_; // 随机数小于它时采样，0 表示不采样
+
+    std::mutex mutex_;                      // 保护 rings_、file_ 和后台线程的状态
+    std::condition_variable cond_;
+    std::vector<std::unique_ptr<SpanRing>> rings_;
+    FILE *file_;
+    std::string serviceName_;
+    bool firstSpan_;
+    bool stopping_;
+    int flushIntervalMs_;
+    std::thread flusher_;
+
+    std::atomic<int64_t> written_;
+    std::atomic<int64_t> dropped_;
+};
+
+} // namespace network